@@ -1,8 +1,10 @@
 import asyncio
 import collections
+import csv
 import re
 import struct
 import sys
+import zlib
 import tkinter
 from tkinter import messagebox, ttk
 from tkinter.constants import FALSE
@@ -16,15 +18,151 @@ from matplotlib.figure import Figure
 titleText = "OpenTracker (WIP)"
 diagTitle = "Select Device"
 connText = "Connected to: {device}"
-statText = "HR: {hr_bpm}, BR: {br_bpm}, SR1: {sr1_bpm}, SR2: {sr2_bpm}"
-cmdChoice = ("<Null>", "Reset", "Calibration")
+statText = "HR: {hr_bpm}, BR: {br_bpm}, Cadence: {sr1_bpm}, Steps: {sr2_bpm}, SpO2: {spo2}, EMG: {emg}, Lost: {lost}\nQuality: {sqi}\nRR: {rr} ms, RMSSD: {rmssd} ms, SDNN: {sdnn} ms, pNN50: {pnn50:.1f}%"
+cmdChoice = ("<Null>", "Reset", "Calibration", "Toggle Red", "Toggle Raw EMG", "Record Start", "Record Stop", "Erase Log")
 devAddrFormat = "{dev_name} | {uuid}"
 uuid_base = "32e6{uuid16}-2b22-4db5-a914-43ce41986c70"
 srv_uuid = uuid_base.format(uuid16="1089")
 cmd_uuid = uuid_base.format(uuid16="108a")
 telemetry_uuid = uuid_base.format(uuid16="108b")
 stat_uuid = uuid_base.format(uuid16="108c")
+stream_uuid = uuid_base.format(uuid16="108d")
+hrv_uuid = uuid_base.format(uuid16="108e")
+diag_uuid = uuid_base.format(uuid16="108f")
+rec_uuid = uuid_base.format(uuid16="1090")
 refresh_interval_ms = 50
+# stream notification layout, see frame.h
+frame_hdr = struct.Struct("<HBB")  # seq, count, format
+frame_record = struct.Struct("<LLLHHHH")  # ticks, red, IR, GSR, flex, EMG1, EMG2
+stat_packet = struct.Struct("<HHHHHHL")  # HR, BR, cadence (per minute), steps, SpO2 (0.1 %), EMG active bits, quality flags
+hrv_packet = struct.Struct("<HHHHH")  # RR, RMSSD, SDNN (ms), pNN50 (per mille), beats
+# diagnostics layout, see prof.h, only present in PROF=1 builds
+diag_hdr = struct.Struct("<LBBBx")  # units per second, sections, bins, histogram shift
+diag_section = "<LLLL{bins}H"  # count, min, max, mean, log2 histogram
+diag_names = ("ADC", "PPG", "TWI", "Telemetry", "Sleep")
+# session log download, see rec.h, chunks of blocks follow the chunk header
+rec_chunk = struct.Struct("<HH")  # block, offset (block count in the end marker)
+rec_hdr = struct.Struct("<LLLHHB3xL")  # magic, seq, time, count, length, flags, CRC-32
+REC_MAGIC = 0x31434552
+REC_CHUNK_END = 0xFFFF
+REC_CMD_DOWNLOAD = 7
+# quality flags, see sqi.h, 4 bits per channel in this order
+sqi_channels = ("GSR", "Flex", "EMG1", "EMG2", "ACC", "PPG")
+sqi_flag_names = ("clip", "flat", "DC", "noise")
+FRAME_FMT_RAW = 0
+FRAME_FMT_PACKED = 1
+FRAME_FMT_MASK = 0x0F
+FRAME_FLAG_NO_RED = 0x80
+FRAME_FLAG_EMG_ENV = 0x40  # EMG fields are envelopes in 1/2 ADC counts
+FRAME_FLAG_PPG = 0x20  # one record per PPG sample, ADC fields 0; without it red and IR are 0
+TICKS_MASK = 0xFFFFFF
+# packed records, see codec.h: native, long and short width per field
+codec_width = (24, 18, 18, 12, 12, 12, 12)
+codec_width_long = (12, 12, 12, 8, 8, 8, 8)
+codec_width_short = (4, 6, 6, 4, 4, 4, 4)
+
+
+def decode_packed(data: bytes, count: int):
+    """Decodes one codec.h block of count records."""
+    value = int.from_bytes(data, "big")
+    pos = len(data) * 8
+
+    def take(n: int) -> int:
+        nonlocal pos
+        pos -= n
+        if pos < 0:
+            raise ValueError("Truncated packed frame")
+        return (value >> pos) & ((1 << n) - 1)
+
+    records = []
+    prev = [take(w) for w in codec_width] if count else []
+    step = 0
+    if count:
+        records.append(tuple(prev))
+    for _ in range(count - 1):
+        cur = []
+        for f, w in enumerate(codec_width):
+            pred = prev[f] + (step if f == 0 else 0)
+            tag = take(2)
+            if tag == 3:
+                cur.append(take(w))
+                continue
+            z = 0 if tag == 0 else take(codec_width_short[f] if tag == 1 else codec_width_long[f])
+            r = (z >> 1) ^ -(z & 1)
+            cur.append((pred + r) & ((1 << w) - 1))
+        step = (cur[0] - prev[0]) & ((1 << codec_width[0]) - 1)
+        prev = cur
+        records.append(tuple(cur))
+    return records
+
+
+def decode_frame(data: bytes):
+    """Returns (seq, flags, records) of one stream notification."""
+    seq, count, fmt = frame_hdr.unpack_from(data)
+    flags = fmt & ~FRAME_FMT_MASK
+    fmt &= FRAME_FMT_MASK
+    if fmt == FRAME_FMT_PACKED:
+        return seq, flags, decode_packed(bytes(data[frame_hdr.size:]), count)
+    if fmt != FRAME_FMT_RAW:
+        raise ValueError(f"Unknown frame format {fmt}")
+    return seq, flags, [frame_record.unpack_from(data, frame_hdr.size + i * frame_record.size) for i in range(count)]
+
+
+def decode_rec_block(block: bytes):
+    """Returns (seq, time, flags, records) of one downloaded log block, None if it is damaged."""
+    if len(block) < rec_hdr.size:
+        return None
+    magic, seq, time, count, length, flags, crc = rec_hdr.unpack_from(block)
+    body = block[rec_hdr.size:rec_hdr.size + length]
+    if magic != REC_MAGIC or len(body) != length or zlib.crc32(block[:rec_hdr.size - 4] + body) != crc:
+        return None
+    return seq, time, flags, decode_packed(body, count)
+
+
+def decode_diag(data: bytes):
+    """Returns (name, count, min us, mean us, max us, histogram) per profiled section."""
+    hz, sections, bins, shift = diag_hdr.unpack_from(data)
+    section = struct.Struct(diag_section.format(bins=bins))
+    us = 1e6 / hz
+    result = []
+    for i in range(sections):
+        count, lo, hi, mean, *hist = section.unpack_from(data, diag_hdr.size + i * section.size)
+        name = diag_names[i] if i < len(diag_names) else f"#{i}"
+        result.append((name, count, lo * us, mean * us, hi * us, hist))
+    return result
+
+
+def format_diag(sections) -> str:
+    return "\n".join(
+        f"{name}: {count}x, {lo:.0f}/{mean:.0f}/{hi:.0f} us, hist {' '.join(map(str, hist))}"
+        for name, count, lo, mean, hi, hist in sections)
+
+
+def sqi_flags(sqi: int, channel: str) -> int:
+    return (sqi >> (4 * sqi_channels.index(channel))) & 0xF
+
+
+def format_sqi(sqi: int) -> str:
+    bad = []
+    for ch in sqi_channels:
+        flags = sqi_flags(sqi, ch)
+        if flags:
+            bad.append(f"{ch} " + "+".join(n for i, n in enumerate(sqi_flag_names) if flags & (1 << i)))
+    return ", ".join(bad) if bad else "all good"
+
+
+class SeqTracker:
+    """Counts notifications lost between consecutive frame sequence numbers."""
+
+    def __init__(self) -> None:
+        self.last = None
+        self.lost = 0
+
+    def update(self, seq: int) -> None:
+        if self.last is not None:
+            self.lost += (seq - self.last - 1) & 0xFFFF
+        self.last = seq
+
 
 class OpenTrackerApp:
     def __init__(self) -> None:
@@ -36,6 +174,9 @@ class OpenTrackerApp:
         self.EMG1 = collections.deque([0] * 256, maxlen=256)
         self.EMG2 = collections.deque([0] * 256, maxlen=256)
         # ^ data
+        self.seqTracker = SeqTracker()
+        self.hrv = (0, 0, 0, 0, 0)
+        self.dataUpdated: bool = False
         self.alive: bool = True
         self.scanUpdate: bool = False
         self.mainWindow = tkinter.Tk()
@@ -66,6 +207,9 @@ class OpenTrackerApp:
         self.statTxt = tkinter.StringVar(value="<Invalid>")
         self.stat = ttk.Label(self.frm, textvariable=self.statTxt)
         self.stat.grid(row=0, column=3, columnspan=1)
+        self.diagTxt = tkinter.StringVar(value="")
+        self.diag = ttk.Label(self.frm, textvariable=self.diagTxt, font="TkFixedFont")
+        self.diag.grid(row=5, column=0, columnspan=6)
         self.ctrlPane = ttk.Frame(self.frm, padding=10)
         self.ctrlPane.grid(row=0, column=4, columnspan=3)
         self.selectedCmd = tkinter.StringVar()
@@ -149,7 +293,9 @@ class OpenTrackerApp:
         if self.BLEDev != None:
             self.evloop.create_task(conn_upd_wrapper())
         if self.BLEDev != None:
-            self.evloop.create_task(telemetry_wrapper())
+            if self.dataUpdated:
+                self.dataUpdated = False
+                self.evloop.create_task(canvas_worker())
             self.statRefreshCounter += 1
             if self.statRefreshCounter >= 200:
                 self.evloop.create_task(stat_wrapper())
@@ -165,6 +311,21 @@ class OpenTrackerApp:
         elif command == cmdChoice[2]:
             self.evloop.create_task(
                 self.BLEDev.write_gatt_char(cmd_uuid, bytes([2])))
+        elif command == cmdChoice[3]:
+            self.evloop.create_task(
+                self.BLEDev.write_gatt_char(cmd_uuid, bytes([3])))
+        elif command == cmdChoice[4]:
+            self.evloop.create_task(
+                self.BLEDev.write_gatt_char(cmd_uuid, bytes([4])))
+        elif command == cmdChoice[5]:
+            self.evloop.create_task(
+                self.BLEDev.write_gatt_char(cmd_uuid, bytes([5])))
+        elif command == cmdChoice[6]:
+            self.evloop.create_task(
+                self.BLEDev.write_gatt_char(cmd_uuid, bytes([6])))
+        elif command == cmdChoice[7]:
+            self.evloop.create_task(
+                self.BLEDev.write_gatt_char(cmd_uuid, bytes([8])))
 
 
 appInstance: OpenTrackerApp
@@ -205,25 +366,53 @@ async def canvas_worker():
 
 async def stat_wrapper():
     try:
-        hr, br, sr1, sr2 = struct.unpack("<BBBB", await appInstance.BLEDev.read_gatt_char(stat_uuid))
+        hr, br, sr1, sr2, spo2, emg, sqi = stat_packet.unpack(await appInstance.BLEDev.read_gatt_char(stat_uuid))
+        rr, rmssd, sdnn, pnn50, _ = appInstance.hrv
+        # Rates derived from a flagged channel are not trustworthy
+        ppg_ok = not sqi_flags(sqi, "PPG")
         appInstance.statTxt.set(statText.format(
-            hr_bpm=hr, br_bpm=br, sr1_bpm=sr1, sr2_bpm=sr2))
+            hr_bpm=hr if ppg_ok else "-", br_bpm=br if not sqi_flags(sqi, "Flex") else "-",
+            sr1_bpm=sr1, sr2_bpm=sr2, sqi=format_sqi(sqi),
+            spo2=f"{spo2 / 10:.1f}%" if spo2 and ppg_ok else "-",
+            emg="/".join("on" if emg & (1 << c) else "off" for c in range(2)), lost=appInstance.seqTracker.lost,
+            rr=rr, rmssd=rmssd, sdnn=sdnn, pnn50=pnn50 / 10))
     except Exception as e:
         print(f"Data fetch failed, possibly because of device disconnect: {e}")
+    if appInstance.BLEDev.services.get_characteristic(diag_uuid) is None:
+        appInstance.diagTxt.set("Profiling not built in (make PROF=1)")
+        return
+    try:
+        appInstance.diagTxt.set(format_diag(decode_diag(await appInstance.BLEDev.read_gatt_char(diag_uuid))))
+    except Exception as e:
+        print(f"Diagnostics fetch failed: {e}")
 
 
-async def telemetry_wrapper():
+def stream_handler(sender, data: bytearray) -> None:
     try:
-        red_val, ir_val, gsr_val, flex_val, emg1_val, emg2_val = struct.unpack("<LLHHHH", await appInstance.BLEDev.read_gatt_char(telemetry_uuid))
-        appInstance.HR_Red.append(red_val / 128)
-        appInstance.HR_IR.append(ir_val / 128)
+        seq, flags, records = decode_frame(data)
+    except (struct.error, ValueError) as e:
+        print(f"Bad stream frame: {e}")
+        return
+    appInstance.seqTracker.update(seq)
+    for _, red_val, ir_val, gsr_val, flex_val, emg1_val, emg2_val in records:
+        if flags & FRAME_FLAG_PPG:
+            if not flags & FRAME_FLAG_NO_RED:
+                appInstance.HR_Red.append(red_val / 128)
+            appInstance.HR_IR.append(ir_val / 128)
+            continue
         appInstance.GSR.append(gsr_val)
         appInstance.Flex.append(flex_val)
-        appInstance.EMG1.append(emg1_val)
-        appInstance.EMG2.append(emg2_val)
-        await canvas_worker()
-    except Exception as e:
-        print(f"Data fetch failed, possibly because of device disconnect: {e}")
+        scale = 1 / 2 if flags & FRAME_FLAG_EMG_ENV else 1
+        appInstance.EMG1.append(emg1_val * scale)
+        appInstance.EMG2.append(emg2_val * scale)
+    appInstance.dataUpdated = True
+
+
+def hrv_handler(sender, data: bytearray) -> None:
+    try:
+        appInstance.hrv = hrv_packet.unpack(data)
+    except struct.error as e:
+        print(f"Bad HRV packet: {e}")
 
 
 async def device_scan_wrapper():
@@ -243,6 +432,9 @@ async def try_connect_wrapper(devstr: str):
     dev = bleak.BleakClient(devMatch.group(2))
     try:
         await dev.connect()
+        appInstance.seqTracker = SeqTracker()
+        await dev.start_notify(stream_uuid, stream_handler)
+        await dev.start_notify(hrv_uuid, hrv_handler)
         appInstance.BLEDev = dev
         appInstance.cmdSendBtn.state(["!disabled"])
         appInstance.discBtn.state(["!disabled"])
@@ -268,6 +460,76 @@ async def conn_upd_wrapper():
         await disconnect_wrapper()
 
 
+async def stream_cli(address: str):
+    tracker = SeqTracker()
+
+    def on_frame(sender, data: bytearray) -> None:
+        seq, flags, records = decode_frame(data)
+        tracker.update(seq)
+        for ticks, red_val, ir_val, gsr_val, flex_val, emg1_val, emg2_val in records:
+            if flags & FRAME_FLAG_PPG:
+                red_txt = "-" if flags & FRAME_FLAG_NO_RED else red_val
+                print(f"Ticks: {ticks}, Red: {red_txt}, IR: {ir_val}, Lost: {tracker.lost}")
+                continue
+            emg_kind = "EMG env" if flags & FRAME_FLAG_EMG_ENV else "EMG"
+            print(
+                f"Ticks: {ticks}, GSR: {gsr_val}, Flex: {flex_val}, {emg_kind}1: {emg1_val}, {emg_kind}2: {emg2_val}, Lost: {tracker.lost}")
+
+    def on_hrv(sender, data: bytearray) -> None:
+        rr, rmssd, sdnn, pnn50, beats = hrv_packet.unpack(data)
+        print(f"Beat: {beats}, RR: {rr} ms, RMSSD: {rmssd} ms, SDNN: {sdnn} ms, pNN50: {pnn50 / 10:.1f}%")
+
+    async with bleak.BleakClient(address) as client:
+        print(f"MTU is {client.mtu_size}, starting...")
+        await client.start_notify(stream_uuid, on_frame)
+        await client.start_notify(hrv_uuid, on_hrv)
+        profiled = client.services.get_characteristic(diag_uuid) is not None
+        while client.is_connected:
+            await asyncio.sleep(1)
+            if profiled:
+                print(format_diag(decode_diag(await client.read_gatt_char(diag_uuid))))
+
+
+async def download_cli(address: str, path: str):
+    blocks = collections.defaultdict(bytearray)
+    done = asyncio.Event()
+    total = 0
+
+    def on_chunk(sender, data: bytearray) -> None:
+        nonlocal total
+        block, offset = rec_chunk.unpack_from(data)
+        if block == REC_CHUNK_END:
+            total = offset
+            done.set()
+        elif offset == len(blocks[block]):
+            blocks[block] += data[rec_chunk.size:]
+
+    async with bleak.BleakClient(address) as client:
+        print(f"MTU is {client.mtu_size}, downloading...")
+        await client.start_notify(rec_uuid, on_chunk)
+        await client.write_gatt_char(cmd_uuid, bytes([REC_CMD_DOWNLOAD]))
+        await done.wait()
+
+    # time and ticks are RTC ticks, time keeps counting past the 24-bit wrap.
+    # PPG and ADC records fill blocks of their own, rows go out in time order.
+    damaged = 0
+    rows = []
+    for i in range(total):
+        decoded = decode_rec_block(bytes(blocks.get(i, b"")))
+        if decoded is None:
+            damaged += 1
+            continue
+        seq, time, flags, records = decoded
+        for record in records:
+            rows.append((seq, time + ((record[0] - records[0][0]) & TICKS_MASK), flags) + record)
+    rows.sort(key=lambda row: row[1])
+    with open(path, "w", newline="") as f:
+        writer = csv.writer(f)
+        writer.writerow(("seq", "time", "flags", "ticks", "red", "ir", "gsr", "flex", "emg1", "emg2"))
+        writer.writerows(rows)
+    print(f"Blocks: {total}, damaged: {damaged}, records: {len(rows)}, saved to {path}")
+
+
 def on_close() -> None:
     appInstance.alive = False
     appInstance.evloop.stop()
@@ -307,18 +569,13 @@ def create_diag() -> None:
 
 if __name__ == "__main__":
     if len(sys.argv) > 1:
-        if sys.argv[1] != "-c":
-            print("Usage: -c <MAC-ADDRESS>")
-            exit()
+        if sys.argv[1] == "-c":
+            asyncio.run(stream_cli(sys.argv[2]))
+        elif sys.argv[1] == "-d":
+            asyncio.run(download_cli(sys.argv[2], sys.argv[3] if len(sys.argv) > 3 else "session.csv"))
         else:
-            client = bleak.BleakClient(sys.argv[2])
-            asyncio.run(client.connect())
-            print(f"MTU is {client.mtu_size}, starting...")
-            while True:
-                red_val, ir_val, gsr_val, flex_val, emg1_val, emg2_val = struct.unpack(
-                    "<LLHHHH", asyncio.run(client.read_gatt_char(telemetry_uuid)))
-                print(
-                    f"Red: {red_val}, IR: {ir_val}, GSR: {gsr_val}, Flex: {flex_val}, EMG1: {emg1_val}, EMG2: {emg2_val}")
+            print("Usage: -c <MAC-ADDRESS> | -d <MAC-ADDRESS> [CSV-FILE]")
+            exit()
     else:
         appInstance = OpenTrackerApp()
         appInstance.evloop.run_forever()
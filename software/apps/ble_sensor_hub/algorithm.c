@@ -7,6 +7,7 @@
 *******************************************************************************
 */
 
+#include <string.h>
 #include "algorithm.h"
 
 int16_t IR_AC_Max = 20;
@@ -25,15 +26,29 @@ int32_t ir_avg_reg = 0;
 int16_t cbuf[32];
 uint8_t offset = 0;
 
+static bool detectBeat(void);
+
 static const uint16_t FIRCoeffs[12] = {172, 321, 579, 927, 1360, 1858, 2390, 2916, 3391, 3768, 4012, 4096};
 
+//  Block filter state, separate from cbuf: don't mix checkForBeat() and checkForBeat_block() on one stream
+#define FIR_TAPS 23
+#if defined(__arm__)
+//  CMSIS q15 FIR needs an even tap count, the 23-tap symmetric filter gets a trailing zero tap.
+//  Coefficients are in CMSIS time reversed order, which for a symmetric filter only moves the pad.
+static const q15_t FIRBlockCoeffs[FIR_TAPS + 1] = {0, 172, 321, 579, 927, 1360, 1858, 2390, 2916, 3391, 3768, 4012,
+                                                   4096, 4012, 3768, 3391, 2916, 2390, 1858, 1360, 927, 579, 321, 172};
+static q15_t firState[FIR_TAPS + 1 + BEAT_BLOCK_SIZE - 1];
+static arm_fir_instance_q15 firInstance;
+static bool firReady = false;
+#else
+static int16_t firHist[FIR_TAPS - 1 + BEAT_BLOCK_SIZE]; // previous 22 inputs followed by the current block
+#endif
+
 //  Heart Rate Monitor functions takes a sample value and the sample number
 //  Returns true if a beat is detected
 //  A running average of four samples is recommended for display on the screen.
 bool checkForBeat(int32_t sample)
 {
-  bool beatDetected = false;
-
   //  Save current state
   IR_AC_Signal_Previous = IR_AC_Signal_Current;
   
@@ -45,6 +60,67 @@ bool checkForBeat(int32_t sample)
   IR_Average_Estimated = averageDCEstimator(&ir_avg_reg, sample);
   IR_AC_Signal_Current = lowPassFIRFilter(sample - IR_Average_Estimated);
 
+  return detectBeat();
+}
+
+//  Block version of checkForBeat: runs the DC estimator and the FIR over a whole FIFO burst.
+//  Writes every beat found to beats (room for n entries), returns how many.
+uint16_t checkForBeat_block(const int32_t *samples, uint16_t n, beat_t *beats)
+{
+  int16_t ac[BEAT_BLOCK_SIZE];
+  int16_t filtered[BEAT_BLOCK_SIZE];
+  uint16_t found = 0;
+
+  for (uint16_t base = 0; base < n; base += BEAT_BLOCK_SIZE)
+  {
+    uint16_t len = (n - base < BEAT_BLOCK_SIZE) ? n - base : BEAT_BLOCK_SIZE;
+
+    for (uint16_t i = 0; i < len; i++)
+    {
+      IR_Average_Estimated = averageDCEstimator(&ir_avg_reg, samples[base + i]);
+      ac[i] = samples[base + i] - IR_Average_Estimated;
+    }
+    lowPassFIRFilter_block(ac, filtered, len);
+    for (uint16_t i = 0; i < len; i++)
+    {
+      IR_AC_Signal_Previous = IR_AC_Signal_Current;
+      IR_AC_Signal_Current = filtered[i];
+      if (detectBeat())
+      {
+        //  Linear interpolation of the crossing, Previous < 0 <= Current so the divisor is positive
+        int32_t rise = (int32_t)IR_AC_Signal_Current - IR_AC_Signal_Previous;
+        beats[found].idx = base + i;
+        beats[found].lag_q8 = ((int32_t)IR_AC_Signal_Current << 8) / rise;
+        found++;
+      }
+    }
+  }
+  return found;
+}
+
+//  Back to the state at power up, both filters' histories included, before a new stream
+void beat_reset(void)
+{
+  IR_AC_Max = 20;
+  IR_AC_Min = -20;
+  IR_AC_Signal_Current = IR_AC_Signal_Previous = IR_AC_Signal_min = IR_AC_Signal_max = 0;
+  IR_Average_Estimated = 0;
+  positiveEdge = negativeEdge = 0;
+  ir_avg_reg = 0;
+  memset(cbuf, 0, sizeof(cbuf));
+  offset = 0;
+#if defined(__arm__)
+  firReady = false; // arm_fir_init_q15() clears firState
+#else
+  memset(firHist, 0, sizeof(firHist));
+#endif
+}
+
+//  Edge tracking shared by the sample and block paths, IR_AC_Signal_Current must hold the newest output
+static bool detectBeat(void)
+{
+  bool beatDetected = false;
+
   //  Detect positive zero crossing (rising edge)
   if ((IR_AC_Signal_Previous < 0) && (IR_AC_Signal_Current >= 0))
   {
@@ -112,6 +188,35 @@ int16_t lowPassFIRFilter(int16_t din)
   return(z >> 15);
 }
 
+//  Low Pass FIR Filter over a block of up to BEAT_BLOCK_SIZE samples
+void lowPassFIRFilter_block(const int16_t *din, int16_t *dout, uint16_t n)
+{
+#if defined(__arm__)
+  if (!firReady)
+  {
+    arm_fir_init_q15(&firInstance, FIR_TAPS + 1, FIRBlockCoeffs, firState, BEAT_BLOCK_SIZE);
+    firReady = true;
+  }
+  //  32-bit accumulation is exact here, the coefficient sum times full scale stays below 2^31
+  arm_fir_fast_q15(&firInstance, (q15_t *)din, dout, n);
+#else
+  int16_t *x = &firHist[FIR_TAPS - 1];
+
+  for (uint16_t i = 0; i < n; i++)
+    x[i] = din[i];
+  for (uint16_t i = 0; i < n; i++)
+  {
+    //  x[i] is the newest input, x[i - 22] the oldest
+    int32_t z = mul16(FIRCoeffs[11], x[i - 11]);
+    for (uint8_t k = 0; k < 11; k++)
+      z += mul16(FIRCoeffs[k], x[i - k] + x[i - 22 + k]);
+    dout[i] = z >> 15;
+  }
+  for (uint8_t k = 0; k < FIR_TAPS - 1; k++)
+    firHist[k] = firHist[n + k];
+#endif
+}
+
 //  Integer multiplier
 int32_t mul16(int16_t x, int16_t y)
 {
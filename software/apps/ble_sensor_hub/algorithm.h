@@ -25,15 +25,34 @@
 #define ALGORITHM_H_
 #include <stdbool.h>
 #include <stdint.h>
+#if defined(__arm__)
+//  CMSIS-DSP is only pulled in for the nRF52 build, the portable paths need nothing beyond stdint
 #ifndef __FPU_PRESENT
 #define __FPU_PRESENT 1U
 #endif
 #define ARM_MATH_CM4
 #include "arm_math.h"
+#endif
+
+//  Largest burst the block filter handles in one pass (the MAX30102 FIFO depth)
+#define BEAT_BLOCK_SIZE 32
+//  Group delay of the symmetric 23-tap low-pass, in samples
+#define BEAT_FIR_DELAY 11
+
+//  Beat found by checkForBeat_block. The rising zero crossing of the filtered signal lies
+//  lag_q8 / 256 sample periods before sample idx, BEAT_FIR_DELAY more in the input signal.
+typedef struct
+{
+  uint16_t idx;
+  uint16_t lag_q8;
+} beat_t;
 
 bool checkForBeat(int32_t sample);
+uint16_t checkForBeat_block(const int32_t *samples, uint16_t n, beat_t *beats);
+void beat_reset(void);
 int16_t averageDCEstimator(int32_t *p, uint16_t x);
 int16_t lowPassFIRFilter(int16_t din);
+void lowPassFIRFilter_block(const int16_t *din, int16_t *dout, uint16_t n);
 int32_t mul16(int16_t x, int16_t y);
 
 #endif /* ALGORITHM_H_ */
@@ -0,0 +1,105 @@
+#include <string.h>
+#include "anc.h"
+
+// Regularizes the normalization so a quiet reference doesn't blow up the step
+#define ANC_DELTA 64
+
+static int16_t sat16(int32_t x)
+{
+  if (x > INT16_MAX)
+    return INT16_MAX;
+  if (x < INT16_MIN)
+    return INT16_MIN;
+  return x;
+}
+
+static void stage_begin(anc_stage_t *stage)
+{
+  memset(stage, 0, sizeof(*stage));
+#if defined(__arm__)
+  arm_lms_norm_init_q15(&stage->lms, ANC_TAPS, stage->coeffs, stage->state, ANC_MU, ANC_BLOCK_SIZE, ANC_POST_SHIFT);
+#endif
+}
+
+// err = desired - prediction from ref, over n <= ANC_BLOCK_SIZE samples
+static void stage_run(anc_stage_t *stage, int16_t *ref, int16_t *desired, int16_t *err, uint16_t n)
+{
+#if defined(__arm__)
+  int16_t est[ANC_BLOCK_SIZE];
+
+  arm_lms_norm_q15(&stage->lms, ref, desired, est, err, n);
+#else
+  for (uint16_t i = 0; i < n; i++)
+  {
+    int16_t old = stage->hist[ANC_TAPS - 1];
+    int64_t acc = 0;
+
+    for (uint8_t k = ANC_TAPS - 1; k > 0; k--)
+      stage->hist[k] = stage->hist[k - 1];
+    stage->hist[0] = ref[i];
+    // Each term is truncated on its own so leaving samples remove exactly what they added
+    stage->energy += (((int32_t)ref[i] * ref[i]) >> 15) - (((int32_t)old * old) >> 15);
+
+    for (uint8_t k = 0; k < ANC_TAPS; k++)
+      acc += (int32_t)stage->coeffs[k] * stage->hist[k];
+    int16_t e = sat16(desired[i] - sat16(acc >> (15 - ANC_POST_SHIFT)));
+    err[i] = e;
+
+    // w += mu * e * x / |x|^2, step and update in q15. Both round to nearest
+    // or zero: flooring drags every coefficient down a little on every sample,
+    // and the error term it builds up passes the PPG through the reference.
+    int32_t step = (int32_t)e * ANC_MU / (stage->energy + ANC_DELTA);
+    for (uint8_t k = 0; k < ANC_TAPS; k++)
+      stage->coeffs[k] = sat16(stage->coeffs[k] + (int32_t)(((int64_t)step * stage->hist[k] + (1 << 14)) >> 15));
+  }
+#endif
+}
+
+void anc_begin(anc_ctx_t *ctx)
+{
+  ctx->primed = false;
+  stage_begin(&ctx->acc);
+  stage_begin(&ctx->emg);
+}
+
+// Shift-and-add DC tracker in Q8, returns the AC part of x
+static int32_t remove_dc(int32_t *dc, int32_t x)
+{
+  *dc += ((x << 8) - *dc) >> ANC_DC_SHIFT;
+  return x - (*dc >> 8);
+}
+
+void anc_process(anc_ctx_t *ctx, const int32_t *ppg, const int16_t *acc, const int16_t *emg, int32_t *out, uint16_t n)
+{
+  int16_t ppg_ac[ANC_BLOCK_SIZE];
+  int16_t acc_ac[ANC_BLOCK_SIZE];
+  int16_t emg_ac[ANC_BLOCK_SIZE];
+  int16_t residual[ANC_BLOCK_SIZE];
+  int16_t cleaned[ANC_BLOCK_SIZE];
+  int32_t dc[ANC_BLOCK_SIZE];
+
+  if (!ctx->primed && n)
+  {
+    ctx->ppg_dc = ppg[0] << 8;
+    ctx->acc_dc = acc[0] << 8;
+    ctx->emg_dc = emg[0] << 8;
+    ctx->primed = true;
+  }
+  for (uint16_t base = 0; base < n; base += ANC_BLOCK_SIZE)
+  {
+    uint16_t len = (n - base < ANC_BLOCK_SIZE) ? n - base : ANC_BLOCK_SIZE;
+
+    for (uint16_t i = 0; i < len; i++)
+    {
+      ppg_ac[i] = sat16(remove_dc(&ctx->ppg_dc, ppg[base + i]));
+      dc[i] = ctx->ppg_dc >> 8;
+      acc_ac[i] = sat16(remove_dc(&ctx->acc_dc, acc[base + i]) << ANC_REF_SHIFT);
+      emg_ac[i] = sat16(remove_dc(&ctx->emg_dc, emg[base + i]) << ANC_REF_SHIFT);
+    }
+    // The ACC stage error is the EMG stage's desired signal
+    stage_run(&ctx->acc, acc_ac, ppg_ac, residual, len);
+    stage_run(&ctx->emg, emg_ac, residual, cleaned, len);
+    for (uint16_t i = 0; i < len; i++)
+      out[base + i] = dc[i] + cleaned[i];
+  }
+}
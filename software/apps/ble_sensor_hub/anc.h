@@ -0,0 +1,45 @@
+#ifndef ANC_H_
+#define ANC_H_
+#include <stdint.h>
+#include "algorithm.h"
+
+#define ANC_BLOCK_SIZE BEAT_BLOCK_SIZE // samples per adaptive filter pass
+#define ANC_TAPS 8                     // even, the CMSIS q15 filters need a multiple of 2
+#define ANC_MU 0x0100                  // NLMS step size, q15 (1/128)
+#define ANC_POST_SHIFT 2               // coefficients span +-4 so strong coupling can still be cancelled
+#define ANC_DC_SHIFT 4                 // DC tracker time constant, 2^4 samples like averageDCEstimator
+#define ANC_REF_SHIFT 3                // 12-bit ADC AC scaled up to use the q15 range
+
+// One normalized LMS stage: predicts the artifact in the desired signal from a
+// noise reference and leaves the prediction error, the cleaned signal.
+typedef struct
+{
+#if defined(__arm__)
+  arm_lms_norm_instance_q15 lms;
+  q15_t state[ANC_TAPS + ANC_BLOCK_SIZE - 1];
+#else
+  int16_t hist[ANC_TAPS]; // newest reference first
+  int32_t energy;         // sum of hist^2, q15
+#endif
+  int16_t coeffs[ANC_TAPS];
+} anc_stage_t;
+
+// Motion artifact canceller for the PPG: the accelerometer stage runs first,
+// the EMG stage cancels what the first one left. All three signals have their
+// DC removed on the way in, the PPG DC is added back on the way out so the
+// result can go straight into the beat detector.
+typedef struct
+{
+  int32_t ppg_dc; // Q8
+  int32_t acc_dc; // Q8
+  int32_t emg_dc; // Q8
+  bool primed;
+  anc_stage_t acc;
+  anc_stage_t emg;
+} anc_ctx_t;
+
+void anc_begin(anc_ctx_t *ctx);
+// ppg, acc and emg are n time-aligned samples, out receives the cleaned PPG (may alias ppg)
+void anc_process(anc_ctx_t *ctx, const int32_t *ppg, const int16_t *acc, const int16_t *emg, int32_t *out, uint16_t n);
+
+#endif /* ANC_H_ */
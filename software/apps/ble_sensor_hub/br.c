@@ -0,0 +1,115 @@
+#include <math.h>
+#include <string.h>
+#include "br.h"
+
+#define BR_BIN(bpm) ((bpm) * BR_WINDOW / (60 * BR_RATE_HZ))
+
+void br_begin(br_ctx_t *ctx)
+{
+  memset(ctx, 0, sizeof(*ctx));
+  for (uint16_t i = 0; i < BR_WINDOW; i++)
+    ctx->hann[i] = 0.5f - 0.5f * cosf(2.0f * (float)M_PI * i / BR_WINDOW);
+#if defined(__arm__)
+  arm_rfft_fast_init_f32(&ctx->fft, BR_WINDOW);
+#endif
+}
+
+// Power of bins lo..hi of x into power[0..hi-lo]
+static void spectrum(br_ctx_t *ctx, float *x, float *power, uint16_t lo, uint16_t hi)
+{
+#if defined(__arm__)
+  float out[BR_WINDOW];
+
+  // Packed output: out[2k], out[2k + 1] are the real and imaginary part of bin k (k > 0)
+  arm_rfft_fast_f32(&ctx->fft, x, out, 0);
+  for (uint16_t k = lo; k <= hi; k++)
+    power[k - lo] = out[2 * k] * out[2 * k] + out[2 * k + 1] * out[2 * k + 1];
+#else
+  // Reference DFT, only over the bins searched
+  (void)ctx;
+  for (uint16_t k = lo; k <= hi; k++)
+  {
+    float re = 0.0f;
+    float im = 0.0f;
+    for (uint16_t n = 0; n < BR_WINDOW; n++)
+    {
+      float phase = 2.0f * (float)M_PI * (float)((k * n) % BR_WINDOW) / BR_WINDOW;
+      re += x[n] * cosf(phase);
+      im -= x[n] * sinf(phase);
+    }
+    power[k - lo] = re * re + im * im;
+  }
+#endif
+}
+
+// Peak power of a sinusoid of BR_MIN_AMPLITUDE, the Hann window sums to BR_WINDOW / 2
+#define BR_MIN_POWER ((float)BR_MIN_AMPLITUDE * BR_MIN_AMPLITUDE * BR_WINDOW * BR_WINDOW / 16)
+
+static void estimate(br_ctx_t *ctx)
+{
+  // One bin either side of the band so a peak at its edge has neighbours to interpolate with
+  enum { lo = BR_BIN(BR_MIN_BPM) - 1, hi = BR_BIN(BR_MAX_BPM) + 1 };
+  float x[BR_WINDOW];
+  float power[hi - lo + 1];
+  float mean = 0.0f;
+
+  // Unroll the ring oldest first, remove the mean and weight
+  for (uint16_t i = 0; i < BR_WINDOW; i++)
+    mean += ctx->window[i];
+  mean /= BR_WINDOW;
+  for (uint16_t i = 0; i < BR_WINDOW; i++)
+    x[i] = (ctx->window[(ctx->head + i) % BR_WINDOW] - mean) * ctx->hann[i];
+
+  spectrum(ctx, x, power, lo, hi);
+
+  uint16_t peak = 1;
+  float total = 0.0f;
+  for (uint16_t k = 1; k < hi - lo; k++)
+  {
+    total += power[k];
+    if (power[k] > power[peak])
+      peak = k;
+  }
+  // Noise alone often has a bin 3 times its mean, but never a breath's swing
+  if (total <= 0.0f || power[peak] * (hi - lo - 1) < BR_MIN_PROMINENCE * total || power[peak] < BR_MIN_POWER)
+  {
+    ctx->bpm = 0;
+    return;
+  }
+
+  // Parabolic interpolation between the neighbouring bins
+  float a = power[peak - 1];
+  float b = power[peak];
+  float c = power[peak + 1];
+  float den = a - 2.0f * b + c;
+  float offset = den != 0.0f ? 0.5f * (a - c) / den : 0.0f;
+  float bin = lo + peak + offset;
+  ctx->bpm = (uint16_t)(bin * 60.0f * BR_RATE_HZ / BR_WINDOW + 0.5f);
+}
+
+bool br_add(br_ctx_t *ctx, uint16_t flex)
+{
+  ctx->acc += flex;
+  if (++ctx->acc_count < BR_DECIM)
+    return false;
+
+  ctx->window[ctx->head] = (float)ctx->acc / BR_DECIM;
+  ctx->head = (ctx->head + 1) % BR_WINDOW;
+  ctx->acc = 0;
+  ctx->acc_count = 0;
+  if (ctx->filled < BR_WINDOW)
+  {
+    ctx->filled++;
+    return false;
+  }
+  if (++ctx->hop < BR_HOP)
+    return false;
+  ctx->hop = 0;
+  estimate(ctx);
+  return true;
+}
+
+uint16_t br_bpm(const br_ctx_t *ctx)
+{
+  return ctx->bpm;
+}
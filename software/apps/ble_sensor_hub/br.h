@@ -0,0 +1,43 @@
+#ifndef BR_H_
+#define BR_H_
+#include <stdbool.h>
+#include <stdint.h>
+#include "algorithm.h"
+
+#define BR_DECIM 5           // 20 Hz flex stream averaged down to 4 Hz
+#define BR_RATE_HZ 4
+#define BR_WINDOW 128        // 32 s analysis window, power of two for the FFT
+#define BR_HOP 8             // new estimate every 8 decimated samples, 2 s
+#define BR_MIN_BPM 6         // respiratory band searched for the peak
+#define BR_MAX_BPM 45
+#define BR_MIN_PROMINENCE 3  // peak power over mean band power needed to report a rate
+#define BR_MIN_AMPLITUDE 5   // ADC counts of breathing swing needed to report a rate
+
+// Breath rate from the flex sensor. Samples are box-car averaged to BR_RATE_HZ
+// into a sliding window; every BR_HOP samples the window is Hann weighted and
+// transformed, and the strongest bin in the respiratory band, refined by
+// parabolic interpolation, gives the rate.
+//
+// Memory: window and Hann table 2 x 512 B here, plus 2 x 512 B of FFT buffers
+// on the stack of br_add() while an estimate is computed. The CMSIS instance
+// adds a few words and shares the library's constant twiddle tables.
+typedef struct
+{
+  float window[BR_WINDOW];  // circular, oldest at head once full
+  float hann[BR_WINDOW];
+  uint16_t head;
+  uint16_t filled;
+  uint16_t hop;
+  uint32_t acc;             // decimator sum
+  uint8_t acc_count;
+  uint16_t bpm;             // 0 while no clear respiratory peak
+#if defined(__arm__)
+  arm_rfft_fast_instance_f32 fft;
+#endif
+} br_ctx_t;
+
+void br_begin(br_ctx_t *ctx);
+bool br_add(br_ctx_t *ctx, uint16_t flex); //one flex sample, true when a new estimate was computed
+uint16_t br_bpm(const br_ctx_t *ctx);
+
+#endif /* BR_H_ */
@@ -0,0 +1,112 @@
+#include <string.h>
+#include "codec.h"
+
+enum
+{
+  FIELD_TICKS,
+  FIELD_RED,
+  FIELD_IR,
+  FIELD_GSR,
+  FIELD_FLEX,
+  FIELD_EMG1,
+  FIELD_EMG2,
+};
+
+// Native, long and short widths per field
+static const uint8_t width[CODEC_FIELDS] = {24, 18, 18, 12, 12, 12, 12};
+static const uint8_t width_long[CODEC_FIELDS] = {12, 12, 12, 8, 8, 8, 8};
+static const uint8_t width_short[CODEC_FIELDS] = {4, 6, 6, 4, 4, 4, 4};
+
+static void fields_of(const telemetry_record_t *record, uint32_t *v)
+{
+  v[FIELD_TICKS] = record->ticks;
+  v[FIELD_RED] = record->max_red;
+  v[FIELD_IR] = record->max_ir;
+  v[FIELD_GSR] = record->gsr;
+  v[FIELD_FLEX] = record->flex;
+  v[FIELD_EMG1] = record->emg1;
+  v[FIELD_EMG2] = record->emg2;
+  for (uint8_t f = 0; f < CODEC_FIELDS; f++)
+    v[f] &= (1UL << width[f]) - 1;
+}
+
+// Appends the n low bits of value, returns false past the end of the buffer
+static bool put_bits(codec_enc_t *enc, uint32_t value, uint8_t n)
+{
+  if (enc->bits + n > (uint32_t)enc->cap * 8)
+    return false;
+  while (n)
+  {
+    uint32_t byte = enc->bits >> 3;
+    uint8_t room = 8 - (enc->bits & 7);
+    uint8_t take = n < room ? n : room;
+    uint8_t chunk = (value >> (n - take)) & ((1U << take) - 1);
+
+    if ((enc->bits & 7) == 0)
+      enc->buf[byte] = 0;
+    enc->buf[byte] |= chunk << (room - take);
+    enc->bits += take;
+    n -= take;
+  }
+  return true;
+}
+
+void codec_begin(codec_enc_t *enc, uint8_t *buf, uint16_t cap)
+{
+  memset(enc, 0, sizeof(*enc));
+  enc->buf = buf;
+  enc->cap = cap;
+}
+
+bool codec_push(codec_enc_t *enc, const telemetry_record_t *record)
+{
+  uint32_t v[CODEC_FIELDS];
+  uint32_t start = enc->bits;
+  bool ok = true;
+
+  fields_of(record, v);
+  if (enc->count == 0)
+  {
+    for (uint8_t f = 0; f < CODEC_FIELDS && ok; f++)
+      ok = put_bits(enc, v[f], width[f]);
+  }
+  else
+  {
+    for (uint8_t f = 0; f < CODEC_FIELDS && ok; f++)
+    {
+      uint32_t mask = (1UL << width[f]) - 1;
+      uint32_t pred = enc->prev[f] + (f == FIELD_TICKS ? enc->prev_step : 0);
+      // Residual as a signed value of the field's width, then zigzag
+      int32_t r = (int32_t)(((v[f] - pred) & mask) << (32 - width[f])) >> (32 - width[f]);
+      uint32_t z = ((uint32_t)r << 1) ^ (uint32_t)(r >> 31);
+
+      if (z == 0)
+        ok = put_bits(enc, 0, 2);
+      else if (z < (1UL << width_short[f]))
+        ok = put_bits(enc, 1, 2) && put_bits(enc, z, width_short[f]);
+      else if (z < (1UL << width_long[f]))
+        ok = put_bits(enc, 2, 2) && put_bits(enc, z, width_long[f]);
+      else
+        ok = put_bits(enc, 3, 2) && put_bits(enc, v[f], width[f]);
+    }
+  }
+  if (!ok)
+  {
+    // Roll back, clearing the partial bits left in the last byte
+    enc->bits = start;
+    if (start & 7)
+      enc->buf[start >> 3] &= 0xFF << (8 - (start & 7));
+    return false;
+  }
+
+  if (enc->count)
+    enc->prev_step = (v[FIELD_TICKS] - enc->prev[FIELD_TICKS]) & ((1UL << width[FIELD_TICKS]) - 1);
+  memcpy(enc->prev, v, sizeof(v));
+  enc->count++;
+  return true;
+}
+
+uint16_t codec_end(const codec_enc_t *enc)
+{
+  return (enc->bits + 7) >> 3;
+}
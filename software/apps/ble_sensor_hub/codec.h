@@ -0,0 +1,37 @@
+#ifndef CODEC_H_
+#define CODEC_H_
+#include <stdbool.h>
+#include <stdint.h>
+#include "frame.h"
+
+// Bit-packed delta coding of telemetry_record_t streams.
+//
+// A block starts with a keyframe: every field at its native width (ticks 24,
+// red/IR 18, ADC 12 bits). Each following record codes every field as a 2-bit
+// class plus payload:
+//   00  same as predicted
+//   01  zigzag residual in the field's short width
+//   10  zigzag residual in the field's long width
+//   11  raw value at native width
+// The prediction is the previous value, for ticks the previous value plus the
+// previous step. Residuals wrap at the native width. Bits are written MSB first.
+// Every block is decodable on its own, so a lost notification costs no more
+// than its own records.
+
+#define CODEC_FIELDS 7
+
+typedef struct
+{
+  uint8_t *buf;
+  uint16_t cap;   // bytes
+  uint32_t bits;  // bits written so far
+  uint16_t count; // records in the block
+  uint32_t prev[CODEC_FIELDS];
+  uint32_t prev_step; // ticks delta of the last two records
+} codec_enc_t;
+
+void codec_begin(codec_enc_t *enc, uint8_t *buf, uint16_t cap);
+bool codec_push(codec_enc_t *enc, const telemetry_record_t *record); // false when the record does not fit
+uint16_t codec_end(const codec_enc_t *enc);                           // bytes used by the block
+
+#endif /* CODEC_H_ */
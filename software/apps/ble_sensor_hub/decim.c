@@ -0,0 +1,66 @@
+#include <math.h>
+#include <string.h>
+#include "decim.h"
+
+void decim_init(decim_t *d)
+{
+  float h[UINT8_MAX];
+  float fc = 0.4f / d->factor; // cutoff over input rate
+  float mid = (d->taps - 1) / 2.0f;
+  float sum = 0.0f;
+  int32_t total = 0;
+
+  for (uint8_t n = 0; n < d->taps; n++)
+  {
+    float t = n - mid;
+    float sinc = (t == 0.0f) ? 2.0f * fc : sinf(2.0f * (float)M_PI * fc * t) / ((float)M_PI * t);
+    float window = 0.54f - 0.46f * cosf(2.0f * (float)M_PI * n / (d->taps - 1));
+    h[n] = sinc * window;
+    sum += h[n];
+  }
+  for (uint8_t n = 0; n < d->taps; n++)
+  {
+    d->coeffs[n] = lrintf(h[n] / sum * 32768.0f);
+    total += d->coeffs[n];
+  }
+  // Rounding leftovers go to the centre tap so DC passes exactly
+  d->coeffs[d->taps / 2] += 32768 - total;
+
+  memset(d->hist, 0, d->taps * sizeof(d->hist[0]));
+  d->phase = 0;
+  d->pos = 0;
+}
+
+bool decim_push(decim_t *d, int16_t x, int16_t *y)
+{
+  d->hist[d->pos] = x;
+  if (++d->pos == d->taps)
+    d->pos = 0;
+  if (++d->phase < d->factor)
+    return false;
+  d->phase = 0;
+
+  // hist[pos] is now the oldest input, the coefficients are symmetric so direction doesn't matter
+  int32_t acc = 0;
+  uint8_t k = d->pos;
+  for (uint8_t n = 0; n < d->taps; n++)
+  {
+    acc += (int32_t)d->coeffs[n] * d->hist[k];
+    if (++k == d->taps)
+      k = 0;
+  }
+  acc = (acc + (1 << 14)) >> 15;
+  *y = acc > INT16_MAX ? INT16_MAX : (acc < INT16_MIN ? INT16_MIN : acc);
+  return true;
+}
+
+bool decim_push_chain(decim_t *const *chain, uint8_t stages, int16_t x, int16_t *y)
+{
+  for (uint8_t i = 0; i < stages; i++)
+  {
+    if (!decim_push(chain[i], x, &x))
+      return false;
+  }
+  *y = x;
+  return true;
+}
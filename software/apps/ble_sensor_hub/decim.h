@@ -0,0 +1,41 @@
+#ifndef DECIM_H_
+#define DECIM_H_
+#include <stdbool.h>
+#include <stdint.h>
+
+// FIR decimator by an integer factor. Only every factor-th output is computed,
+// which costs taps / factor multiplies per input, the same as running the
+// polyphase branches separately. The low-pass is a Hamming windowed sinc with
+// its cutoff at 80 % of the output Nyquist frequency, generated by decim_init()
+// in q15 with unity DC gain.
+typedef struct
+{
+  uint8_t factor;
+  uint8_t taps;
+  uint8_t phase;    // inputs since the last output
+  uint8_t pos;      // history slot the next input goes to
+  int16_t *coeffs;  // [taps] q15
+  int16_t *hist;    // [taps] circular
+} decim_t;
+
+// Taps per unit of factor that keep the passband, half the output Nyquist
+// frequency, within 0.5 dB and what aliases onto it 55 dB down. At 4 the
+// aliases only got 30 dB of rejection.
+#define DECIM_TAPS_PER_FACTOR 8
+
+// Statically allocates a decimator, DECIM_TAPS_PER_FACTOR * _factor taps is a sensible default
+#define DECIM_DEF(_name, _factor, _taps)                     \
+  static int16_t _name##_coeffs[(_taps)];                    \
+  static int16_t _name##_hist[(_taps)];                      \
+  static decim_t _name = {                                   \
+      .factor = (_factor),                                   \
+      .taps = (_taps),                                       \
+      .coeffs = _name##_coeffs,                              \
+      .hist = _name##_hist,                                  \
+  }
+
+void decim_init(decim_t *d);
+bool decim_push(decim_t *d, int16_t x, int16_t *y); //true when y holds a new output
+bool decim_push_chain(decim_t *const *chain, uint8_t stages, int16_t x, int16_t *y); //cascade, true when the last stage produced y
+
+#endif /* DECIM_H_ */
@@ -0,0 +1,99 @@
+#include <math.h>
+#include <string.h>
+#include "emg.h"
+
+void emg_begin(emg_ctx_t *ctx)
+{
+  memset(ctx, 0, sizeof(*ctx));
+}
+
+static int16_t sat16(int32_t x)
+{
+  if (x > INT16_MAX)
+    return INT16_MAX;
+  if (x < INT16_MIN)
+    return INT16_MIN;
+  return x;
+}
+
+// RMS of the block, q15 in and out
+static uint16_t block_rms(const int16_t *x, uint16_t n)
+{
+#if defined(__arm__)
+  q15_t rms;
+
+  arm_rms_q15(x, n, &rms);
+  return rms;
+#else
+  uint64_t sum = 0;
+
+  for (uint16_t i = 0; i < n; i++)
+    sum += (int32_t)x[i] * x[i];
+  return (uint16_t)sqrtf((float)sum / n);
+#endif
+}
+
+static void detect(emg_ctx_t *ctx)
+{
+  uint16_t floor = ctx->floor < EMG_MIN_FLOOR ? EMG_MIN_FLOOR : ctx->floor;
+  bool change = ctx->active ? ctx->env < (uint32_t)floor * EMG_OFFSET_RATIO
+                            : ctx->env > (uint32_t)floor * EMG_ONSET_RATIO;
+
+  ctx->hold = change ? ctx->hold + 1 : 0;
+  if (ctx->hold >= EMG_HOLD_BLOCKS)
+  {
+    ctx->active = !ctx->active;
+    ctx->hold = 0;
+    if (ctx->active)
+      ctx->onsets++;
+  }
+  // The floor only learns from rest, or it would chase the contraction
+  if (!ctx->active && !change)
+    ctx->floor += ((int32_t)ctx->env - ctx->floor) >> EMG_FLOOR_SHIFT;
+}
+
+bool emg_add(emg_ctx_t *ctx, uint16_t x)
+{
+  int32_t x_q8 = (int32_t)x << 8;
+
+  if (!ctx->primed)
+  {
+    ctx->lp = x_q8;
+    ctx->primed = true;
+  }
+  ctx->lp += (x_q8 - ctx->lp) >> EMG_HP_SHIFT;
+  ctx->band += ((x_q8 - ctx->lp) - ctx->band) >> EMG_LP_SHIFT;
+  ctx->block[ctx->fill++] = sat16(ctx->band >> (8 - EMG_SCALE_SHIFT));
+  if (ctx->fill < EMG_BLOCK)
+    return false;
+  ctx->fill = 0;
+
+  uint16_t rms = block_rms(ctx->block, EMG_BLOCK);
+  if (ctx->floor == 0)
+    ctx->env = ctx->floor = rms; // first block seeds both
+  ctx->env += ((int32_t)rms - ctx->env) >> EMG_ENV_SHIFT;
+  detect(ctx);
+  return true;
+}
+
+uint16_t emg_envelope(const emg_ctx_t *ctx)
+{
+  return ctx->env;
+}
+
+uint16_t emg_envelope_telemetry(const emg_ctx_t *ctx)
+{
+  uint16_t env = ctx->env >> EMG_TELEMETRY_SHIFT;
+
+  return env > EMG_TELEMETRY_MAX ? EMG_TELEMETRY_MAX : env;
+}
+
+bool emg_active(const emg_ctx_t *ctx)
+{
+  return ctx->active;
+}
+
+uint16_t emg_onsets(const emg_ctx_t *ctx)
+{
+  return ctx->onsets;
+}
@@ -0,0 +1,45 @@
+#ifndef EMG_H_
+#define EMG_H_
+#include <stdbool.h>
+#include <stdint.h>
+#include "algorithm.h"
+
+#define EMG_BLOCK 50            // scans per envelope value, 20 Hz out of 1 kHz
+#define EMG_HP_SHIFT 3          // one-pole high-pass near 20 Hz at 1 kHz, drops drift and motion
+#define EMG_LP_SHIFT 1          // one-pole low-pass near 110 Hz, drops ADC noise and what aliases from above 500 Hz
+#define EMG_SCALE_SHIFT 3       // 12-bit ADC scaled into q15 for the RMS
+#define EMG_ENV_SHIFT 1         // envelope smoothing across blocks
+#define EMG_FLOOR_SHIFT 5       // noise floor tracking while at rest
+#define EMG_ONSET_RATIO 3       // envelope over floor that starts an activation
+#define EMG_OFFSET_RATIO 2      // and the one that ends it, for hysteresis
+#define EMG_HOLD_BLOCKS 2       // blocks a state change has to persist, 100 ms
+#define EMG_MIN_FLOOR 16        // floor lower bound, 2 ADC counts in envelope units
+#define EMG_TELEMETRY_SHIFT 2   // envelope to 1/2 ADC counts for the 12-bit telemetry fields
+#define EMG_TELEMETRY_MAX 4095  // 2047 counts RMS, past a full scale sine
+
+// EMG front end for one channel: high-pass and low-pass into the EMG band, then
+// a block RMS of the rectified signal every EMG_BLOCK samples, smoothed into an envelope. Activation starts
+// when the envelope stays EMG_ONSET_RATIO above the resting noise floor and
+// ends when it drops below EMG_OFFSET_RATIO of it.
+typedef struct
+{
+  bool primed;
+  int32_t lp;               // Q8 low-pass, subtracted for the high-pass
+  int32_t band;             // Q8, the high-passed signal low-passed
+  int16_t block[EMG_BLOCK]; // high-passed, q15 scaled
+  uint8_t fill;
+  uint16_t env;             // 1/8 ADC counts
+  uint16_t floor;           // 1/8 ADC counts
+  bool active;
+  uint8_t hold;
+  uint16_t onsets;          // activations so far, wraps
+} emg_ctx_t;
+
+void emg_begin(emg_ctx_t *ctx);
+bool emg_add(emg_ctx_t *ctx, uint16_t x); //one scan, true when a new envelope value is ready
+uint16_t emg_envelope(const emg_ctx_t *ctx); //1/8 ADC counts RMS
+uint16_t emg_envelope_telemetry(const emg_ctx_t *ctx); //1/2 ADC counts RMS, saturated at EMG_TELEMETRY_MAX
+bool emg_active(const emg_ctx_t *ctx);
+uint16_t emg_onsets(const emg_ctx_t *ctx);
+
+#endif /* EMG_H_ */
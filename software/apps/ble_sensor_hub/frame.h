@@ -0,0 +1,41 @@
+#ifndef FRAME_H_
+#define FRAME_H_
+#include <stdint.h>
+
+// What goes over the air and into the session log: a record per sample and
+// the header of every stream notification. PPG samples arrive in FIFO bursts
+// up to a watermark behind the ADC scans, so they travel in frames and log
+// blocks of their own, each in order by ticks. Nothing here depends on the
+// SDK, so host tools and OpenTracker.py's struct formats can follow it as is.
+
+#define TELEMETRY_FMT_RAW 0    // frame body is count telemetry_record_t
+#define TELEMETRY_FMT_PACKED 1 // frame body is one codec.h block of count records
+#define TELEMETRY_FMT_MASK 0x0F
+
+// Flags in the upper half of the format byte
+#define TELEMETRY_FLAG_NO_RED 0x80  // max_red is not sampled into the PPG records and reads 0
+#define TELEMETRY_FLAG_EMG_ENV 0x40 // emg1/emg2 are envelopes in 1/2 ADC counts, one record per envelope
+#define TELEMETRY_FLAG_PPG 0x20     // one record per PPG sample with its own ticks, gsr..emg2 read 0.
+                                    // Without it the records carry the ADC channels, max_red/max_ir read 0.
+
+// Every notification starts with this header, seq increments per frame so the
+// host can count lost notifications
+typedef struct __attribute__((packed))
+{
+  uint16_t seq;
+  uint8_t count;
+  uint8_t format; // TELEMETRY_FMT_* | TELEMETRY_FLAG_*
+} telemetry_hdr_t;
+
+typedef struct __attribute__((packed))
+{
+  uint32_t ticks; // app_timer ticks at acquisition
+  uint32_t max_red;
+  uint32_t max_ir;
+  uint16_t gsr;
+  uint16_t flex;
+  uint16_t emg1;
+  uint16_t emg2;
+} telemetry_record_t;
+
+#endif /* FRAME_H_ */
@@ -0,0 +1,114 @@
+#include <stdbool.h>
+#include <string.h>
+#include "decode.h"
+
+// Native, long and short widths per field, as in codec.c
+static const uint8_t width[] = {24, 18, 18, 12, 12, 12, 12};
+static const uint8_t width_long[] = {12, 12, 12, 8, 8, 8, 8};
+static const uint8_t width_short[] = {4, 6, 6, 4, 4, 4, 4};
+
+#define FIELDS (sizeof(width) / sizeof(width[0]))
+
+typedef struct
+{
+  const uint8_t *data;
+  uint32_t bits; // available
+  uint32_t pos;
+} reader_t;
+
+// Takes the next n bits MSB first, false past the end
+static bool take(reader_t *r, uint8_t n, uint32_t *value)
+{
+  if (r->pos + n > r->bits)
+    return false;
+  *value = 0;
+  while (n)
+  {
+    uint8_t room = 8 - (r->pos & 7);
+    uint8_t got = n < room ? n : room;
+
+    *value = *value << got | ((r->data[r->pos >> 3] >> (room - got)) & ((1U << got) - 1));
+    r->pos += got;
+    n -= got;
+  }
+  return true;
+}
+
+static void record_of(const uint32_t *v, telemetry_record_t *record)
+{
+  record->ticks = v[0];
+  record->max_red = v[1];
+  record->max_ir = v[2];
+  record->gsr = v[3];
+  record->flex = v[4];
+  record->emg1 = v[5];
+  record->emg2 = v[6];
+}
+
+uint16_t decode_packed(const uint8_t *data, uint16_t len, uint16_t count, telemetry_record_t *records)
+{
+  reader_t r = {.data = data, .bits = (uint32_t)len * 8};
+  uint32_t prev[FIELDS];
+  uint32_t cur[FIELDS];
+  uint32_t step = 0;
+
+  for (uint16_t n = 0; n < count; n++)
+  {
+    for (uint8_t f = 0; f < FIELDS; f++)
+    {
+      uint32_t mask = (1UL << width[f]) - 1;
+      uint32_t tag;
+      uint32_t z = 0;
+
+      if (n == 0)
+      {
+        if (!take(&r, width[f], &cur[f]))
+          return n;
+        continue;
+      }
+      if (!take(&r, 2, &tag))
+        return n;
+      if (tag == 3)
+      {
+        if (!take(&r, width[f], &cur[f]))
+          return n;
+        continue;
+      }
+      if (tag && !take(&r, tag == 1 ? width_short[f] : width_long[f], &z))
+        return n;
+      uint32_t pred = prev[f] + (f == 0 ? step : 0);
+      cur[f] = (pred + ((z >> 1) ^ -(z & 1))) & mask;
+    }
+    if (n)
+      step = (cur[0] - prev[0]) & ((1UL << width[0]) - 1);
+    memcpy(prev, cur, sizeof(cur));
+    record_of(cur, &records[n]);
+  }
+  return count;
+}
+
+int decode_frame(const uint8_t *data, uint16_t len, telemetry_hdr_t *hdr, telemetry_record_t *records, uint16_t max)
+{
+  const uint8_t *body = data + sizeof(*hdr);
+
+  if (len < sizeof(*hdr))
+    return -1;
+  memcpy(hdr, data, sizeof(*hdr));
+  len -= sizeof(*hdr);
+  if (hdr->count > max)
+    return -1;
+  switch (hdr->format & TELEMETRY_FMT_MASK)
+  {
+  case TELEMETRY_FMT_RAW:
+    if (len < hdr->count * sizeof(telemetry_record_t))
+      return -1;
+    memcpy(records, body, hdr->count * sizeof(telemetry_record_t));
+    return hdr->count;
+
+  case TELEMETRY_FMT_PACKED:
+    return decode_packed(body, len, hdr->count, records) == hdr->count ? hdr->count : -1;
+
+  default:
+    return -1;
+  }
+}
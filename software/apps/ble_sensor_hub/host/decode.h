@@ -0,0 +1,19 @@
+#ifndef DECODE_H_
+#define DECODE_H_
+#include <stdint.h>
+#include "frame.h"
+
+// The central's side of the stream characteristic, what decode_frame() and
+// decode_packed() in monitor/OpenTracker.py do: a telemetry_hdr_t, then count
+// raw records or one codec.h block of them.
+
+// Decodes count records of a codec.h block of len bytes. Returns the number
+// decoded, fewer than count when the block is truncated.
+uint16_t decode_packed(const uint8_t *data, uint16_t len, uint16_t count, telemetry_record_t *records);
+
+// Decodes one notification into records, which has room for max. Returns the
+// number of records, -1 for an unknown format, a truncated body or more
+// records than max.
+int decode_frame(const uint8_t *data, uint16_t len, telemetry_hdr_t *hdr, telemetry_record_t *records, uint16_t max);
+
+#endif /* DECODE_H_ */
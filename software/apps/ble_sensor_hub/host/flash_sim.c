@@ -0,0 +1,258 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "flash_sim.h"
+#include "nrf_fstorage_sd.h"
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+typedef struct
+{
+  nrf_fstorage_t const *fs;
+  nrf_fstorage_evt_id_t id;
+  uint32_t addr;
+  void const *src;
+  uint32_t len; // bytes to write or pages to erase
+  void *param;
+} op_t;
+
+// Opaque to the application, there is nothing to choose between here
+struct nrf_fstorage_api_s
+{
+  int unused;
+};
+nrf_fstorage_api_t nrf_fstorage_sd;
+
+static uint8_t *mem; // mapped at base, read only outside complete()
+static uint32_t base;
+static uint32_t size;
+static nrf_fstorage_info_t info;
+static uint32_t *page_erases;
+static op_t queue[FLASH_SIM_QUEUE_SIZE];
+static uint8_t queue_size = FLASH_SIM_QUEUE_SIZE;
+static uint8_t head;
+static uint8_t count;
+static uint64_t now;
+static uint64_t head_end;
+static uint32_t fail;
+static flash_sim_stats_t stats;
+
+void flash_sim_begin(uint32_t start, uint32_t bytes, uint32_t page_size)
+{
+  void *want = (void *)(uintptr_t)start;
+
+  if (mem)
+    munmap(mem, size);
+  mem = mmap(want, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+  if (mem != want)
+  {
+    fprintf(stderr, "flash_sim: cannot map 0x%x..0x%x\n", (unsigned)start, (unsigned)(start + bytes - 1));
+    exit(1);
+  }
+  memset(mem, 0xFF, bytes);
+  mprotect(mem, bytes, PROT_READ);
+  base = start;
+  size = bytes;
+  info.erase_unit = page_size;
+  info.program_unit = 4;
+  free(page_erases);
+  page_erases = calloc(bytes / page_size, sizeof(*page_erases));
+  flash_sim_reset();
+  now = 0;
+  fail = 0;
+  stats = (flash_sim_stats_t){0};
+}
+
+void flash_sim_reset(void)
+{
+  head = 0;
+  count = 0;
+}
+
+void flash_sim_set_queue(uint8_t n)
+{
+  queue_size = n < 1 ? 1 : n > FLASH_SIM_QUEUE_SIZE ? FLASH_SIM_QUEUE_SIZE : n;
+}
+
+void flash_sim_fail(uint32_t n)
+{
+  fail = n;
+}
+
+uint32_t flash_sim_page_erases(uint32_t page)
+{
+  return page < size / info.erase_unit ? page_erases[page] : 0;
+}
+
+flash_sim_stats_t *flash_sim_stats(void)
+{
+  return &stats;
+}
+
+uint64_t flash_sim_now(void)
+{
+  return now;
+}
+
+static void start_head(void)
+{
+  const op_t *op = &queue[head];
+  uint64_t d = op->id == NRF_FSTORAGE_EVT_WRITE_RESULT ? (uint64_t)op->len / 4 * FLASH_SIM_WRITE_NS
+                                                       : (uint64_t)op->len * FLASH_SIM_ERASE_NS;
+
+  head_end = now + d;
+  stats.busy_ns += d;
+}
+
+// Programming only clears bits, erasing sets them all
+static void apply(const op_t *op)
+{
+  uint8_t *dst = mem + (op->addr - base);
+
+  mprotect(mem, size, PROT_READ | PROT_WRITE);
+  if (op->id == NRF_FSTORAGE_EVT_WRITE_RESULT)
+  {
+    for (uint32_t i = 0; i < op->len; i += 4)
+    {
+      uint32_t old, word;
+      memcpy(&old, dst + i, 4);
+      memcpy(&word, (const uint8_t *)op->src + i, 4);
+      stats.dirty += (word & ~old) != 0;
+      old &= word;
+      memcpy(dst + i, &old, 4);
+    }
+    stats.writes++;
+    stats.words += op->len / 4;
+  }
+  else
+  {
+    memset(dst, 0xFF, op->len * info.erase_unit);
+    for (uint32_t p = 0; p < op->len; p++)
+      page_erases[(op->addr - base) / info.erase_unit + p]++;
+    stats.erases += op->len;
+  }
+  mprotect(mem, size, PROT_READ);
+}
+
+static void complete(void)
+{
+  op_t op = queue[head];
+  nrf_fstorage_evt_t evt = {
+      .id = op.id,
+      .result = NRF_SUCCESS,
+      .addr = op.addr,
+      .p_src = op.src,
+      .len = op.len,
+      .p_param = op.param,
+  };
+
+  now = head_end;
+  if (fail)
+  {
+    fail--;
+    stats.failed++;
+    evt.result = NRF_ERROR_TIMEOUT;
+  }
+  else
+    apply(&op);
+  head = (head + 1) % FLASH_SIM_QUEUE_SIZE;
+  if (--count)
+    start_head();
+  if (op.fs->evt_handler)
+    op.fs->evt_handler(&evt);
+}
+
+uint64_t flash_sim_next(void)
+{
+  return count ? head_end : UINT64_MAX;
+}
+
+uint32_t flash_sim_advance(uint64_t t)
+{
+  uint32_t done = 0;
+
+  while (count && head_end <= t)
+  {
+    complete();
+    done++;
+  }
+  if (t > now)
+    now = t;
+  return done;
+}
+
+uint32_t flash_sim_run(void)
+{
+  uint32_t done = 0;
+
+  while (count)
+  {
+    complete();
+    done++;
+  }
+  return done;
+}
+
+static ret_code_t submit(const op_t *op)
+{
+  if (count == queue_size)
+  {
+    stats.refused++;
+    return NRF_ERROR_NO_MEM;
+  }
+  queue[(head + count) % FLASH_SIM_QUEUE_SIZE] = *op;
+  if (count++ == 0)
+    start_head();
+  return NRF_SUCCESS;
+}
+
+static bool in_range(nrf_fstorage_t const *p_fs, uint32_t addr, uint32_t len)
+{
+  return addr >= p_fs->start_addr && addr + len - 1 <= p_fs->end_addr && addr >= base && addr + len <= base + size;
+}
+
+ret_code_t nrf_fstorage_init(nrf_fstorage_t *p_fs, nrf_fstorage_api_t const *p_api, void *p_param)
+{
+  if (!mem)
+    return NRF_ERROR_INVALID_STATE;
+  p_fs->p_api = p_api;
+  p_fs->p_flash_info = &info;
+  return NRF_SUCCESS;
+}
+
+ret_code_t nrf_fstorage_write(nrf_fstorage_t const *p_fs, uint32_t dest, void const *p_src, uint32_t len,
+                              void *p_param)
+{
+  op_t op = {p_fs, NRF_FSTORAGE_EVT_WRITE_RESULT, dest, p_src, len, p_param};
+
+  if (!p_fs->p_api)
+    return NRF_ERROR_INVALID_STATE;
+  if (!p_src)
+    return NRF_ERROR_NULL;
+  if (len == 0 || len % info.program_unit)
+    return NRF_ERROR_INVALID_LENGTH;
+  if (dest % info.program_unit || !in_range(p_fs, dest, len))
+    return NRF_ERROR_INVALID_ADDR;
+  return submit(&op);
+}
+
+ret_code_t nrf_fstorage_erase(nrf_fstorage_t const *p_fs, uint32_t page_addr, uint32_t len, void *p_param)
+{
+  op_t op = {p_fs, NRF_FSTORAGE_EVT_ERASE_RESULT, page_addr, NULL, len, p_param};
+
+  if (!p_fs->p_api)
+    return NRF_ERROR_INVALID_STATE;
+  if (len == 0)
+    return NRF_ERROR_INVALID_LENGTH;
+  if (page_addr % info.erase_unit || !in_range(p_fs, page_addr, len * info.erase_unit))
+    return NRF_ERROR_INVALID_ADDR;
+  return submit(&op);
+}
+
+bool nrf_fstorage_is_busy(nrf_fstorage_t const *p_fs)
+{
+  return count != 0;
+}
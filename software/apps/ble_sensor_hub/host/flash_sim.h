@@ -0,0 +1,49 @@
+#ifndef FLASH_SIM_H_
+#define FLASH_SIM_H_
+#include <stdbool.h>
+#include <stdint.h>
+#include "nrf_fstorage.h"
+
+// Host implementation of nrf_fstorage (stub/nrf_fstorage.h) over simulated
+// NOR flash. The region is mapped at its target address, so code that reads
+// flash through a pointer made from an address works unchanged.
+//
+// Erased bytes read 0xFF and a write can only clear bits, as on the NVMC.
+// Operations queue like the SoftDevice backend's and run one after the other
+// on a virtual clock of their own: FLASH_SIM_WRITE_NS per word written,
+// FLASH_SIM_ERASE_NS per page erased. Each one ends with its event to the
+// instance's handler once the clock gets past it, through flash_sim_advance()
+// or flash_sim_run(). A reset drops what is still queued, the flash keeps
+// whatever completed.
+
+#define FLASH_SIM_WRITE_NS 41000     // nRF52832 tWRITE, one 32-bit word
+#define FLASH_SIM_ERASE_NS 85000000  // tERASEPAGE
+#define FLASH_SIM_QUEUE_SIZE 4       // NRF_FSTORAGE_SD_QUEUE_SIZE
+
+typedef struct
+{
+  uint32_t writes;    // completed write operations
+  uint32_t words;     // words programmed
+  uint32_t erases;    // pages erased
+  uint32_t refused;   // operations turned away with a full queue
+  uint32_t failed;    // operations completed with an error
+  uint32_t dirty;     // words written over bits a write could not set
+  uint64_t busy_ns;   // flash busy
+} flash_sim_stats_t;
+
+// Maps size bytes of erased flash at address start, pages of page_size
+void flash_sim_begin(uint32_t start, uint32_t size, uint32_t page_size);
+void flash_sim_reset(void);              // drops the queue, like a chip reset
+void flash_sim_set_queue(uint8_t size);  // up to FLASH_SIM_QUEUE_SIZE
+void flash_sim_fail(uint32_t count);     // the next count operations end in NRF_ERROR_TIMEOUT
+uint32_t flash_sim_page_erases(uint32_t page); // per page from start, for wear
+flash_sim_stats_t *flash_sim_stats(void);      // may be cleared by the caller
+
+uint64_t flash_sim_now(void);
+uint64_t flash_sim_next(void); // end of the running operation, UINT64_MAX when idle
+// Moves the clock to t, completing what ends by then, including operations
+// the handlers queue. Returns how many completed.
+uint32_t flash_sim_advance(uint64_t t);
+uint32_t flash_sim_run(void); // until the queue is empty
+
+#endif /* FLASH_SIM_H_ */
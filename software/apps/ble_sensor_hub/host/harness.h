@@ -0,0 +1,99 @@
+#ifndef HARNESS_H_
+#define HARNESS_H_
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Checks and timing for the host test programs. Each program is one
+// translation unit that includes this header, runs its checks and returns
+// harness_result(). With -b on the command line it runs its benchmarks too.
+
+static int harness_checks;
+static int harness_failures;
+
+#define CHECK(_cond)                                                          \
+  do                                                                          \
+  {                                                                           \
+    harness_checks++;                                                         \
+    if (!(_cond))                                                             \
+    {                                                                         \
+      harness_failures++;                                                     \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #_cond); \
+    }                                                                         \
+  } while (0)
+
+#define CHECK_EQ(_a, _b)                                                                    \
+  do                                                                                        \
+  {                                                                                         \
+    long long _va = (long long)(_a);                                                        \
+    long long _vb = (long long)(_b);                                                        \
+    harness_checks++;                                                                       \
+    if (_va != _vb)                                                                         \
+    {                                                                                       \
+      harness_failures++;                                                                   \
+      fprintf(stderr, "%s:%d: %s == %s failed: %lld != %lld\n", __FILE__, __LINE__, #_a, #_b, \
+              _va, _vb);                                                                    \
+    }                                                                                       \
+  } while (0)
+
+#define CHECK_NEAR(_a, _b, _tol)                                                                 \
+  do                                                                                             \
+  {                                                                                              \
+    double _va = (double)(_a);                                                                   \
+    double _vb = (double)(_b);                                                                   \
+    harness_checks++;                                                                            \
+    if (!(_va - _vb <= (_tol) && _vb - _va <= (_tol)))                                           \
+    {                                                                                            \
+      harness_failures++;                                                                        \
+      fprintf(stderr, "%s:%d: %s ~ %s failed: %g vs %g (tolerance %g)\n", __FILE__, __LINE__, #_a, \
+              #_b, _va, _vb, (double)(_tol));                                                    \
+    }                                                                                            \
+  } while (0)
+
+// Monotonic nanoseconds
+static inline uint64_t harness_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// Time stamp counter where there is one, 0 elsewhere. On x86 it counts at a
+// fixed reference rate, close to but not exactly core cycles.
+static inline uint64_t harness_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+static inline bool harness_bench(int argc, char **argv)
+{
+  for (int i = 1; i < argc; i++)
+    if (strcmp(argv[i], "-b") == 0)
+      return true;
+  return false;
+}
+
+// Keeps the optimizer from dropping a result that is only timed
+static inline void harness_keep(const void *p)
+{
+  __asm__ volatile("" : : "g"(p) : "memory");
+}
+
+static inline int harness_result(const char *name)
+{
+  printf("%s: %d checks, %d failed\n", name, harness_checks, harness_failures);
+  return harness_failures ? 1 : 0;
+}
+
+#endif /* HARNESS_H_ */
@@ -0,0 +1,521 @@
+// Runs the whole firmware, main.c and everything it calls, on the
+// discrete-event simulator (sim.h) against models of its hardware: the
+// SAADC scan over synthetic analog inputs, the MAX30102 on the timed TWI bus
+// with a synthetic PPG, flash, and a central that connects, writes commands
+// and decodes every notification it receives.
+//
+//   hubsim [-t s] [-c s] [-d s] [-f s] [-n s] [-w s:cmd]... [-i ms] [-q n] [-k scale] [-r s] [-T trace.csv]
+//
+//   -t  length of the run                       (60 s)
+//   -c  central connects                        (1 s)
+//   -d  central disconnects                     (58 s)
+//   -f  finger on the sensor                    (4 s)
+//   -n  MAX30102 INT stops reaching the nRF, the line reads high from then on (never)
+//   -w  command byte written to 0x108a at s, repeatable, replaces the defaults
+//   -i  connection interval                     (30 ms)
+//   -q  SoftDevice TX queue for notifications   (1)
+//   -k  virtual ns charged per host ns of firmware code, 0 keeps runs identical (0)
+//   -r  RTC counter at the start, s of its 512 s range, 500 wraps it 12 s in
+//   -T  one CSV row per event: virtual ns, handler, late ns, host ns
+//
+// stdout holds the firmware log and the report, identical on every run with
+// -k 0 (the golden output), host timings go to stderr.
+
+#include <inttypes.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "app_timer.h"
+#include "decode.h"
+#include "flash_sim.h"
+#include "max30102.h"
+#include "max30102_sim.h"
+#include "rec.h"
+#include "sim.h"
+#include "sim_ble.h"
+#include "sim_nrf.h"
+#include "synth.h"
+#include "telemetry.h"
+#include "twi_sim.h"
+
+#define NS_PER_S 1000000000u
+#define MAX_BEATS 1024
+#define MAX_WRITES 32
+#define HRV_MATCH_S 4.0 // a notified RR is matched to the true beats this far back
+#define LED_FULL 0x3F   // LEDx_PA the synthetic PPG amplitude is given for
+
+#define UUID_STAT 0x108c
+#define UUID_STREAM 0x108d
+#define UUID_HRV 0x108e
+#define UUID_REC 0x1090
+#define UUID_CMD 0x108a
+
+int firmware_main(void); // main.c, renamed by the Makefile
+
+static struct
+{
+  double end;
+  double connect;
+  double disconnect;
+  double finger;
+  double int_lost;
+  double interval_ms;
+  int queue;
+  double cpu_scale;
+  double rtc_start;
+  const char *trace;
+  int writes;
+  double write_t[MAX_WRITES];
+  uint8_t write_cmd[MAX_WRITES];
+} opt = {
+    .end = 60,
+    .connect = 1,
+    .disconnect = 58,
+    .finger = 4,
+    .int_lost = -1,
+    .interval_ms = 30,
+    .queue = 1,
+    .rtc_start = 500,
+};
+
+// Record start, raw EMG on and off, record stop, download, red off and on, erase
+static const struct
+{
+  double t;
+  uint8_t cmd;
+} default_writes[] = {{10, 5}, {25, 4}, {28, 4}, {40, 6}, {42, 7}, {50, 3}, {52, 3}, {55, 8}};
+
+/*******************************************************************************
+ *   Analog inputs
+ ******************************************************************************/
+static uint32_t seeds[NRF_SAADC_INPUT_VDD + 1];
+
+static uint16_t analog(nrf_saadc_input_t pin, uint64_t t_ns)
+{
+  double t = (double)t_ns / NS_PER_S;
+  uint32_t *seed = &seeds[pin];
+
+  switch (pin)
+  {
+  case NRF_SAADC_INPUT_AIN1: // GSR, a skin response every 20 s
+  {
+    double since = fmod(t, 20.0) - 8.0;
+    double response = since > 0 ? 300.0 * (1.0 - exp(-since / 0.5)) * exp(-since / 4.0) : 0.0;
+    return synth_adc(t, 1500 + response, 0, 0, 2, seed);
+  }
+  case NRF_SAADC_INPUT_AIN2: // flex, breathing at 15 per minute
+    return synth_adc(t, 2100, 180, 0.25f, 4, seed);
+  case NRF_SAADC_INPUT_AIN4: // EMG1, a burst of activity
+    return synth_adc(t, 2048, 0, 0, t >= 20 && t < 23 ? 300 : 8, seed);
+  case NRF_SAADC_INPUT_AIN5: // EMG2 at rest
+    return synth_adc(t, 2048, 0, 0, 8, seed);
+  case NRF_SAADC_INPUT_AIN6: // ACC, walking at 108 steps per minute
+    return synth_adc(t, 2048, t >= 32 && t < 44 ? 400 : 0, 1.8f, 6, seed);
+  default:
+    return 0;
+  }
+}
+
+/*******************************************************************************
+ *   MAX30102 sampling
+ ******************************************************************************/
+static synth_ppg_t ppg = {
+    .bpm = 72,
+    .rr_jitter = 0.03f,
+    .ir_dc = 220000,
+    .ir_ac = 400,
+    .red_dc = 180000,
+    .red_ac = 250,
+    .noise = 3,
+    .seed = 149,
+};
+static double beats[MAX_BEATS]; // true beat times, s
+static int beat_count;
+static uint32_t ppg_taken;
+static uint32_t ppg_lost; // samples the full FIFO turned away
+static sim_handler_t *sensor;
+
+// FIFO rate the registers configure: SPO2_SR over SMP_AVE
+static double ppg_rate(void)
+{
+  static const uint16_t sr[] = {50, 100, 200, 400, 800, 1000, 1600, 3200};
+  uint8_t ave = (max30102_sim_reg(0x08) >> 5) & 0x07;
+
+  return (double)sr[(max30102_sim_reg(0x0A) >> 2) & 0x07] / (1u << (ave > 5 ? 5 : ave));
+}
+
+static uint32_t led_scale(uint32_t x, uint8_t reg)
+{
+  return (uint32_t)((uint64_t)x * max30102_sim_reg(reg) / LED_FULL);
+}
+
+static bool ppg_sample(void *ctx, uint32_t arg)
+{
+  double t = (double)sim_now() / NS_PER_S;
+  double rate = ppg_rate();
+  uint32_t red, ir;
+  double beat_t;
+
+  sim_at(sim_now() + (uint64_t)(NS_PER_S / rate), sensor, ppg_sample, NULL, 0);
+  ppg.rate_hz = rate;
+  ppg.t = t;
+  if (synth_ppg_next(&ppg, &red, &ir, &beat_t) && beat_count < MAX_BEATS)
+    beats[beat_count++] = beat_t;
+  if (max30102_sim_shutdown())
+    return true;
+  if (t < opt.finger)
+  {
+    red = (uint32_t)ppg.red_dc / 8;
+    ir = (uint32_t)ppg.ir_dc / 8;
+  }
+  ppg_taken++;
+  ppg_lost += max30102_sim_unread() == MAX30102_FIFO_DEPTH;
+  max30102_sim_sample(led_scale(red, 0x0C), led_scale(ir, 0x0D));
+  return true;
+}
+
+#ifdef MAX30102_INT_PIN
+static bool ppg_int_level(void)
+{
+  if (opt.int_lost >= 0 && (double)sim_now() / NS_PER_S >= opt.int_lost)
+    return true;
+  return !max30102_sim_int();
+}
+#endif
+
+/*******************************************************************************
+ *   Central
+ ******************************************************************************/
+static struct
+{
+  uint32_t frames;
+  uint32_t gaps; // frames missing by seq
+  uint32_t records;
+  uint32_t ppg;      // PPG records
+  uint32_t ppg_gaps; // samples missing before a PPG record
+  uint32_t ppg_gap_max;
+  uint32_t ppg_ticks;
+  uint32_t ppg_step; // between the last PPG records with none missing
+  uint16_t next_seq;
+  bool seen;
+  uint64_t latency_ns;
+  uint64_t latency_max_ns;
+} stream;
+
+static struct
+{
+  uint32_t notifications;
+  uint32_t matched;
+  double rr_err_ms; // absolute, summed
+  double latency_s;
+  double latency_max_s;
+} hrv;
+
+static struct
+{
+  uint32_t chunks;
+  uint32_t blocks;
+  uint32_t intact; // blocks whose CRC checks
+  uint32_t records;
+  uint32_t ppg;    // PPG records
+  int32_t end;     // block count of the end marker, -1 before it
+  uint8_t block[REC_BLOCK_SIZE];
+  uint16_t have;
+} download = {.end = -1};
+
+static uint64_t ticks_ns(uint32_t ticks)
+{
+  return (uint64_t)ticks * NS_PER_S / APP_TIMER_CLOCK_FREQ;
+}
+
+// A PPG record in the stream. Each one follows the one before by a sample
+// period, a step half as long again means samples went missing.
+static void rx_ppg(const telemetry_record_t *record)
+{
+  uint32_t step = (record->ticks - stream.ppg_ticks) & APP_TIMER_MAX_CNT_VAL;
+
+  if (stream.ppg_step && step > stream.ppg_step * 3 / 2)
+  {
+    stream.ppg_gaps++;
+    if (step > stream.ppg_gap_max)
+      stream.ppg_gap_max = step;
+  }
+  else if (stream.ppg)
+    stream.ppg_step = step;
+  stream.ppg_ticks = record->ticks;
+  stream.ppg++;
+}
+
+static void rx_stream(const uint8_t *data, uint16_t len)
+{
+  static telemetry_record_t records[UINT8_MAX];
+  const telemetry_hdr_t *hdr = (const telemetry_hdr_t *)data;
+  telemetry_hdr_t h;
+  int count = decode_frame(data, len, &h, records, UINT8_MAX);
+
+  if (len < sizeof(*hdr) + 3)
+    return;
+  if (stream.seen && hdr->seq != stream.next_seq)
+    stream.gaps += (uint16_t)(hdr->seq - stream.next_seq);
+  stream.seen = true;
+  stream.next_seq = hdr->seq + 1;
+  stream.frames++;
+  stream.records += hdr->count;
+  for (int i = 0; i < count && (h.format & TELEMETRY_FLAG_PPG); i++)
+    rx_ppg(&records[i]);
+
+  // The keyframe leads with the first record's 24 ticks bits
+  const uint8_t *body = data + sizeof(*hdr);
+  uint32_t ticks = (uint32_t)body[0] << 16 | (uint32_t)body[1] << 8 | body[2];
+  uint64_t latency = ticks_ns((sim_nrf_ticks(sim_now()) - ticks) & APP_TIMER_MAX_CNT_VAL);
+  stream.latency_ns += latency;
+  if (latency > stream.latency_max_ns)
+    stream.latency_max_ns = latency;
+}
+
+static void rx_hrv(const uint8_t *data, uint16_t len)
+{
+  uint16_t rr_ms = data[0] | data[1] << 8;
+  double now = (double)sim_now() / NS_PER_S;
+  double best = HUGE_VAL;
+  int match = -1;
+
+  hrv.notifications++;
+  for (int i = beat_count - 1; i > 0 && beats[i] >= now - HRV_MATCH_S; i--)
+  {
+    double err = fabs(rr_ms - 1000.0 * (beats[i] - beats[i - 1]));
+    if (beats[i] <= now && err < best)
+    {
+      best = err;
+      match = i;
+    }
+  }
+  if (match < 0)
+    return;
+  hrv.matched++;
+  hrv.rr_err_ms += best;
+  hrv.latency_s += now - beats[match];
+  if (now - beats[match] > hrv.latency_max_s)
+    hrv.latency_max_s = now - beats[match];
+}
+
+static void rx_rec(const uint8_t *data, uint16_t len)
+{
+  uint16_t block = data[0] | data[1] << 8;
+  uint16_t offset = data[2] | data[3] << 8;
+  const rec_hdr_t *hdr = (const rec_hdr_t *)download.block;
+
+  download.chunks++;
+  if (block == 0xFFFF)
+  {
+    download.end = offset;
+    return;
+  }
+  len -= 4;
+  if (offset != download.have || offset + len > REC_BLOCK_SIZE)
+  {
+    download.have = 0; // lost the start of this one
+    return;
+  }
+  memcpy(download.block + offset, data + 4, len);
+  download.have += len;
+  if (download.have < sizeof(rec_hdr_t) || download.have < sizeof(rec_hdr_t) + hdr->length)
+    return;
+  download.blocks++;
+  uint32_t crc = rec_crc32(download.block, offsetof(rec_hdr_t, crc), 0);
+  if (hdr->magic == REC_MAGIC && rec_crc32((const uint8_t *)(hdr + 1), hdr->length, crc) == hdr->crc)
+  {
+    static telemetry_record_t records[REC_DATA_SIZE];
+    uint16_t n = decode_packed((const uint8_t *)(hdr + 1), hdr->length, hdr->count, records);
+
+    download.intact++;
+    download.records += n;
+    download.ppg += hdr->flags & TELEMETRY_FLAG_PPG ? n : 0;
+  }
+  download.have = 0;
+}
+
+static void central_rx(uint16_t uuid16, const uint8_t *data, uint16_t len)
+{
+  switch (uuid16)
+  {
+  case UUID_STREAM:
+    rx_stream(data, len);
+    break;
+
+  case UUID_HRV:
+    rx_hrv(data, len);
+    break;
+
+  case UUID_REC:
+    rx_rec(data, len);
+    break;
+
+  default:
+    break;
+  }
+}
+
+/*******************************************************************************
+ *   Report
+ ******************************************************************************/
+static uint16_t u16(const uint8_t *p)
+{
+  return p[0] | p[1] << 8;
+}
+
+static void report(void)
+{
+  const sim_saadc_stats_t *saadc = sim_nrf_saadc_stats();
+  const twi_sim_stats_t *twi = twi_sim_stats();
+  const flash_sim_stats_t *flash = flash_sim_stats();
+  const sim_ble_stats_t *ble = sim_ble_stats();
+  uint16_t len;
+  const uint8_t *stat = sim_ble_value(UUID_STAT, &len);
+
+  printf("saadc: %" PRIu32 " scans, %" PRIu32 " lost, %" PRIu32 " buffers\n", saadc->scans, saadc->lost,
+         saadc->buffers);
+  printf("max30102: %" PRIu32 " samples, %" PRIu32 " lost to a full FIFO, %d true beats\n", ppg_taken, ppg_lost,
+         beat_count);
+  printf("twi: %" PRIu32 " transactions, %" PRIu32 " bytes, bus %.3f ms\n", twi->transactions, twi->bytes,
+         twi->bus_ns / 1e6);
+  printf("flash: %" PRIu32 " writes, %" PRIu32 " words, %" PRIu32 " page erases, %" PRIu32 " refused, %" PRIu32
+         " dirty, busy %.3f ms\n",
+         flash->writes, flash->words, flash->erases, flash->refused, flash->dirty, flash->busy_ns / 1e6);
+  printf("ble: %" PRIu32 " connection events, %" PRIu32 " notifications, %" PRIu32 " bytes, %" PRIu32 " refused\n",
+         ble->events, ble->sent, ble->bytes, ble->refused);
+  printf("stream: %" PRIu32 " frames, %" PRIu32 " missing, %" PRIu32 " records, latency mean %.1f ms, max %.1f ms\n",
+         stream.frames, stream.gaps, stream.records, stream.frames ? stream.latency_ns / 1e6 / stream.frames : 0.0,
+         stream.latency_max_ns / 1e6);
+  printf("stream ppg: %" PRIu32 " records, %" PRIu32 " gaps, longest %.3f s\n", stream.ppg, stream.ppg_gaps,
+         ticks_ns(stream.ppg_gap_max) / 1e9);
+  printf("hrv: %" PRIu32 " notifications, %" PRIu32 " matched, RR error mean %.1f ms, latency mean %.3f s, max %.3f s\n",
+         hrv.notifications, hrv.matched, hrv.matched ? hrv.rr_err_ms / hrv.matched : 0.0,
+         hrv.matched ? hrv.latency_s / hrv.matched : 0.0, hrv.latency_max_s);
+  printf("download: %" PRIu32 " chunks, %" PRIu32 " blocks, %" PRIu32 " intact, %" PRIu32 " records, %" PRIu32
+         " PPG, end marker %" PRId32 "\n",
+         download.chunks, download.blocks, download.intact, download.records, download.ppg, download.end);
+  if (stat && len >= 16)
+    printf("stat: hr %u, br %u, cadence %u, steps %u, spo2 %u, emg %u, sqi 0x%08" PRIx32 "\n", u16(stat),
+           u16(stat + 2), u16(stat + 4), u16(stat + 6), u16(stat + 8), u16(stat + 10),
+           (uint32_t)u16(stat + 12) | (uint32_t)u16(stat + 14) << 16);
+}
+
+/*******************************************************************************
+ *   Setup
+ ******************************************************************************/
+static uint64_t ns(double s)
+{
+  return (uint64_t)llround(s * NS_PER_S);
+}
+
+static const sim_clock_t twi_clock = {"twi", twi_sim_now, twi_sim_next, twi_sim_advance};
+static const sim_clock_t flash_clock = {"flash", flash_sim_now, flash_sim_next, flash_sim_advance};
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr,
+          "usage: %s [-t s] [-c s] [-d s] [-f s] [-n s] [-w s:cmd]... [-i ms] [-q n] [-k scale] [-r s] [-T trace.csv]\n",
+          argv0);
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  sim_config_t config = {.report = report};
+  int c;
+
+  while ((c = getopt(argc, argv, "t:c:d:f:n:w:i:q:k:r:T:")) != -1)
+  {
+    switch (c)
+    {
+    case 't':
+      opt.end = atof(optarg);
+      break;
+    case 'c':
+      opt.connect = atof(optarg);
+      break;
+    case 'd':
+      opt.disconnect = atof(optarg);
+      break;
+    case 'f':
+      opt.finger = atof(optarg);
+      break;
+    case 'n':
+      opt.int_lost = atof(optarg);
+      break;
+    case 'w':
+    {
+      double t;
+      unsigned cmd;
+      if (opt.writes == MAX_WRITES || sscanf(optarg, "%lf:%u", &t, &cmd) != 2)
+        usage(argv[0]);
+      opt.write_t[opt.writes] = t;
+      opt.write_cmd[opt.writes++] = cmd;
+      break;
+    }
+    case 'i':
+      opt.interval_ms = atof(optarg);
+      break;
+    case 'q':
+      opt.queue = atoi(optarg);
+      break;
+    case 'k':
+      opt.cpu_scale = atof(optarg);
+      break;
+    case 'r':
+      opt.rtc_start = atof(optarg);
+      break;
+    case 'T':
+      opt.trace = optarg;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (!opt.writes)
+    for (size_t i = 0; i < sizeof(default_writes) / sizeof(default_writes[0]); i++)
+    {
+      opt.write_t[opt.writes] = default_writes[i].t;
+      opt.write_cmd[opt.writes++] = default_writes[i].cmd;
+    }
+
+  config.end_ns = ns(opt.end);
+  config.cpu_scale = opt.cpu_scale;
+  if (opt.trace && !(config.trace = fopen(opt.trace, "w")))
+  {
+    perror(opt.trace);
+    return 1;
+  }
+  if (config.trace)
+    fprintf(config.trace, "t_ns,handler,late_ns,host_ns\n");
+  sim_begin(&config);
+
+  for (size_t i = 0; i < sizeof(seeds) / sizeof(seeds[0]); i++)
+    seeds[i] = 2041 + 97 * i;
+  sim_nrf_begin(opt.rtc_start, analog);
+  flash_sim_begin(REC_FLASH_START, REC_PAGES * 4096, 4096);
+  max30102_sim_attach();
+#ifdef MAX30102_INT_PIN
+  sim_nrf_pin(MAX30102_INT_PIN, ppg_int_level);
+#endif
+  sim_add_clock(&twi_clock);
+  sim_add_clock(&flash_clock);
+
+  synth_ppg_begin(&ppg);
+  sensor = sim_handler("max30102", false);
+  sim_at(0, sensor, ppg_sample, NULL, 0);
+
+  sim_ble_begin(ns(opt.interval_ms / 1000), opt.queue);
+  sim_ble_central(central_rx);
+  sim_ble_connect_at(ns(opt.connect));
+  for (int i = 0; i < opt.writes; i++)
+    sim_ble_write_at(ns(opt.write_t[i]), UUID_CMD, &opt.write_cmd[i], 1);
+  sim_ble_disconnect_at(ns(opt.disconnect));
+
+  // Returns only through sim_finish()
+  return firmware_main();
+}
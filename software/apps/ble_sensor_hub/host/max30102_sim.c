@@ -0,0 +1,169 @@
+#include <string.h>
+#include "max30102_sim.h"
+#include "twi_sim.h"
+
+#define FIFO_DEPTH 32
+#define SAMPLE_BYTES 6
+
+#define REG_INT_STATUS_1 0x00
+#define REG_INT_ENABLE_1 0x02
+#define REG_FIFO_WR_PTR 0x04
+#define REG_OVERFLOW_CTR 0x05
+#define REG_FIFO_RD_PTR 0x06
+#define REG_FIFO_DATA 0x07
+#define REG_FIFO_CONF 0x08
+#define REG_MODE_CONF 0x09
+#define REG_REV_ID 0xFE
+#define REG_PART_ID 0xFF
+
+#define INT_A_FULL 0x80
+#define INT_PWR_RDY 0x01
+#define MODE_SHDN 0x80
+#define MODE_RESET 0x40
+
+static struct
+{
+  uint8_t regs[256];
+  uint8_t fifo[FIFO_DEPTH][SAMPLE_BYTES];
+  uint8_t pointer; // register address of the next access
+  uint8_t byte;    // bytes of the current sample already read
+  uint8_t unread;  // the pointers alone cannot tell a full FIFO from an empty one
+} sim;
+
+static void power_on(void)
+{
+  memset(&sim, 0, sizeof(sim));
+  sim.regs[REG_INT_STATUS_1] = INT_PWR_RDY;
+  sim.regs[REG_REV_ID] = 0x03;
+  sim.regs[REG_PART_ID] = MAX30102_SIM_PART_ID;
+}
+
+static uint8_t read_byte(void)
+{
+  uint8_t reg = sim.pointer;
+  uint8_t value = sim.regs[reg];
+
+  if (reg == REG_FIFO_DATA)
+  {
+    // The data register does not auto-increment, every read pops a byte and
+    // a complete sample advances RD_PTR and clears OVF_COUNTER
+    value = sim.fifo[sim.regs[REG_FIFO_RD_PTR]][sim.byte];
+    sim.regs[REG_INT_STATUS_1] &= ~INT_A_FULL;
+    if (++sim.byte == SAMPLE_BYTES)
+    {
+      sim.byte = 0;
+      if (sim.unread)
+      {
+        sim.regs[REG_FIFO_RD_PTR] = (sim.regs[REG_FIFO_RD_PTR] + 1) & 0x1F;
+        sim.regs[REG_OVERFLOW_CTR] = 0;
+        sim.unread--;
+      }
+    }
+    return value;
+  }
+  if (reg == REG_INT_STATUS_1)
+    sim.regs[reg] = 0;
+  sim.pointer++;
+  return value;
+}
+
+static void write_byte(uint8_t value)
+{
+  uint8_t reg = sim.pointer++;
+
+  switch (reg)
+  {
+  case REG_MODE_CONF:
+    if (value & MODE_RESET)
+    {
+      power_on();
+      return;
+    }
+    break;
+  case REG_FIFO_WR_PTR:
+  case REG_OVERFLOW_CTR:
+  case REG_FIFO_RD_PTR:
+    sim.regs[reg] = value & 0x1F;
+    sim.unread = (sim.regs[REG_FIFO_WR_PTR] - sim.regs[REG_FIFO_RD_PTR]) & 0x1F;
+    sim.byte = 0;
+    return;
+  case REG_INT_STATUS_1:
+  case REG_FIFO_DATA:
+  case REG_REV_ID:
+  case REG_PART_ID:
+    return; // read only
+  }
+  sim.regs[reg] = value;
+}
+
+static void bus_write(void *ctx, const uint8_t *data, uint8_t len)
+{
+  if (len == 0)
+    return;
+  sim.pointer = data[0];
+  for (uint8_t i = 1; i < len; i++)
+    write_byte(data[i]);
+}
+
+static void bus_read(void *ctx, uint8_t *data, uint8_t len)
+{
+  for (uint8_t i = 0; i < len; i++)
+    data[i] = read_byte();
+}
+
+static const twi_sim_dev_t device = {
+    .address = MAX30102_SIM_ADDR,
+    .write = bus_write,
+    .read = bus_read,
+};
+
+void max30102_sim_attach(void)
+{
+  power_on();
+  twi_sim_attach(&device);
+}
+
+void max30102_sim_sample(uint32_t red, uint32_t ir)
+{
+  uint8_t *slot;
+
+  if (sim.regs[REG_MODE_CONF] & MODE_SHDN)
+    return;
+  if (sim.unread == FIFO_DEPTH)
+  {
+    if (sim.regs[REG_OVERFLOW_CTR] < 0x1F)
+      sim.regs[REG_OVERFLOW_CTR]++;
+    return;
+  }
+  slot = sim.fifo[sim.regs[REG_FIFO_WR_PTR]];
+  slot[0] = (red >> 16) & 0x03;
+  slot[1] = red >> 8;
+  slot[2] = red;
+  slot[3] = (ir >> 16) & 0x03;
+  slot[4] = ir >> 8;
+  slot[5] = ir;
+  sim.regs[REG_FIFO_WR_PTR] = (sim.regs[REG_FIFO_WR_PTR] + 1) & 0x1F;
+  sim.unread++;
+  if (sim.unread >= FIFO_DEPTH - (sim.regs[REG_FIFO_CONF] & 0x0F))
+    sim.regs[REG_INT_STATUS_1] |= INT_A_FULL;
+}
+
+uint8_t max30102_sim_unread(void)
+{
+  return sim.unread;
+}
+
+bool max30102_sim_int(void)
+{
+  return sim.regs[REG_INT_STATUS_1] & sim.regs[REG_INT_ENABLE_1] & INT_A_FULL;
+}
+
+bool max30102_sim_shutdown(void)
+{
+  return sim.regs[REG_MODE_CONF] & MODE_SHDN;
+}
+
+uint8_t max30102_sim_reg(uint8_t reg)
+{
+  return sim.regs[reg];
+}
@@ -0,0 +1,25 @@
+#ifndef MAX30102_SIM_H_
+#define MAX30102_SIM_H_
+#include <stdbool.h>
+#include <stdint.h>
+
+// Register and FIFO model of the MAX30102 on the simulated TWI bus, as far as
+// max30102.c uses it: the 32-sample FIFO with its write, read and overflow
+// pointers, FIFO_DATA popping one byte per read, the almost-full interrupt
+// and its INT pin, shutdown and reset. SpO2 mode only, red then IR.
+
+#define MAX30102_SIM_ADDR 0x57
+#define MAX30102_SIM_PART_ID 0x15
+
+void max30102_sim_attach(void); // power-on state, answering on the bus
+
+// One sample taken by the sensor, as it lands in the FIFO. Ignored in
+// shutdown. With the FIFO full the sample is lost and OVF_COUNTER counts it.
+void max30102_sim_sample(uint32_t red, uint32_t ir);
+
+uint8_t max30102_sim_unread(void); // samples in the FIFO
+bool max30102_sim_int(void);       // INT pin asserted (active low on the wire)
+bool max30102_sim_shutdown(void);
+uint8_t max30102_sim_reg(uint8_t reg); // register value, without read side effects
+
+#endif /* MAX30102_SIM_H_ */
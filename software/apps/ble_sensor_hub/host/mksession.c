@@ -0,0 +1,64 @@
+// Writes the synthetic session data/session.csv is generated from:
+//
+//   mksession > data/session.csv
+//
+// 90 s at the PPG rate: no finger for the first 5 s, 72 bpm with some RR
+// spread, then 95 bpm from 50 s on. Flex breathes at 15 per minute, GSR
+// drifts with a few skin responses, EMG rests with two bursts. The RTC
+// starts 12 s before its 24-bit wrap so every consumer sees it wrap.
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include "synth.h"
+
+#define SESSION_RATE_HZ 25
+#define SESSION_SECONDS 90
+#define SESSION_TICKS_START 500.0 // s, the RTC wraps at 512 s
+
+int main(void)
+{
+  synth_ppg_t ppg = {
+      .rate_hz = SESSION_RATE_HZ,
+      .bpm = 72,
+      .rr_jitter = 0.03f,
+      .ir_dc = 90000,
+      .ir_ac = 150,
+      .red_dc = 70000,
+      .red_ac = 90,
+      .noise = 3,
+      .seed = 149,
+  };
+  uint32_t seed = 2041;
+
+  synth_ppg_begin(&ppg);
+  printf("ticks,red,ir,gsr,flex,emg1,emg2\n");
+  for (int i = 0; i < SESSION_SECONDS * SESSION_RATE_HZ; i++)
+  {
+    double t = (double)i / SESSION_RATE_HZ;
+    uint32_t red, ir;
+    double beat_t;
+
+    if (t >= 50.0)
+      ppg.bpm = 95;
+    synth_ppg_next(&ppg, &red, &ir, &beat_t);
+    if (t < 5.0)
+    {
+      red /= 4;
+      ir /= 4;
+    }
+
+    // Skin responses: a fast rise and slow decay every 20 s
+    double since = fmod(t, 20.0) - 8.0;
+    double response = since > 0 ? 300.0 * (1.0 - exp(-since / 0.5)) * exp(-since / 4.0) : 0.0;
+    uint16_t gsr = synth_adc(t, 1500 + 5 * t + response, 0, 0, 2, &seed);
+    uint16_t flex = synth_adc(t, 2100, 180, 15 / 60.0, 4, &seed);
+    bool burst = (t >= 30.0 && t < 33.0) || (t >= 70.0 && t < 72.0);
+    uint16_t emg1 = synth_adc(t, 2048, 0, 0, burst ? 300 : 8, &seed);
+    uint16_t emg2 = synth_adc(t, 2048, 0, 0, 8, &seed);
+
+    printf("%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%u,%u,%u,%u\n", synth_ticks(SESSION_TICKS_START + t), red, ir, gsr,
+           flex, emg1, emg2);
+  }
+  return 0;
+}
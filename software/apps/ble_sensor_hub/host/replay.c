@@ -0,0 +1,324 @@
+// Replays a recorded or synthetic session through the beat detector, the heart
+// rate averaging, the SpO2 estimator and the peak detector, the same way the
+// firmware feeds them.
+//
+//   replay [-s] [-n burst] [-r rate] session.csv
+//
+// The input is CSV with a header naming its columns. ticks, red and ir are
+// required, gsr, flex, emg1 and emg2 are used when present and other columns
+// are ignored, so a session downloaded with OpenTracker.py -d replays as is.
+// There is one row per PPG sample, ticks are 24-bit RTC ticks at acquisition.
+// With a flags column only the rows flagged TELEMETRY_FLAG_PPG are samples,
+// the others set the ADC channels of the samples that follow.
+//
+// Detected beats, heart rate, SpO2 readings and peaks go to stdout, which is what the golden
+// files in data/ hold. Timing per stage goes to stderr.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "algorithm.h"
+#include "frame.h"
+#include "harness.h"
+#include "hr.h"
+#include "pd.h"
+#include "spo2.h"
+
+#define REPLAY_BURST 24         // PPG samples per FIFO drain, the firmware watermark
+#define REPLAY_RATE_HZ 25       // PPG sample rate
+#define REPLAY_FINGER_MIN 50000 // IR level below which beats are ignored
+#define REPLAY_PD_LAG 30        // peak detector window, threshold and influence
+#define REPLAY_PD_THRESHOLD 1.2f
+#define REPLAY_PD_INFLUENCE 0.9f
+#define REPLAY_LINE 512
+
+enum
+{
+  COL_TICKS,
+  COL_RED,
+  COL_IR,
+  COL_GSR,
+  COL_FLEX,
+  COL_EMG1,
+  COL_EMG2,
+  COL_COUNT
+};
+#define COL_ADC COL_GSR // ADC channels run through the peak detector, in this order
+#define ADC_COUNT (COL_COUNT - COL_ADC)
+
+static const char *const col_names[COL_COUNT] = {"ticks", "red", "ir", "gsr", "flex", "emg1", "emg2"};
+
+typedef struct
+{
+  uint32_t v[COL_COUNT];
+} row_t;
+
+PD_CTX_DEF(adc_pd, ADC_COUNT, REPLAY_PD_LAG);
+
+static row_t *rows;
+static size_t row_count;
+static int col_index[COL_COUNT];
+static int flags_index;
+
+static void usage(void)
+{
+  fprintf(stderr, "usage: replay [-s] [-n burst] [-r rate] session.csv\n"
+                  "  -s  per-sample checkForBeat() instead of the block path\n"
+                  "  -n  PPG samples per block call, 1..%d (default %d)\n"
+                  "  -r  PPG sample rate in Hz (default %d)\n",
+          BEAT_BLOCK_SIZE, REPLAY_BURST, REPLAY_RATE_HZ);
+  exit(2);
+}
+
+// Maps header names to columns, -1 for the ones the file lacks
+static void parse_header(char *line)
+{
+  int col = 0;
+
+  for (int c = 0; c < COL_COUNT; c++)
+    col_index[c] = -1;
+  flags_index = -1;
+  for (char *tok = strtok(line, ",\r\n"); tok; tok = strtok(NULL, ",\r\n"), col++)
+  {
+    for (int c = 0; c < COL_COUNT; c++)
+      if (strcmp(tok, col_names[c]) == 0)
+        col_index[c] = col;
+    if (strcmp(tok, "flags") == 0)
+      flags_index = col;
+  }
+  for (int c = COL_TICKS; c <= COL_IR; c++)
+    if (col_index[c] < 0)
+    {
+      fprintf(stderr, "replay: no %s column\n", col_names[c]);
+      exit(1);
+    }
+}
+
+static void load(const char *path)
+{
+  char line[REPLAY_LINE];
+  size_t cap = 0;
+  uint32_t adc[ADC_COUNT] = {0}; // newest ADC row's channels
+  FILE *f = fopen(path, "r");
+
+  if (!f)
+  {
+    perror(path);
+    exit(1);
+  }
+  if (!fgets(line, sizeof(line), f))
+  {
+    fprintf(stderr, "replay: %s is empty\n", path);
+    exit(1);
+  }
+  parse_header(line);
+  while (fgets(line, sizeof(line), f))
+  {
+    long fields[64];
+    int n = 0;
+
+    for (char *tok = strtok(line, ",\r\n"); tok && n < 64; tok = strtok(NULL, ",\r\n"))
+      fields[n++] = strtol(tok, NULL, 0);
+    if (n == 0)
+      continue;
+    if (flags_index >= 0 && flags_index < n && !(fields[flags_index] & TELEMETRY_FLAG_PPG))
+    {
+      for (int c = COL_ADC; c < COL_COUNT; c++)
+        if (col_index[c] >= 0 && col_index[c] < n)
+          adc[c - COL_ADC] = fields[col_index[c]];
+      continue;
+    }
+    if (row_count == cap)
+    {
+      cap = cap ? 2 * cap : 4096;
+      rows = realloc(rows, cap * sizeof(*rows));
+      if (!rows)
+      {
+        perror("replay");
+        exit(1);
+      }
+    }
+    for (int c = 0; c < COL_COUNT; c++)
+      rows[row_count].v[c] = (col_index[c] >= 0 && col_index[c] < n) ? (uint32_t)fields[col_index[c]] : 0;
+    if (flags_index >= 0)
+      for (int c = COL_ADC; c < COL_COUNT; c++)
+        rows[row_count].v[c] = adc[c - COL_ADC];
+    row_count++;
+  }
+  fclose(f);
+}
+
+int main(int argc, char **argv)
+{
+  bool per_sample = false;
+  int burst = REPLAY_BURST;
+  int rate = REPLAY_RATE_HZ;
+  const char *path = NULL;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-s") == 0)
+      per_sample = true;
+    else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+      burst = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+      rate = atoi(argv[++i]);
+    else if (argv[i][0] != '-' && !path)
+      path = argv[i];
+    else
+      usage();
+  }
+  if (!path || burst < 1 || burst > BEAT_BLOCK_SIZE || rate < 1)
+    usage();
+  load(path);
+
+  // Beats, stamped the way hr_update() does: back by the filter delay and the
+  // interpolated crossing, in sample periods of Q8 ticks
+  uint32_t period_q8 = ((uint32_t)HR_TICK_HZ << 8) / rate;
+  uint32_t *beat_ticks = malloc((row_count + 1) * sizeof(*beat_ticks));
+  size_t *beat_idx = malloc((row_count + 1) * sizeof(*beat_idx)); // sample each beat was reported at
+  size_t beat_count = 0;
+  uint64_t start = harness_ns();
+
+  if (per_sample)
+  {
+    for (size_t i = 0; i < row_count; i++)
+      if (checkForBeat(rows[i].v[COL_IR]) && rows[i].v[COL_IR] > REPLAY_FINGER_MIN)
+      {
+        beat_idx[beat_count] = i;
+        beat_ticks[beat_count++] = (rows[i].v[COL_TICKS] - ((BEAT_FIR_DELAY * period_q8) >> 8)) & HR_TICK_MASK;
+      }
+  }
+  else
+  {
+    int32_t ir[BEAT_BLOCK_SIZE];
+    beat_t beats[BEAT_BLOCK_SIZE];
+
+    for (size_t base = 0; base < row_count; base += burst)
+    {
+      uint16_t n = row_count - base < (size_t)burst ? row_count - base : (size_t)burst;
+      for (uint16_t i = 0; i < n; i++)
+        ir[i] = rows[base + i].v[COL_IR];
+      uint16_t found = checkForBeat_block(ir, n, beats);
+      for (uint16_t b = 0; b < found; b++)
+      {
+        const row_t *row = &rows[base + beats[b].idx];
+        uint32_t lag = ((BEAT_FIR_DELAY << 8) + beats[b].lag_q8) * period_q8 >> 16;
+        if (row->v[COL_IR] > REPLAY_FINGER_MIN)
+        {
+          beat_idx[beat_count] = base + beats[b].idx;
+          beat_ticks[beat_count++] = (row->v[COL_TICKS] - lag) & HR_TICK_MASK;
+        }
+      }
+    }
+  }
+  uint64_t beat_ns = harness_ns() - start;
+
+  hr_ctx_t hr;
+  hr_begin(&hr);
+  start = harness_ns();
+  for (size_t i = 0; i < beat_count; i++)
+    hr_add_beat(&hr, beat_ticks[i]);
+  uint64_t hr_ns = harness_ns() - start;
+
+  // SpO2 windows from beat to beat as hr_update() closes them, restarted
+  // whenever the finger is off. Timed on its own, then again for the output.
+  spo2_ctx_t spo2;
+  start = harness_ns();
+  spo2_begin(&spo2);
+  for (size_t i = 0, b = 0; i < row_count; i++)
+  {
+    if (rows[i].v[COL_IR] <= REPLAY_FINGER_MIN)
+    {
+      spo2_begin(&spo2);
+      continue;
+    }
+    spo2_add(&spo2, rows[i].v[COL_RED], rows[i].v[COL_IR]);
+    if (b < beat_count && beat_idx[b] == i)
+    {
+      spo2_beat(&spo2);
+      b++;
+    }
+  }
+  uint64_t spo2_ns = harness_ns() - start;
+
+  // Timed on its own, then again for the output
+  float adc[ADC_COUNT];
+  pd_begin(&adc_pd, REPLAY_PD_THRESHOLD, REPLAY_PD_INFLUENCE);
+  start = harness_ns();
+  for (size_t i = 0; i < row_count; i++)
+  {
+    for (int c = 0; c < ADC_COUNT; c++)
+      adc[c] = rows[i].v[COL_ADC + c];
+    pd_add(&adc_pd, adc);
+  }
+  uint64_t pd_ns = harness_ns() - start;
+
+  hr_begin(&hr);
+  for (size_t i = 0; i < beat_count; i++)
+  {
+    bool avg = hr_add_beat(&hr, beat_ticks[i]);
+    printf("beat %" PRIu32 " bpm %u", beat_ticks[i], hr.bpm);
+    if (avg)
+      printf(" hr %u", hr_bpm(&hr));
+    printf("\n");
+  }
+
+  uint32_t readings = 0;
+  spo2_begin(&spo2);
+  for (size_t i = 0, b = 0; i < row_count; i++)
+  {
+    if (rows[i].v[COL_IR] <= REPLAY_FINGER_MIN)
+    {
+      spo2_begin(&spo2);
+      continue;
+    }
+    spo2_add(&spo2, rows[i].v[COL_RED], rows[i].v[COL_IR]);
+    if (b < beat_count && beat_idx[b] == i)
+    {
+      if (spo2_beat(&spo2))
+      {
+        printf("spo2 %" PRIu32 " %u\n", rows[i].v[COL_TICKS], spo2_value(&spo2));
+        readings++;
+      }
+      b++;
+    }
+  }
+
+  uint32_t peaks[ADC_COUNT] = {0};
+  int prev[ADC_COUNT] = {0};
+  pd_begin(&adc_pd, REPLAY_PD_THRESHOLD, REPLAY_PD_INFLUENCE);
+  for (size_t i = 0; i < row_count; i++)
+  {
+    for (int c = 0; c < ADC_COUNT; c++)
+      adc[c] = rows[i].v[COL_ADC + c];
+    pd_add(&adc_pd, adc);
+    for (int c = 0; c < ADC_COUNT; c++)
+    {
+      int peak = pd_peak(&adc_pd, c);
+      if (col_index[COL_ADC + c] >= 0 && peak && peak != prev[c])
+      {
+        printf("peak %s %" PRIu32 " %+d\n", col_names[COL_ADC + c], rows[i].v[COL_TICKS], peak);
+        peaks[c]++;
+      }
+      prev[c] = peak;
+    }
+  }
+
+  printf("samples %zu beats %zu hr %u spo2 %u readings %" PRIu32 " peaks", row_count, beat_count, hr_bpm(&hr),
+         spo2_value(&spo2), readings);
+  for (int c = 0; c < ADC_COUNT; c++)
+    printf(" %s %" PRIu32, col_names[COL_ADC + c], peaks[c]);
+  printf("\n");
+
+  fprintf(stderr, "%s: %.1f ns/sample\n", per_sample ? "checkForBeat" : "checkForBeat_block",
+          row_count ? (double)beat_ns / row_count : 0.0);
+  fprintf(stderr, "hr_add_beat: %.1f ns/beat\n", beat_count ? (double)hr_ns / beat_count : 0.0);
+  fprintf(stderr, "spo2_add, spo2_beat: %.1f ns/sample\n", row_count ? (double)spo2_ns / row_count : 0.0);
+  fprintf(stderr, "pd_add: %.1f ns/sample (%d channels)\n", row_count ? (double)pd_ns / row_count : 0.0, ADC_COUNT);
+  free(beat_idx);
+  free(beat_ticks);
+  free(rows);
+  return 0;
+}
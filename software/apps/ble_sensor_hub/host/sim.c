@@ -0,0 +1,316 @@
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sim.h"
+#include "simple_ble.h"
+
+#define SIM_HANDLERS 32
+#define SIM_CLOCKS 4
+#define SIM_HOOKS 4
+#define SIM_LINE 1024
+
+typedef struct
+{
+  uint64_t t;
+  uint64_t seq; // scheduling order, breaks ties
+  sim_handler_t *h;
+  sim_fn_t fn;
+  void *ctx;
+  uint32_t arg;
+} event_t;
+
+static sim_config_t config;
+static uint64_t now;
+static uint64_t seq;
+static event_t *heap; // binary min-heap on (t, seq)
+static size_t heap_count;
+static size_t heap_cap;
+static sim_handler_t handlers[SIM_HANDLERS];
+static int handler_count;
+static const sim_clock_t *clocks[SIM_CLOCKS];
+static sim_handler_t *clock_handlers[SIM_CLOCKS];
+static int clock_count;
+static void (*hooks[SIM_HOOKS])(void);
+static int hook_count;
+static bool woke;
+static sim_handler_t *main_loop;
+static uint64_t main_start; // host time the main loop last resumed
+static bool line_start = true;
+
+static uint64_t host_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static bool before(const event_t *a, const event_t *b)
+{
+  return a->t < b->t || (a->t == b->t && a->seq < b->seq);
+}
+
+static void push(const event_t *e)
+{
+  size_t i = heap_count++;
+
+  if (heap_count > heap_cap)
+  {
+    heap_cap = heap_cap ? 2 * heap_cap : 64;
+    heap = realloc(heap, heap_cap * sizeof(*heap));
+    if (!heap)
+    {
+      perror("sim");
+      exit(1);
+    }
+  }
+  while (i && before(e, &heap[(i - 1) / 2]))
+  {
+    heap[i] = heap[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  heap[i] = *e;
+}
+
+static event_t pop(void)
+{
+  event_t top = heap[0];
+  event_t last = heap[--heap_count];
+  size_t i = 0;
+
+  for (;;)
+  {
+    size_t c = 2 * i + 1;
+    if (c >= heap_count)
+      break;
+    if (c + 1 < heap_count && before(&heap[c + 1], &heap[c]))
+      c++;
+    if (!before(&heap[c], &last))
+      break;
+    heap[i] = heap[c];
+    i = c;
+  }
+  heap[i] = last;
+  return top;
+}
+
+void sim_begin(const sim_config_t *c)
+{
+  config = *c;
+  main_loop = sim_handler("main", false);
+  main_start = host_ns();
+}
+
+uint64_t sim_now(void)
+{
+  return now;
+}
+
+sim_handler_t *sim_handler(const char *name, bool irq)
+{
+  for (int i = 0; i < handler_count; i++)
+    if (strcmp(handlers[i].name, name) == 0)
+      return &handlers[i];
+  if (handler_count == SIM_HANDLERS)
+  {
+    fprintf(stderr, "sim: more than %d handlers\n", SIM_HANDLERS);
+    exit(1);
+  }
+  handlers[handler_count] = (sim_handler_t){.name = name, .irq = irq};
+  return &handlers[handler_count++];
+}
+
+void sim_at(uint64_t t, sim_handler_t *h, sim_fn_t fn, void *ctx, uint32_t arg)
+{
+  event_t e = {.t = t < now ? now : t, .seq = seq++, .h = h, .fn = fn, .ctx = ctx, .arg = arg};
+
+  push(&e);
+}
+
+void sim_wake(void)
+{
+  woke = true;
+}
+
+void sim_on_event(void (*hook)(void))
+{
+  if (hook_count < SIM_HOOKS)
+    hooks[hook_count++] = hook;
+}
+
+void sim_add_clock(const sim_clock_t *clock)
+{
+  if (clock_count < SIM_CLOCKS)
+  {
+    clock_handlers[clock_count] = sim_handler(clock->name, true);
+    clocks[clock_count++] = clock;
+  }
+}
+
+// Books one run of h that was due at t and took host ns of host time
+static void account(sim_handler_t *h, uint64_t t, uint64_t host)
+{
+  uint64_t late = now - t;
+
+  h->calls++;
+  h->late_ns += late;
+  if (late > h->late_max_ns)
+    h->late_max_ns = late;
+  h->host_ns += host;
+  if (host > h->host_max_ns)
+    h->host_max_ns = host;
+  if (config.trace)
+    fprintf(config.trace, "%" PRIu64 ",%s,%" PRIu64 ",%" PRIu64 "\n", now, h->name, late, host);
+  now += (uint64_t)(host * config.cpu_scale);
+  for (int i = 0; i < hook_count; i++)
+    hooks[i]();
+}
+
+// Runs the earliest event, a clock's completion before a queued event due at
+// the same time. False once the next one is due at end or later.
+static bool step(uint64_t end)
+{
+  uint64_t t = heap_count ? heap[0].t : UINT64_MAX;
+  int c = -1;
+  sim_handler_t *h;
+  uint64_t start;
+
+  for (int i = 0; i < clock_count; i++)
+  {
+    uint64_t next = clocks[i]->next();
+    if (next < t || (next == t && c < 0))
+    {
+      t = next;
+      c = i;
+    }
+  }
+  if (t >= end)
+    return false;
+  if (t > now)
+    now = t;
+  // Idle clocks follow along, so what is started next starts now
+  for (int i = 0; i < clock_count; i++)
+    if (i != c && clocks[i]->next() > now && clocks[i]->now() < now)
+      clocks[i]->advance(now);
+
+  start = host_ns();
+  if (c >= 0)
+  {
+    h = clock_handlers[c];
+    clocks[c]->advance(t);
+  }
+  else
+  {
+    event_t e = pop();
+    h = e.h;
+    if (!e.fn(e.ctx, e.arg))
+      return true;
+  }
+  if (h->irq)
+    woke = true;
+  account(h, t, host_ns() - start);
+  return true;
+}
+
+// sd_app_evt_wait(): everything up to the next interrupt happens in here
+void power_manage(void)
+{
+  account(main_loop, now, host_ns() - main_start);
+  for (int i = 0; i < clock_count; i++)
+    if (clocks[i]->now() > now)
+      now = clocks[i]->now();
+  woke = false;
+  while (!woke)
+    if (!step(config.end_ns))
+    {
+      now = config.end_ns;
+      sim_finish(NULL);
+    }
+  main_start = host_ns();
+}
+
+void sim_run(uint64_t t)
+{
+  while (step(t))
+    ;
+  if (now < t)
+    now = t;
+}
+
+void sim_finish(const char *why)
+{
+  uint64_t host_total = 0;
+
+  fflush(stdout);
+  printf("sim: %" PRIu64 ".%03" PRIu64 " s%s%s\n", now / 1000000000u, now / 1000000 % 1000, why ? ", " : "",
+         why ? why : "");
+  printf("%-16s %10s %10s %10s\n", "handler", "calls", "late us", "max us");
+  for (int i = 0; i < handler_count; i++)
+  {
+    const sim_handler_t *h = &handlers[i];
+    printf("%-16s %10" PRIu32 " %10.1f %10.1f\n", h->name, h->calls, h->calls ? h->late_ns / 1e3 / h->calls : 0.0,
+           h->late_max_ns / 1e3);
+    host_total += h->host_ns;
+  }
+  if (config.report)
+    config.report();
+
+  // Host time is the only thing that differs between runs, it goes apart
+  fprintf(stderr, "%-16s %10s %10s %10s %8s\n", "handler", "host ms", "mean ns", "max ns", "load %");
+  for (int i = 0; i < handler_count; i++)
+  {
+    const sim_handler_t *h = &handlers[i];
+    fprintf(stderr, "%-16s %10.3f %10.0f %10" PRIu64 " %8.4f\n", h->name, h->host_ns / 1e6,
+            h->calls ? (double)h->host_ns / h->calls : 0.0, h->host_max_ns, now ? 100.0 * h->host_ns / now : 0.0);
+  }
+  fprintf(stderr, "host %.3f ms for %.3f s simulated\n", host_total / 1e6, now / 1e9);
+  if (config.trace)
+    fclose(config.trace);
+  exit(0);
+}
+
+// Copies fmt without the l of %lu and friends, "%%" and "%ll" pass as they are
+static void strip_long(char *out, size_t size, const char *fmt)
+{
+  size_t n = 0;
+
+  for (const char *p = fmt; *p && n + 1 < size; p++)
+  {
+    out[n++] = *p;
+    if (*p != '%')
+      continue;
+    if (p[1] == '%')
+    {
+      out[n++] = *++p;
+      continue;
+    }
+    while (p[1] && strchr("-+ #0123456789.*", p[1]) && n + 1 < size)
+      out[n++] = *++p;
+    if (p[1] == 'l' && p[2] && strchr("diouxX", p[2]))
+      p++;
+  }
+  out[n] = '\0';
+}
+
+int sim_printf(const char *fmt, ...)
+{
+  char format[SIM_LINE];
+  char text[SIM_LINE];
+  va_list ap;
+  int len;
+
+  strip_long(format, sizeof(format), fmt);
+  va_start(ap, fmt);
+  len = vsnprintf(text, sizeof(text), format, ap);
+  va_end(ap);
+  for (const char *p = text; *p; p++)
+  {
+    if (line_start)
+      printf("%4" PRIu64 ".%03" PRIu64 " ", now / 1000000000u, now / 1000000 % 1000);
+    putchar(*p);
+    line_start = *p == '\n';
+  }
+  return len;
+}
@@ -0,0 +1,81 @@
+#ifndef SIM_H_
+#define SIM_H_
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Discrete-event simulator the whole firmware runs on. A virtual clock in
+// nanoseconds drives everything the firmware can observe: the RTC behind
+// app_timer and millis(), peripheral events and the BLE link. Events run in
+// time order, ties in the order they were scheduled, so a run is the same on
+// every machine.
+//
+// Events belong to named handlers, which count their calls, how late they ran
+// against their due time and the host time they took. Handlers flagged irq
+// stand for interrupts: running one of their events returns from
+// power_manage(), the main loop's sleep. Other events are hardware going on
+// by itself and only wake the main loop through sim_wake().
+//
+// With a cpu scale k > 0 every handler and main loop pass also moves the clock
+// by k times the host time it took, so slow code delays what comes after it
+// the way it would on target. The default 0 keeps runs deterministic.
+
+// An event that finds it has nothing to do any more, a timeout of a timer
+// stopped since, returns false and is neither counted nor wakes anything
+typedef bool (*sim_fn_t)(void *ctx, uint32_t arg);
+
+typedef struct
+{
+  const char *name;
+  bool irq;
+  uint32_t calls;
+  uint64_t late_ns; // virtual time between due and run, summed
+  uint64_t late_max_ns;
+  uint64_t host_ns; // host time spent in the handler
+  uint64_t host_max_ns;
+} sim_handler_t;
+
+typedef struct
+{
+  uint64_t end_ns;   // the run stops at this virtual time
+  double cpu_scale;  // virtual ns charged per host ns of firmware code
+  FILE *trace;       // one CSV row per event when set
+  void (*report)(void); // prints the scenario's results at the end
+} sim_config_t;
+
+void sim_begin(const sim_config_t *config);
+uint64_t sim_now(void);
+sim_handler_t *sim_handler(const char *name, bool irq); // found by name or added
+
+// Runs fn(ctx, arg) as an event of h at t, now if t is in the past
+void sim_at(uint64_t t, sim_handler_t *h, sim_fn_t fn, void *ctx, uint32_t arg);
+void sim_wake(void); // the running event delivered something to the main loop
+void sim_on_event(void (*hook)(void)); // runs after every event and main loop pass
+
+// A model with a clock of its own, like twi_sim.h and flash_sim.h: its
+// completions run as events of an irq handler of that name, and the clock
+// follows the simulator's. A blocking call that moved it ahead moves the
+// simulator along when the main loop next sleeps.
+typedef struct
+{
+  const char *name;
+  uint64_t (*now)(void);
+  uint64_t (*next)(void);          // next completion, UINT64_MAX when idle
+  uint32_t (*advance)(uint64_t t); // completes what ends by t, moves the clock to t
+} sim_clock_t;
+
+void sim_add_clock(const sim_clock_t *clock);
+
+// Runs everything due before t and leaves the clock at t, for test programs
+// that drive the simulator themselves rather than through power_manage()
+void sim_run(uint64_t t);
+
+// Ends the run: prints the reports and exits
+void sim_finish(const char *why);
+
+// printf of the firmware, compiled in by sim_retarget.h. Lines get the
+// virtual time in front, and the l length modifier is dropped since uint32_t
+// is unsigned long on target but not here.
+int sim_printf(const char *fmt, ...);
+
+#endif /* SIM_H_ */
@@ -0,0 +1,320 @@
+#include <stdlib.h>
+#include <string.h>
+#include "nrf_sdh_ble.h"
+#include "sim.h"
+#include "sim_ble.h"
+#include "simple_ble.h"
+
+#define SIM_BLE_CHARS 16
+#define SIM_BLE_QUEUE_MAX 8
+#define SIM_BLE_WRITES 32
+#define SIM_BLE_WRITE_MAX 20 // bytes of a write without a long write procedure
+#define SIM_BLE_FIRST_HANDLE 0x000C // the GAP and GATT services come first
+
+typedef struct
+{
+  simple_ble_char_t *c;
+  uint8_t *buf;
+  uint16_t len;
+  bool notify;
+  bool subscribed;
+} attr_t;
+
+typedef struct
+{
+  uint16_t uuid16;
+  uint16_t len;
+  uint8_t data[NRF_SDH_BLE_GATT_MAX_MTU_SIZE];
+} notification_t;
+
+typedef struct
+{
+  uint16_t uuid16;
+  uint16_t len;
+  uint8_t data[SIM_BLE_WRITE_MAX];
+} write_t;
+
+// The observers' section, empty when nothing registers one
+extern const nrf_sdh_ble_evt_observer_t __start_sdh_ble_observers[] __attribute__((weak));
+extern const nrf_sdh_ble_evt_observer_t __stop_sdh_ble_observers[] __attribute__((weak));
+
+static simple_ble_app_t app = {.conn_handle = BLE_CONN_HANDLE_INVALID};
+static attr_t attrs[SIM_BLE_CHARS];
+static uint8_t attr_count;
+static uint16_t next_handle = SIM_BLE_FIRST_HANDLE;
+static notification_t queue[SIM_BLE_QUEUE_MAX];
+static uint8_t queued;
+static uint8_t queue_size = 1;
+static uint64_t interval = 30000000;
+static uint16_t mtu = BLE_GATT_ATT_MTU_DEFAULT;
+static bool mtu_exchanged;
+static uint32_t connection; // connection events of an earlier link find it changed
+static write_t writes[SIM_BLE_WRITES];
+static uint8_t write_count;
+static void (*central_rx)(uint16_t uuid16, const uint8_t *data, uint16_t len);
+static sim_handler_t *radio;
+static sim_handler_t *link;
+static sim_ble_stats_t stats;
+
+static attr_t *find_handle(uint16_t handle)
+{
+  for (uint8_t i = 0; i < attr_count; i++)
+    if (attrs[i].c->char_handle.value_handle == handle)
+      return &attrs[i];
+  return NULL;
+}
+
+static attr_t *find_uuid(uint16_t uuid16)
+{
+  for (uint8_t i = 0; i < attr_count; i++)
+    if (attrs[i].c->uuid16 == uuid16)
+      return &attrs[i];
+  return NULL;
+}
+
+// The application's callbacks come first, as simple_ble's own observer would
+// pass them on, then every other observer
+static void dispatch(const ble_evt_t *evt)
+{
+  switch (evt->header.evt_id)
+  {
+  case BLE_GAP_EVT_CONNECTED:
+    ble_evt_connected(evt);
+    break;
+
+  case BLE_GAP_EVT_DISCONNECTED:
+    ble_evt_disconnected(evt);
+    break;
+
+  case BLE_GATTS_EVT_WRITE:
+    ble_evt_write(evt);
+    break;
+
+  default:
+    break;
+  }
+  for (const nrf_sdh_ble_evt_observer_t *obs = __start_sdh_ble_observers; obs < __stop_sdh_ble_observers; obs++)
+    obs->handler(evt, obs->p_context);
+}
+
+static bool connection_event(void *ctx, uint32_t id)
+{
+  ble_evt_t evt = {.evt.gatts_evt.conn_handle = app.conn_handle};
+
+  if (id != connection)
+    return false; // the link is gone
+  stats.events++;
+  sim_at(sim_now() + interval, radio, connection_event, NULL, id);
+  if (!mtu_exchanged)
+  {
+    mtu_exchanged = true;
+    mtu = NRF_SDH_BLE_GATT_MAX_MTU_SIZE;
+    evt.header.evt_id = BLE_GATTS_EVT_EXCHANGE_MTU_REQUEST;
+    evt.evt.gatts_evt.params.exchange_mtu_request.client_rx_mtu = mtu;
+    dispatch(&evt);
+    sim_wake();
+  }
+  if (!queued)
+    return true;
+  for (uint8_t i = 0; i < queued; i++)
+  {
+    stats.sent++;
+    stats.bytes += queue[i].len;
+    if (central_rx)
+      central_rx(queue[i].uuid16, queue[i].data, queue[i].len);
+  }
+  evt.header.evt_id = BLE_GATTS_EVT_HVN_TX_COMPLETE;
+  evt.evt.gatts_evt.params.hvn_tx_complete.count = queued;
+  queued = 0;
+  dispatch(&evt);
+  sim_wake();
+  return true;
+}
+
+static bool link_connect(void *ctx, uint32_t arg)
+{
+  ble_evt_t evt = {.header.evt_id = BLE_GAP_EVT_CONNECTED};
+
+  if (app.conn_handle != BLE_CONN_HANDLE_INVALID)
+    return false;
+  app.conn_handle = 0;
+  evt.evt.gap_evt.conn_handle = app.conn_handle;
+  mtu = BLE_GATT_ATT_MTU_DEFAULT;
+  mtu_exchanged = false;
+  queued = 0;
+  for (uint8_t i = 0; i < attr_count; i++)
+    attrs[i].subscribed = attrs[i].notify;
+  sim_at(sim_now() + interval, radio, connection_event, NULL, ++connection);
+  dispatch(&evt);
+  return true;
+}
+
+static bool link_disconnect(void *ctx, uint32_t arg)
+{
+  ble_evt_t evt = {.header.evt_id = BLE_GAP_EVT_DISCONNECTED};
+
+  if (app.conn_handle == BLE_CONN_HANDLE_INVALID)
+    return false;
+  evt.evt.gap_evt.conn_handle = app.conn_handle;
+  evt.evt.gap_evt.params.disconnected.reason = 0x13; // remote user terminated
+  app.conn_handle = BLE_CONN_HANDLE_INVALID;
+  connection++;
+  queued = 0;
+  for (uint8_t i = 0; i < attr_count; i++)
+    attrs[i].subscribed = false;
+  dispatch(&evt);
+  return true;
+}
+
+static bool link_write(void *ctx, uint32_t idx)
+{
+  const write_t *w = &writes[idx];
+  attr_t *attr = find_uuid(w->uuid16);
+  union
+  {
+    ble_evt_t evt;
+    uint8_t raw[sizeof(ble_evt_t) + SIM_BLE_WRITE_MAX];
+  } u;
+  ble_gatts_evt_write_t *p = &u.evt.evt.gatts_evt.params.write;
+
+  if (app.conn_handle == BLE_CONN_HANDLE_INVALID || !attr)
+    return false;
+  memcpy(attr->buf, w->data, w->len < attr->len ? w->len : attr->len);
+  memset(&u, 0, sizeof(u));
+  u.evt.header.evt_id = BLE_GATTS_EVT_WRITE;
+  u.evt.evt.gatts_evt.conn_handle = app.conn_handle;
+  p->handle = attr->c->char_handle.value_handle;
+  p->len = w->len;
+  memcpy(p->data, w->data, w->len);
+  dispatch(&u.evt);
+  return true;
+}
+
+void sim_ble_begin(uint64_t interval_ns, uint8_t size)
+{
+  interval = interval_ns;
+  queue_size = size < 1 ? 1 : size > SIM_BLE_QUEUE_MAX ? SIM_BLE_QUEUE_MAX : size;
+  radio = sim_handler("radio", false);
+  link = sim_handler("ble", true);
+}
+
+void sim_ble_central(void (*rx)(uint16_t uuid16, const uint8_t *data, uint16_t len))
+{
+  central_rx = rx;
+}
+
+void sim_ble_connect_at(uint64_t t)
+{
+  sim_at(t, link, link_connect, NULL, 0);
+}
+
+void sim_ble_disconnect_at(uint64_t t)
+{
+  sim_at(t, link, link_disconnect, NULL, 0);
+}
+
+void sim_ble_write_at(uint64_t t, uint16_t uuid16, const uint8_t *data, uint16_t len)
+{
+  if (write_count == SIM_BLE_WRITES || len > SIM_BLE_WRITE_MAX)
+  {
+    fprintf(stderr, "sim_ble: more than %d writes or %d bytes\n", SIM_BLE_WRITES, SIM_BLE_WRITE_MAX);
+    exit(1);
+  }
+  writes[write_count] = (write_t){.uuid16 = uuid16, .len = len};
+  memcpy(writes[write_count].data, data, len);
+  sim_at(t, link, link_write, NULL, write_count++);
+}
+
+const uint8_t *sim_ble_value(uint16_t uuid16, uint16_t *len)
+{
+  attr_t *attr = find_uuid(uuid16);
+
+  if (!attr)
+    return NULL;
+  *len = attr->len;
+  return attr->buf;
+}
+
+sim_ble_stats_t *sim_ble_stats(void)
+{
+  return &stats;
+}
+
+/*******************************************************************************
+ *   SoftDevice and simple_ble
+ ******************************************************************************/
+uint32_t sd_ble_gatts_hvx(uint16_t conn_handle, ble_gatts_hvx_params_t const *p_hvx_params)
+{
+  attr_t *attr = find_handle(p_hvx_params->handle);
+  notification_t *n = &queue[queued];
+  uint16_t len;
+
+  if (conn_handle == BLE_CONN_HANDLE_INVALID || conn_handle != app.conn_handle)
+    return BLE_ERROR_INVALID_CONN_HANDLE;
+  if (!attr)
+    return NRF_ERROR_NOT_FOUND;
+  if (!attr->subscribed)
+    return NRF_ERROR_INVALID_STATE;
+  if (queued == queue_size)
+  {
+    stats.refused++;
+    return NRF_ERROR_RESOURCES;
+  }
+  len = p_hvx_params->p_len ? *p_hvx_params->p_len : attr->len;
+  if (len > mtu - 3)
+    len = mtu - 3;
+  n->uuid16 = attr->c->uuid16;
+  n->len = len;
+  memcpy(n->data, p_hvx_params->p_data ? p_hvx_params->p_data : attr->buf, len);
+  if (p_hvx_params->p_data && p_hvx_params->p_data != attr->buf)
+    memcpy(attr->buf, p_hvx_params->p_data, len < attr->len ? len : attr->len);
+  if (p_hvx_params->p_len)
+    *p_hvx_params->p_len = len;
+  queued++;
+  return NRF_SUCCESS;
+}
+
+simple_ble_app_t *simple_ble_init(const simple_ble_config_t *conf)
+{
+  return &app;
+}
+
+void simple_ble_add_service(simple_ble_service_t *service)
+{
+  service->service_handle = next_handle++;
+}
+
+// Declaration, value and, with notify, the CCCD
+void simple_ble_add_characteristic(uint8_t read, uint8_t write, uint8_t notify, uint8_t vlen, uint16_t len,
+                                   uint8_t *buf, simple_ble_service_t *service, simple_ble_char_t *char_handle)
+{
+  if (attr_count == SIM_BLE_CHARS)
+  {
+    fprintf(stderr, "sim_ble: more than %d characteristics\n", SIM_BLE_CHARS);
+    exit(1);
+  }
+  char_handle->char_handle.value_handle = next_handle + 1;
+  char_handle->char_handle.cccd_handle = notify ? next_handle + 2 : 0;
+  next_handle += notify ? 3 : 2;
+  attrs[attr_count++] = (attr_t){.c = char_handle, .buf = buf, .len = len, .notify = notify};
+}
+
+bool simple_ble_is_char_event(ble_evt_t const *p_ble_evt, simple_ble_char_t *char_handle)
+{
+  return p_ble_evt->header.evt_id == BLE_GATTS_EVT_WRITE &&
+         p_ble_evt->evt.gatts_evt.params.write.handle == char_handle->char_handle.value_handle;
+}
+
+uint32_t simple_ble_notify_char(simple_ble_char_t *char_handle)
+{
+  ble_gatts_hvx_params_t hvx_params = {
+      .handle = char_handle->char_handle.value_handle,
+      .type = BLE_GATT_HVX_NOTIFICATION,
+  };
+
+  return sd_ble_gatts_hvx(app.conn_handle, &hvx_params);
+}
+
+void simple_ble_adv_only_name(void)
+{
+}
@@ -0,0 +1,33 @@
+#ifndef SIM_BLE_H_
+#define SIM_BLE_H_
+#include <stdint.h>
+
+// SoftDevice and a scripted central for the simulator (sim.h), behind the
+// simple_ble calls, sd_ble_gatts_hvx() and the nrf_sdh_ble observers.
+//
+// The central connects, subscribes to every notify characteristic and asks
+// for the largest MTU at the first connection event. Notifications wait in a
+// TX queue of the given size, NRF_ERROR_RESOURCES when it is full, and every
+// connection event hands them all to the central and raises HVN_TX_COMPLETE.
+// Connection events are "radio" events, what the central does on its own
+// (connect, write, disconnect) are "ble" interrupts.
+
+typedef struct
+{
+  uint32_t events;  // connection events
+  uint32_t sent;    // notifications delivered to the central
+  uint32_t bytes;   // of their payload
+  uint32_t refused; // notifications turned away with the TX queue full
+} sim_ble_stats_t;
+
+// interval_ns: connection interval, queue: TX buffers for notifications
+void sim_ble_begin(uint64_t interval_ns, uint8_t queue);
+// Receives every notification the central gets, by characteristic
+void sim_ble_central(void (*rx)(uint16_t uuid16, const uint8_t *data, uint16_t len));
+void sim_ble_connect_at(uint64_t t);
+void sim_ble_disconnect_at(uint64_t t);
+void sim_ble_write_at(uint64_t t, uint16_t uuid16, const uint8_t *data, uint16_t len);
+const uint8_t *sim_ble_value(uint16_t uuid16, uint16_t *len); // attribute value, NULL if there is none
+sim_ble_stats_t *sim_ble_stats(void);
+
+#endif /* SIM_BLE_H_ */
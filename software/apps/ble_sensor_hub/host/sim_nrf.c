@@ -0,0 +1,498 @@
+#include <math.h>
+#include <stddef.h>
+#include "app_timer.h"
+#include "nrf.h"
+#include "nrf_drv_gpiote.h"
+#include "nrf_drv_ppi.h"
+#include "nrf_drv_timer.h"
+#include "nrf_gpio.h"
+#include "sim.h"
+#include "sim_nrf.h"
+
+#define TIMER_INSTANCES 5
+#define TIMER_FREQ_HZ 16000000
+#define TIMER_EVENT_ADDR(_instance, _cc) (0x40008000u + 0x1000u * (_instance) + NRF_TIMER_EVENT_COMPARE0 + 4 * (_cc))
+#define SAADC_CHANNELS 8
+#define SAADC_TASK_SAMPLE_ADDR 0x40007004u
+#define SIM_PINS 4
+
+/*******************************************************************************
+ *   RTC1 and app_timer
+ ******************************************************************************/
+static uint64_t rtc_offset; // counter at virtual time 0, not wrapped
+static bool timers_ready;
+
+// Counter at t, not wrapped
+static uint64_t rtc_ticks(uint64_t t)
+{
+  return rtc_offset + t * APP_TIMER_CLOCK_FREQ / 1000000000u;
+}
+
+// First virtual time the counter reads ticks
+static uint64_t rtc_time(uint64_t ticks)
+{
+  return ((ticks - rtc_offset) * 1000000000u + APP_TIMER_CLOCK_FREQ - 1) / APP_TIMER_CLOCK_FREQ;
+}
+
+uint32_t sim_nrf_ticks(uint64_t t_ns)
+{
+  return rtc_ticks(t_ns) & APP_TIMER_MAX_CNT_VAL;
+}
+
+ret_code_t app_timer_init(void)
+{
+  timers_ready = true;
+  return NRF_SUCCESS;
+}
+
+ret_code_t app_timer_create(app_timer_id_t const *p_timer_id, app_timer_mode_t mode,
+                            app_timer_timeout_handler_t timeout_handler)
+{
+  app_timer_t *timer = *p_timer_id;
+
+  if (!timeout_handler)
+    return NRF_ERROR_INVALID_PARAM;
+  if (timer->active)
+    return NRF_ERROR_INVALID_STATE;
+  timer->handler = timeout_handler;
+  timer->mode = mode;
+  timer->sim = sim_handler(timer->name, true);
+  return NRF_SUCCESS;
+}
+
+static bool timer_timeout(void *ctx, uint32_t generation)
+{
+  app_timer_t *timer = ctx;
+
+  if (!timer->active || generation != timer->generation)
+    return false; // stopped or restarted since
+  if (timer->mode == APP_TIMER_MODE_REPEATED)
+  {
+    timer->due += timer->period;
+    sim_at(rtc_time(timer->due), timer->sim, timer_timeout, timer, generation);
+  }
+  else
+    timer->active = false;
+  timer->handler(timer->p_context);
+  return true;
+}
+
+// Like the SDK, starting a running timer is ignored
+ret_code_t app_timer_start(app_timer_id_t timer_id, uint32_t timeout_ticks, void *p_context)
+{
+  if (!timers_ready || !timer_id->handler)
+    return NRF_ERROR_INVALID_STATE;
+  if (timeout_ticks < APP_TIMER_MIN_TIMEOUT_TICKS || timeout_ticks > APP_TIMER_MAX_CNT_VAL)
+    return NRF_ERROR_INVALID_PARAM;
+  if (timer_id->active)
+    return NRF_SUCCESS;
+  timer_id->active = true;
+  timer_id->generation++;
+  timer_id->period = timer_id->mode == APP_TIMER_MODE_REPEATED ? timeout_ticks : 0;
+  timer_id->p_context = p_context;
+  timer_id->due = rtc_ticks(sim_now()) + timeout_ticks;
+  sim_at(rtc_time(timer_id->due), timer_id->sim, timer_timeout, timer_id, timer_id->generation);
+  return NRF_SUCCESS;
+}
+
+ret_code_t app_timer_stop(app_timer_id_t timer_id)
+{
+  timer_id->active = false;
+  timer_id->generation++;
+  return NRF_SUCCESS;
+}
+
+uint32_t app_timer_cnt_get(void)
+{
+  return sim_nrf_ticks(sim_now());
+}
+
+uint32_t app_timer_cnt_diff_compute(uint32_t ticks_to, uint32_t ticks_from)
+{
+  return (ticks_to - ticks_from) & APP_TIMER_MAX_CNT_VAL;
+}
+
+/*******************************************************************************
+ *   TIMER, PPI and SAADC
+ ******************************************************************************/
+static struct
+{
+  bool enabled;
+  nrf_timer_frequency_t frequency;
+  uint32_t cc[NRF_TIMER_CC_CHANNEL_COUNT];
+} timers[TIMER_INSTANCES];
+
+static struct
+{
+  bool allocated;
+  bool enabled;
+  uint32_t eep;
+  uint32_t tep;
+} ppi[PPI_CH_NUM];
+static bool ppi_ready;
+
+static struct
+{
+  sim_analog_t analog;
+  nrfx_saadc_event_handler_t handler;
+  nrf_saadc_input_t pin[SAADC_CHANNELS]; // NRF_SAADC_INPUT_DISABLED for channels not in the scan
+  nrf_saadc_value_t *buf[2];             // buf[0] is being filled, buf[1] is queued behind it
+  uint16_t size[2];
+  uint8_t queued;
+  uint16_t pos;        // values in buf[0]
+  bool scanning;       // SAMPLE is being triggered
+  uint64_t period;     // between SAMPLE tasks
+  uint64_t next_scan;
+  uint32_t generation; // of the event that finds buf[0] full
+  sim_handler_t *dma;
+  sim_handler_t *done;
+  sim_saadc_stats_t stats;
+} saadc;
+
+static bool saadc_done(void *ctx, uint32_t size);
+
+// Converts the scans due by t into the buffers, a full buffer is handed to
+// the DONE interrupt as of the scan that filled it
+static void saadc_catch_up(uint64_t t)
+{
+  while (saadc.scanning && saadc.next_scan <= t)
+  {
+    saadc.stats.scans++;
+    if (!saadc.queued)
+      saadc.stats.lost++;
+    for (uint8_t c = 0; saadc.queued && c < SAADC_CHANNELS; c++)
+    {
+      if (saadc.pin[c] == NRF_SAADC_INPUT_DISABLED)
+        continue;
+      saadc.buf[0][saadc.pos++] = saadc.analog(saadc.pin[c], saadc.next_scan);
+      if (saadc.pos < saadc.size[0])
+        continue;
+      // END: EasyDMA moves on to the queued buffer by itself
+      sim_at(saadc.next_scan, saadc.done, saadc_done, saadc.buf[0], saadc.size[0]);
+      saadc.buf[0] = saadc.buf[1];
+      saadc.size[0] = saadc.size[1];
+      saadc.queued--;
+      saadc.pos = 0;
+    }
+    saadc.next_scan += saadc.period;
+  }
+}
+
+static bool saadc_dma(void *ctx, uint32_t generation);
+
+// Plans the event at the scan that fills buf[0]
+static void saadc_project(void)
+{
+  uint8_t channels = 0;
+
+  saadc.generation++;
+  for (uint8_t c = 0; c < SAADC_CHANNELS; c++)
+    channels += saadc.pin[c] != NRF_SAADC_INPUT_DISABLED;
+  if (!saadc.scanning || !saadc.queued || !channels)
+    return;
+  uint32_t scans = (saadc.size[0] - saadc.pos + channels - 1) / channels;
+  sim_at(saadc.next_scan + (scans - 1) * saadc.period, saadc.dma, saadc_dma, NULL, saadc.generation);
+}
+
+static bool saadc_dma(void *ctx, uint32_t generation)
+{
+  if (generation != saadc.generation)
+    return false;
+  saadc_catch_up(sim_now());
+  saadc_project();
+  return true;
+}
+
+static bool saadc_done(void *ctx, uint32_t size)
+{
+  nrfx_saadc_evt_t evt = {.type = NRFX_SAADC_EVT_DONE, .data.done = {.p_buffer = ctx, .size = size}};
+
+  saadc.stats.buffers++;
+  saadc.handler(&evt);
+  return true;
+}
+
+// Scanning runs while some enabled timer's compare event reaches SAMPLE over
+// an enabled PPI channel
+static void saadc_update(void)
+{
+  uint64_t period = 0;
+
+  for (uint8_t ch = 0; ch < PPI_CH_NUM; ch++)
+  {
+    if (!ppi[ch].enabled || ppi[ch].tep != SAADC_TASK_SAMPLE_ADDR)
+      continue;
+    for (uint8_t i = 0; i < TIMER_INSTANCES; i++)
+      for (uint8_t cc = 0; timers[i].enabled && cc < NRF_TIMER_CC_CHANNEL_COUNT; cc++)
+        if (ppi[ch].eep == TIMER_EVENT_ADDR(i, cc) && timers[i].cc[cc])
+          period = (uint64_t)timers[i].cc[cc] * (1000000000u >> 4) / (TIMER_FREQ_HZ >> 4 >> timers[i].frequency);
+  }
+  if (period && !saadc.scanning)
+  {
+    // The timer starts from zero, the first compare is a period away
+    saadc.scanning = true;
+    saadc.period = period;
+    saadc.next_scan = sim_now() + period;
+    saadc_project();
+  }
+  else if (!period && saadc.scanning)
+  {
+    saadc_catch_up(sim_now());
+    saadc.scanning = false;
+    saadc_project();
+  }
+}
+
+ret_code_t nrf_drv_timer_init(nrf_drv_timer_t const *p_instance, nrf_drv_timer_config_t const *p_config,
+                              nrfx_timer_event_handler_t timer_event_handler)
+{
+  if (p_instance->instance_id >= TIMER_INSTANCES)
+    return NRF_ERROR_INVALID_PARAM;
+  timers[p_instance->instance_id].frequency = p_config->frequency;
+  return NRF_SUCCESS;
+}
+
+uint32_t nrf_drv_timer_us_to_ticks(nrf_drv_timer_t const *p_instance, uint32_t time_us)
+{
+  return (uint32_t)((uint64_t)time_us * (TIMER_FREQ_HZ / 1000000) >> timers[p_instance->instance_id].frequency);
+}
+
+void nrf_drv_timer_extended_compare(nrf_drv_timer_t const *p_instance, nrf_timer_cc_channel_t cc_channel,
+                                    uint32_t cc_value, nrf_timer_short_mask_t timer_short_mask, bool enable_int)
+{
+  timers[p_instance->instance_id].cc[cc_channel] = cc_value;
+}
+
+uint32_t nrf_drv_timer_compare_event_address_get(nrf_drv_timer_t const *p_instance, uint32_t channel)
+{
+  return TIMER_EVENT_ADDR(p_instance->instance_id, channel);
+}
+
+void nrf_drv_timer_enable(nrf_drv_timer_t const *p_instance)
+{
+  timers[p_instance->instance_id].enabled = true;
+  saadc_update();
+}
+
+void nrf_drv_timer_disable(nrf_drv_timer_t const *p_instance)
+{
+  timers[p_instance->instance_id].enabled = false;
+  saadc_update();
+}
+
+ret_code_t nrf_drv_ppi_init(void)
+{
+  if (ppi_ready)
+    return NRF_ERROR_MODULE_ALREADY_INITIALIZED;
+  ppi_ready = true;
+  return NRF_SUCCESS;
+}
+
+ret_code_t nrf_drv_ppi_channel_alloc(nrf_ppi_channel_t *p_channel)
+{
+  for (uint8_t ch = 0; ch < PPI_CH_NUM; ch++)
+    if (!ppi[ch].allocated)
+    {
+      ppi[ch].allocated = true;
+      *p_channel = (nrf_ppi_channel_t)ch;
+      return NRF_SUCCESS;
+    }
+  return NRF_ERROR_NO_MEM;
+}
+
+ret_code_t nrf_drv_ppi_channel_assign(nrf_ppi_channel_t channel, uint32_t eep, uint32_t tep)
+{
+  if (channel >= PPI_CH_NUM || !ppi[channel].allocated)
+    return NRF_ERROR_INVALID_STATE;
+  ppi[channel].eep = eep;
+  ppi[channel].tep = tep;
+  saadc_update();
+  return NRF_SUCCESS;
+}
+
+ret_code_t nrf_drv_ppi_channel_enable(nrf_ppi_channel_t channel)
+{
+  if (channel >= PPI_CH_NUM || !ppi[channel].allocated)
+    return NRF_ERROR_INVALID_STATE;
+  ppi[channel].enabled = true;
+  saadc_update();
+  return NRF_SUCCESS;
+}
+
+ret_code_t nrf_drv_ppi_channel_disable(nrf_ppi_channel_t channel)
+{
+  if (channel >= PPI_CH_NUM || !ppi[channel].allocated)
+    return NRF_ERROR_INVALID_STATE;
+  ppi[channel].enabled = false;
+  saadc_update();
+  return NRF_SUCCESS;
+}
+
+nrfx_err_t nrfx_saadc_init(nrfx_saadc_config_t const *p_config, nrfx_saadc_event_handler_t event_handler)
+{
+  if (saadc.handler)
+    return NRF_ERROR_INVALID_STATE;
+  saadc.handler = event_handler;
+  saadc.dma = sim_handler("saadc_dma", false);
+  saadc.done = sim_handler("saadc", true);
+  return NRF_SUCCESS;
+}
+
+nrfx_err_t nrfx_saadc_channel_init(uint8_t channel, nrf_saadc_channel_config_t const *p_config)
+{
+  if (channel >= SAADC_CHANNELS)
+    return NRF_ERROR_INVALID_PARAM;
+  saadc.pin[channel] = p_config->pin_p;
+  return NRF_SUCCESS;
+}
+
+nrfx_err_t nrfx_saadc_buffer_convert(nrf_saadc_value_t *p_buffer, uint16_t size)
+{
+  if (saadc.queued == 2)
+    return NRF_ERROR_BUSY;
+  saadc_catch_up(sim_now()); // scans so far went to the buffer before or were lost
+  saadc.buf[saadc.queued] = p_buffer;
+  saadc.size[saadc.queued] = size;
+  if (saadc.queued++ == 0)
+    saadc.pos = 0;
+  saadc_project();
+  return NRF_SUCCESS;
+}
+
+uint32_t nrfx_saadc_sample_task_get(void)
+{
+  return SAADC_TASK_SAMPLE_ADDR;
+}
+
+const sim_saadc_stats_t *sim_nrf_saadc_stats(void)
+{
+  saadc_catch_up(sim_now());
+  return &saadc.stats;
+}
+
+/*******************************************************************************
+ *   GPIO and GPIOTE
+ ******************************************************************************/
+static struct
+{
+  uint32_t pin;
+  bool (*level)(void);
+} sources[SIM_PINS];
+
+static struct
+{
+  uint32_t pin;
+  nrf_gpiote_polarity_t sense;
+  nrf_drv_gpiote_evt_handler_t handler;
+  bool enabled;
+  bool level; // as of the last check
+} inputs[SIM_PINS];
+
+static bool gpiote_ready;
+static sim_handler_t *gpiote;
+
+void sim_nrf_pin(uint32_t pin, bool (*level)(void))
+{
+  for (int i = 0; i < SIM_PINS; i++)
+    if (!sources[i].level || sources[i].pin == pin)
+    {
+      sources[i].pin = pin;
+      sources[i].level = level;
+      return;
+    }
+}
+
+void nrf_gpio_cfg_output(uint32_t pin_number)
+{
+}
+
+uint32_t nrf_gpio_pin_read(uint32_t pin_number)
+{
+  for (int i = 0; i < SIM_PINS; i++)
+    if (sources[i].level && sources[i].pin == pin_number)
+      return sources[i].level();
+  return 1;
+}
+
+static bool gpiote_event(void *ctx, uint32_t action)
+{
+  typeof(inputs[0]) *in = ctx;
+
+  in->handler(in->pin, (nrf_gpiote_polarity_t)action);
+  return true;
+}
+
+// Edge detection on the enabled inputs, after every event
+static void gpiote_check(void)
+{
+  for (int i = 0; i < SIM_PINS; i++)
+  {
+    if (!inputs[i].enabled)
+      continue;
+    bool level = nrf_gpio_pin_read(inputs[i].pin);
+    nrf_gpiote_polarity_t edge = level ? NRF_GPIOTE_POLARITY_LOTOHI : NRF_GPIOTE_POLARITY_HITOLO;
+    if (level != inputs[i].level && (inputs[i].sense == edge || inputs[i].sense == NRF_GPIOTE_POLARITY_TOGGLE))
+      sim_at(sim_now(), gpiote, gpiote_event, &inputs[i], edge);
+    inputs[i].level = level;
+  }
+}
+
+bool nrf_drv_gpiote_is_init(void)
+{
+  return gpiote_ready;
+}
+
+ret_code_t nrf_drv_gpiote_init(void)
+{
+  if (gpiote_ready)
+    return NRF_ERROR_INVALID_STATE;
+  gpiote_ready = true;
+  gpiote = sim_handler("gpiote", true);
+  sim_on_event(gpiote_check);
+  return NRF_SUCCESS;
+}
+
+ret_code_t nrf_drv_gpiote_in_init(nrf_drv_gpiote_pin_t pin, nrf_drv_gpiote_in_config_t const *p_config,
+                                  nrf_drv_gpiote_evt_handler_t evt_handler)
+{
+  for (int i = 0; i < SIM_PINS; i++)
+    if (!inputs[i].handler)
+    {
+      inputs[i].pin = pin;
+      inputs[i].sense = p_config->sense;
+      inputs[i].handler = evt_handler;
+      return NRF_SUCCESS;
+    }
+  return NRF_ERROR_NO_MEM;
+}
+
+void nrf_drv_gpiote_in_event_enable(nrf_drv_gpiote_pin_t pin, bool int_enable)
+{
+  for (int i = 0; i < SIM_PINS; i++)
+    if (inputs[i].handler && inputs[i].pin == pin)
+    {
+      inputs[i].enabled = int_enable;
+      inputs[i].level = nrf_gpio_pin_read(pin);
+    }
+}
+
+void nrf_drv_gpiote_in_event_disable(nrf_drv_gpiote_pin_t pin)
+{
+  for (int i = 0; i < SIM_PINS; i++)
+    if (inputs[i].handler && inputs[i].pin == pin)
+      inputs[i].enabled = false;
+}
+
+/*******************************************************************************
+ *   Setup
+ ******************************************************************************/
+void sim_nrf_begin(double rtc_start_s, sim_analog_t analog)
+{
+  rtc_offset = (uint64_t)llround(rtc_start_s * APP_TIMER_CLOCK_FREQ);
+  saadc.analog = analog;
+}
+
+void NVIC_SystemReset(void)
+{
+  sim_finish("system reset");
+}
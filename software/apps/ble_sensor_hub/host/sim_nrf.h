@@ -0,0 +1,35 @@
+#ifndef SIM_NRF_H_
+#define SIM_NRF_H_
+#include <stdbool.h>
+#include <stdint.h>
+#include "nrfx_saadc.h"
+
+// nRF52 peripherals of the simulator (sim.h) behind the SDK calls the
+// firmware makes:
+//   RTC1 and app_timer  the counter follows the virtual clock, timeouts are
+//                       events of a handler named after the timer
+//   TIMER, PPI, SAADC   a running timer whose compare event is routed to the
+//                       SAMPLE task scans every initialized channel, EasyDMA
+//                       fills the queued buffers and DONE is the "saadc"
+//                       interrupt. Scans without a buffer are lost.
+//   GPIO and GPIOTE     input levels come from device models, edges are
+//                       checked after every event and run as "gpiote"
+
+// Level of an analog input at a virtual time, in counts of the configured
+// resolution
+typedef uint16_t (*sim_analog_t)(nrf_saadc_input_t pin, uint64_t t_ns);
+
+typedef struct
+{
+  uint32_t scans;   // SAMPLE tasks
+  uint32_t lost;    // of them with no buffer to convert into
+  uint32_t buffers; // DONE events
+} sim_saadc_stats_t;
+
+// rtc_start_s: RTC counter at virtual time 0, in seconds of its 512 s range
+void sim_nrf_begin(double rtc_start_s, sim_analog_t analog);
+void sim_nrf_pin(uint32_t pin, bool (*level)(void)); // input driven by a device model
+uint32_t sim_nrf_ticks(uint64_t t_ns); // RTC counter at a virtual time
+const sim_saadc_stats_t *sim_nrf_saadc_stats(void);
+
+#endif /* SIM_NRF_H_ */
@@ -0,0 +1,11 @@
+#ifndef SIM_RETARGET_H_
+#define SIM_RETARGET_H_
+#include <stdio.h>
+#include "sim.h"
+
+// Forced ahead of main.c in the simulator build (see Makefile): the firmware's
+// log goes through sim_printf(), which stamps it with the virtual time
+
+#define printf sim_printf
+
+#endif /* SIM_RETARGET_H_ */
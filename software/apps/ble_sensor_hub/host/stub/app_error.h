@@ -0,0 +1,22 @@
+#ifndef APP_ERROR_H_
+#define APP_ERROR_H_
+#include <stdio.h>
+#include <stdlib.h>
+#include "sdk_errors.h"
+
+// On the board a failed check resets the chip, on a host it ends the program
+// with the failing call, which is what a test wants to see.
+#define APP_ERROR_CHECK(_err)                                                              \
+  do                                                                                       \
+  {                                                                                        \
+    ret_code_t _e = (_err);                                                                \
+    if (_e != NRF_SUCCESS)                                                                 \
+    {                                                                                      \
+      fprintf(stderr, "%s:%d: error 0x%04x from %s\n", __FILE__, __LINE__, (unsigned)_e, #_err); \
+      abort();                                                                             \
+    }                                                                                      \
+  } while (0)
+
+#define APP_ERROR_CHECK_BOOL(_cond) APP_ERROR_CHECK((_cond) ? NRF_SUCCESS : NRF_ERROR_INTERNAL)
+
+#endif /* APP_ERROR_H_ */
@@ -0,0 +1,56 @@
+#ifndef APP_TIMER_H_
+#define APP_TIMER_H_
+#include <stdbool.h>
+#include <stdint.h>
+#include "app_util.h"
+#include "sdk_errors.h"
+
+// Host stand-in for the RTC1 based app_timer library, same calls. sim_nrf.c
+// runs the RTC from the simulator's virtual clock: 24 bits at 32768 Hz, and
+// timeouts are events of the simulator named after their timer.
+
+#define APP_TIMER_CLOCK_FREQ 32768
+#define APP_TIMER_CONFIG_RTC_FREQUENCY 0
+#define APP_TIMER_MAX_CNT_VAL 0x00FFFFFF
+#define APP_TIMER_MIN_TIMEOUT_TICKS 5
+
+#define APP_TIMER_TICKS(_ms) \
+  ((uint32_t)ROUNDED_DIV((_ms) * (uint64_t)APP_TIMER_CLOCK_FREQ, 1000 * (APP_TIMER_CONFIG_RTC_FREQUENCY + 1)))
+
+typedef void (*app_timer_timeout_handler_t)(void *p_context);
+
+typedef enum
+{
+  APP_TIMER_MODE_SINGLE_SHOT,
+  APP_TIMER_MODE_REPEATED
+} app_timer_mode_t;
+
+// Opaque on target, laid out for sim_nrf.c here
+typedef struct
+{
+  const char *name;
+  app_timer_timeout_handler_t handler;
+  app_timer_mode_t mode;
+  bool active;
+  uint32_t period;     // ticks, 0 for a single shot
+  uint64_t due;        // ticks since the simulation started
+  uint32_t generation; // bumped on every start and stop, retires queued timeouts
+  void *p_context;
+  void *sim;           // the simulator's handler record
+} app_timer_t;
+
+typedef app_timer_t *app_timer_id_t;
+
+#define APP_TIMER_DEF(_timer_id)                                  \
+  static app_timer_t _timer_id##_data = {.name = #_timer_id};     \
+  static const app_timer_id_t _timer_id = &_timer_id##_data
+
+ret_code_t app_timer_init(void);
+ret_code_t app_timer_create(app_timer_id_t const *p_timer_id, app_timer_mode_t mode,
+                            app_timer_timeout_handler_t timeout_handler);
+ret_code_t app_timer_start(app_timer_id_t timer_id, uint32_t timeout_ticks, void *p_context);
+ret_code_t app_timer_stop(app_timer_id_t timer_id);
+uint32_t app_timer_cnt_get(void);
+uint32_t app_timer_cnt_diff_compute(uint32_t ticks_to, uint32_t ticks_from);
+
+#endif /* APP_TIMER_H_ */
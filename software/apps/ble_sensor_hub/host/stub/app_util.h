@@ -0,0 +1,15 @@
+#ifndef APP_UTIL_H_
+#define APP_UTIL_H_
+#include <stdint.h>
+
+// Host stand-in for the SDK utility macros the application uses
+
+#define UNIT_0_625_MS 625
+#define UNIT_1_25_MS 1250
+#define UNIT_10_MS 10000
+#define MSEC_TO_UNITS(_time, _resolution) (((_time) * 1000) / (_resolution))
+
+#define ROUNDED_DIV(_a, _b) (((_a) + ((_b) / 2)) / (_b))
+#define CEIL_DIV(_a, _b) ((((_a) - 1) / (_b)) + 1)
+
+#endif /* APP_UTIL_H_ */
@@ -0,0 +1,17 @@
+#ifndef APP_UTIL_PLATFORM_H_
+#define APP_UTIL_PLATFORM_H_
+#include "app_util.h"
+
+// Interrupts are events of the host simulator and never preempt each other,
+// so critical regions have nothing to mask
+
+#define APP_IRQ_PRIORITY_HIGHEST 0
+#define APP_IRQ_PRIORITY_HIGH 2
+#define APP_IRQ_PRIORITY_MID 4
+#define APP_IRQ_PRIORITY_LOW 6
+#define APP_IRQ_PRIORITY_LOWEST 7
+
+#define CRITICAL_REGION_ENTER() {
+#define CRITICAL_REGION_EXIT() }
+
+#endif /* APP_UTIL_PLATFORM_H_ */
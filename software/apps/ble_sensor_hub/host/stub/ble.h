@@ -0,0 +1,122 @@
+#ifndef BLE_H_
+#define BLE_H_
+#include <stdint.h>
+#include "sdk_errors.h"
+
+// Host stand-in for the s132 SoftDevice API, only the events and calls the
+// application handles. sim_ble.c plays the SoftDevice and a central.
+
+#define BLE_CONN_HANDLE_INVALID 0xFFFF
+#define BLE_GATT_ATT_MTU_DEFAULT 23
+#define BLE_GATT_HVX_NOTIFICATION 0x01
+#define BLE_GATT_HVX_INDICATION 0x02
+
+#define BLE_ERROR_INVALID_CONN_HANDLE 0x3002
+#define BLE_ERROR_GATTS_SYS_ATTR_MISSING 0x3401
+
+enum
+{
+  BLE_GAP_EVT_CONNECTED = 0x10,
+  BLE_GAP_EVT_DISCONNECTED = 0x11,
+  BLE_GATTC_EVT_EXCHANGE_MTU_RSP = 0x3A,
+  BLE_GATTS_EVT_WRITE = 0x50,
+  BLE_GATTS_EVT_EXCHANGE_MTU_REQUEST = 0x55,
+  BLE_GATTS_EVT_HVN_TX_COMPLETE = 0x57,
+};
+
+typedef struct
+{
+  uint16_t evt_id;
+  uint16_t evt_len;
+} ble_evt_hdr_t;
+
+typedef struct
+{
+  uint8_t reason;
+} ble_gap_evt_disconnected_t;
+
+typedef struct
+{
+  uint16_t conn_handle;
+  union
+  {
+    ble_gap_evt_disconnected_t disconnected;
+  } params;
+} ble_gap_evt_t;
+
+typedef struct
+{
+  uint16_t handle;
+  uint8_t op;
+  uint16_t offset;
+  uint16_t len;
+  uint8_t data[1]; // len bytes
+} ble_gatts_evt_write_t;
+
+typedef struct
+{
+  uint16_t client_rx_mtu;
+} ble_gatts_evt_exchange_mtu_request_t;
+
+typedef struct
+{
+  uint8_t count;
+} ble_gatts_evt_hvn_tx_complete_t;
+
+typedef struct
+{
+  uint16_t conn_handle;
+  union
+  {
+    ble_gatts_evt_write_t write;
+    ble_gatts_evt_exchange_mtu_request_t exchange_mtu_request;
+    ble_gatts_evt_hvn_tx_complete_t hvn_tx_complete;
+  } params;
+} ble_gatts_evt_t;
+
+typedef struct
+{
+  uint16_t server_rx_mtu;
+} ble_gattc_evt_exchange_mtu_rsp_t;
+
+typedef struct
+{
+  uint16_t conn_handle;
+  uint16_t gatt_status;
+  union
+  {
+    ble_gattc_evt_exchange_mtu_rsp_t exchange_mtu_rsp;
+  } params;
+} ble_gattc_evt_t;
+
+typedef struct
+{
+  ble_evt_hdr_t header;
+  union
+  {
+    ble_gap_evt_t gap_evt;
+    ble_gatts_evt_t gatts_evt;
+    ble_gattc_evt_t gattc_evt;
+  } evt;
+} ble_evt_t;
+
+typedef struct
+{
+  uint16_t handle;
+  uint8_t type;
+  uint16_t offset;
+  uint16_t *p_len; // in: bytes to send, out: bytes sent
+  uint8_t const *p_data;
+} ble_gatts_hvx_params_t;
+
+typedef struct
+{
+  uint16_t value_handle;
+  uint16_t user_desc_handle;
+  uint16_t cccd_handle;
+  uint16_t sccd_handle;
+} ble_gatts_char_handles_t;
+
+uint32_t sd_ble_gatts_hvx(uint16_t conn_handle, ble_gatts_hvx_params_t const *p_hvx_params);
+
+#endif /* BLE_H_ */
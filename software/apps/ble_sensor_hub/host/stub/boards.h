@@ -0,0 +1,5 @@
+#ifndef BOARDS_H_
+#define BOARDS_H_
+#include "nrf_gpio.h"
+
+#endif /* BOARDS_H_ */
@@ -0,0 +1,7 @@
+#ifndef DISPLAY_H_
+#define DISPLAY_H_
+
+// The board's display is not modelled, the application includes but never
+// calls it
+
+#endif /* DISPLAY_H_ */
@@ -0,0 +1,14 @@
+#ifndef NRF_H_
+#define NRF_H_
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "app_error.h"
+
+// Host stand-in for the device header: no registers, only what the
+// application sources use unconditionally.
+
+// Ends a simulation (sim_nrf.c), a test program never calls it
+void NVIC_SystemReset(void);
+
+#endif /* NRF_H_ */
@@ -0,0 +1,14 @@
+#ifndef NRF_DELAY_H_
+#define NRF_DELAY_H_
+#include <stdint.h>
+
+// Busy waits take no virtual time on the host
+static inline void nrf_delay_ms(uint32_t ms)
+{
+}
+
+static inline void nrf_delay_us(uint32_t us)
+{
+}
+
+#endif /* NRF_DELAY_H_ */
@@ -0,0 +1,50 @@
+#ifndef NRF_DRV_GPIOTE_H_
+#define NRF_DRV_GPIOTE_H_
+#include <stdbool.h>
+#include <stdint.h>
+#include "nrf_gpio.h"
+#include "sdk_errors.h"
+
+// Host stand-in for the GPIOTE driver. Input events are edges of the pin
+// levels sim_nrf.c reads from the device models, checked after every event of
+// the simulator.
+
+typedef uint32_t nrf_drv_gpiote_pin_t;
+
+typedef enum
+{
+  NRF_GPIOTE_POLARITY_LOTOHI = 1,
+  NRF_GPIOTE_POLARITY_HITOLO = 2,
+  NRF_GPIOTE_POLARITY_TOGGLE = 3
+} nrf_gpiote_polarity_t;
+
+typedef struct
+{
+  nrf_gpiote_polarity_t sense;
+  nrf_gpio_pin_pull_t pull;
+  bool is_watcher;
+  bool hi_accuracy;
+  bool skip_gpio_setup;
+} nrf_drv_gpiote_in_config_t;
+
+#define GPIOTE_CONFIG_IN_SENSE_HITOLO(_hi_accu)                                                   \
+  {                                                                                               \
+    .sense = NRF_GPIOTE_POLARITY_HITOLO, .pull = NRF_GPIO_PIN_NOPULL, .is_watcher = false,        \
+    .hi_accuracy = (_hi_accu), .skip_gpio_setup = false                                           \
+  }
+#define GPIOTE_CONFIG_IN_SENSE_LOTOHI(_hi_accu)                                                   \
+  {                                                                                               \
+    .sense = NRF_GPIOTE_POLARITY_LOTOHI, .pull = NRF_GPIO_PIN_NOPULL, .is_watcher = false,        \
+    .hi_accuracy = (_hi_accu), .skip_gpio_setup = false                                           \
+  }
+
+typedef void (*nrf_drv_gpiote_evt_handler_t)(nrf_drv_gpiote_pin_t pin, nrf_gpiote_polarity_t action);
+
+bool nrf_drv_gpiote_is_init(void);
+ret_code_t nrf_drv_gpiote_init(void);
+ret_code_t nrf_drv_gpiote_in_init(nrf_drv_gpiote_pin_t pin, nrf_drv_gpiote_in_config_t const *p_config,
+                                  nrf_drv_gpiote_evt_handler_t evt_handler);
+void nrf_drv_gpiote_in_event_enable(nrf_drv_gpiote_pin_t pin, bool int_enable);
+void nrf_drv_gpiote_in_event_disable(nrf_drv_gpiote_pin_t pin);
+
+#endif /* NRF_DRV_GPIOTE_H_ */
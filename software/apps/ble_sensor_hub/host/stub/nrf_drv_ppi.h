@@ -0,0 +1,22 @@
+#ifndef NRF_DRV_PPI_H_
+#define NRF_DRV_PPI_H_
+#include <stdint.h>
+#include "sdk_errors.h"
+
+// Host stand-in for the PPI driver. Channels connect event and task
+// addresses as on target, sim_nrf.c knows the ones the simulator models.
+
+#define PPI_CH_NUM 20
+
+typedef enum
+{
+  NRF_PPI_CHANNEL0 = 0,
+} nrf_ppi_channel_t;
+
+ret_code_t nrf_drv_ppi_init(void);
+ret_code_t nrf_drv_ppi_channel_alloc(nrf_ppi_channel_t *p_channel);
+ret_code_t nrf_drv_ppi_channel_assign(nrf_ppi_channel_t channel, uint32_t eep, uint32_t tep);
+ret_code_t nrf_drv_ppi_channel_enable(nrf_ppi_channel_t channel);
+ret_code_t nrf_drv_ppi_channel_disable(nrf_ppi_channel_t channel);
+
+#endif /* NRF_DRV_PPI_H_ */
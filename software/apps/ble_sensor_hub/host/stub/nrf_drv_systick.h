@@ -0,0 +1,6 @@
+#ifndef NRF_DRV_SYSTICK_H_
+#define NRF_DRV_SYSTICK_H_
+
+// Included by the application, nothing of it is used
+
+#endif /* NRF_DRV_SYSTICK_H_ */
@@ -0,0 +1,102 @@
+#ifndef NRF_DRV_TIMER_H_
+#define NRF_DRV_TIMER_H_
+#include <stdbool.h>
+#include <stdint.h>
+#include "sdk_errors.h"
+
+// Host stand-in for the TIMER driver. Only compare events routed over PPI do
+// anything: sim_nrf.c turns a running timer whose compare event triggers the
+// SAADC sample task into scans of the simulator.
+
+typedef enum
+{
+  NRF_TIMER_FREQ_16MHz = 0,
+  NRF_TIMER_FREQ_8MHz,
+  NRF_TIMER_FREQ_4MHz,
+  NRF_TIMER_FREQ_2MHz,
+  NRF_TIMER_FREQ_1MHz,
+  NRF_TIMER_FREQ_500kHz,
+  NRF_TIMER_FREQ_250kHz,
+  NRF_TIMER_FREQ_125kHz,
+  NRF_TIMER_FREQ_62500Hz,
+  NRF_TIMER_FREQ_31250Hz
+} nrf_timer_frequency_t;
+
+typedef enum
+{
+  NRF_TIMER_MODE_TIMER = 0,
+  NRF_TIMER_MODE_COUNTER
+} nrf_timer_mode_t;
+
+typedef enum
+{
+  NRF_TIMER_BIT_WIDTH_8 = 1,
+  NRF_TIMER_BIT_WIDTH_16 = 0,
+  NRF_TIMER_BIT_WIDTH_24 = 2,
+  NRF_TIMER_BIT_WIDTH_32 = 3
+} nrf_timer_bit_width_t;
+
+typedef enum
+{
+  NRF_TIMER_CC_CHANNEL0 = 0,
+  NRF_TIMER_CC_CHANNEL1,
+  NRF_TIMER_CC_CHANNEL2,
+  NRF_TIMER_CC_CHANNEL3
+} nrf_timer_cc_channel_t;
+
+#define NRF_TIMER_CC_CHANNEL_COUNT 4
+
+typedef enum
+{
+  NRF_TIMER_EVENT_COMPARE0 = 0x140,
+  NRF_TIMER_EVENT_COMPARE1 = 0x144,
+  NRF_TIMER_EVENT_COMPARE2 = 0x148,
+  NRF_TIMER_EVENT_COMPARE3 = 0x14C
+} nrf_timer_event_t;
+
+typedef enum
+{
+  NRF_TIMER_SHORT_COMPARE0_CLEAR_MASK = 0x001,
+  NRF_TIMER_SHORT_COMPARE1_CLEAR_MASK = 0x002,
+  NRF_TIMER_SHORT_COMPARE2_CLEAR_MASK = 0x004,
+  NRF_TIMER_SHORT_COMPARE3_CLEAR_MASK = 0x008,
+  NRF_TIMER_SHORT_COMPARE0_STOP_MASK = 0x100,
+} nrf_timer_short_mask_t;
+
+typedef struct
+{
+  uint8_t instance_id;
+} nrf_drv_timer_t;
+
+#define NRF_DRV_TIMER_INSTANCE(_id) \
+  {                                 \
+    .instance_id = (_id)            \
+  }
+
+typedef struct
+{
+  nrf_timer_frequency_t frequency;
+  nrf_timer_mode_t mode;
+  nrf_timer_bit_width_t bit_width;
+  uint8_t interrupt_priority;
+  void *p_context;
+} nrf_drv_timer_config_t;
+
+#define NRF_DRV_TIMER_DEFAULT_CONFIG                                          \
+  {                                                                           \
+    .frequency = NRF_TIMER_FREQ_16MHz, .mode = NRF_TIMER_MODE_TIMER,          \
+    .bit_width = NRF_TIMER_BIT_WIDTH_16, .interrupt_priority = 6, .p_context = NULL \
+  }
+
+typedef void (*nrfx_timer_event_handler_t)(nrf_timer_event_t event_type, void *p_context);
+
+ret_code_t nrf_drv_timer_init(nrf_drv_timer_t const *p_instance, nrf_drv_timer_config_t const *p_config,
+                              nrfx_timer_event_handler_t timer_event_handler);
+uint32_t nrf_drv_timer_us_to_ticks(nrf_drv_timer_t const *p_instance, uint32_t time_us);
+void nrf_drv_timer_extended_compare(nrf_drv_timer_t const *p_instance, nrf_timer_cc_channel_t cc_channel,
+                                    uint32_t cc_value, nrf_timer_short_mask_t timer_short_mask, bool enable_int);
+uint32_t nrf_drv_timer_compare_event_address_get(nrf_drv_timer_t const *p_instance, uint32_t channel);
+void nrf_drv_timer_enable(nrf_drv_timer_t const *p_instance);
+void nrf_drv_timer_disable(nrf_drv_timer_t const *p_instance);
+
+#endif /* NRF_DRV_TIMER_H_ */
@@ -0,0 +1,37 @@
+#ifndef NRF_DRV_TWI_H_
+#define NRF_DRV_TWI_H_
+#include <stdbool.h>
+#include <stdint.h>
+#include "app_error.h"
+#include "app_util_platform.h"
+#include "sdk_errors.h"
+
+// Host stand-in for the TWI driver, only its configuration type: transfers go
+// through nrf_twi_mngr to the device models attached with twi_sim.h.
+
+// Frequencies are plain bit rates here, on target they are register values
+#define NRF_TWIM_FREQ_100K 100000
+#define NRF_TWIM_FREQ_250K 250000
+#define NRF_TWIM_FREQ_400K 400000
+#define NRF_DRV_TWI_FREQ_100K NRF_TWIM_FREQ_100K
+#define NRF_DRV_TWI_FREQ_250K NRF_TWIM_FREQ_250K
+#define NRF_DRV_TWI_FREQ_400K NRF_TWIM_FREQ_400K
+
+typedef uint32_t nrf_drv_twi_frequency_t;
+
+typedef struct
+{
+  uint32_t scl;
+  uint32_t sda;
+  nrf_drv_twi_frequency_t frequency;
+  uint8_t interrupt_priority;
+  bool clear_bus_init;
+  bool hold_bus_uninit;
+} nrf_drv_twi_config_t;
+
+#define NRF_DRV_TWI_DEFAULT_CONFIG \
+  {                                \
+    .frequency = NRF_DRV_TWI_FREQ_100K, .interrupt_priority = 6, \
+  }
+
+#endif /* NRF_DRV_TWI_H_ */
@@ -0,0 +1,55 @@
+#ifndef NRF_FSTORAGE_H_
+#define NRF_FSTORAGE_H_
+#include <stdbool.h>
+#include <stdint.h>
+#include "sdk_errors.h"
+
+// Host stand-in for the fstorage library, same types and calls. flash_sim.c
+// implements them over a simulated flash: operations queue and complete in
+// order at the speed of the nRF52 NVMC, reads go straight to memory.
+
+typedef enum
+{
+  NRF_FSTORAGE_EVT_READ_RESULT,
+  NRF_FSTORAGE_EVT_WRITE_RESULT,
+  NRF_FSTORAGE_EVT_ERASE_RESULT
+} nrf_fstorage_evt_id_t;
+
+typedef struct
+{
+  nrf_fstorage_evt_id_t id;
+  ret_code_t result;
+  uint32_t addr;     // first address written, or the first page erased
+  void const *p_src; // data written
+  uint32_t len;      // bytes written, or pages erased
+  void *p_param;
+} nrf_fstorage_evt_t;
+
+typedef void (*nrf_fstorage_evt_handler_t)(nrf_fstorage_evt_t *p_evt);
+
+typedef struct
+{
+  uint32_t erase_unit;
+  uint32_t program_unit;
+} nrf_fstorage_info_t;
+
+typedef struct nrf_fstorage_api_s nrf_fstorage_api_t;
+
+typedef struct
+{
+  nrf_fstorage_api_t const *p_api;
+  nrf_fstorage_info_t const *p_flash_info;
+  nrf_fstorage_evt_handler_t evt_handler;
+  uint32_t start_addr;
+  uint32_t end_addr; // last byte
+} nrf_fstorage_t;
+
+#define NRF_FSTORAGE_DEF(_inst) _inst
+
+ret_code_t nrf_fstorage_init(nrf_fstorage_t *p_fs, nrf_fstorage_api_t const *p_api, void *p_param);
+ret_code_t nrf_fstorage_write(nrf_fstorage_t const *p_fs, uint32_t dest, void const *p_src, uint32_t len,
+                              void *p_param);
+ret_code_t nrf_fstorage_erase(nrf_fstorage_t const *p_fs, uint32_t page_addr, uint32_t len, void *p_param);
+bool nrf_fstorage_is_busy(nrf_fstorage_t const *p_fs);
+
+#endif /* NRF_FSTORAGE_H_ */
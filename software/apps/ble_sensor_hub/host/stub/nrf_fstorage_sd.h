@@ -0,0 +1,8 @@
+#ifndef NRF_FSTORAGE_SD_H_
+#define NRF_FSTORAGE_SD_H_
+#include "nrf_fstorage.h"
+
+// The SoftDevice backend, the only one flash_sim.c offers
+extern nrf_fstorage_api_t nrf_fstorage_sd;
+
+#endif /* NRF_FSTORAGE_SD_H_ */
@@ -0,0 +1,19 @@
+#ifndef NRF_GPIO_H_
+#define NRF_GPIO_H_
+#include <stdint.h>
+
+#define NRF_GPIO_PIN_MAP(_port, _pin) (((_port) << 5) | ((_pin) & 0x1F))
+
+typedef enum
+{
+  NRF_GPIO_PIN_NOPULL = 0,
+  NRF_GPIO_PIN_PULLDOWN = 1,
+  NRF_GPIO_PIN_PULLUP = 3,
+} nrf_gpio_pin_pull_t;
+
+// Pin levels come from the device models of the simulator (sim_nrf.c), an
+// unconnected input reads high
+void nrf_gpio_cfg_output(uint32_t pin_number);
+uint32_t nrf_gpio_pin_read(uint32_t pin_number);
+
+#endif /* NRF_GPIO_H_ */
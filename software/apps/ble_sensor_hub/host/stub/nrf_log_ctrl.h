@@ -0,0 +1,9 @@
+#ifndef NRF_LOG_CTRL_H_
+#define NRF_LOG_CTRL_H_
+#include "sdk_errors.h"
+
+#define NRF_LOG_INIT(_timestamp_func) NRF_SUCCESS
+#define NRF_LOG_FLUSH() ((void)0)
+#define NRF_LOG_PROCESS() false
+
+#endif /* NRF_LOG_CTRL_H_ */
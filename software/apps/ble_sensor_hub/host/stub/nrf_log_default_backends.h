@@ -0,0 +1,6 @@
+#ifndef NRF_LOG_DEFAULT_BACKENDS_H_
+#define NRF_LOG_DEFAULT_BACKENDS_H_
+
+#define NRF_LOG_DEFAULT_BACKENDS_INIT() ((void)0)
+
+#endif /* NRF_LOG_DEFAULT_BACKENDS_H_ */
@@ -0,0 +1,25 @@
+#ifndef NRF_SDH_BLE_H_
+#define NRF_SDH_BLE_H_
+#include "ble.h"
+
+// Host stand-in for the SoftDevice handler's BLE event dispatch. Observers are
+// collected in a linker section as on target, sim_ble.c passes every event to
+// each of them. Priorities are accepted and ignored.
+
+#define NRF_SDH_BLE_GATT_MAX_MTU_SIZE 247
+
+typedef void (*nrf_sdh_ble_evt_handler_t)(ble_evt_t const *p_ble_evt, void *p_context);
+
+typedef struct
+{
+  nrf_sdh_ble_evt_handler_t handler;
+  void *p_context;
+} nrf_sdh_ble_evt_observer_t;
+
+#define NRF_SDH_BLE_OBSERVER(_name, _prio, _handler, _context)                                  \
+  static nrf_sdh_ble_evt_observer_t const _name __attribute__((section("sdh_ble_observers"), used)) = { \
+      .handler = (_handler),                                                                    \
+      .p_context = (_context),                                                                  \
+  }
+
+#endif /* NRF_SDH_BLE_H_ */
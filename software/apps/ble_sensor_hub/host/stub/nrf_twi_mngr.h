@@ -0,0 +1,75 @@
+#ifndef NRF_TWI_MNGR_H_
+#define NRF_TWI_MNGR_H_
+#include <stdbool.h>
+#include <stdint.h>
+#include "nrf_drv_twi.h"
+#include "sdk_errors.h"
+
+// Host stand-in for the SDK TWI transaction manager, same types and calls.
+// twi_sim.c implements it against the device models attached with twi_sim.h.
+
+#define NRF_TWI_MNGR_NO_STOP 0x01
+
+#define NRF_TWI_MNGR_READ_OP(_address) (((_address) << 1) | 1)
+#define NRF_TWI_MNGR_WRITE_OP(_address) ((_address) << 1)
+#define NRF_TWI_MNGR_IS_READ_OP(_operation) ((_operation)&1)
+#define NRF_TWI_MNGR_OP_ADDRESS(_operation) ((_operation) >> 1)
+
+typedef void (*nrf_twi_mngr_callback_t)(ret_code_t result, void *p_user_data);
+
+typedef struct
+{
+  uint8_t *p_data;
+  uint8_t length;
+  uint8_t operation;
+  uint8_t flags;
+} nrf_twi_mngr_transfer_t;
+
+typedef struct
+{
+  nrf_twi_mngr_callback_t callback;
+  void *p_user_data;
+  nrf_twi_mngr_transfer_t const *p_transfers;
+  uint8_t number_of_transfers;
+  nrf_drv_twi_config_t const *p_required_twi_cfg;
+} nrf_twi_mngr_transaction_t;
+
+#define NRF_TWI_MNGR_TRANSFER(_operation, _p_data, _length, _flags) \
+  {                                                                 \
+    .p_data = (uint8_t *)(_p_data), .length = (_length), .operation = (_operation), .flags = (_flags) \
+  }
+#define NRF_TWI_MNGR_WRITE(_address, _p_data, _length, _flags) \
+  NRF_TWI_MNGR_TRANSFER(NRF_TWI_MNGR_WRITE_OP(_address), _p_data, _length, _flags)
+#define NRF_TWI_MNGR_READ(_address, _p_data, _length, _flags) \
+  NRF_TWI_MNGR_TRANSFER(NRF_TWI_MNGR_READ_OP(_address), _p_data, _length, _flags)
+
+// Queue and progress of one manager instance
+typedef struct
+{
+  nrf_twi_mngr_transaction_t const **queue;
+  uint8_t size;
+  uint8_t head;
+  uint8_t count;
+  bool initialized;
+  uint32_t frequency;
+} nrf_twi_mngr_cb_t;
+
+typedef struct
+{
+  nrf_twi_mngr_cb_t *p_cb;
+} nrf_twi_mngr_t;
+
+#define NRF_TWI_MNGR_DEF(_name, _queue_size, _twi_idx)                               \
+  static nrf_twi_mngr_transaction_t const *_name##_queue[(_queue_size)];             \
+  static nrf_twi_mngr_cb_t _name##_cb = {.queue = _name##_queue, .size = (_queue_size)}; \
+  static const nrf_twi_mngr_t _name = {.p_cb = &_name##_cb}
+
+ret_code_t nrf_twi_mngr_init(nrf_twi_mngr_t const *p_nrf_twi_mngr, nrf_drv_twi_config_t const *p_default_twi_config);
+ret_code_t nrf_twi_mngr_schedule(nrf_twi_mngr_t const *p_nrf_twi_mngr,
+                                 nrf_twi_mngr_transaction_t const *p_transaction);
+ret_code_t nrf_twi_mngr_perform(nrf_twi_mngr_t const *p_nrf_twi_mngr, nrf_drv_twi_config_t const *p_config,
+                                nrf_twi_mngr_transfer_t const *p_transfers, uint8_t number_of_transfers,
+                                void (*user_function)(void));
+bool nrf_twi_mngr_is_idle(nrf_twi_mngr_t const *p_nrf_twi_mngr);
+
+#endif /* NRF_TWI_MNGR_H_ */
@@ -0,0 +1,137 @@
+#ifndef NRFX_SAADC_H_
+#define NRFX_SAADC_H_
+#include <stdbool.h>
+#include <stdint.h>
+#include "sdk_errors.h"
+
+// Host stand-in for the SAADC driver in buffered mode. Every SAMPLE task
+// converts each initialized channel into the current buffer, EasyDMA moves on
+// to the queued one when it fills and the DONE event reports the full one.
+// sim_nrf.c produces the conversions from the simulator's analog sources,
+// keyed by the positive input of each channel.
+
+typedef int16_t nrf_saadc_value_t;
+typedef ret_code_t nrfx_err_t;
+
+typedef enum
+{
+  NRF_SAADC_RESOLUTION_8BIT = 0,
+  NRF_SAADC_RESOLUTION_10BIT,
+  NRF_SAADC_RESOLUTION_12BIT,
+  NRF_SAADC_RESOLUTION_14BIT
+} nrf_saadc_resolution_t;
+
+typedef enum
+{
+  NRF_SAADC_OVERSAMPLE_DISABLED = 0,
+} nrf_saadc_oversample_t;
+
+typedef enum
+{
+  NRF_SAADC_INPUT_DISABLED = 0,
+  NRF_SAADC_INPUT_AIN0,
+  NRF_SAADC_INPUT_AIN1,
+  NRF_SAADC_INPUT_AIN2,
+  NRF_SAADC_INPUT_AIN3,
+  NRF_SAADC_INPUT_AIN4,
+  NRF_SAADC_INPUT_AIN5,
+  NRF_SAADC_INPUT_AIN6,
+  NRF_SAADC_INPUT_AIN7,
+  NRF_SAADC_INPUT_VDD
+} nrf_saadc_input_t;
+
+typedef enum
+{
+  NRF_SAADC_GAIN1_6 = 0,
+  NRF_SAADC_GAIN1_5,
+  NRF_SAADC_GAIN1_4,
+  NRF_SAADC_GAIN1_3,
+  NRF_SAADC_GAIN1_2,
+  NRF_SAADC_GAIN1,
+  NRF_SAADC_GAIN2,
+  NRF_SAADC_GAIN4
+} nrf_saadc_gain_t;
+
+typedef enum
+{
+  NRF_SAADC_REFERENCE_INTERNAL = 0,
+  NRF_SAADC_REFERENCE_VDD4
+} nrf_saadc_reference_t;
+
+typedef enum
+{
+  NRF_SAADC_ACQTIME_3US = 0,
+  NRF_SAADC_ACQTIME_5US,
+  NRF_SAADC_ACQTIME_10US,
+  NRF_SAADC_ACQTIME_15US,
+  NRF_SAADC_ACQTIME_20US,
+  NRF_SAADC_ACQTIME_40US
+} nrf_saadc_acqtime_t;
+
+typedef enum
+{
+  NRF_SAADC_MODE_SINGLE_ENDED = 0,
+  NRF_SAADC_MODE_DIFFERENTIAL
+} nrf_saadc_mode_t;
+
+typedef struct
+{
+  nrf_saadc_resolution_t resolution;
+  nrf_saadc_oversample_t oversample;
+  uint8_t interrupt_priority;
+  bool low_power_mode;
+} nrfx_saadc_config_t;
+
+#define NRFX_SAADC_DEFAULT_CONFIG                                                    \
+  {                                                                                  \
+    .resolution = NRF_SAADC_RESOLUTION_10BIT, .oversample = NRF_SAADC_OVERSAMPLE_DISABLED, \
+    .interrupt_priority = 6, .low_power_mode = false                                 \
+  }
+
+typedef struct
+{
+  nrf_saadc_gain_t gain;
+  nrf_saadc_reference_t reference;
+  nrf_saadc_acqtime_t acq_time;
+  nrf_saadc_mode_t mode;
+  nrf_saadc_input_t pin_p;
+  nrf_saadc_input_t pin_n;
+} nrf_saadc_channel_config_t;
+
+#define NRFX_SAADC_DEFAULT_CHANNEL_CONFIG_SE(_pin_p)                                                   \
+  {                                                                                                    \
+    .gain = NRF_SAADC_GAIN1_6, .reference = NRF_SAADC_REFERENCE_INTERNAL, .acq_time = NRF_SAADC_ACQTIME_10US, \
+    .mode = NRF_SAADC_MODE_SINGLE_ENDED, .pin_p = (nrf_saadc_input_t)(_pin_p),                          \
+    .pin_n = NRF_SAADC_INPUT_DISABLED                                                                  \
+  }
+
+typedef enum
+{
+  NRFX_SAADC_EVT_DONE,
+  NRFX_SAADC_EVT_LIMIT,
+  NRFX_SAADC_EVT_CALIBRATEDONE
+} nrfx_saadc_evt_type_t;
+
+typedef struct
+{
+  nrf_saadc_value_t *p_buffer;
+  uint16_t size;
+} nrfx_saadc_done_evt_t;
+
+typedef struct
+{
+  nrfx_saadc_evt_type_t type;
+  union
+  {
+    nrfx_saadc_done_evt_t done;
+  } data;
+} nrfx_saadc_evt_t;
+
+typedef void (*nrfx_saadc_event_handler_t)(nrfx_saadc_evt_t const *p_event);
+
+nrfx_err_t nrfx_saadc_init(nrfx_saadc_config_t const *p_config, nrfx_saadc_event_handler_t event_handler);
+nrfx_err_t nrfx_saadc_channel_init(uint8_t channel, nrf_saadc_channel_config_t const *p_config);
+nrfx_err_t nrfx_saadc_buffer_convert(nrf_saadc_value_t *p_buffer, uint16_t size);
+uint32_t nrfx_saadc_sample_task_get(void);
+
+#endif /* NRFX_SAADC_H_ */
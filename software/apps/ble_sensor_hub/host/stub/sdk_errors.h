@@ -0,0 +1,26 @@
+#ifndef SDK_ERRORS_H_
+#define SDK_ERRORS_H_
+#include <stdint.h>
+
+// Host stand-in for the nRF5 SDK error codes, same values as the SDK
+
+typedef uint32_t ret_code_t;
+
+#define NRF_SUCCESS 0
+#define NRF_ERROR_INTERNAL 3
+#define NRF_ERROR_NO_MEM 4
+#define NRF_ERROR_NOT_FOUND 5
+#define NRF_ERROR_INVALID_PARAM 7
+#define NRF_ERROR_INVALID_STATE 8
+#define NRF_ERROR_INVALID_LENGTH 9
+#define NRF_ERROR_TIMEOUT 13
+#define NRF_ERROR_NULL 14
+#define NRF_ERROR_INVALID_ADDR 16
+#define NRF_ERROR_BUSY 17
+#define NRF_ERROR_RESOURCES 19
+#define NRF_ERROR_MODULE_ALREADY_INITIALIZED 0x0085
+#define NRF_ERROR_DRV_TWI_ERR_OVERRUN 0x8200
+#define NRF_ERROR_DRV_TWI_ERR_ANACK 0x8201
+#define NRF_ERROR_DRV_TWI_ERR_DNACK 0x8202
+
+#endif /* SDK_ERRORS_H_ */
@@ -0,0 +1,63 @@
+#ifndef SIMPLE_BLE_H_
+#define SIMPLE_BLE_H_
+#include <stdbool.h>
+#include <stdint.h>
+#include "app_timer.h"
+#include "ble.h"
+
+// Host stand-in for the buckler simple_ble library, same calls. sim_ble.c
+// assigns attribute handles and hands the application's events to the
+// callbacks below, which the application defines.
+
+typedef struct
+{
+  uint8_t platform_id;
+  uint16_t device_id;
+  const char *adv_name;
+  uint16_t adv_interval;      // 0.625 ms units
+  uint16_t min_conn_interval; // 1.25 ms units
+  uint16_t max_conn_interval;
+} simple_ble_config_t;
+
+typedef struct
+{
+  struct
+  {
+    uint8_t uuid128[16];
+  } uuid128;
+  struct
+  {
+    uint16_t uuid;
+    uint8_t type;
+  } uuid_handle;
+  uint16_t service_handle;
+} simple_ble_service_t;
+
+typedef struct
+{
+  uint16_t uuid16;
+  ble_gatts_char_handles_t char_handle;
+} simple_ble_char_t;
+
+typedef struct
+{
+  uint16_t conn_handle;
+} simple_ble_app_t;
+
+simple_ble_app_t *simple_ble_init(const simple_ble_config_t *conf);
+void simple_ble_add_service(simple_ble_service_t *service);
+void simple_ble_add_characteristic(uint8_t read, uint8_t write, uint8_t notify, uint8_t vlen, uint16_t len,
+                                   uint8_t *buf, simple_ble_service_t *service, simple_ble_char_t *char_handle);
+bool simple_ble_is_char_event(ble_evt_t const *p_ble_evt, simple_ble_char_t *char_handle);
+uint32_t simple_ble_notify_char(simple_ble_char_t *char_handle);
+void simple_ble_adv_only_name(void);
+
+// Sleeps until the next event, the simulator's main loop hook
+void power_manage(void);
+
+void ble_evt_connected(ble_evt_t const *p_ble_evt);
+void ble_evt_disconnected(ble_evt_t const *p_ble_evt);
+void ble_evt_write(ble_evt_t const *p_ble_evt);
+void ble_error(uint32_t error_code);
+
+#endif /* SIMPLE_BLE_H_ */
@@ -0,0 +1,73 @@
+#include <math.h>
+#include "synth.h"
+
+uint32_t synth_rand(uint32_t *state)
+{
+  uint32_t x = *state;
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+float synth_uniform(uint32_t *state)
+{
+  return (float)((double)synth_rand(state) / 2147483648.0 - 1.0);
+}
+
+// Irwin-Hall with 12 terms, close enough to normal for test signals
+float synth_gauss(uint32_t *state)
+{
+  float sum = 0.0f;
+
+  for (int i = 0; i < 12; i++)
+    sum += synth_uniform(state);
+  return sum * 0.5f;
+}
+
+uint32_t synth_ticks(double t)
+{
+  return (uint32_t)llround(t * SYNTH_TICK_HZ) & SYNTH_TICK_MASK;
+}
+
+static double next_period(synth_ppg_t *p)
+{
+  return 60.0 / p->bpm * (1.0 + p->rr_jitter * synth_uniform(&p->seed));
+}
+
+void synth_ppg_begin(synth_ppg_t *p)
+{
+  if (p->seed == 0)
+    p->seed = 1;
+  p->t = 0.0;
+  p->start = 0.0;
+  p->period = next_period(p);
+  p->beats = 0;
+}
+
+bool synth_ppg_next(synth_ppg_t *p, uint32_t *red, uint32_t *ir, double *beat_t)
+{
+  bool beat = false;
+
+  while (p->t >= p->start + p->period)
+  {
+    p->start += p->period;
+    p->period = next_period(p);
+    p->beats++;
+    *beat_t = p->start;
+    beat = true;
+  }
+  double wave = sin(2.0 * M_PI * (p->t - p->start) / p->period);
+  *ir = (uint32_t)lround(p->ir_dc + p->ir_ac * wave + p->noise * synth_gauss(&p->seed));
+  *red = (uint32_t)lround(p->red_dc + p->red_ac * wave + p->noise * synth_gauss(&p->seed));
+  p->t += 1.0 / p->rate_hz;
+  return beat;
+}
+
+uint16_t synth_adc(double t, float dc, float ac, float hz, float noise, uint32_t *seed)
+{
+  double v = dc + ac * sin(2.0 * M_PI * hz * t) + noise * synth_gauss(seed);
+
+  return v < 0 ? 0 : v > 4095 ? 4095 : (uint16_t)lround(v);
+}
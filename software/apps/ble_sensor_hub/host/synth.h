@@ -0,0 +1,47 @@
+#ifndef SYNTH_H_
+#define SYNTH_H_
+#include <stdbool.h>
+#include <stdint.h>
+
+// Deterministic synthetic sensor signals for the host programs. Every
+// generator draws from its own xorshift state, so a seed gives the same
+// samples on every machine and every run.
+
+#define SYNTH_TICK_HZ 32768        // RTC ticks, like app_timer_cnt_get()
+#define SYNTH_TICK_MASK 0x00FFFFFF
+
+uint32_t synth_rand(uint32_t *state); // never returns 0 for a non-zero state
+float synth_uniform(uint32_t *state); // -1..1
+float synth_gauss(uint32_t *state);   // zero mean, unit variance
+uint32_t synth_ticks(double t);       // seconds to wrapped RTC ticks
+
+// PPG pulse train: one sinusoidal cycle per beat, so the true beat time is the
+// rising zero crossing of the AC part. Each RR interval is drawn around the
+// nominal rate with rr_jitter relative spread.
+typedef struct
+{
+  float rate_hz;   // sample rate
+  float bpm;
+  float rr_jitter;
+  float ir_dc;
+  float ir_ac;     // amplitude, counts
+  float red_dc;
+  float red_ac;
+  float noise;     // gaussian, counts RMS
+  uint32_t seed;
+
+  double t;        // time of the next sample, s
+  double start;    // start of the current beat, s
+  double period;   // length of the current beat, s
+  uint32_t beats;  // rising crossings so far
+} synth_ppg_t;
+
+void synth_ppg_begin(synth_ppg_t *p); // parameters set, t = 0
+// Next sample. Returns true when a beat started since the previous sample,
+// *beat_t is then its exact time.
+bool synth_ppg_next(synth_ppg_t *p, uint32_t *red, uint32_t *ir, double *beat_t);
+
+// Sinusoid around a 12-bit level, for breathing on the flex channel
+uint16_t synth_adc(double t, float dc, float ac, float hz, float noise, uint32_t *seed);
+
+#endif /* SYNTH_H_ */
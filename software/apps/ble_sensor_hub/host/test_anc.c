@@ -0,0 +1,205 @@
+// anc.c on a synthetic PPG corrupted by motion: an arm swing at walking
+// cadence, close to the heart rate and several times the pulse amplitude,
+// reaches the IR channel through a short coupling filter, and the same swing
+// is on the accelerometer reference. Bursts go through anc_process() and then
+// checkForBeat_block() the way hr_update() runs them. Cancelling has to take
+// most of the artifact out, find the true beats again and bring the rate
+// back to the true one, where the uncancelled signal follows the cadence.
+// On the clean PPG, with the arm still swinging, the canceller must leave the
+// pulse alone.
+//
+//   test_anc [-b]   -b adds the beat detection and rate error over artifact
+//                   amplitudes and the host cost per sample of the canceller
+
+#include <math.h>
+#include "algorithm.h"
+#include "anc.h"
+#include "harness.h"
+#include "hr.h"
+#include "synth.h"
+
+#define RATE_HZ 25
+#define SECONDS 300
+#define SAMPLES (SECONDS * RATE_HZ)
+#define BURST 24          // PPG_WATERMARK
+#define BPM 72
+#define CADENCE_HZ 1.7    // 102 steps a minute
+#define SETTLE_S 30       // left out of the rate and residual figures
+#define MATCH_S 0.3
+#define BEATS_MAX 512
+
+typedef struct
+{
+  uint32_t matched; // true beats found
+  uint32_t false_beats;
+  double bpm_err;   // mean absolute, of hr_bpm() after SETTLE_S
+  double residual;  // RMS of what is left of the artifact after SETTLE_S, counts
+  uint64_t ns;      // in anc_process()
+  uint64_t cyc;
+} result_t;
+
+static int32_t clean[SAMPLES], ir[SAMPLES];
+static int16_t acc[SAMPLES], emg[SAMPLES];
+static double truth[BEATS_MAX];
+static uint32_t beats;
+
+// PPG, accelerometer and EMG references, the artifact scaled to gain counts
+// of IR per count of ACC
+static void make_signals(double gain)
+{
+  synth_ppg_t p = {
+      .rate_hz = RATE_HZ,
+      .bpm = BPM,
+      .rr_jitter = 0.03f,
+      .ir_dc = 90000,
+      .ir_ac = 150,
+      .red_dc = 70000,
+      .red_ac = 90,
+      .noise = 3,
+      .seed = 43,
+  };
+  uint32_t seed = 13;
+  double prev = 0;
+
+  beats = 0;
+  synth_ppg_begin(&p);
+  for (int i = 0; i < SAMPLES; i++)
+  {
+    double t = p.t, beat_t;
+    uint32_t red, sample;
+    // Swing with its first harmonic, slowly changing in strength
+    double swing = (1.0 + 0.3 * sin(2.0 * M_PI * t / 40.0)) *
+                   (250.0 * sin(2.0 * M_PI * CADENCE_HZ * t) + 80.0 * sin(4.0 * M_PI * CADENCE_HZ * t + 1.0));
+
+    if (synth_ppg_next(&p, &red, &sample, &beat_t) && beats < BEATS_MAX)
+      truth[beats++] = beat_t;
+    clean[i] = sample;
+    ir[i] = sample + (int32_t)lround(gain * (swing + 0.5 * prev));
+    acc[i] = (int16_t)lround(2048 + swing + 5.0 * synth_gauss(&seed));
+    emg[i] = (int16_t)lround(2048 + 8.0 * synth_gauss(&seed));
+    prev = swing;
+  }
+}
+
+static result_t run(bool cancel)
+{
+  static int32_t out[SAMPLES];
+  static bool taken[BEATS_MAX];
+  result_t res = {0};
+  anc_ctx_t anc;
+  hr_ctx_t hr;
+  beat_t found[BEAT_BLOCK_SIZE];
+  uint32_t period_q8 = (SYNTH_TICK_HZ << 8) / RATE_HZ;
+  uint32_t readings = 0;
+  double sum = 0, sq = 0;
+  int n = 0;
+
+  memset(taken, 0, sizeof(taken));
+  beat_reset();
+  anc_begin(&anc);
+  hr_begin(&hr);
+  for (int base = 0; base < SAMPLES; base += BURST)
+  {
+    int len = SAMPLES - base < BURST ? SAMPLES - base : BURST;
+
+    memcpy(&out[base], &ir[base], len * sizeof(out[0]));
+    if (cancel)
+    {
+      uint64_t start = harness_ns(), cyc = harness_cycles();
+      anc_process(&anc, &ir[base], &acc[base], &emg[base], &out[base], len);
+      res.ns += harness_ns() - start;
+      res.cyc += harness_cycles() - cyc;
+    }
+    uint16_t count = checkForBeat_block(&out[base], len, found);
+    for (uint16_t b = 0; b < count; b++)
+    {
+      int idx = base + found[b].idx;
+      uint32_t ticks = hr_beat_ticks(&found[b], synth_ticks((double)idx / RATE_HZ), period_q8);
+      double t = (double)idx / RATE_HZ - (BEAT_FIR_DELAY + found[b].lag_q8 / 256.0) / RATE_HZ;
+      int match = -1;
+
+      if (hr_add_beat(&hr, ticks) && t > SETTLE_S)
+      {
+        res.bpm_err += fabs((double)hr_bpm(&hr) - BPM);
+        readings++;
+      }
+      for (uint32_t k = 0; k < beats; k++)
+        if (!taken[k] && fabs(truth[k] - t) < MATCH_S)
+          match = k;
+      if (match < 0)
+      {
+        res.false_beats++;
+        continue;
+      }
+      taken[match] = true;
+      res.matched++;
+    }
+  }
+  res.bpm_err = readings ? res.bpm_err / readings : BPM;
+
+  // The artifact left is the output less the clean PPG, its mean aside
+  for (int i = SETTLE_S * RATE_HZ; i < SAMPLES; i++, n++)
+  {
+    double d = out[i] - clean[i];
+    sum += d;
+    sq += d * d;
+  }
+  res.residual = sqrt(sq / n - (sum / n) * (sum / n));
+  return res;
+}
+
+// Motion on the accelerometer that never reaches the PPG: nothing to take out
+static void check_clean(void)
+{
+  make_signals(0);
+  result_t raw = run(false);
+  result_t anc = run(true);
+
+  CHECK(raw.matched >= beats - 5);
+  CHECK(anc.matched >= raw.matched - 2);
+  CHECK(anc.false_beats <= 2);
+  CHECK(anc.bpm_err < 2);
+  CHECK(anc.residual < 20);           // the PPG passes through
+}
+
+// An artifact 4 to 5 times the pulse at a cadence the detector locks onto
+static void check_motion(void)
+{
+  make_signals(2.0);
+  result_t raw = run(false);
+  result_t anc = run(true);
+
+  CHECK(raw.bpm_err > 10);            // the uncancelled rate follows the cadence
+  CHECK(anc.residual * 5 < raw.residual);
+  CHECK(anc.matched >= beats * 9 / 10);
+  CHECK(anc.false_beats <= beats / 20);
+  CHECK(anc.bpm_err < 3);
+}
+
+// Cycles are the TSC's on x86, 0 elsewhere. The portable q15 NLMS runs here,
+// the nRF52 build runs arm_lms_norm_q15.
+static void bench(void)
+{
+  static const double gains[] = {0, 0.5, 1, 2, 4};
+
+  printf("%6s %10s %10s %10s %10s %10s %10s %10s\n", "gain", "raw found", "anc found", "raw bpm", "anc bpm",
+         "residual", "ns/sample", "cyc/sample");
+  for (int g = 0; g < 5; g++)
+  {
+    make_signals(gains[g]);
+    result_t raw = run(false);
+    result_t anc = run(true);
+    printf("%6.1f %6u/%-3u %6u/%-3u %10.1f %10.1f %4.0f/%-5.0f %10.1f %10.1f\n", gains[g], (unsigned)raw.matched,
+           (unsigned)beats, (unsigned)anc.matched, (unsigned)beats, raw.bpm_err, anc.bpm_err, raw.residual,
+           anc.residual, (double)anc.ns / SAMPLES, (double)anc.cyc / SAMPLES);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  check_clean();
+  check_motion();
+  if (harness_bench(argc, argv))
+    bench();
+  return harness_result("test_anc");
+}
@@ -0,0 +1,173 @@
+// The block path of the beat detector (algorithm.c) against the per-sample
+// one it replaces. The portable lowPassFIRFilter_block() has to give the
+// FIRCoeffs filter's output bit for bit, in bursts of any length up to
+// BEAT_BLOCK_SIZE, for a synthetic PPG and for full scale noise, where the
+// symmetric pair sums overflow int16_t the same way in both. Over a PPG fed
+// in FIFO sized bursts, checkForBeat_block() has to find the beats
+// checkForBeat() finds, on the same samples, with the crossing interpolated
+// within the sample before.
+//
+//   test_beat [-b]   -b adds the host cost per sample of both paths, the
+//                    filter alone and the whole detector, per burst length.
+//                    This is the portable block filter, the nRF52 build runs
+//                    arm_fir_fast_q15 instead.
+
+#include "algorithm.h"
+#include "harness.h"
+#include "synth.h"
+
+#define SAMPLES 30000 // 5 minutes at 100 Hz
+
+static int32_t ppg[SAMPLES];
+static int16_t ac[SAMPLES]; // ppg less its DC, what the filter sees
+static int16_t noise[SAMPLES];
+
+static void make_signals(void)
+{
+  synth_ppg_t p = {
+      .rate_hz = 100,
+      .bpm = 72,
+      .rr_jitter = 0.05f,
+      .ir_dc = 40000,
+      .ir_ac = 300,
+      .red_dc = 30000,
+      .red_ac = 200,
+      .noise = 4,
+      .seed = 3,
+  };
+  uint32_t red, ir, seed = 5;
+  double beat_t;
+
+  synth_ppg_begin(&p);
+  for (int i = 0; i < SAMPLES; i++)
+  {
+    synth_ppg_next(&p, &red, &ir, &beat_t);
+    ppg[i] = ir;
+    ac[i] = (int16_t)(ir - 40000);
+    noise[i] = (int16_t)synth_rand(&seed);
+  }
+}
+
+// Burst lengths as the FIFO hands them over, 1..BEAT_BLOCK_SIZE
+static uint16_t burst(uint32_t *seed)
+{
+  return 1 + synth_rand(seed) % BEAT_BLOCK_SIZE;
+}
+
+// Scalar and block filter over the same input, the block one in random bursts
+static void check_fir(const int16_t *in, int n)
+{
+  static int16_t scalar[SAMPLES], block[SAMPLES];
+  uint32_t seed = 17;
+  int differ = 0;
+
+  for (int i = 0; i < n; i++)
+    scalar[i] = lowPassFIRFilter(in[i]);
+  for (int i = 0; i < n;)
+  {
+    uint16_t len = burst(&seed);
+    if (len > n - i)
+      len = n - i;
+    lowPassFIRFilter_block(&in[i], &block[i], len);
+    i += len;
+  }
+  for (int i = 0; i < n; i++)
+    differ += scalar[i] != block[i];
+  CHECK_EQ(differ, 0);
+
+  // Both filters start over from silence for the next input
+  for (int i = 0; i < 32; i++)
+  {
+    int16_t zero = 0, out;
+    lowPassFIRFilter(zero);
+    lowPassFIRFilter_block(&zero, &out, 1);
+  }
+}
+
+// The same beats on the same samples from both paths
+static void check_beats(void)
+{
+  static uint8_t scalar[SAMPLES];
+  beat_t beats[BEAT_BLOCK_SIZE];
+  uint32_t seed = 29;
+  int scalar_count = 0, block_count = 0, missing = 0, bad_lag = 0;
+
+  beat_reset();
+  for (int i = 0; i < SAMPLES; i++)
+  {
+    scalar[i] = checkForBeat(ppg[i]);
+    scalar_count += scalar[i];
+  }
+  beat_reset();
+  for (int i = 0; i < SAMPLES;)
+  {
+    uint16_t len = burst(&seed);
+    if (len > SAMPLES - i)
+      len = SAMPLES - i;
+    uint16_t found = checkForBeat_block(&ppg[i], len, beats);
+    for (uint16_t b = 0; b < found; b++)
+    {
+      missing += !scalar[i + beats[b].idx];
+      bad_lag += beats[b].lag_q8 > 256;
+    }
+    block_count += found;
+    i += len;
+  }
+  // 72 bpm for 5 minutes, less the DC estimator settling
+  CHECK(scalar_count > 330 && scalar_count <= 360);
+  CHECK_EQ(block_count, scalar_count);
+  CHECK_EQ(missing, 0);
+  CHECK_EQ(bad_lag, 0);
+}
+
+static void bench(void)
+{
+  static int16_t out[SAMPLES];
+  static const uint16_t bursts[] = {1, 4, 8, 16, 32};
+  beat_t beats[BEAT_BLOCK_SIZE];
+
+  uint64_t start = harness_ns(), cyc = harness_cycles();
+  for (int i = 0; i < SAMPLES; i++)
+    out[i] = lowPassFIRFilter(ac[i]);
+  double fir_ns = (double)(harness_ns() - start) / SAMPLES, fir_cyc = (double)(harness_cycles() - cyc) / SAMPLES;
+  harness_keep(out);
+
+  beat_reset();
+  start = harness_ns(), cyc = harness_cycles();
+  for (int i = 0; i < SAMPLES; i++)
+    out[0] += checkForBeat(ppg[i]);
+  double beat_ns = (double)(harness_ns() - start) / SAMPLES, beat_cyc = (double)(harness_cycles() - cyc) / SAMPLES;
+  harness_keep(out);
+
+  printf("%-8s %12s %12s %12s %12s\n", "burst", "fir ns/samp", "fir cyc", "beat ns/samp", "beat cyc");
+  printf("%-8s %12.1f %12.1f %12.1f %12.1f\n", "scalar", fir_ns, fir_cyc, beat_ns, beat_cyc);
+  for (int b = 0; b < 5; b++)
+  {
+    int n = SAMPLES / bursts[b] * bursts[b];
+
+    start = harness_ns(), cyc = harness_cycles();
+    for (int i = 0; i < n; i += bursts[b])
+      lowPassFIRFilter_block(&ac[i], &out[i], bursts[b]);
+    fir_ns = (double)(harness_ns() - start) / n, fir_cyc = (double)(harness_cycles() - cyc) / n;
+    harness_keep(out);
+
+    beat_reset();
+    start = harness_ns(), cyc = harness_cycles();
+    for (int i = 0; i < n; i += bursts[b])
+      out[0] += checkForBeat_block(&ppg[i], bursts[b], beats);
+    beat_ns = (double)(harness_ns() - start) / n, beat_cyc = (double)(harness_cycles() - cyc) / n;
+    harness_keep(out);
+    printf("%-8u %12.1f %12.1f %12.1f %12.1f\n", bursts[b], fir_ns, fir_cyc, beat_ns, beat_cyc);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  make_signals();
+  check_fir(ac, SAMPLES);
+  check_fir(noise, SAMPLES);
+  check_beats();
+  if (harness_bench(argc, argv))
+    bench();
+  return harness_result("test_beat");
+}
@@ -0,0 +1,147 @@
+// br.c on synthetic breathing on the flex channel at its 20 Hz rate: sinusoids
+// over the respiratory band, an asymmetric breath whose harmonics are as
+// strong as a slow fundamental, a rate that steps partway, and noise with no
+// breathing at all. Every estimate once the window is full has to land within
+// a breath per minute of the true rate, a step has to be followed within a
+// window, and noise alone must not produce a rate.
+//
+//   test_br [-b]   -b adds the rate error over the band, the host cost per
+//                  sample and per estimate and the memory br.c takes. This is
+//                  the reference DFT, the nRF52 build runs arm_rfft_fast_f32.
+
+#include <math.h>
+#include "br.h"
+#include "harness.h"
+#include "synth.h"
+
+#define RATE_HZ (BR_RATE_HZ * BR_DECIM)
+#define FILL_S (BR_WINDOW / BR_RATE_HZ)  // seconds before the first estimate
+
+typedef struct
+{
+  uint32_t estimates;
+  uint32_t zero;     // estimates without a rate
+  double max_err;    // bpm
+  uint16_t last;
+  uint64_t ns;       // in br_add(), all of it
+  uint64_t est_ns;   // in the calls that computed an estimate
+  uint32_t samples;
+} result_t;
+
+// One breath of phase 0..1: inhale over the first third, exhale over the rest
+static double breath(double phase, bool asymmetric)
+{
+  if (!asymmetric)
+    return sin(2.0 * M_PI * phase);
+  return phase < 1.0 / 3 ? -cos(3.0 * M_PI * phase) : cos(1.5 * M_PI * (phase - 1.0 / 3));
+}
+
+// seconds of breathing at bpm, switching to bpm2 at switch_s; truth is the
+// rate over the window that ends at each estimate
+static result_t run(double bpm, double bpm2, double switch_s, double amp, bool asymmetric, double seconds)
+{
+  result_t res = {0};
+  br_ctx_t ctx;
+  uint32_t seed = 19;
+  double phase = 0;
+
+  br_begin(&ctx);
+  for (uint32_t i = 0; i < seconds * RATE_HZ; i++)
+  {
+    double t = (double)i / RATE_HZ;
+    double rate = t < switch_s ? bpm : bpm2;
+    double v = 2100 + amp * breath(phase, asymmetric) + 3 * synth_gauss(&seed);
+    uint16_t x = v < 0 ? 0 : v > 4095 ? 4095 : (uint16_t)lround(v);
+
+    phase = fmod(phase + rate / 60.0 / RATE_HZ, 1.0);
+    uint64_t start = harness_ns();
+    bool estimate = br_add(&ctx, x);
+    uint64_t ns = harness_ns() - start;
+    res.ns += ns;
+    res.samples++;
+    if (!estimate)
+      continue;
+    res.est_ns += ns;
+    res.estimates++;
+    res.last = br_bpm(&ctx);
+    res.zero += !res.last;
+    // Whole windows only, a window straddling the step has no single truth
+    if (t - FILL_S >= switch_s || t < switch_s)
+    {
+      double err = fabs(res.last - rate);
+      if (err > res.max_err)
+        res.max_err = err;
+    }
+  }
+  return res;
+}
+
+// Sinusoidal breathing over the whole band, its edges included
+static void check_band(void)
+{
+  for (double bpm = BR_MIN_BPM; bpm <= BR_MAX_BPM; bpm += 3)
+  {
+    result_t r = run(bpm, bpm, 1e9, 150, false, 120);
+
+    CHECK(r.estimates >= (120 - FILL_S) * BR_RATE_HZ / BR_HOP - 1);
+    CHECK_EQ(r.zero, 0);
+    CHECK(r.max_err <= 1.0);
+  }
+}
+
+// Short inhale, long exhale: the fundamental still wins over its harmonics
+static void check_asymmetric(void)
+{
+  for (double bpm = 8; bpm <= 20; bpm += 6)
+  {
+    result_t r = run(bpm, bpm, 1e9, 150, true, 120);
+
+    CHECK_EQ(r.zero, 0);
+    CHECK(r.max_err <= 1.0);
+  }
+}
+
+// 12 to 24 per minute at 60 s: the new rate once the window is past the step
+static void check_step(void)
+{
+  result_t r = run(12, 24, 60, 150, false, 60 + FILL_S + 10);
+
+  CHECK(r.max_err <= 1.0);
+  CHECK_NEAR(r.last, 24, 1);
+}
+
+// Noise alone has no peak to report, shallow breathing twice BR_MIN_AMPLITUDE does
+static void check_noise(void)
+{
+  result_t r = run(15, 15, 1e9, 0, false, 120);
+  result_t shallow = run(15, 15, 1e9, 2 * BR_MIN_AMPLITUDE, false, 120);
+
+  CHECK(r.estimates > 0);
+  CHECK_EQ(r.zero, r.estimates);
+  CHECK_EQ(shallow.zero, 0);
+  CHECK(shallow.max_err <= 1.0);
+}
+
+static void bench(void)
+{
+  printf("br_ctx_t: %zu bytes, estimate() stack: %zu bytes of buffers\n", sizeof(br_ctx_t),
+         2 * BR_WINDOW * sizeof(float));
+  printf("%6s %10s %10s %12s %12s\n", "bpm", "estimates", "err bpm", "ns/sample", "ns/estimate");
+  for (double bpm = 6; bpm <= 45; bpm += 6)
+  {
+    result_t r = run(bpm, bpm, 1e9, 150, false, 300);
+    printf("%6.0f %10u %10.2f %12.1f %12.1f\n", bpm, (unsigned)r.estimates, r.max_err, (double)r.ns / r.samples,
+           (double)r.est_ns / r.estimates);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  check_band();
+  check_asymmetric();
+  check_step();
+  check_noise();
+  if (harness_bench(argc, argv))
+    bench();
+  return harness_result("test_br");
+}
@@ -0,0 +1,262 @@
+// codec.c against decode.c on the recorded session (data/session.csv, 25 Hz)
+// and on the streams main.c builds: an ADC scan every ms with raw EMG and a
+// record per PPG sample at 100 Hz, the RTC wrapping partway. Records are packed into
+// consecutive blocks the size of a notification body and of a session log
+// block, the way telemetry.c and rec.c fill them, and every one has to decode
+// to what went in. Fields that defeat the prediction (full scale swings,
+// every bit set) must come back too, and a record that does not fit must
+// leave the block as it was.
+//
+//   test_codec [-b]   -b adds the compression ratio per stream and block size
+//                     and the host cost per record of encoding and decoding
+
+#include <stdlib.h>
+#include "codec.h"
+#include "decode.h"
+#include "harness.h"
+#include "rec.h"
+#include "synth.h"
+#include "telemetry.h"
+
+#define SESSION_CSV "data/session.csv"
+#define SESSION_MAX 4096
+#define STREAM_RECORDS 20000
+#define PPG_RECORDS 2000
+#define BLOCK_MAX 1024
+#define BODY (TELEMETRY_MAX_PAYLOAD - sizeof(telemetry_hdr_t))               // of a notification at the largest MTU
+#define BODY_MIN (BLE_GATT_ATT_MTU_DEFAULT - 3 - sizeof(telemetry_hdr_t)) // at the default MTU
+#define RECORDS_MAX 1024 // of one block, 14 bits per record at best
+
+typedef struct
+{
+  const char *name;
+  telemetry_record_t *records;
+  uint32_t count;
+} data_t;
+
+typedef struct
+{
+  uint32_t blocks;
+  uint32_t bytes;
+} packed_t;
+
+static telemetry_record_t session[SESSION_MAX];
+static telemetry_record_t stream[STREAM_RECORDS];
+static telemetry_record_t ppg_stream[PPG_RECORDS];
+static uint8_t blocks[STREAM_RECORDS][BLOCK_MAX] __attribute__((aligned(4)));
+static uint16_t block_len[STREAM_RECORDS];
+static uint16_t block_count[STREAM_RECORDS];
+
+static uint32_t load_session(void)
+{
+  FILE *f = fopen(SESSION_CSV, "r");
+  uint32_t n = 0;
+  unsigned ticks, red, ir, gsr, flex, emg1, emg2;
+
+  if (!f)
+  {
+    perror(SESSION_CSV);
+    exit(1);
+  }
+  fscanf(f, "%*[^\n]\n");
+  while (n < SESSION_MAX && fscanf(f, "%u,%u,%u,%u,%u,%u,%u", &ticks, &red, &ir, &gsr, &flex, &emg1, &emg2) == 7)
+    session[n++] = (telemetry_record_t){ticks, red, ir, gsr, flex, emg1, emg2};
+  fclose(f);
+  return n;
+}
+
+// What adc_update() pushes with raw EMG on: one record per 1 kHz scan
+static uint32_t make_stream(void)
+{
+  uint32_t seed = 11;
+
+  for (uint32_t i = 0; i < STREAM_RECORDS; i++)
+  {
+    double t = i / 1000.0;
+
+    stream[i] = (telemetry_record_t){
+        .ticks = synth_ticks(505.0 + t), // wraps 7 s in
+        .gsr = synth_adc(t, 1500, 20, 0.05f, 1.5f, &seed),
+        .flex = synth_adc(t, 2100, 150, 0.25f, 2, &seed),
+        .emg1 = synth_adc(t, 2048, 0, 1, 12, &seed),
+        .emg2 = synth_adc(t, 2048, 0, 1, 12, &seed),
+    };
+  }
+  return STREAM_RECORDS;
+}
+
+// What ppg_task() pushes: one record per PPG sample, here at 100 Hz
+static uint32_t make_ppg_stream(void)
+{
+  synth_ppg_t ppg = {
+      .rate_hz = 100,
+      .bpm = 72,
+      .rr_jitter = 0.03f,
+      .ir_dc = 220000,
+      .ir_ac = 400,
+      .red_dc = 180000,
+      .red_ac = 250,
+      .noise = 3,
+      .seed = 7,
+  };
+  uint32_t red, ir;
+  double beat_t;
+
+  synth_ppg_begin(&ppg);
+  for (uint32_t i = 0; i < PPG_RECORDS; i++)
+  {
+    synth_ppg_next(&ppg, &red, &ir, &beat_t);
+    ppg_stream[i] = (telemetry_record_t){
+        .ticks = synth_ticks(505.0 + i / 100.0),
+        .max_red = red,
+        .max_ir = ir,
+    };
+  }
+  return PPG_RECORDS;
+}
+
+// Packs records into blocks of cap bytes, a new one whenever a record does not fit
+static packed_t pack(const data_t *d, uint16_t cap)
+{
+  packed_t p = {0};
+  codec_enc_t enc;
+
+  for (uint32_t i = 0; i < d->count;)
+  {
+    codec_begin(&enc, blocks[p.blocks], cap);
+    while (i < d->count && codec_push(&enc, &d->records[i]))
+      i++;
+    block_len[p.blocks] = codec_end(&enc);
+    block_count[p.blocks] = enc.count;
+    p.bytes += block_len[p.blocks];
+    p.blocks++;
+  }
+  return p;
+}
+
+static uint32_t unpack(const data_t *d, const packed_t *p)
+{
+  static telemetry_record_t out[RECORDS_MAX];
+  uint32_t n = 0;
+  uint32_t wrong = 0;
+
+  for (uint32_t b = 0; b < p->blocks; b++)
+  {
+    uint16_t count = decode_packed(blocks[b], block_len[b], block_count[b], out);
+
+    wrong += block_count[b] - count;
+    for (uint16_t i = 0; i < count; i++, n++)
+      wrong += n >= d->count || memcmp(&out[i], &d->records[n], sizeof(out[i])) != 0;
+  }
+  return wrong + (d->count - n);
+}
+
+static void check_round_trip(const data_t *d, uint16_t cap, double min_ratio)
+{
+  packed_t p = pack(d, cap);
+
+  CHECK_EQ(unpack(d, &p), 0);
+  // Against the records as telemetry_record_t, keyframes included
+  CHECK((double)d->count * sizeof(telemetry_record_t) / p.bytes >= min_ratio);
+}
+
+// Full scale steps every record and every bit set: the raw class each time
+static void check_unpredictable(void)
+{
+  static telemetry_record_t records[64];
+  data_t d = {"extremes", records, 64};
+
+  for (uint32_t i = 0; i < 64; i++)
+  {
+    uint32_t hi = i & 1 ? 0 : 0xFFFFFFFF;
+    records[i] = (telemetry_record_t){(i * 0x9E3779B1u) & 0x00FFFFFF, hi & 0x3FFFF, ~hi & 0x3FFFF, hi & 0xFFF,
+                                      ~hi & 0xFFF, hi & 0xFFF, (i * 97) & 0xFFF};
+  }
+  packed_t p = pack(&d, BODY);
+  CHECK_EQ(unpack(&d, &p), 0);
+  CHECK(p.blocks > 1);
+}
+
+// A record that does not fit leaves the block, bit for bit, as it was
+static void check_rollback(void)
+{
+  uint8_t buf[40], copy[40];
+  codec_enc_t enc;
+  telemetry_record_t out[16];
+  uint32_t i = 0;
+
+  memset(buf, 0xA5, sizeof(buf));
+  codec_begin(&enc, buf, sizeof(buf));
+  while (codec_push(&enc, &stream[i]))
+    i++;
+  uint16_t len = codec_end(&enc);
+  memcpy(copy, buf, sizeof(buf));
+  telemetry_record_t extreme = {0x00FFFFFF, 0x3FFFF, 0, 0xFFF, 0, 0xFFF, 0};
+  CHECK(!codec_push(&enc, &extreme));
+  CHECK_EQ(codec_end(&enc), len);
+  CHECK_EQ(enc.count, i);
+  CHECK(memcmp(buf, copy, len) == 0);
+  CHECK_EQ(decode_packed(buf, len, i, out), i);
+  CHECK(memcmp(out, stream, i * sizeof(out[0])) == 0);
+  // One more than there is decodes short rather than past the end
+  CHECK_EQ(decode_packed(buf, len, i + 1, out), i);
+}
+
+// Bits per record and ratio against telemetry_record_t, at the default MTU,
+// the largest and a log block. Cycles are the TSC's on x86, 0 elsewhere.
+static void bench(const data_t *sets, int n)
+{
+  static const uint16_t caps[] = {BODY_MIN, BODY, REC_DATA_SIZE};
+  static telemetry_record_t out[RECORDS_MAX];
+
+  printf("%-8s %6s %8s %8s %10s %10s %10s\n", "data", "block", "bits/rec", "ratio", "enc ns/rec", "enc cyc/rec",
+         "dec ns/rec");
+  for (int s = 0; s < n; s++)
+    for (int c = 0; c < 3; c++)
+    {
+      const data_t *d = &sets[s];
+      packed_t p;
+      uint32_t rounds = 2000000 / d->count + 1;
+
+      uint64_t start = harness_ns(), start_cyc = harness_cycles();
+      for (uint32_t r = 0; r < rounds; r++)
+        p = pack(d, caps[c]);
+      uint64_t enc_ns = harness_ns() - start, enc_cyc = harness_cycles() - start_cyc;
+      harness_keep(blocks);
+
+      CHECK_EQ(unpack(d, &p), 0);
+      start = harness_ns();
+      for (uint32_t r = 0; r < rounds; r++)
+        for (uint32_t b = 0; b < p.blocks; b++)
+          decode_packed(blocks[b], block_len[b], block_count[b], out);
+      uint64_t dec_ns = harness_ns() - start;
+      harness_keep(out);
+
+      double records = (double)d->count * rounds;
+      printf("%-8s %6u %8.1f %8.2f %10.1f %10.1f %10.1f\n", d->name, caps[c], p.bytes * 8.0 / d->count,
+             (double)d->count * sizeof(telemetry_record_t) / p.bytes, enc_ns / records, enc_cyc / records,
+             dec_ns / records);
+    }
+}
+
+int main(int argc, char **argv)
+{
+  data_t sets[] = {
+      {"session", session, load_session()},
+      {"stream", stream, make_stream()},
+      {"ppg", ppg_stream, make_ppg_stream()},
+  };
+
+  CHECK(sets[0].count > 2000);
+  check_round_trip(&sets[0], BODY, 2.0);
+  check_round_trip(&sets[0], REC_DATA_SIZE, 2.0);
+  check_round_trip(&sets[1], BODY, 3.0);
+  check_round_trip(&sets[1], REC_DATA_SIZE, 3.0);
+  check_round_trip(&sets[2], BODY, 3.0);
+  check_round_trip(&sets[2], REC_DATA_SIZE, 3.0);
+  check_unpredictable();
+  check_rollback();
+  if (harness_bench(argc, argv))
+    bench(sets, 3);
+  return harness_result("test_codec");
+}
@@ -0,0 +1,173 @@
+// decim.c with the factors and tap counts main.c gives each channel: ACC by
+// 10, flex by 10 then 5, GSR by 10, 5 then 4, all from the 1 kHz scan. A
+// constant has to pass exactly; a sinusoid in the passband, up to half the
+// output Nyquist frequency, has to keep its amplitude within 0.5 dB; one that
+// would alias onto the passband, from the output rate less half the Nyquist
+// frequency up to the scan Nyquist frequency, has to come out at least 55 dB
+// down. Amplitudes are fitted to the output over whole periods.
+//
+//   test_decim [-b]   -b adds the frequency response of each chain and the
+//                     host cost per scan of the whole multi-rate graph: the
+//                     three chains and both EMG envelopes, as adc_update()
+//                     runs them
+
+#include <math.h>
+#include "decim.h"
+#include "emg.h"
+#include "harness.h"
+#include "synth.h"
+
+#define SCAN_HZ 1000.0
+#define AMP 8000.0
+#define OUT_MAX 4096
+
+DECIM_DEF(acc_decim, 10, DECIM_TAPS_PER_FACTOR * 10);
+DECIM_DEF(flex_decim1, 10, DECIM_TAPS_PER_FACTOR * 10);
+DECIM_DEF(flex_decim2, 5, DECIM_TAPS_PER_FACTOR * 5);
+DECIM_DEF(gsr_decim1, 10, DECIM_TAPS_PER_FACTOR * 10);
+DECIM_DEF(gsr_decim2, 5, DECIM_TAPS_PER_FACTOR * 5);
+DECIM_DEF(gsr_decim3, 4, DECIM_TAPS_PER_FACTOR * 4);
+
+typedef struct
+{
+  const char *name;
+  decim_t *const *stages;
+  uint8_t count;
+  uint16_t factor; // overall
+} chain_t;
+
+static decim_t *const acc_chain[] = {&acc_decim};
+static decim_t *const flex_chain[] = {&flex_decim1, &flex_decim2};
+static decim_t *const gsr_chain[] = {&gsr_decim1, &gsr_decim2, &gsr_decim3};
+static const chain_t chains[] = {
+    {"acc", acc_chain, 1, 10},
+    {"flex", flex_chain, 2, 50},
+    {"gsr", gsr_chain, 3, 200},
+};
+
+static void chain_init(const chain_t *c)
+{
+  for (uint8_t i = 0; i < c->count; i++)
+    decim_init(c->stages[i]);
+}
+
+// Gain of the chain at hz, output amplitude over input amplitude
+static double gain(const chain_t *c, double hz)
+{
+  static double out[OUT_MAX];
+  uint32_t settle = 64, n = 0;
+  // Whole periods of the output, at least a few hundred samples
+  uint32_t want = 512;
+  double re = 0, im = 0;
+
+  chain_init(c);
+  for (uint32_t i = 0; n < settle + want && n < OUT_MAX; i++)
+  {
+    int16_t y;
+    if (decim_push_chain(c->stages, c->count, (int16_t)lrint(AMP * sin(2.0 * M_PI * hz * i / SCAN_HZ)), &y))
+      out[n++] = y;
+  }
+  // The output samples are taken at the last input of each group, a fixed
+  // delay that only shifts the phase
+  for (uint32_t k = settle; k < n; k++)
+  {
+    double ph = 2.0 * M_PI * hz * ((double)(k + 1) * c->factor - 1) / SCAN_HZ;
+    re += out[k] * cos(ph);
+    im += out[k] * sin(ph);
+  }
+  // Frequencies that alias to 0 or to Nyquist leave a DC or alternating output the fit can't split
+  return 2.0 * sqrt(re * re + im * im) / (n - settle) / AMP;
+}
+
+static double db(double g)
+{
+  return 20.0 * log10(g > 1e-9 ? g : 1e-9);
+}
+
+static void check_dc(const chain_t *c)
+{
+  int16_t y = 0;
+  int wrong = 0;
+
+  chain_init(c);
+  for (uint32_t i = 0; i < 200 * c->factor; i++)
+    if (decim_push_chain(c->stages, c->count, 1234, &y) && i > 100 * c->factor)
+      wrong += y != 1234;
+  CHECK_EQ(wrong, 0);
+}
+
+// Passband within 0.5 dB, everything aliasing onto it 55 dB down
+static void check_response(const chain_t *c)
+{
+  double nyq = SCAN_HZ / c->factor / 2;
+  double worst_pass = 0, worst_stop = -200;
+
+  for (double hz = nyq / 32; hz <= nyq / 2; hz += nyq / 32)
+  {
+    double d = fabs(db(gain(c, hz)));
+    worst_pass = d > worst_pass ? d : worst_pass;
+  }
+  // Stopband: aliases of the passband, off the exact multiples of the output rate
+  for (double hz = 2 * nyq - nyq / 2 + nyq / 64; hz < SCAN_HZ / 2; hz += nyq / 7.3)
+  {
+    double d = db(gain(c, hz));
+    worst_stop = d > worst_stop ? d : worst_stop;
+  }
+  CHECK(worst_pass <= 0.5);
+  CHECK(worst_stop <= -55.0);
+}
+
+static void bench(void)
+{
+  printf("%-6s %10s %10s %10s %10s %10s %10s\n", "chain", "0.25 nyq", "0.5 nyq", "0.8 nyq", "nyq", "1.5 nyq",
+         "2 nyq-");
+  for (int c = 0; c < 3; c++)
+  {
+    double nyq = SCAN_HZ / chains[c].factor / 2;
+    printf("%-6s %8.2fdB %8.2fdB %8.2fdB %8.2fdB %8.2fdB %8.2fdB\n", chains[c].name, db(gain(&chains[c], 0.25 * nyq)),
+           db(gain(&chains[c], 0.5 * nyq)), db(gain(&chains[c], 0.8 * nyq)), db(gain(&chains[c], 0.999 * nyq)),
+           db(gain(&chains[c], 1.5 * nyq)), db(gain(&chains[c], 1.999 * nyq - 0.5 * nyq)));
+  }
+
+  // One minute of scans through the whole graph
+  static uint16_t scan[60000][4];
+  uint32_t seed = 3, outputs = 0;
+  emg_ctx_t emg1, emg2;
+
+  for (uint32_t i = 0; i < 60000; i++)
+  {
+    double t = i / SCAN_HZ;
+    scan[i][0] = synth_adc(t, 2048, 300, 1.7f, 4, &seed);  // acc
+    scan[i][1] = synth_adc(t, 2100, 150, 0.25f, 4, &seed); // flex
+    scan[i][2] = synth_adc(t, 1500, 20, 0.05f, 2, &seed);  // gsr
+    scan[i][3] = synth_adc(t, 2048, 0, 0, 40, &seed);      // emg
+  }
+  for (int c = 0; c < 3; c++)
+    chain_init(&chains[c]);
+  emg_begin(&emg1);
+  emg_begin(&emg2);
+  uint64_t start = harness_ns(), cyc = harness_cycles();
+  for (uint32_t i = 0; i < 60000; i++)
+  {
+    int16_t y;
+    outputs += emg_add(&emg1, scan[i][3]);
+    outputs += emg_add(&emg2, scan[i][3]);
+    for (int c = 0; c < 3; c++)
+      outputs += decim_push_chain(chains[c].stages, chains[c].count, scan[i][c], &y);
+  }
+  double ns = (double)(harness_ns() - start) / 60000, cycles = (double)(harness_cycles() - cyc) / 60000;
+  printf("graph: %.1f ns/scan, %.1f cycles/scan, %.2f %% of the 1 ms scan period\n", ns, cycles, ns / 1e4);
+  harness_keep(&outputs);
+}
+
+int main(int argc, char **argv)
+{
+  for (int c = 0; c < 3; c++)
+  {
+    check_dc(&chains[c]);
+    check_response(&chains[c]);
+  }
+  if (harness_bench(argc, argv))
+    bench();
+  return harness_result("test_decim");
+}
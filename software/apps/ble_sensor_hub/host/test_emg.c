@@ -0,0 +1,262 @@
+// emg.c on synthetic surface EMG at the 1 kHz scan rate: gaussian noise
+// band-limited to roughly 30..150 Hz, in contractions of known amplitude on a
+// resting floor, with motion drift underneath. Every contraction has to be
+// detected once, within 150 ms of its start and ended within 450 ms of its
+// end (the envelope decays by half a block at a time, then holds), and rest
+// must not start one. The envelope has to scale with the contraction, barely
+// move with the drift, and pass a tone in the EMG band well over one near the
+// scan Nyquist frequency. What goes into the telemetry records has to fit
+// their 12-bit fields, so a strong contraction and even a full scale square
+// wave decode as they were sent.
+//
+//   test_emg [-b]   -b adds the envelope per contraction and the host cost
+//                   per sample
+
+#include <math.h>
+#include "codec.h"
+#include "decode.h"
+#include "emg.h"
+#include "harness.h"
+#include "synth.h"
+
+#define SCAN_HZ 1000
+#define SECONDS 60
+#define SAMPLES (SECONDS * SCAN_HZ)
+#define BURSTS 5
+
+typedef struct
+{
+  double start;
+  double length;
+  double rms; // ADC counts
+} burst_t;
+
+static const burst_t bursts[BURSTS] = {
+    {5, 2, 60}, {12, 1, 120}, {20, 3, 40}, {30, 0.5, 200}, {40, 4, 80},
+};
+
+static uint16_t scans[SAMPLES];
+
+// Band-limited noise of unit RMS: the difference of two one-pole low-passes
+static double band_noise(uint32_t *seed)
+{
+  static double lo, hi;
+  double x = synth_gauss(seed);
+
+  hi += (x - hi) * 0.6;  // about 150 Hz
+  lo += (x - lo) * 0.17; // about 30 Hz
+  return (hi - lo) * 2.2;
+}
+
+static void make_scans(double drift)
+{
+  uint32_t seed = 47;
+
+  for (int i = 0; i < SAMPLES; i++)
+  {
+    double t = (double)i / SCAN_HZ;
+    double rms = 4; // resting floor
+    for (int b = 0; b < BURSTS; b++)
+      if (t >= bursts[b].start && t < bursts[b].start + bursts[b].length)
+        rms = bursts[b].rms;
+    double v = 2048 + rms * band_noise(&seed) + drift * sin(2.0 * M_PI * 2.0 * t);
+    scans[i] = v < 0 ? 0 : v > 4095 ? 4095 : (uint16_t)lround(v);
+  }
+}
+
+// Envelope per burst, averaged over its middle, 1/8 counts
+static void run(double onset_s[BURSTS], double offset_s[BURSTS], double env[BURSTS], uint32_t *onsets)
+{
+  emg_ctx_t ctx;
+  bool active = false;
+  uint32_t n[BURSTS] = {0};
+
+  for (int b = 0; b < BURSTS; b++)
+    onset_s[b] = offset_s[b] = -1, env[b] = 0;
+  emg_begin(&ctx);
+  for (int i = 0; i < SAMPLES; i++)
+  {
+    double t = (double)(i + 1) / SCAN_HZ;
+
+    if (!emg_add(&ctx, scans[i]))
+      continue;
+    for (int b = 0; b < BURSTS; b++)
+    {
+      const burst_t *u = &bursts[b];
+      if (t > u->start + 0.3 * u->length && t < u->start + 0.9 * u->length)
+      {
+        env[b] += emg_envelope(&ctx);
+        n[b]++;
+      }
+      // Changes between this burst and the next are this burst's
+      if (emg_active(&ctx) != active && t >= u->start && (b + 1 == BURSTS || t < bursts[b + 1].start))
+      {
+        if (!active && onset_s[b] < 0)
+          onset_s[b] = t - u->start;
+        else if (active)
+          offset_s[b] = t - (u->start + u->length);
+      }
+    }
+    active = emg_active(&ctx);
+  }
+  for (int b = 0; b < BURSTS; b++)
+    env[b] /= n[b] ? n[b] : 1;
+  *onsets = emg_onsets(&ctx);
+}
+
+static void check_bursts(void)
+{
+  double onset[BURSTS], offset[BURSTS], env[BURSTS];
+  uint32_t onsets;
+
+  make_scans(0);
+  run(onset, offset, env, &onsets);
+  CHECK_EQ(onsets, BURSTS);
+  for (int b = 0; b < BURSTS; b++)
+  {
+    CHECK(onset[b] >= 0 && onset[b] <= 0.150);
+    CHECK(offset[b] >= 0 && offset[b] <= 0.450);
+    // The envelope follows the contraction within 20 %, whatever its strength
+    CHECK_NEAR(env[b] / bursts[b].rms, env[0] / bursts[0].rms, 0.2 * env[0] / bursts[0].rms);
+  }
+}
+
+// Movement under the electrodes at 2 Hz, 100 counts: what the high-pass leaves
+// raises the resting floor, the weakest contraction still has to clear it
+static void check_drift(void)
+{
+  double onset[BURSTS], offset[BURSTS], env[BURSTS], clean[BURSTS];
+  uint32_t onsets;
+
+  make_scans(0);
+  run(onset, offset, clean, &onsets);
+  make_scans(100);
+  run(onset, offset, env, &onsets);
+  CHECK_EQ(onsets, BURSTS);
+  for (int b = 0; b < BURSTS; b++)
+    CHECK_NEAR(env[b], clean[b], 0.15 * clean[b]);
+}
+
+// Envelope of a steady tone at hz, 1/8 counts
+static double tone(double hz)
+{
+  emg_ctx_t ctx;
+  double sum = 0;
+  int n = 0;
+
+  emg_begin(&ctx);
+  for (int i = 0; i < 5 * SCAN_HZ; i++)
+    if (emg_add(&ctx, (uint16_t)lround(2048 + 200 * sin(2.0 * M_PI * hz * i / SCAN_HZ))) && i > SCAN_HZ)
+    {
+      sum += emg_envelope(&ctx);
+      n++;
+    }
+  return sum / n;
+}
+
+// Both one-pole sections: 450 Hz, noise and aliases from above Nyquist, and
+// 2 Hz motion well under the band
+static void check_band(void)
+{
+  double in_band = tone(80);
+
+  CHECK(tone(450) < 0.5 * in_band);
+  CHECK(tone(2) < 0.15 * in_band);
+}
+
+// Envelope records of an 80 Hz contraction of amp counts around mid scale,
+// square for a square wave, packed and decoded the way the host gets them.
+// Returns the largest envelope, 1/8 counts, with the largest value sent and
+// the records that decode differently.
+static uint16_t envelope_records(double amp, bool square, uint16_t *sent, uint32_t *wrong)
+{
+  static telemetry_record_t records[4 * SCAN_HZ / EMG_BLOCK], out[4 * SCAN_HZ / EMG_BLOCK];
+  static uint8_t block[2048];
+  emg_ctx_t ctx;
+  codec_enc_t enc;
+  uint16_t n = 0, most = 0;
+
+  emg_begin(&ctx);
+  for (int i = 0; i < 4 * SCAN_HZ; i++)
+  {
+    double s = sin(2.0 * M_PI * 80 * i / SCAN_HZ);
+    double v = 2048 + amp * (square ? (s < 0 ? -1 : 1) : s);
+    if (!emg_add(&ctx, v < 0 ? 0 : v > 4095 ? 4095 : (uint16_t)lround(v)))
+      continue;
+    most = emg_envelope(&ctx) > most ? emg_envelope(&ctx) : most;
+    records[n] = (telemetry_record_t){
+        .ticks = synth_ticks(i / (double)SCAN_HZ),
+        .emg1 = emg_envelope_telemetry(&ctx),
+        .emg2 = emg_envelope_telemetry(&ctx),
+    };
+    n++;
+  }
+  codec_begin(&enc, block, sizeof(block));
+  for (uint16_t i = 0; i < n; i++)
+    CHECK(codec_push(&enc, &records[i]));
+  CHECK_EQ(decode_packed(block, codec_end(&enc), n, out), n);
+  *sent = *wrong = 0;
+  for (uint16_t i = 0; i < n; i++)
+  {
+    *wrong += memcmp(&out[i], &records[i], sizeof(out[i])) != 0;
+    *sent = out[i].emg1 > *sent ? out[i].emg1 : *sent;
+  }
+  return most;
+}
+
+static void check_telemetry(void)
+{
+  uint16_t sent;
+  uint32_t wrong;
+
+  // 1400 counts: past 4095 in the envelope's own 1/8 counts
+  uint16_t env = envelope_records(1400, false, &sent, &wrong);
+  CHECK(env > 4095);
+  CHECK_EQ(wrong, 0);
+  CHECK_EQ(sent, env >> EMG_TELEMETRY_SHIFT);
+  CHECK(sent < EMG_TELEMETRY_MAX);
+
+  // A full scale square wave, as much as the ADC can give, still fits
+  env = envelope_records(2047, true, &sent, &wrong);
+  CHECK_EQ(wrong, 0);
+  CHECK_EQ(sent, env >> EMG_TELEMETRY_SHIFT);
+  CHECK(sent < EMG_TELEMETRY_MAX);
+}
+
+// Cycles are the TSC's on x86, 0 elsewhere
+static void bench(void)
+{
+  double onset[BURSTS], offset[BURSTS], env[BURSTS];
+  uint32_t onsets, rounds = 20, total = 0;
+  emg_ctx_t ctx;
+
+  make_scans(0);
+  run(onset, offset, env, &onsets);
+  printf("%8s %8s %8s %8s %10s\n", "rms", "onset", "offset", "env", "env/rms");
+  for (int b = 0; b < BURSTS; b++)
+    printf("%8.0f %6.0fms %6.0fms %8.0f %10.2f\n", bursts[b].rms, onset[b] * 1000, offset[b] * 1000, env[b],
+           env[b] / bursts[b].rms);
+  printf("tone 80 Hz %.0f, 450 Hz %.0f, 2 Hz %.0f\n", tone(80), tone(450), tone(2));
+
+  uint64_t start = harness_ns(), cyc = harness_cycles();
+  for (uint32_t r = 0; r < rounds; r++)
+  {
+    emg_begin(&ctx);
+    for (int i = 0; i < SAMPLES; i++)
+      total += emg_add(&ctx, scans[i]);
+  }
+  double n = (double)rounds * SAMPLES;
+  printf("emg_add: %.1f ns/sample, %.1f cycles/sample\n", (harness_ns() - start) / n, (harness_cycles() - cyc) / n);
+  harness_keep(&total);
+}
+
+int main(int argc, char **argv)
+{
+  check_bursts();
+  check_drift();
+  check_band();
+  check_telemetry();
+  if (harness_bench(argc, argv))
+    bench();
+  return harness_result("test_emg");
+}
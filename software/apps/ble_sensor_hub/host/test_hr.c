@@ -0,0 +1,189 @@
+// Beat timing of the PPG path against a synthetic PPG whose beat times are
+// known (synth.h): FIFO bursts through checkForBeat_block(), beat times from
+// hr_beat_ticks() the way hr_update() takes them, rates from hr_add_beat().
+// Every detected beat is matched to the true beat nearest to it, and each
+// beat to beat interval is compared with the true one. The interpolated
+// crossing has to land within a few ms of the true beat to beat interval and
+// beat the sample stamps it replaced by a wide margin, which in turn beat the old stamps
+// taken when the 60 ms timer fired. The rate has to settle on the true one
+// with the RTC wrapping partway.
+//
+//   test_hr [-b]   -b adds the interval error of the three stamps over rates
+//                  and sample rates, and the host cost per sample of detection
+
+#include <math.h>
+#include "algorithm.h"
+#include "harness.h"
+#include "hr.h"
+#include "synth.h"
+
+#define BURST 24            // PPG_WATERMARK
+#define TIMER_S 0.060       // period of the timer beats used to be stamped at
+#define START_S 500.0       // RTC time at the first sample, it wraps at 512 s
+#define BEATS_MAX 1024
+#define MATCH_S 0.3         // a detected beat this far from every true one is false
+
+typedef struct
+{
+  uint32_t beats; // true ones
+  uint32_t found;
+  uint32_t matched;
+  uint32_t intervals; // consecutive matched pairs
+  double offset_s;    // interpolated stamp less true time, summed
+  double rms_ms[3];   // interval error: timer, sample, interpolated
+  uint16_t bpm;       // hr_add_beat() average at the end
+  uint64_t ns;        // host time in detection
+  uint32_t samples;
+} result_t;
+
+// Seconds since START_S of a wrapped tick stamp, near a known time
+static double ticks_s(uint32_t ticks, double near)
+{
+  double t = (double)ticks / SYNTH_TICK_HZ - START_S;
+  double span = (double)(SYNTH_TICK_MASK + 1) / SYNTH_TICK_HZ;
+
+  return t + span * round((near - t) / span);
+}
+
+static result_t run(float bpm, float rate_hz, double seconds)
+{
+  synth_ppg_t p = {
+      .rate_hz = rate_hz,
+      .bpm = bpm,
+      .rr_jitter = 0.03f, // as data/session.csv
+      .ir_dc = 90000,
+      .ir_ac = 150,
+      .red_dc = 70000,
+      .red_ac = 90,
+      .noise = 3,
+      .seed = 41,
+  };
+  static double truth[BEATS_MAX];
+  int32_t ir[BEAT_BLOCK_SIZE];
+  uint32_t ticks[BEAT_BLOCK_SIZE];
+  double t[BEAT_BLOCK_SIZE];
+  beat_t beats[BEAT_BLOCK_SIZE];
+  uint32_t period_q8 = (uint32_t)lround(256.0 * SYNTH_TICK_HZ / rate_hz);
+  uint32_t samples = (uint32_t)(seconds * rate_hz);
+  result_t res = {0};
+  hr_ctx_t hr;
+  int last = -1;              // true beat matched before
+  double prev[3] = {0, 0, 0}; // its stamps
+
+  beat_reset();
+  hr_begin(&hr);
+  synth_ppg_begin(&p);
+  for (uint32_t base = 0; base < samples; base += BURST)
+  {
+    uint16_t n = samples - base < BURST ? samples - base : BURST;
+
+    for (uint16_t i = 0; i < n; i++)
+    {
+      uint32_t red, sample;
+      double beat_t;
+
+      t[i] = p.t;
+      ticks[i] = synth_ticks(START_S + p.t);
+      if (synth_ppg_next(&p, &red, &sample, &beat_t) && res.beats < BEATS_MAX)
+        truth[res.beats++] = beat_t;
+      ir[i] = sample;
+    }
+    uint64_t start = harness_ns();
+    uint16_t found = checkForBeat_block(ir, n, beats);
+    res.ns += harness_ns() - start;
+    res.samples += n;
+
+    for (uint16_t b = 0; b < found; b++)
+    {
+      beat_t at_sample = {.idx = beats[b].idx, .lag_q8 = 0};
+      uint32_t stamp = hr_beat_ticks(&beats[b], ticks[beats[b].idx], period_q8);
+      double sample_t = t[beats[b].idx];
+      double stamps[3] = {
+          ceil(sample_t / TIMER_S) * TIMER_S,
+          ticks_s(hr_beat_ticks(&at_sample, ticks[beats[b].idx], period_q8), sample_t),
+          ticks_s(stamp, sample_t),
+      };
+      int match = -1;
+
+      res.found++;
+      if (hr_add_beat(&hr, stamp))
+        res.bpm = hr_bpm(&hr);
+      for (uint32_t k = 0; k < res.beats; k++)
+        if (fabs(truth[k] - stamps[2]) < MATCH_S)
+          match = k;
+      if (match < 0)
+        continue;
+      res.matched++;
+      res.offset_s += stamps[2] - truth[match];
+      if (match == last + 1 && last >= 0)
+      {
+        double rr = truth[match] - truth[last];
+        for (int m = 0; m < 3; m++)
+          res.rms_ms[m] += pow(1000.0 * (stamps[m] - prev[m] - rr), 2);
+        res.intervals++;
+      }
+      last = match;
+      for (int m = 0; m < 3; m++)
+        prev[m] = stamps[m];
+    }
+  }
+  for (int m = 0; m < 3; m++)
+    res.rms_ms[m] = sqrt(res.rms_ms[m] / res.intervals);
+  res.offset_s /= res.matched;
+  return res;
+}
+
+// The firmware's rate: 72 bpm at 25 sps for 5 minutes, through the RTC wrap
+static void check_timing(void)
+{
+  result_t r = run(72, 25, 300);
+
+  CHECK(r.beats >= 355);
+  CHECK_EQ(r.matched, r.found);           // nothing false
+  CHECK(r.matched >= r.beats - 5);        // the DC estimator settling
+  CHECK(r.intervals >= r.matched - 3);
+  // The FIR delay is undone, what is left is the DC estimator's phase lead
+  CHECK_NEAR(r.offset_s, 0, 0.040);
+  CHECK(r.rms_ms[2] < 8.0);
+  CHECK(r.rms_ms[2] * 3 < r.rms_ms[1]);   // interpolation against sample stamps
+  CHECK(r.rms_ms[1] < r.rms_ms[0]);       // sample stamps against the timer
+  CHECK_NEAR(r.bpm, 72, 2);
+}
+
+// The beat time steps back by the lag and the FIR delay, across the wrap
+static void check_beat_ticks(void)
+{
+  uint32_t period_q8 = (SYNTH_TICK_HZ << 8) / 25;
+  beat_t beat = {.idx = 0, .lag_q8 = 128};
+  uint32_t lag = (uint32_t)((BEAT_FIR_DELAY + 0.5) * SYNTH_TICK_HZ / 25);
+
+  CHECK_EQ(hr_beat_ticks(&beat, 100000, period_q8), 100000 - lag);
+  CHECK_EQ(hr_beat_ticks(&beat, 100, period_q8), (100 - lag) & HR_TICK_MASK);
+  // Twice the period at the power state's half rate, twice the lag
+  CHECK_NEAR(hr_beat_ticks(&beat, 100000, 2 * period_q8), 100000 - 2 * lag, 1);
+}
+
+static void bench(void)
+{
+  static const float rates[] = {25, 50, 100};
+  static const float bpms[] = {45, 72, 120, 180};
+
+  printf("%6s %5s %8s %12s %12s %12s %10s\n", "sps", "bpm", "found", "timer ms", "sample ms", "interp ms",
+         "ns/sample");
+  for (int s = 0; s < 3; s++)
+    for (int b = 0; b < 4; b++)
+    {
+      result_t r = run(bpms[b], rates[s], 300);
+      printf("%6.0f %5.0f %4u/%-3u %12.2f %12.2f %12.2f %10.1f\n", rates[s], bpms[b], (unsigned)r.matched,
+             (unsigned)r.beats, r.rms_ms[0], r.rms_ms[1], r.rms_ms[2], (double)r.ns / r.samples);
+    }
+}
+
+int main(int argc, char **argv)
+{
+  check_beat_ticks();
+  check_timing();
+  if (harness_bench(argc, argv))
+    bench();
+  return harness_result("test_hr");
+}
@@ -0,0 +1,254 @@
+// hrv.c against synthetic RR sequences with known intervals. Beats are
+// stamped on the wrapping RTC the way hr_beat() hands them over, and after
+// every beat RMSSD, SDNN and pNN50 have to match the textbook definitions
+// computed in doubles over the same window, within the millisecond the tick
+// conversion truncates. Premature beats with their compensatory pause and
+// missed beats have to be rejected, and leave the metrics as if the clean
+// intervals around them were the only ones, the successive difference across
+// the gap left out. A step in rate has to restart the window.
+//
+//   test_hrv [-b]   -b adds the host cost per beat of hrv_add_beat() and of
+//                   hrv_metrics()
+
+#include <math.h>
+#include "harness.h"
+#include "hrv.h"
+#include "synth.h"
+
+#define START_S 505.0 // RTC time at the first beat, it wraps at 512 s
+#define BEATS 2000
+
+// What hrv.c should hold, in true intervals
+typedef struct
+{
+  double rr[BEATS];
+  double diff[BEATS];
+  uint32_t rr_count;
+  uint32_t diff_count;
+  bool last_valid;
+} ref_t;
+
+static void ref_add(ref_t *r, double rr)
+{
+  if (r->last_valid)
+    r->diff[r->diff_count++] = rr - r->rr[r->rr_count - 1];
+  r->rr[r->rr_count++] = rr;
+  r->last_valid = true;
+}
+
+// Metrics over the last HRV_WINDOW intervals and differences
+static void ref_metrics(const ref_t *r, double *rmssd, double *sdnn, double *pnn50)
+{
+  uint32_t n = r->rr_count < HRV_WINDOW ? r->rr_count : HRV_WINDOW;
+  uint32_t m = r->diff_count < HRV_WINDOW ? r->diff_count : HRV_WINDOW;
+  const double *rr = &r->rr[r->rr_count - n];
+  const double *diff = &r->diff[r->diff_count - m];
+  double mean = 0, var = 0, sq = 0, nn50 = 0;
+
+  for (uint32_t i = 0; i < n; i++)
+    mean += rr[i] / n;
+  for (uint32_t i = 0; i < n; i++)
+    var += (rr[i] - mean) * (rr[i] - mean);
+  for (uint32_t i = 0; i < m; i++)
+  {
+    sq += diff[i] * diff[i];
+    nn50 += fabs(diff[i]) > HRV_NN50_MS;
+  }
+  *sdnn = n >= 2 ? sqrt(var / (n - 1)) : 0;
+  *rmssd = m ? sqrt(sq / m) : 0;
+  *pnn50 = m ? 1000.0 * nn50 / m : 0;
+}
+
+// Resting rhythm: respiratory sinus arrhythmia plus gaussian spread, ms
+static double next_rr(uint32_t i, double mean, uint32_t *seed)
+{
+  return mean + 40.0 * sin(2.0 * M_PI * i / 4.5) + 25.0 * synth_gauss(seed);
+}
+
+// Feeds a beat at t and compares the metrics with the reference; returns
+// the number of metrics outside tolerance
+static int beat(hrv_ctx_t *ctx, double t, bool accept, const ref_t *r)
+{
+  hrv_metrics_t m;
+  double rmssd, sdnn, pnn50;
+  uint32_t diffs;
+
+  CHECK_EQ(hrv_add_beat(ctx, synth_ticks(START_S + t)), accept);
+  hrv_metrics(ctx, &m);
+  ref_metrics(r, &rmssd, &sdnn, &pnn50);
+  diffs = r->diff_count < HRV_WINDOW ? r->diff_count : HRV_WINDOW;
+  // Each interval is off by up to 1 ms, the square root floors
+  return (fabs(m.rmssd_ms - rmssd) > 1.5) + (fabs(m.sdnn_ms - sdnn) > 1.5) +
+         (diffs && fabs(m.pnn50 - pnn50) > 2000.0 / diffs + 1);
+}
+
+// A clean rhythm through the RTC wrap: every interval accepted
+static void check_clean(void)
+{
+  static ref_t r;
+  hrv_ctx_t ctx;
+  uint32_t seed = 3;
+  double t = 0;
+  int bad = 0;
+
+  memset(&r, 0, sizeof(r));
+  hrv_begin(&ctx);
+  CHECK(!hrv_add_beat(&ctx, synth_ticks(START_S)));
+  for (uint32_t i = 0; i < 500; i++)
+  {
+    double rr = next_rr(i, 850, &seed);
+
+    t += rr / 1000;
+    ref_add(&r, rr);
+    bad += beat(&ctx, t, true, &r);
+  }
+  CHECK_EQ(bad, 0);
+  CHECK_EQ(ctx.accepted, 500);
+  CHECK_EQ(ctx.rejected, 0);
+  CHECK_NEAR(hrv_rr(&ctx), r.rr[r.rr_count - 1], 1);
+}
+
+// Every 37th beat premature at 60% with a compensatory pause, every 53rd
+// missed by the detector: those intervals out, the chain broken after them
+static void check_artifacts(void)
+{
+  static ref_t r;
+  hrv_ctx_t ctx;
+  uint32_t seed = 5, artifacts = 0;
+  double t = 0;
+  int bad = 0;
+
+  memset(&r, 0, sizeof(r));
+  hrv_begin(&ctx);
+  hrv_add_beat(&ctx, synth_ticks(START_S));
+  for (uint32_t i = 0; i < BEATS / 2; i++)
+  {
+    double rr = next_rr(i, 850, &seed);
+
+    if (i > 8 && i % 37 == 0)
+    {
+      r.last_valid = false;
+      bad += beat(&ctx, t + 0.6 * rr / 1000, false, &r);
+      bad += beat(&ctx, t + 2 * rr / 1000, false, &r);
+      t += 2 * rr / 1000;
+      artifacts += 2;
+    }
+    else if (i > 8 && i % 53 == 0)
+    {
+      double next = next_rr(++i, 850, &seed);
+
+      r.last_valid = false;
+      bad += beat(&ctx, t + (rr + next) / 1000, false, &r);
+      t += (rr + next) / 1000;
+      artifacts++;
+    }
+    else
+    {
+      t += rr / 1000;
+      ref_add(&r, rr);
+      bad += beat(&ctx, t, true, &r);
+    }
+  }
+  CHECK_EQ(bad, 0);
+  CHECK_EQ(ctx.rejected, artifacts);
+  CHECK(artifacts > 60);
+}
+
+// A step from 1000 to 600 ms: HRV_REJECT_RESET rejections, then a new window
+static void check_restart(void)
+{
+  hrv_ctx_t ctx;
+  hrv_metrics_t m;
+  uint32_t seed = 7;
+  double t = 0;
+
+  hrv_begin(&ctx);
+  hrv_add_beat(&ctx, synth_ticks(START_S));
+  for (uint32_t i = 0; i < 100; i++)
+  {
+    t += next_rr(i, 1000, &seed) / 1000;
+    hrv_add_beat(&ctx, synth_ticks(START_S + t));
+  }
+  CHECK_EQ(ctx.rejected, 0);
+  for (uint32_t i = 0; i < HRV_REJECT_RESET; i++)
+  {
+    t += 0.6;
+    CHECK(!hrv_add_beat(&ctx, synth_ticks(START_S + t)));
+  }
+  CHECK_EQ(ctx.rr_count, 0);
+  for (uint32_t i = 0; i < HRV_WINDOW; i++)
+  {
+    t += 0.6;
+    CHECK(hrv_add_beat(&ctx, synth_ticks(START_S + t)));
+  }
+  hrv_metrics(&ctx, &m);
+  CHECK_NEAR(hrv_rr(&ctx), 600, 1);
+  CHECK(m.sdnn_ms <= 1);
+  CHECK(m.rmssd_ms <= 1);
+  CHECK_EQ(m.pnn50, 0);
+}
+
+// Intervals outside HRV_RR_MIN_MS..HRV_RR_MAX_MS never enter an empty window
+static void check_range(void)
+{
+  hrv_ctx_t ctx;
+
+  hrv_begin(&ctx);
+  hrv_add_beat(&ctx, synth_ticks(START_S));
+  CHECK(!hrv_add_beat(&ctx, synth_ticks(START_S + 0.25)));
+  CHECK(!hrv_add_beat(&ctx, synth_ticks(START_S + 2.35)));
+  CHECK(hrv_add_beat(&ctx, synth_ticks(START_S + 3.15)));
+  CHECK_EQ(ctx.rr_count, 1);
+  CHECK_EQ(ctx.diff_count, 0);
+}
+
+// Cycles are the TSC's on x86, 0 elsewhere
+static void bench(void)
+{
+  static uint32_t ticks[BEATS];
+  hrv_ctx_t ctx;
+  hrv_metrics_t m;
+  uint32_t seed = 9, accepted = 0;
+  double t = 0;
+
+  for (uint32_t i = 0; i < BEATS; i++)
+  {
+    t += next_rr(i, 850, &seed) / 1000;
+    ticks[i] = synth_ticks(START_S + t);
+  }
+  printf("%-12s %10s %10s\n", "", "ns/beat", "cyc/beat");
+  for (int metrics = 0; metrics < 2; metrics++)
+  {
+    uint32_t rounds = 200;
+    uint64_t ns = 0, cyc = 0;
+
+    for (uint32_t r = 0; r < rounds; r++)
+    {
+      hrv_begin(&ctx);
+      uint64_t start = harness_ns(), start_cyc = harness_cycles();
+      for (uint32_t i = 0; i < BEATS; i++)
+      {
+        accepted += hrv_add_beat(&ctx, ticks[i]);
+        if (metrics)
+          hrv_metrics(&ctx, &m);
+      }
+      ns += harness_ns() - start;
+      cyc += harness_cycles() - start_cyc;
+      harness_keep(&m);
+    }
+    printf("%-12s %10.1f %10.1f\n", metrics ? "add+metrics" : "add", (double)ns / rounds / BEATS,
+           (double)cyc / rounds / BEATS);
+  }
+  harness_keep(&accepted);
+}
+
+int main(int argc, char **argv)
+{
+  check_clean();
+  check_artifacts();
+  check_restart();
+  check_range();
+  if (harness_bench(argc, argv))
+    bench();
+  return harness_result("test_hrv");
+}
@@ -0,0 +1,426 @@
+// max30102.c against the register and FIFO model in max30102_sim.c: setup,
+// the blocking accessors and the asynchronous FIFO drain main.c runs on the
+// almost-full interrupt, including overflow and pointer wrap, and the
+// watermark over its whole range. On the timed bus,
+// the drain against the blocking burst read it replaced: CPU time lost waiting
+// and samples delivered, over sample rates and bus latencies.
+//
+//   test_max30102 [-b]   -b adds the host cost of a drain per sample and the
+//                        blocking versus asynchronous table
+
+#include "harness.h"
+#include "max30102.h"
+#include "max30102_sim.h"
+#include "twi_sim.h"
+
+#define WATERMARK 24
+
+static struct
+{
+  uint32_t calls;
+  ret_code_t result;
+  uint8_t count;
+  uint8_t overflow;
+  uint32_t red[MAX30102_FIFO_DEPTH];
+  uint32_t ir[MAX30102_FIFO_DEPTH];
+} drained;
+
+static void on_fifo(ret_code_t result, const uint32_t *red, const uint32_t *ir, uint8_t count, uint8_t overflow)
+{
+  drained.calls++;
+  drained.result = result;
+  drained.count = count;
+  drained.overflow = overflow;
+  for (uint8_t i = 0; i < count; i++)
+  {
+    drained.red[i] = red[i];
+    drained.ir[i] = ir[i];
+  }
+}
+
+static uint32_t next_sample; // sample n is red 2n, IR 2n + 1, within 18 bits
+
+static void produce(int n)
+{
+  for (int i = 0; i < n; i++, next_sample++)
+    max30102_sim_sample((2 * next_sample) & 0x3FFFF, (2 * next_sample + 1) & 0x3FFFF);
+}
+
+static void drain(void)
+{
+  drained.calls = 0;
+  CHECK_EQ(MAX30102_read_fifo_async(on_fifo), NRF_SUCCESS);
+  twi_sim_run();
+  CHECK_EQ(drained.calls, 1);
+  CHECK_EQ(drained.result, NRF_SUCCESS);
+}
+
+// Checks the drained samples continue the sequence from *expect
+static void check_sequence(uint32_t *expect)
+{
+  int wrong = 0;
+
+  for (uint8_t i = 0; i < drained.count; i++, (*expect)++)
+    wrong += drained.red[i] != ((2 * *expect) & 0x3FFFF) || drained.ir[i] != ((2 * *expect + 1) & 0x3FFFF);
+  CHECK_EQ(wrong, 0);
+}
+
+static void setup(void)
+{
+  nrf_drv_twi_config_t config = NRF_DRV_TWI_DEFAULT_CONFIG;
+  static bool twi_ready;
+
+  max30102_sim_attach();
+  if (!twi_ready)
+  {
+    config.frequency = NRF_TWIM_FREQ_400K;
+    MAX30102_twi_init(&config);
+    twi_ready = true;
+  }
+  MAX30102_reset();
+  MAX30102_init();
+  CHECK_EQ(MAX30102_set_watermark(WATERMARK), WATERMARK);
+  next_sample = 0;
+}
+
+static void check_init(void)
+{
+  uint8_t id;
+
+  setup();
+  MAX30102_read_register(0xFF, &id);
+  CHECK_EQ(id, MAX30102_SIM_PART_ID);
+  CHECK_EQ(max30102_sim_reg(0x02), 0x80);                 // A_FULL only
+  CHECK_EQ(max30102_sim_reg(0x08) & 0x0F, 32 - WATERMARK); // FIFO_A_FULL
+  CHECK_EQ(max30102_sim_reg(0x09), 0x03);                 // SpO2 mode
+  CHECK(!max30102_sim_int());
+}
+
+// The baseline one-sample read still works on the same bus
+static void check_read_fifo(void)
+{
+  uint32_t red, ir;
+
+  setup();
+  produce(2);
+  MAX30102_read_fifo(&red, &ir);
+  CHECK_EQ(red, 0);
+  CHECK_EQ(ir, 1);
+  MAX30102_read_fifo(&red, &ir);
+  CHECK_EQ(red, 2);
+  CHECK_EQ(ir, 3);
+  CHECK_EQ(max30102_sim_unread(), 0);
+}
+
+static void check_watermark_drain(void)
+{
+  uint32_t expect = 0;
+
+  setup();
+  produce(WATERMARK - 1);
+  CHECK(!max30102_sim_int());
+  produce(1);
+  CHECK(max30102_sim_int());
+
+  CHECK_EQ(MAX30102_read_fifo_async(on_fifo), NRF_SUCCESS);
+  CHECK_EQ(MAX30102_read_fifo_async(on_fifo), NRF_ERROR_BUSY);
+  drained.calls = 0;
+  twi_sim_run();
+  CHECK_EQ(drained.calls, 1);
+  CHECK_EQ(drained.count, WATERMARK);
+  CHECK_EQ(drained.overflow, 0);
+  check_sequence(&expect);
+  CHECK(!max30102_sim_int());
+  CHECK_EQ(max30102_sim_unread(), 0);
+
+  // Nothing pending completes with no samples
+  drain();
+  CHECK_EQ(drained.count, 0);
+}
+
+// Samples taken while the FIFO is full are lost, the drain returns the 32 it
+// holds and how many were dropped, and the count restarts after
+// Every watermark the driver accepts raises INT on exactly that many unread
+// samples and leaves a free slot for the one that lands during the drain.
+// Requests outside 17..31 are clamped, the rest of FIFO_CONF is left alone.
+static void check_watermark_range(void)
+{
+  static const struct
+  {
+    uint8_t asked;
+    uint8_t got;
+  } clamp[] = {{0, 17}, {16, 17}, {17, 17}, {24, 24}, {31, 31}, {32, 31}, {255, 31}};
+
+  setup();
+  uint8_t conf = max30102_sim_reg(0x08) & 0xF0;
+  for (size_t i = 0; i < sizeof(clamp) / sizeof(clamp[0]); i++)
+  {
+    CHECK_EQ(MAX30102_set_watermark(clamp[i].asked), clamp[i].got);
+    CHECK_EQ(max30102_sim_reg(0x08), conf | (32 - clamp[i].got));
+    CHECK_EQ(MAX30102_a_full_to_watermark(max30102_sim_reg(0x08)), clamp[i].got);
+  }
+  for (uint8_t a_full = 1; a_full <= 15; a_full++)
+    CHECK_EQ(MAX30102_watermark_to_a_full(MAX30102_a_full_to_watermark(a_full)), a_full);
+
+  for (uint8_t w = MAX30102_WATERMARK_MIN; w <= MAX30102_WATERMARK_MAX; w++)
+  {
+    uint32_t expect = 0;
+
+    setup();
+    MAX30102_set_watermark(w);
+    produce(w - 1);
+    CHECK(!max30102_sim_int());
+    produce(1);
+    CHECK(max30102_sim_int());
+    produce(1); // before the drain gets to it
+    drain();
+    CHECK_EQ(drained.count, w + 1);
+    CHECK_EQ(drained.overflow, 0);
+    check_sequence(&expect);
+  }
+}
+
+static void check_overflow(void)
+{
+  uint32_t expect = 0;
+
+  setup();
+  produce(MAX30102_FIFO_DEPTH + 9);
+  CHECK_EQ(max30102_sim_unread(), MAX30102_FIFO_DEPTH);
+  drain();
+  CHECK_EQ(drained.count, MAX30102_FIFO_DEPTH);
+  CHECK_EQ(drained.overflow, 9);
+  check_sequence(&expect);
+
+  // The overflow counter saturates at 31
+  produce(MAX30102_FIFO_DEPTH + 40);
+  drain();
+  CHECK_EQ(drained.count, MAX30102_FIFO_DEPTH);
+  CHECK_EQ(drained.overflow, 31);
+
+  produce(5);
+  drain();
+  CHECK_EQ(drained.count, 5);
+  CHECK_EQ(drained.overflow, 0);
+}
+
+// Drains of every size from 1 to 31 walk the 5-bit pointers around many times,
+// no sample may be lost, repeated or reordered
+static void check_wrap(void)
+{
+  uint32_t expect = 0;
+  uint32_t total = 0;
+
+  setup();
+  for (int round = 0; round < 200; round++)
+  {
+    int n = 1 + (round * 7) % (MAX30102_FIFO_DEPTH - 1);
+    produce(n);
+    drain();
+    CHECK_EQ(drained.count, n);
+    CHECK_EQ(drained.overflow, 0);
+    check_sequence(&expect);
+    total += drained.count;
+  }
+  CHECK_EQ(total, next_sample);
+}
+
+// A sensor that does not answer fails the drain, and the driver takes the next one
+static void check_nack(void)
+{
+  setup();
+  produce(WATERMARK);
+  twi_sim_detach(MAX30102_SIM_ADDR);
+  drained.calls = 0;
+  CHECK_EQ(MAX30102_read_fifo_async(on_fifo), NRF_SUCCESS);
+  twi_sim_run();
+  CHECK_EQ(drained.calls, 1);
+  CHECK_EQ(drained.result, NRF_ERROR_DRV_TWI_ERR_ANACK);
+  CHECK_EQ(drained.count, 0);
+  max30102_sim_attach();
+  CHECK_EQ(MAX30102_read_fifo_async(on_fifo), NRF_SUCCESS);
+  twi_sim_run();
+}
+
+// Waking up discards what was sampled before the shutdown
+static void check_shutdown(void)
+{
+  setup();
+  produce(10);
+  MAX30102_shutdown(true);
+  CHECK(max30102_sim_shutdown());
+  produce(10);
+  CHECK_EQ(max30102_sim_unread(), 10);
+  MAX30102_shutdown(false);
+  CHECK(!max30102_sim_shutdown());
+  CHECK_EQ(max30102_sim_unread(), 0);
+  CHECK(!max30102_sim_int());
+}
+
+// Bus time of a drain of n samples at 400 kHz: pointer read, then FIFO_DATA
+static uint64_t drain_ns(int n, uint32_t latency)
+{
+  uint32_t ptr_bits = 1 + (1 + 9 + 9) + (1 + 9 + 9 * 7); // INT_STATUS_1 through RD_PTR
+  uint32_t data_bits = 1 + (1 + 9 + 9) + (1 + 9 + 9 * MAX30102_SAMPLE_BYTES * n);
+
+  return 2 * (uint64_t)latency + (uint64_t)(ptr_bits + data_bits) * 1000000000u / 400000 + 1;
+}
+
+// The drain completes when the bus is through with both transactions, not before
+static void check_timing(void)
+{
+  for (uint32_t latency = 0; latency <= 2000000; latency += 1000000)
+  {
+    setup();
+    twi_sim_set_latency(latency);
+    produce(WATERMARK);
+    uint64_t start = twi_sim_now();
+    uint64_t end = start + drain_ns(WATERMARK, latency);
+
+    drained.calls = 0;
+    CHECK_EQ(MAX30102_read_fifo_async(on_fifo), NRF_SUCCESS);
+    twi_sim_advance(end - 1000);
+    CHECK_EQ(drained.calls, 0);
+    twi_sim_advance(end);
+    CHECK_EQ(drained.calls, 1);
+    CHECK_EQ(drained.count, WATERMARK);
+    CHECK_NEAR(twi_sim_now(), end, 2);
+    twi_sim_set_latency(0);
+  }
+}
+
+typedef struct
+{
+  uint32_t delivered;
+  uint32_t lost;
+  uint64_t blocked_ns;
+  uint64_t elapsed_ns;
+} stream_t;
+
+// The drain max30102.c used to do, blocking the caller for the whole burst,
+// reading the same registers as the asynchronous one
+static void drain_blocking(void)
+{
+  uint8_t regs[7]; // INT_STATUS_1 through RD_PTR
+  uint8_t raw[MAX30102_FIFO_DEPTH * MAX30102_SAMPLE_BYTES];
+
+  MAX30102_read_registers(0x00, regs, sizeof(regs));
+  uint8_t count = (regs[4] - regs[6]) & 0x1F;
+  if (count == 0 && ((regs[0] & 0x80) || (regs[5] & 0x1F)))
+    count = MAX30102_FIFO_DEPTH;
+  if (count)
+    MAX30102_read_registers(0x07, raw, count * MAX30102_SAMPLE_BYTES);
+  drained.count = count;
+  drained.overflow = regs[5] & 0x1F;
+}
+
+// Samples at rate_hz for the given time, draining on INT like val_update does,
+// with the blocking read or the asynchronous drain
+static stream_t stream(bool blocking, uint32_t rate_hz, uint32_t latency, double seconds)
+{
+  stream_t st = {0};
+  uint64_t period = 1000000000u / rate_hz;
+  uint64_t next = period;
+  uint64_t end;
+  bool busy = false;
+
+  setup();
+  twi_sim_set_latency(latency);
+  twi_sim_stats()->blocked_ns = 0;
+  end = twi_sim_now() + (uint64_t)(seconds * 1e9);
+  next += twi_sim_now();
+  while (twi_sim_now() < end)
+  {
+    drained.calls = 0;
+    twi_sim_advance(next < twi_sim_next() ? next : twi_sim_next());
+    if (drained.calls)
+    {
+      busy = false;
+      st.delivered += drained.count;
+      st.lost += drained.overflow;
+    }
+    for (; next <= twi_sim_now(); next += period)
+      produce(1);
+    if (max30102_sim_int() && !busy)
+    {
+      if (blocking)
+      {
+        drain_blocking();
+        st.delivered += drained.count;
+        st.lost += drained.overflow;
+      }
+      else
+        busy = MAX30102_read_fifo_async(on_fifo) == NRF_SUCCESS;
+    }
+  }
+  twi_sim_run();
+  st.blocked_ns = twi_sim_stats()->blocked_ns;
+  st.elapsed_ns = twi_sim_now() - (end - (uint64_t)(seconds * 1e9));
+  twi_sim_set_latency(0);
+  return st;
+}
+
+// At the firmware's rate both keep up without loss, only the blocking read
+// takes CPU time, and it grows with the bus latency
+static void check_stream(void)
+{
+  for (uint32_t latency = 0; latency <= 5000000; latency += 5000000)
+  {
+    stream_t async = stream(false, MAX30102_SAMPLE_RATE_HZ, latency, 60.0);
+    stream_t sync = stream(true, MAX30102_SAMPLE_RATE_HZ, latency, 60.0);
+    uint32_t expect = 60 * MAX30102_SAMPLE_RATE_HZ;
+
+    CHECK_EQ(async.lost, 0);
+    CHECK_EQ(sync.lost, 0);
+    CHECK(async.delivered >= expect - WATERMARK && async.delivered <= expect);
+    CHECK(sync.delivered >= expect - WATERMARK && sync.delivered <= expect);
+    CHECK_EQ(async.blocked_ns, 0);
+    CHECK(sync.blocked_ns >= sync.delivered / WATERMARK * drain_ns(WATERMARK, latency) - 1000);
+  }
+}
+
+static void bench(void)
+{
+  enum { ROUNDS = 20000 };
+
+  setup();
+  uint64_t start = harness_ns();
+  for (int i = 0; i < ROUNDS; i++)
+  {
+    produce(WATERMARK);
+    MAX30102_read_fifo_async(on_fifo);
+    twi_sim_run();
+  }
+  uint64_t ns = harness_ns() - start;
+  printf("drain of %d: %.1f ns/sample on the host, driver and model together\n", WATERMARK,
+         (double)ns / ROUNDS / WATERMARK);
+
+  printf("%7s %8s %18s %18s\n", "rate", "latency", "blocking", "async");
+  printf("%7s %8s %9s %8s %9s %8s\n", "sps", "us", "samp/s", "cpu idle", "samp/s", "cpu idle");
+  for (uint32_t rate = 25; rate <= 3200; rate *= 2)
+    for (uint32_t latency = 0; latency <= 1000000; latency += 1000000)
+    {
+      stream_t sync = stream(true, rate, latency, 10.0);
+      stream_t async = stream(false, rate, latency, 10.0);
+      printf("%7" PRIu32 " %8" PRIu32 " %9.0f %7.1f%% %9.0f %7.1f%%\n", rate, latency / 1000,
+             sync.delivered * 1e9 / sync.elapsed_ns, 100.0 - 100.0 * sync.blocked_ns / sync.elapsed_ns,
+             async.delivered * 1e9 / async.elapsed_ns, 100.0 - 100.0 * async.blocked_ns / async.elapsed_ns);
+    }
+}
+
+int main(int argc, char **argv)
+{
+  check_init();
+  check_read_fifo();
+  check_watermark_drain();
+  check_watermark_range();
+  check_overflow();
+  check_wrap();
+  check_nack();
+  check_shutdown();
+  check_timing();
+  check_stream();
+  if (harness_bench(argc, argv))
+    bench();
+  return harness_result("test_max30102");
+}
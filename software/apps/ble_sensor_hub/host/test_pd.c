@@ -0,0 +1,316 @@
+// pd.c against the original O(lag) detector it replaced, which rescanned the
+// whole window with getAvg()/getStd() on every sample. The reference below is
+// that code, moved into a struct so several can run side by side.
+//
+// A bank of channels must behave exactly like that many one-channel banks.
+//
+//   test_pd [-b]   -b adds the cost per sample over lag 16..1024 and the
+//                  bank throughput over channel counts
+
+#include <math.h>
+#include <stdlib.h>
+#include "harness.h"
+#include "pd.h"
+#include "synth.h"
+
+#define EPSILON 0.01f
+
+typedef struct
+{
+  int index, lag;
+  float threshold, influence;
+  int peak;
+  float *data, *avg, *std;
+} ref_t;
+
+static void ref_begin(ref_t *r, int l, float th, float inf)
+{
+  r->index = 0;
+  r->lag = l;
+  r->threshold = th;
+  r->influence = inf;
+  r->peak = 0;
+  r->data = calloc(l + 1, sizeof(float));
+  r->avg = calloc(l + 1, sizeof(float));
+  r->std = calloc(l + 1, sizeof(float));
+}
+
+static void ref_end(ref_t *r)
+{
+  free(r->data);
+  free(r->avg);
+  free(r->std);
+}
+
+static float ref_avg(const ref_t *r, int start, int len)
+{
+  float x = 0.0;
+  for (int i = 0; i < len; ++i)
+    x += r->data[(start + i) % r->lag];
+  return x / len;
+}
+
+static float ref_point(const ref_t *r, int start, int len)
+{
+  float xi = 0.0;
+  for (int i = 0; i < len; ++i)
+    xi += r->data[(start + i) % r->lag] * r->data[(start + i) % r->lag];
+  return xi / len;
+}
+
+static float ref_std(const ref_t *r, int start, int len)
+{
+  float x1 = ref_avg(r, start, len);
+  float x2 = ref_point(r, start, len);
+  float std_val = x2 - x1 * x1;
+  if (std_val > -EPSILON && std_val < EPSILON)
+    return 0.0;
+  return sqrt(std_val);
+}
+
+static void ref_add(ref_t *r, float sample)
+{
+  int i = r->index % r->lag;
+  int j = (r->index + 1) % r->lag;
+  float deviation = sample - r->avg[i];
+
+  r->peak = 0;
+  if (deviation > r->threshold * r->std[i])
+  {
+    r->data[j] = r->influence * sample + (1.0 - r->influence) * r->data[i];
+    r->peak = 1;
+  }
+  else if (deviation < -r->threshold * r->std[i])
+  {
+    r->data[j] = r->influence * sample + (1.0 - r->influence) * r->data[i];
+    r->peak = -1;
+  }
+  else
+    r->data[j] = sample;
+  r->avg[j] = ref_avg(r, j, r->lag);
+  r->std[j] = ref_std(r, j, r->lag);
+  r->index++;
+  if (r->index >= 16383)
+    r->index = r->lag + j;
+}
+
+static float ref_filt(const ref_t *r)
+{
+  return r->avg[r->index % r->lag];
+}
+
+// Noisy baseline with a slow swing and a spike every 97 samples, roughly what
+// the GSR and flex channels look like. Small values keep the reference's
+// E[x^2] - E[x]^2 out of float cancellation, which the new code does not have.
+static float signal(int i, uint32_t *seed)
+{
+  float x = 20.0f * sinf(i * 0.01f) + synth_gauss(seed);
+  if (i % 97 == 0)
+    x += 15.0f;
+  return x;
+}
+
+// Runs both for n samples and checks they agree. A sample whose deviation sits
+// within float rounding of the threshold may be called either way, so a few
+// peak disagreements are allowed, and each leaves a slightly different value in
+// the window until it ages out, hence the filt tolerance of 0.1% of the swing.
+static void check_equivalent(int lag, float th, float inf, int n)
+{
+  ref_t ref;
+  pd_ctx_t pd = {
+      .channels = 1,
+      .lag = lag,
+      .data = calloc(lag, sizeof(float)),
+      .avg = &(float){0},
+      .m2 = &(float){0},
+      .std = &(float){0},
+      .threshold = &(float){0},
+      .influence = &(float){0},
+      .peak = &(int32_t){0},
+  };
+  uint32_t seed = 7 + lag;
+  int peaks = 0, mismatched = 0;
+  double worst = 0.0;
+
+  ref_begin(&ref, lag, th, inf);
+  pd_begin(&pd, th, inf);
+  for (int i = 0; i < n; i++)
+  {
+    float x = signal(i, &seed);
+    ref_add(&ref, x);
+    pd_add(&pd, &x);
+    double err = fabs(pd_filt(&pd, 0) - ref_filt(&ref));
+    worst = err > worst ? err : worst;
+    peaks += ref.peak != 0;
+    mismatched += pd_peak(&pd, 0) != ref.peak;
+  }
+  CHECK_NEAR(worst, 0.0, 0.02);
+  CHECK(peaks > n / 100);
+  CHECK(mismatched * 1000 <= n);
+  if (mismatched)
+    printf("lag %d: %d of %d peaks differ, filt within %.2g\n", lag, mismatched, n, worst);
+  ref_end(&ref);
+  free(pd.data);
+}
+
+// A flat input has zero deviation: no peaks, filt is the level once the window
+// has filled, and the zero std must not turn rounding noise into peaks.
+static void check_flat(void)
+{
+  PD_CTX_DEF(flat, 1, 16);
+  float x = 1000.0f;
+
+  pd_begin(&flat, 2.0f, 0.5f);
+  for (int i = 0; i < 10000; i++)
+  {
+    pd_add(&flat, &x);
+    if (i >= 16)
+      CHECK_EQ(pd_peak(&flat, 0), 0);
+  }
+  CHECK_NEAR(pd_filt(&flat, 0), x, 1e-3);
+}
+
+// Each channel of a bank, with its own signal and configuration, against a
+// one-channel bank fed the same thing. The update is the same arithmetic either
+// way, so they must match exactly.
+static void check_independent(void)
+{
+  enum { CH = 5, LAG = 30 };
+  PD_CTX_DEF(bank, CH, LAG);
+  PD_CTX_DEF(single, 1, LAG);
+  static float in[20000][CH];
+  static float filt[20000][CH];
+  static int32_t peak[20000][CH];
+  uint32_t seed = 99;
+
+  for (int i = 0; i < 20000; i++)
+    for (int c = 0; c < CH; c++)
+      in[i][c] = c * 1000 + (c + 1) * signal(i + 31 * c, &seed);
+  // A burst on one channel only
+  for (int i = 5000; i < 5050; i++)
+    in[i][2] += 500.0f;
+
+  pd_begin(&bank, 2.0f, 0.5f);
+  for (int c = 0; c < CH; c++)
+    pd_config(&bank, c, 1.0f + 0.5f * c, 0.2f * c);
+  for (int i = 0; i < 20000; i++)
+  {
+    pd_add(&bank, in[i]);
+    for (int c = 0; c < CH; c++)
+    {
+      filt[i][c] = pd_filt(&bank, c);
+      peak[i][c] = pd_peak(&bank, c);
+    }
+  }
+
+  for (int c = 0; c < CH; c++)
+  {
+    int filt_diff = 0, peak_diff = 0;
+
+    pd_begin(&single, 1.0f + 0.5f * c, 0.2f * c);
+    for (int i = 0; i < 20000; i++)
+    {
+      pd_add(&single, &in[i][c]);
+      filt_diff += pd_filt(&single, 0) != filt[i][c];
+      peak_diff += pd_peak(&single, 0) != peak[i][c];
+    }
+    CHECK_EQ(filt_diff, 0);
+    CHECK_EQ(peak_diff, 0);
+  }
+  CHECK_EQ(peak[5000][2], 1);
+}
+
+static void bench(void)
+{
+  enum { N = 20000 };
+  static float samples[N];
+  uint32_t seed = 1;
+
+  for (int i = 0; i < N; i++)
+    samples[i] = signal(i, &seed);
+  printf("%6s %12s %12s\n", "lag", "ref ns/samp", "pd ns/samp");
+  for (int lag = 16; lag <= 1024; lag *= 2)
+  {
+    ref_t ref;
+    pd_ctx_t pd = {
+        .channels = 1,
+        .lag = lag,
+        .data = calloc(lag, sizeof(float)),
+        .avg = &(float){0},
+        .m2 = &(float){0},
+        .std = &(float){0},
+        .threshold = &(float){0},
+        .influence = &(float){0},
+        .peak = &(int32_t){0},
+    };
+
+    ref_begin(&ref, lag, 2.0f, 0.5f);
+    uint64_t start = harness_ns();
+    for (int i = 0; i < N; i++)
+      ref_add(&ref, samples[i]);
+    uint64_t ref_ns = harness_ns() - start;
+    harness_keep(ref.avg);
+
+    pd_begin(&pd, 2.0f, 0.5f);
+    start = harness_ns();
+    for (int i = 0; i < N; i++)
+      pd_add(&pd, &samples[i]);
+    uint64_t pd_ns = harness_ns() - start;
+    harness_keep(pd.avg);
+
+    printf("%6d %12.1f %12.1f\n", lag, (double)ref_ns / N, (double)pd_ns / N);
+    ref_end(&ref);
+    free(pd.data);
+  }
+
+  printf("%6s %12s %14s\n", "chans", "ns/add", "Mchan-samp/s");
+  for (int ch = 1; ch <= 32; ch *= 2)
+  {
+    enum { LAG = 32 };
+    pd_ctx_t pd = {
+        .channels = ch,
+        .lag = LAG,
+        .data = calloc(LAG * ch, sizeof(float)),
+        .avg = calloc(ch, sizeof(float)),
+        .m2 = calloc(ch, sizeof(float)),
+        .std = calloc(ch, sizeof(float)),
+        .threshold = calloc(ch, sizeof(float)),
+        .influence = calloc(ch, sizeof(float)),
+        .peak = calloc(ch, sizeof(int32_t)),
+    };
+    float *in = malloc((size_t)N * ch * sizeof(float));
+
+    for (int i = 0; i < N * ch; i++)
+      in[i] = samples[(i * 7) % N];
+    pd_begin(&pd, 2.0f, 0.5f);
+    uint64_t start = harness_ns();
+    for (int i = 0; i < N; i++)
+      pd_add(&pd, &in[i * ch]);
+    uint64_t ns = harness_ns() - start;
+    harness_keep(pd.avg);
+
+    printf("%6d %12.1f %14.1f\n", ch, (double)ns / N, (double)N * ch / ns * 1e3);
+    free(in);
+    free(pd.data);
+    free(pd.avg);
+    free(pd.m2);
+    free(pd.std);
+    free(pd.threshold);
+    free(pd.influence);
+    free(pd.peak);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  check_flat();
+  check_equivalent(16, 2.0f, 0.5f, 20000);
+  check_equivalent(30, 1.2f, 0.9f, 20000);
+  check_equivalent(32, 3.5f, 0.0f, 20000);
+  check_equivalent(128, 2.0f, 0.5f, 20000);
+  check_equivalent(1024, 2.0f, 1.0f, 20000);
+  check_independent();
+  if (harness_bench(argc, argv))
+    bench();
+  return harness_result("test_pd");
+}
@@ -0,0 +1,261 @@
+// power.c driven by link events and synthetic PPG samples on the RTC's 24-bit
+// ticks, starting at 500 s like hubsim so the counter wraps partway. The state
+// machine has to follow the link and the recording, find a finger only after
+// POWER_PRESENT_SAMPLES and lose it only after POWER_ABSENT_SAMPLES, back the
+// LEDs off under saturation while ignoring samples from before the last change,
+// and hand out the matching hardware configuration once per change. The energy
+// report has to split the time exactly between the states and charge each one
+// its modelled current, with PPG stamps older than the last accounting and the
+// wrap adding nothing.
+//
+//   test_power [-b]   -b adds the report of a scripted session and the host
+//                     cost per PPG sample
+
+#include "harness.h"
+#include "power.h"
+#include "synth.h"
+
+#define FINGER_MIN 50000     // PPG_FINGER_MIN
+#define FINGER 120000        // IR of a finger at POWER_LED_ACTIVE
+#define START_S 500.0
+#define SAMPLE_S 0.04        // 25 Hz out of the sensor while tracking
+
+static uint32_t now;
+
+static void advance(double s)
+{
+  now = synth_ticks(START_S + s);
+}
+
+// IR the sensor reads at led for a finger giving level at full current
+static uint32_t ir_at(uint32_t level, uint8_t led)
+{
+  return (uint32_t)((uint64_t)level * led / POWER_LED_ACTIVE);
+}
+
+// n samples of level, each stamped one period after the last, t in seconds since the start
+static double feed(power_ctx_t *ctx, double t, uint32_t n, uint32_t level)
+{
+  for (uint32_t i = 0; i < n; i++)
+  {
+    power_config_t config;
+
+    power_config(ctx, &config);
+    t += config.ppg_fast ? SAMPLE_S : 2 * SAMPLE_S;
+    advance(t);
+    power_ppg(ctx, level >= POWER_SATURATION ? level : ir_at(level, config.led_ir), now);
+  }
+  return t;
+}
+
+static void check_link(void)
+{
+  power_ctx_t ctx;
+  power_config_t config;
+
+  advance(0);
+  power_begin(&ctx, FINGER_MIN, now);
+  CHECK_EQ(power_state(&ctx), POWER_OFF);
+  CHECK(power_changed(&ctx));
+  CHECK(!power_changed(&ctx));
+  power_config(&ctx, &config);
+  CHECK(!config.adc_on && !config.ppg_on);
+  CHECK_EQ(config.led_ir, 0);
+
+  power_link(&ctx, true, false, now);
+  CHECK_EQ(power_state(&ctx), POWER_SEARCH);
+  CHECK(power_changed(&ctx));
+  power_config(&ctx, &config);
+  CHECK(config.connected && config.adc_on && config.ppg_on && !config.ppg_fast);
+  CHECK_EQ(config.led_red, 0);
+  CHECK_EQ(config.led_ir, POWER_LED_SEARCH);
+  // Nothing new, nothing to apply
+  power_link(&ctx, true, false, now);
+  CHECK(!power_changed(&ctx));
+
+  // Recording keeps the sensors on without a link
+  power_link(&ctx, false, true, now);
+  CHECK_EQ(power_state(&ctx), POWER_SEARCH);
+  CHECK(power_changed(&ctx));
+  power_link(&ctx, false, false, now);
+  CHECK_EQ(power_state(&ctx), POWER_OFF);
+}
+
+static void check_finger(void)
+{
+  power_ctx_t ctx;
+  power_config_t config;
+  double t = 0;
+
+  advance(t);
+  power_begin(&ctx, FINGER_MIN, now);
+  power_link(&ctx, true, false, now);
+  // Fewer than POWER_PRESENT_SAMPLES in a row is no finger
+  t = feed(&ctx, t, POWER_PRESENT_SAMPLES - 1, FINGER);
+  t = feed(&ctx, t, 1, 0);
+  t = feed(&ctx, t, POWER_PRESENT_SAMPLES - 1, FINGER);
+  CHECK_EQ(power_state(&ctx), POWER_SEARCH);
+  power_changed(&ctx);
+  t = feed(&ctx, t, 1, FINGER);
+  CHECK_EQ(power_state(&ctx), POWER_ACTIVE);
+  CHECK(power_changed(&ctx));
+  power_config(&ctx, &config);
+  CHECK(config.ppg_fast);
+  CHECK_EQ(config.led_red, POWER_LED_ACTIVE);
+  CHECK_EQ(config.led_ir, POWER_LED_ACTIVE);
+
+  // A finger just over the threshold stays one at full current
+  t = feed(&ctx, t, 100, FINGER_MIN + 1000);
+  CHECK_EQ(power_state(&ctx), POWER_ACTIVE);
+  t = feed(&ctx, t, POWER_ABSENT_SAMPLES - 1, 0);
+  t = feed(&ctx, t, 1, FINGER);
+  t = feed(&ctx, t, POWER_ABSENT_SAMPLES - 1, 0);
+  CHECK_EQ(power_state(&ctx), POWER_ACTIVE);
+  t = feed(&ctx, t, 1, 0);
+  CHECK_EQ(power_state(&ctx), POWER_SEARCH);
+}
+
+static void check_saturation(void)
+{
+  power_ctx_t ctx;
+  power_config_t config;
+  double t = 0;
+
+  advance(t);
+  power_begin(&ctx, FINGER_MIN, now);
+  power_link(&ctx, true, false, now);
+  t = feed(&ctx, t, POWER_PRESENT_SAMPLES, FINGER);
+  t = feed(&ctx, t, 1, POWER_SATURATION);
+  CHECK_EQ(power_state(&ctx), POWER_SATURATED);
+  power_config(&ctx, &config);
+  CHECK_EQ(config.led_ir, POWER_LED_ACTIVE - POWER_LED_ACTIVE / 4);
+
+  // Samples within POWER_SETTLE_MS saw the old current, they change nothing
+  uint32_t settle = POWER_SETTLE_MS / 1000.0 / SAMPLE_S;
+  t = feed(&ctx, t, settle - 1, POWER_SATURATION);
+  power_config(&ctx, &config);
+  CHECK_EQ(config.led_ir, POWER_LED_ACTIVE - POWER_LED_ACTIVE / 4);
+
+  // Saturated for good: down to the floor and no further
+  t = feed(&ctx, t, 200, POWER_SATURATION);
+  power_config(&ctx, &config);
+  CHECK_EQ(config.led_ir, POWER_LED_MIN);
+  CHECK_EQ(config.led_red, POWER_LED_MIN);
+
+  // Clear long enough and tracking goes on at the lower current
+  t = feed(&ctx, t, POWER_CLEAR_SAMPLES - 1, FINGER);
+  CHECK_EQ(power_state(&ctx), POWER_SATURATED);
+  t = feed(&ctx, t, 1, FINGER);
+  CHECK_EQ(power_state(&ctx), POWER_ACTIVE);
+  power_config(&ctx, &config);
+  CHECK_EQ(config.led_ir, POWER_LED_MIN);
+}
+
+static power_report_t session;
+
+// 10 s off, 20 s searching, 30 s tracking, 5 s off, across the wrap at 512 s.
+// The main loop links every 25 ms, the PPG samples of each burst arrive a
+// watermark late and stamped back to when they were taken.
+static void check_energy(void)
+{
+  power_ctx_t ctx;
+  power_config_t config;
+  uint32_t expect_ua[POWER_STATES];
+  double t = 0;
+
+  advance(t);
+  power_begin(&ctx, FINGER_MIN, now);
+  power_config(&ctx, &config);
+  expect_ua[POWER_OFF] = power_model_ua(&config);
+  for (; t < 10; t += 0.025)
+  {
+    advance(t);
+    power_link(&ctx, false, false, now);
+  }
+  for (uint32_t burst = 0; t < 60; t += 0.025)
+  {
+    advance(t);
+    power_link(&ctx, true, false, now);
+    // Every 16th loop a burst of the samples taken over the last 400 ms
+    if (++burst % 16)
+      continue;
+    power_config(&ctx, &config);
+    uint32_t n = config.ppg_fast ? 10 : 5;
+    for (uint32_t i = 0; i < n; i++)
+    {
+      double taken = t - (n - 1 - i) * 0.4 / n;
+      power_ppg(&ctx, t < 30 ? 0 : ir_at(FINGER, config.led_ir), synth_ticks(START_S + taken));
+    }
+    power_config(&ctx, &config);
+    expect_ua[power_state(&ctx)] = power_model_ua(&config);
+  }
+  for (; t < 65; t += 0.025)
+  {
+    advance(t);
+    power_link(&ctx, false, false, now);
+  }
+  power_report(&ctx, now, &session);
+
+  CHECK_EQ(session.seconds[POWER_OFF], 14); // the last 25 ms short of 15
+  CHECK_EQ(session.seconds[POWER_SEARCH], 20);
+  CHECK_EQ(session.seconds[POWER_ACTIVE], 29); // 30 less the PRESENT samples and the burst lag
+  CHECK_EQ(session.seconds[POWER_SATURATED], 0);
+  CHECK_EQ(session.ua[POWER_OFF], expect_ua[POWER_OFF]);
+  CHECK_EQ(session.ua[POWER_SEARCH], expect_ua[POWER_SEARCH]);
+  CHECK_EQ(session.ua[POWER_ACTIVE], expect_ua[POWER_ACTIVE]);
+  CHECK_EQ(session.ua[POWER_SATURATED], 0);
+  CHECK_NEAR(session.avg_ua,
+             (15.0 * expect_ua[POWER_OFF] + 20.0 * expect_ua[POWER_SEARCH] + 30.0 * expect_ua[POWER_ACTIVE]) / 65, 20);
+}
+
+// The model against the datasheet figures it is built from
+static void check_model(void)
+{
+  power_config_t off = {0};
+  power_config_t search = {.connected = true, .adc_on = true, .ppg_on = true, .led_ir = POWER_LED_SEARCH};
+  power_config_t active = {.connected = true, .adc_on = true, .ppg_on = true, .ppg_fast = true,
+                           .led_red = POWER_LED_ACTIVE, .led_ir = POWER_LED_ACTIVE};
+
+  CHECK_EQ(power_model_ua(&off), POWER_UA_IDLE + POWER_UA_ADVERTISING + POWER_UA_PPG_SHDN);
+  CHECK(power_model_ua(&search) < power_model_ua(&active));
+  CHECK_EQ(power_model_ua(&active) - power_model_ua(&search),
+           (uint32_t)(2 * POWER_LED_ACTIVE) * POWER_UA_PER_LED_CODE * POWER_LED_PW_US * POWER_SPS_FAST / 1000000 -
+               (uint32_t)POWER_LED_SEARCH * POWER_UA_PER_LED_CODE * POWER_LED_PW_US * POWER_SPS_SLOW / 1000000);
+}
+
+// Cycles are the TSC's on x86, 0 elsewhere
+static void bench(void)
+{
+  static const char *const names[POWER_STATES] = {"off", "search", "active", "saturated"};
+  uint32_t rounds = 1000000, sum = 0;
+  power_ctx_t ctx;
+
+  for (int s = 0; s < POWER_STATES; s++)
+    printf("%-10s %4u s %6u uA\n", names[s], (unsigned)session.seconds[s], (unsigned)session.ua[s]);
+  printf("average    %13u uA\n", (unsigned)session.avg_ua);
+
+  advance(0);
+  power_begin(&ctx, FINGER_MIN, now);
+  power_link(&ctx, true, false, now);
+  uint64_t start = harness_ns(), cyc = harness_cycles();
+  for (uint32_t r = 0; r < rounds; r++)
+  {
+    power_ppg(&ctx, FINGER + (r & 0xFF), now + r * 1310);
+    sum += power_state(&ctx);
+  }
+  printf("power_ppg: %.1f ns/sample, %.1f cycles/sample\n", (double)(harness_ns() - start) / rounds,
+         (double)(harness_cycles() - cyc) / rounds);
+  harness_keep(&sum);
+}
+
+int main(int argc, char **argv)
+{
+  check_link();
+  check_finger();
+  check_saturation();
+  check_energy();
+  check_model();
+  if (harness_bench(argc, argv))
+    bench();
+  return harness_result("test_power");
+}
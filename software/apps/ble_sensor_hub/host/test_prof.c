@@ -0,0 +1,153 @@
+// prof.c built with its probes on, on the host's monotonic clock backend. The
+// clock has to count nanoseconds, never step back between two reads and time a
+// sleep to within a few milliseconds. A probed section has to record every
+// pass with min <= mean <= max and leave the other sections empty. Recorded
+// durations have to land in their log2 bins, the top one catching everything
+// longer, the bins have to saturate rather than wrap, and the report has to
+// carry the layout the monitor parses.
+//
+//   test_prof [-b]   -b adds the host cost of a clock read and of a probed
+//                    empty section
+
+#include <time.h>
+#include "harness.h"
+#include "prof.h"
+
+static void sleep_ns(long ns)
+{
+  struct timespec ts = {.tv_sec = ns / 1000000000L, .tv_nsec = ns % 1000000000L};
+
+  nanosleep(&ts, NULL);
+}
+
+static void check_clock(void)
+{
+  uint32_t prev = prof_now(), back = 0;
+
+  CHECK_EQ(prof_hz(), 1000000000u);
+  // Differences are what the probes use, the 32-bit value wraps every 4.3 s
+  for (int i = 0; i < 100000; i++)
+  {
+    uint32_t t = prof_now();
+    back += (int32_t)(t - prev) < 0;
+    prev = t;
+  }
+  CHECK_EQ(back, 0);
+
+  uint32_t start = prof_now();
+  sleep_ns(2000000);
+  uint32_t elapsed = prof_now() - start;
+  CHECK(elapsed >= 2000000);
+  CHECK(elapsed < 2000000 + 50000000);
+}
+
+static void check_sections(void)
+{
+  prof_report_t report;
+
+  prof_init();
+  for (int i = 0; i < 5; i++)
+  {
+    PROF_BEGIN(PROF_ADC);
+    sleep_ns(1000000);
+    PROF_END(PROF_ADC);
+  }
+  prof_report(&report);
+
+  const prof_stat_t *s = &report.stat[PROF_ADC];
+  uint32_t binned = 0;
+  CHECK_EQ(s->count, 5);
+  CHECK(s->min >= 1000000);
+  CHECK(s->min <= s->mean && s->mean <= s->max);
+  for (int b = 0; b < PROF_BINS; b++)
+    binned += s->hist[b];
+  CHECK_EQ(binned, 5);
+  for (int i = 0; i < PROF_COUNT; i++)
+    if (i != PROF_ADC)
+    {
+      CHECK_EQ(report.stat[i].count, 0);
+      CHECK_EQ(report.stat[i].min, 0);
+      CHECK_EQ(report.stat[i].mean, 0);
+    }
+}
+
+// Bin b holds 2^(b + PROF_HIST_SHIFT) up to twice that, bin 0 everything below
+static void check_bins(void)
+{
+  const uint32_t elapsed[] = {0, 511, 512, 1023, 1024, 1u << 23, UINT32_MAX};
+  prof_report_t report;
+  uint64_t total = 0;
+
+  prof_init();
+  for (unsigned i = 0; i < sizeof(elapsed) / sizeof(elapsed[0]); i++)
+  {
+    PROF_RECORD(PROF_TWI, elapsed[i]);
+    total += elapsed[i];
+  }
+  prof_report(&report);
+
+  const prof_stat_t *s = &report.stat[PROF_TWI];
+  CHECK_EQ(s->count, 7);
+  CHECK_EQ(s->min, 0);
+  CHECK_EQ(s->max, UINT32_MAX);
+  CHECK_EQ(s->mean, total / 7);
+  CHECK_EQ(s->hist[0], 2);
+  CHECK_EQ(s->hist[1], 2);
+  CHECK_EQ(s->hist[2], 1);
+  CHECK_EQ(s->hist[PROF_BINS - 1], 2);
+
+  for (uint32_t i = 0; i < 70000; i++)
+    PROF_RECORD(PROF_SLEEP, 100);
+  prof_report(&report);
+  CHECK_EQ(report.stat[PROF_SLEEP].count, 70000);
+  CHECK_EQ(report.stat[PROF_SLEEP].hist[0], UINT16_MAX);
+}
+
+// What the monitor reads off the diagnostics characteristic
+static void check_report(void)
+{
+  prof_report_t report;
+
+  prof_init();
+  prof_report(&report);
+  CHECK_EQ(report.hz, 1000000000u);
+  CHECK_EQ(report.sections, PROF_COUNT);
+  CHECK_EQ(report.bins, PROF_BINS);
+  CHECK_EQ(report.hist_shift, PROF_HIST_SHIFT);
+  CHECK_EQ(sizeof(prof_report_t), 8 + PROF_COUNT * (16 + 2 * PROF_BINS));
+}
+
+// Cycles are the TSC's on x86, 0 elsewhere
+static void bench(void)
+{
+  uint32_t rounds = 1000000, sum = 0;
+
+  uint64_t start = harness_ns(), cyc = harness_cycles();
+  for (uint32_t r = 0; r < rounds; r++)
+    sum += prof_now();
+  printf("prof_now: %.1f ns, %.1f cycles\n", (double)(harness_ns() - start) / rounds,
+         (double)(harness_cycles() - cyc) / rounds);
+
+  prof_init();
+  start = harness_ns();
+  cyc = harness_cycles();
+  for (uint32_t r = 0; r < rounds; r++)
+  {
+    PROF_BEGIN(PROF_TELEMETRY);
+    PROF_END(PROF_TELEMETRY);
+  }
+  printf("empty section: %.1f ns, %.1f cycles\n", (double)(harness_ns() - start) / rounds,
+         (double)(harness_cycles() - cyc) / rounds);
+  harness_keep(&sum);
+}
+
+int main(int argc, char **argv)
+{
+  check_clock();
+  check_sections();
+  check_bins();
+  check_report();
+  if (harness_bench(argc, argv))
+    bench();
+  return harness_result("test_prof");
+}
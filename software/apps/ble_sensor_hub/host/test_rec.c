@@ -0,0 +1,452 @@
+// rec.c on the simulated flash (flash_sim.h) through nrf_fstorage, the way
+// main.c wires it, a record per millisecond of virtual time and the flash
+// completing at NVMC speed meanwhile. Over several laps of the log the stored
+// range has to decode to the newest records in order, the flash has to
+// program what the blocks hold and no more, erase a page per page of blocks
+// and wear every page alike. A reset with a block queued has to lose only
+// that block, one after a torn write has to carry on from the next page, and
+// neither may write over programmed flash. Erasing the log has to be one
+// multi-page erase, refused while a block is on its way to flash, spare the
+// lap after it its page erases and, when it fails, leave the old log
+// readable. A second lane filled with bursts a second late, the way the PPG
+// samples arrive, has to keep to blocks of its own without cutting the
+// first lane's short or being taken for an RTC wrap.
+//
+//   test_rec [-b]   -b adds write amplification and wear over the laps and
+//                   the host cost per record
+
+#include <math.h>
+#include "decode.h"
+#include "flash_sim.h"
+#include "harness.h"
+#include "nrf_fstorage_sd.h"
+#include "rec.h"
+#include "synth.h"
+
+#define START 0x60000
+#define PAGE 4096
+#define PAGES 8
+#define BPP (PAGE / REC_BLOCK_SIZE)
+#define SLOTS (PAGES * BPP)
+#define BLOCK_RECORDS 8192 // more than a block can hold
+#define LATE_BURST 24      // records of the late lane per burst, 40 ms apart
+#define PAGE_MS 960        // between its bursts
+
+static rec_ctx_t rec;
+static uint64_t now_ns;
+static uint32_t pushed; // records pushed since the flash was blank
+
+static void fs_handler(nrf_fstorage_evt_t *p_evt)
+{
+  if (p_evt->id == NRF_FSTORAGE_EVT_WRITE_RESULT)
+    rec_write_done(&rec, p_evt->p_param, p_evt->result == NRF_SUCCESS);
+  else if (p_evt->id == NRF_FSTORAGE_EVT_ERASE_RESULT)
+    rec_erase_done(&rec, p_evt->p_param, p_evt->result == NRF_SUCCESS);
+}
+
+static nrf_fstorage_t fs = {
+    .evt_handler = fs_handler,
+    .start_addr = START,
+    .end_addr = START + PAGES * PAGE - 1,
+};
+
+static bool fs_erase(uint16_t page, uint16_t count, void *p_context)
+{
+  return nrf_fstorage_erase(&fs, START + page * PAGE, count, p_context) == NRF_SUCCESS;
+}
+
+static bool fs_write(uint32_t offset, const void *src, uint16_t len, void *p_context)
+{
+  return nrf_fstorage_write(&fs, START + offset, src, len, p_context) == NRF_SUCCESS;
+}
+
+static const rec_flash_t flash = {
+    .page_size = PAGE,
+    .pages = PAGES,
+    .base = (const uint8_t *)START,
+    .erase = fs_erase,
+    .write = fs_write,
+};
+
+// Record i of the session, the same every time it is asked for
+static telemetry_record_t record_at(uint32_t i)
+{
+  double t = i / 1000.0;
+  uint32_t h = i * 2654435761u;
+
+  return (telemetry_record_t){
+      .ticks = synth_ticks(505.0 + t),
+      .max_red = (uint32_t)(180000 + 250 * sin(2.0 * M_PI * 1.2 * t)) + (h >> 29),
+      .max_ir = (uint32_t)(220000 + 400 * sin(2.0 * M_PI * 1.2 * t)) + (h >> 28 & 7),
+      .gsr = (uint16_t)(1500 + 20 * sin(2.0 * M_PI * 0.05 * t)),
+      .flex = (uint16_t)(2100 + 150 * sin(2.0 * M_PI * 0.25 * t)) + (h >> 26 & 3),
+      .emg1 = 2048 + (h >> 24 & 15),
+      .emg2 = 2048 + (h >> 20 & 15),
+  };
+}
+
+// Record j of the late lane, a PPG sample every 40 ms
+static telemetry_record_t late_at(uint32_t j)
+{
+  double t = j * 0.04;
+
+  return (telemetry_record_t){
+      .ticks = synth_ticks(505.0 + t),
+      .max_red = (uint32_t)(180000 + 250 * sin(2.0 * M_PI * 1.2 * t)) + (j * 7 & 15),
+      .max_ir = (uint32_t)(220000 + 400 * sin(2.0 * M_PI * 1.2 * t)) + (j * 5 & 15),
+  };
+}
+
+static void blank(void)
+{
+  flash_sim_begin(START, PAGES * PAGE, PAGE);
+  nrf_fstorage_init(&fs, &nrf_fstorage_sd, NULL);
+  now_ns = 0;
+  pushed = 0;
+  rec_begin(&rec, &flash);
+}
+
+static void push(void)
+{
+  telemetry_record_t r = record_at(pushed++);
+
+  rec_push(&rec, 0, &r);
+}
+
+// n records a millisecond apart, the flash keeping up meanwhile
+static void record(uint32_t n)
+{
+  // From where flash_sim_run() left the flash's clock
+  if (now_ns < flash_sim_now())
+    now_ns = flash_sim_now();
+  for (uint32_t i = 0; i < n; i++)
+  {
+    now_ns += 1000000;
+    flash_sim_advance(now_ns);
+    push();
+  }
+}
+
+// A block on its way to flash
+static bool queued(void)
+{
+  for (uint8_t b = 0; b < REC_LANES + 1; b++)
+    if (rec.busy[b])
+      return true;
+  return false;
+}
+
+// Records without the flash getting anywhere, until a block is queued
+static void close_one(void)
+{
+  while (!queued())
+    push();
+}
+
+static void wear(uint32_t *lo, uint32_t *hi)
+{
+  *lo = UINT32_MAX;
+  *hi = 0;
+  for (uint32_t p = 0; p < PAGES; p++)
+  {
+    uint32_t e = flash_sim_page_erases(p);
+    *lo = e < *lo ? e : *lo;
+    *hi = e > *hi ? e : *hi;
+  }
+}
+
+typedef struct
+{
+  uint32_t blocks;  // seqs in the range
+  uint32_t intact;
+  uint32_t records;
+  uint32_t bytes;   // headers and codec data
+  uint32_t wrong;   // records other than the ones pushed, in order
+  uint32_t last;    // index after the newest record stored
+} readback_t;
+
+// Decodes the stored range. A block holds consecutive records, the first
+// one is looked up by its ticks from where the previous block ended, since
+// blocks lost to a reset leave a gap.
+static readback_t readback(void)
+{
+  static telemetry_record_t out[BLOCK_RECORDS];
+  readback_t r = {0};
+  uint32_t first, end, next = 0;
+
+  rec_range(&rec, &first, &end);
+  for (uint32_t seq = first; seq < end; seq++)
+  {
+    const rec_hdr_t *hdr = rec_block(&rec, seq);
+
+    r.blocks++;
+    if (!hdr)
+      continue;
+    uint16_t n = decode_packed((const uint8_t *)(hdr + 1), hdr->length, hdr->count, out);
+    r.intact++;
+    r.records += n;
+    r.bytes += sizeof(*hdr) + hdr->length;
+    while (next < pushed && record_at(next).ticks != out[0].ticks)
+      next++;
+    for (uint16_t i = 0; i < n; i++, next++)
+    {
+      telemetry_record_t want = record_at(next);
+      r.wrong += memcmp(&out[i], &want, sizeof(want)) != 0;
+    }
+    r.last = next;
+  }
+  return r;
+}
+
+// Four laps of the log at a record per millisecond
+static void check_laps(void)
+{
+  uint32_t lo, hi;
+
+  blank();
+  rec_start(&rec, 0, 0);
+  record(40000);
+  rec_stop(&rec);
+  flash_sim_run();
+
+  readback_t r = readback();
+  const rec_stats_t *s = &rec.stats;
+  const flash_sim_stats_t *f = flash_sim_stats();
+  CHECK(s->blocks > 4 * SLOTS);
+  CHECK_EQ(s->dropped, 0);
+  CHECK_EQ(s->failed, 0);
+  CHECK_EQ(f->refused, 0);
+  CHECK_EQ(f->dirty, 0);
+  // The newest lap, less the page erased for the block that comes next
+  CHECK(r.blocks >= SLOTS - BPP);
+  CHECK_EQ(r.intact, r.blocks);
+  CHECK_EQ(r.wrong, 0);
+  CHECK_EQ(r.last, pushed);
+  // One write per block and a page erase per page of them
+  CHECK_EQ(f->writes, s->blocks);
+  CHECK_EQ(s->erases, (s->blocks + BPP - 1) / BPP);
+  CHECK_EQ(f->erases, s->erases);
+  // Programmed per record what the stored blocks hold per record, words rounding up
+  CHECK_NEAR((double)f->words * 4 / pushed, (double)r.bytes / r.records, 0.02 * r.bytes / r.records);
+  wear(&lo, &hi);
+  CHECK(hi - lo <= 1);
+}
+
+// A reset with a block queued loses that block. One during a write leaves a
+// torn header the next block can't be written over, the log goes on from the
+// next page.
+static void check_reset(void)
+{
+  uint32_t first, end, kept;
+
+  blank();
+  rec_start(&rec, 0, 0);
+  record(20000);
+  rec_range(&rec, &first, &kept);
+  close_one();
+  flash_sim_reset();
+  rec_begin(&rec, &flash);
+  rec_range(&rec, &first, &end);
+  CHECK_EQ(end, kept);
+  CHECK_EQ(readback().wrong, 0);
+
+  rec_start(&rec, 0, 0);
+  while (rec.head % BPP == 0 || flash_sim_next() != UINT64_MAX)
+    record(100);
+  uint32_t head = rec.head;
+  static const uint32_t torn[2] = {REC_MAGIC, 0};
+  fs_write((head % SLOTS) * REC_BLOCK_SIZE, torn, sizeof(torn), NULL);
+  flash_sim_run();
+  flash_sim_reset();
+  rec_begin(&rec, &flash);
+  CHECK_EQ(rec.head, head + BPP - head % BPP);
+
+  rec_start(&rec, 0, 0);
+  record(20000);
+  rec_stop(&rec);
+  flash_sim_run();
+  readback_t r = readback();
+  CHECK_EQ(flash_sim_stats()->dirty, 0);
+  CHECK_EQ(rec.stats.failed, 0);
+  CHECK(r.blocks - r.intact <= BPP); // the rest of the torn page, if still in range
+  CHECK_EQ(r.wrong, 0);
+  CHECK_EQ(r.last, pushed);
+}
+
+static void check_erase(void)
+{
+  uint32_t first, end, erases[PAGES];
+
+  blank();
+  rec_start(&rec, 0, 0);
+  record(60000);
+  close_one();
+  CHECK(!rec_erase(&rec)); // the write would land in the erased log
+  flash_sim_run();
+
+  for (uint32_t p = 0; p < PAGES; p++)
+    erases[p] = flash_sim_page_erases(p);
+  uint32_t ops = flash_sim_stats()->erases;
+  CHECK(rec_erase(&rec));
+  uint32_t wiped = rec.head;
+  CHECK(rec_wiping(&rec));
+  CHECK(!rec_erase(&rec)); // one at a time
+  rec_range(&rec, &first, &end);
+  CHECK_EQ(end - first, 0);
+  flash_sim_run();
+  CHECK(!rec_wiping(&rec));
+  CHECK_EQ(rec.stats.wipes, 1);
+  CHECK_EQ(flash_sim_stats()->erases, ops + PAGES);
+  for (uint32_t p = 0; p < PAGES; p++)
+    CHECK_EQ(flash_sim_page_erases(p), erases[p] + 1);
+
+  // The lap after needs no page erases
+  uint32_t page_erases = rec.stats.erases;
+  while (rec.head < wiped + SLOTS)
+    record(1);
+  flash_sim_run();
+  CHECK_EQ(rec.stats.erases, page_erases);
+  while (rec.head < wiped + SLOTS + 1)
+    record(1);
+  flash_sim_run();
+  CHECK_EQ(rec.stats.erases, page_erases + 1);
+
+  // Recording through another, retried until no block is on its way like
+  // main.c does. The flash is taken for the whole erase, what doesn't fit
+  // the buffer meanwhile is lost.
+  while (!rec_erase(&rec))
+    record(1);
+  record(5000);
+  flash_sim_run();
+  CHECK_EQ(rec.stats.wipes, 2);
+  CHECK(rec.stats.dropped < PAGES * FLASH_SIM_ERASE_NS / 1000000);
+  CHECK_EQ(flash_sim_stats()->refused, 0);
+  CHECK_EQ(flash_sim_stats()->dirty, 0);
+  rec_stop(&rec);
+  flash_sim_run();
+  readback_t before = readback();
+  CHECK_EQ(before.intact, before.blocks);
+  CHECK_EQ(before.wrong, 0);
+  CHECK_EQ(before.last, pushed);
+
+  // A failed erase leaves the log as it was
+  flash_sim_fail(1);
+  CHECK(rec_erase(&rec));
+  flash_sim_run();
+  CHECK(!rec_wiping(&rec));
+  CHECK_EQ(rec.stats.wipes, 2);
+  CHECK_EQ(rec.stats.failed, 1);
+  readback_t r = readback();
+  CHECK_EQ(r.intact, before.intact);
+  CHECK_EQ(r.records, before.records);
+  CHECK_EQ(r.wrong, 0);
+}
+
+// A record per millisecond in lane 0 and a burst in lane 1 every PAGE_MS,
+// each sample of it up to a burst old, across the RTC wrap 7 s in and a lap
+// of the log
+static void check_lanes(void)
+{
+  static telemetry_record_t out[BLOCK_RECORDS];
+  uint32_t first, end, late = 0;
+  uint32_t next[2] = {0, 0}, wrong = 0, short_blocks = 0, blocks[2] = {0, 0};
+
+  blank();
+  rec_start(&rec, 0, TELEMETRY_FLAG_EMG_ENV);
+  rec_start(&rec, 1, TELEMETRY_FLAG_PPG);
+  for (uint32_t ms = 1; ms <= 10000; ms++)
+  {
+    now_ns += 1000000;
+    flash_sim_advance(now_ns);
+    push();
+    if (ms % PAGE_MS)
+      continue;
+    for (uint32_t k = 0; k < LATE_BURST; k++)
+    {
+      telemetry_record_t r = late_at(late++);
+      rec_push(&rec, 1, &r);
+    }
+  }
+  rec_stop(&rec);
+  flash_sim_run();
+  CHECK_EQ(rec.stats.dropped, 0);
+  CHECK_EQ(rec.stats.failed, 0);
+
+  rec_range(&rec, &first, &end);
+  for (uint32_t seq = first; seq < end; seq++)
+  {
+    const rec_hdr_t *hdr = rec_block(&rec, seq);
+    if (!hdr)
+    {
+      wrong++;
+      continue;
+    }
+    uint8_t lane = hdr->flags == TELEMETRY_FLAG_PPG;
+    uint16_t n = decode_packed((const uint8_t *)(hdr + 1), hdr->length, hdr->count, out);
+
+    // The oldest blocks gave way, the first one stored starts anywhere
+    while (lane && next[1] < late && late_at(next[1]).ticks != out[0].ticks)
+      next[1]++;
+    while (!lane && next[0] < pushed && record_at(next[0]).ticks != out[0].ticks)
+      next[0]++;
+    double t = lane ? next[1] * 0.04 : next[0] / 1000.0;
+
+    CHECK(hdr->flags == (lane ? TELEMETRY_FLAG_PPG : TELEMETRY_FLAG_EMG_ENV));
+    // Ticks of the first record, the wrap counted only once the newest record passed it
+    CHECK_EQ(hdr->time, ((505.0 + t >= 512.0 ? 1u : 0u) << 24) | out[0].ticks);
+    for (uint16_t i = 0; i < n; i++, next[lane]++)
+    {
+      telemetry_record_t want = lane ? late_at(next[1]) : record_at(next[0]);
+      wrong += memcmp(&out[i], &want, sizeof(want)) != 0;
+    }
+    // Only the last block of each lane is partial
+    short_blocks += hdr->length < REC_DATA_SIZE - sizeof(telemetry_record_t);
+    blocks[lane]++;
+  }
+  CHECK_EQ(wrong, 0);
+  CHECK_EQ(next[0], pushed);
+  CHECK_EQ(next[1], late);
+  CHECK(blocks[1] > 1);
+  CHECK(short_blocks <= 2);
+}
+
+// Cycles are the TSC's on x86, 0 elsewhere
+static void bench(void)
+{
+  uint32_t rounds = 100000, lo, hi;
+
+  printf("%5s %8s %8s %12s %8s %6s %6s\n", "laps", "blocks", "records", "bytes/rec", "erases", "wear", "");
+  blank();
+  rec_start(&rec, 0, 0);
+  for (int lap = 0; lap < 5; lap++)
+  {
+    record(100000);
+    readback_t r = readback();
+    wear(&lo, &hi);
+    printf("%5.1f %8u %8u %5.2f/%5.2f %8u %6u %6u\n", (double)rec.stats.blocks / SLOTS, (unsigned)rec.stats.blocks,
+           (unsigned)r.records, (double)flash_sim_stats()->words * 4 / pushed, (double)r.bytes / r.records,
+           (unsigned)rec.stats.erases, (unsigned)lo, (unsigned)hi);
+  }
+  printf("bytes/rec: programmed/stored, wear: least/most erased page\n");
+
+  uint64_t start = harness_ns(), cyc = harness_cycles();
+  for (uint32_t i = 0; i < rounds; i++)
+  {
+    push();
+    if (queued())
+      flash_sim_run();
+  }
+  printf("rec_push: %.1f ns/record, %.1f cycles/record, flash included\n", (double)(harness_ns() - start) / rounds,
+         (double)(harness_cycles() - cyc) / rounds);
+}
+
+int main(int argc, char **argv)
+{
+  check_laps();
+  check_reset();
+  check_erase();
+  check_lanes();
+  if (harness_bench(argc, argv))
+    bench();
+  return harness_result("test_rec");
+}
@@ -0,0 +1,203 @@
+// ring.c with its producer and consumer on two threads, standing in for the
+// interrupt and the main loop. Every item carries its sequence number and a
+// payload made from it. A producer that retries a full ring must get every
+// item across intact and in order. One that drops on a full ring, as the
+// interrupt handlers do, must lose exactly what it counts as overruns, and
+// what does arrive must still be in order.
+//
+//   test_ring [-b]   -b adds items per second across threads and the cost of
+//                    a push and pop on one thread, for the firmware's item sizes
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include "harness.h"
+#include "ring.h"
+
+#define ITEMS 200000u
+
+typedef struct
+{
+  uint32_t seq;
+  uint32_t a; // seq * 2654435761
+  uint32_t b; // ~seq
+} item_t; // the size of ppg_sample_t
+
+typedef struct
+{
+  uint32_t seq;
+  uint16_t ch[5];
+  uint16_t check; // low bits of seq, the size of adc_sample_t
+} scan_t;
+
+#define ITEM_MAX sizeof(scan_t)
+
+RING_DEF(items, item_t, 64);
+RING_DEF(scans, scan_t, 256);
+
+typedef struct
+{
+  ring_t *ring;
+  uint32_t count;
+  bool retry; // on a full ring, otherwise the item is dropped
+  atomic_bool done;
+} producer_t;
+
+static void fill(ring_t *r, uint32_t seq, void *out)
+{
+  union
+  {
+    item_t item;
+    scan_t scan;
+  } u;
+
+  if (r->item_size == sizeof(item_t))
+    u.item = (item_t){.seq = seq, .a = seq * 2654435761u, .b = ~seq};
+  else
+    u.scan = (scan_t){.seq = seq, .ch = {seq, seq >> 1, seq >> 2, seq >> 3, seq >> 4}, .check = seq};
+  memcpy(out, &u, r->item_size);
+}
+
+static bool intact(ring_t *r, const void *in)
+{
+  uint32_t expect[ITEM_MAX / sizeof(uint32_t)];
+
+  fill(r, *(const uint32_t *)in, expect);
+  return memcmp(in, expect, r->item_size) == 0;
+}
+
+static void *produce(void *arg)
+{
+  producer_t *p = arg;
+  uint32_t item[ITEM_MAX / sizeof(uint32_t)];
+
+  for (uint32_t seq = 0; seq < p->count; seq++)
+  {
+    fill(p->ring, seq, item);
+    while (!ring_push(p->ring, item) && p->retry)
+      sched_yield();
+  }
+  atomic_store(&p->done, true);
+  return NULL;
+}
+
+typedef struct
+{
+  uint32_t received;
+  uint32_t corrupt;
+  uint32_t disorder; // not after the one before
+  uint32_t last;
+  uint64_t ns;
+} result_t;
+
+static void receive(ring_t *r, result_t *res, const uint32_t *item)
+{
+  res->corrupt += !intact(r, item);
+  res->disorder += res->received && *item <= res->last;
+  res->last = *item;
+  res->received++;
+}
+
+// Consumes until the producer is done and the ring is empty
+static result_t run(ring_t *r, uint32_t count, bool retry)
+{
+  producer_t p = {.ring = r, .count = count, .retry = retry};
+  result_t res = {0};
+  uint32_t item[ITEM_MAX / sizeof(uint32_t)];
+  pthread_t thread;
+
+  r->overruns = 0;
+  uint64_t start = harness_ns();
+  pthread_create(&thread, NULL, produce, &p);
+  for (;;)
+  {
+    // Done is read before the ring, so the last item is not left behind
+    bool done = atomic_load(&p.done);
+    if (ring_pop(r, item))
+      receive(r, &res, item);
+    else if (done)
+      break;
+    else
+      sched_yield();
+  }
+  res.ns = harness_ns() - start;
+  pthread_join(thread, NULL);
+  return res;
+}
+
+static void check_lossless(ring_t *r)
+{
+  result_t res = run(r, ITEMS, true);
+
+  CHECK_EQ(res.received, ITEMS);
+  CHECK_EQ(res.corrupt, 0);
+  CHECK_EQ(res.disorder, 0);
+  CHECK_EQ(res.last, ITEMS - 1);
+}
+
+static void check_dropping(ring_t *r)
+{
+  result_t res = run(r, ITEMS, false);
+
+  CHECK_EQ(res.received + r->overruns, ITEMS);
+  CHECK_EQ(res.corrupt, 0);
+  CHECK_EQ(res.disorder, 0);
+}
+
+// Single thread: fill to capacity, one more is an overrun, empty in order
+static void check_capacity(void)
+{
+  item_t item;
+
+  items.overruns = 0;
+  for (uint32_t i = 0; i <= items.mask; i++)
+  {
+    fill(&items, i, &item);
+    CHECK(ring_push(&items, &item));
+  }
+  CHECK(!ring_push(&items, &item));
+  CHECK_EQ(items.overruns, 1);
+  for (uint32_t i = 0; i <= items.mask; i++)
+  {
+    CHECK(ring_pop(&items, &item));
+    CHECK_EQ(item.seq, i);
+  }
+  CHECK(!ring_pop(&items, &item));
+}
+
+static void bench(void)
+{
+  ring_t *rings[] = {&items, &scans};
+  const char *names[] = {"ppg 12 B", "adc 16 B"};
+
+  printf("%-10s %16s %14s\n", "ring", "threads Mitem/s", "push+pop ns");
+  for (int i = 0; i < 2; i++)
+  {
+    ring_t *r = rings[i];
+    uint32_t item[ITEM_MAX / sizeof(uint32_t)];
+    result_t res = run(r, 10 * ITEMS, true);
+
+    uint64_t start = harness_ns();
+    for (uint32_t seq = 0; seq < 10 * ITEMS; seq++)
+    {
+      fill(r, seq, item);
+      ring_push(r, item);
+      ring_pop(r, item);
+    }
+    uint64_t ns = harness_ns() - start;
+    harness_keep(item);
+    printf("%-10s %16.1f %14.1f\n", names[i], (double)res.received / res.ns * 1e3, (double)ns / (10 * ITEMS));
+  }
+}
+
+int main(int argc, char **argv)
+{
+  check_capacity();
+  check_lossless(&items);
+  check_lossless(&scans);
+  check_dropping(&items);
+  check_dropping(&scans);
+  if (harness_bench(argc, argv))
+    bench();
+  return harness_result("test_ring");
+}
@@ -0,0 +1,244 @@
+// The hardware-timed SAADC scan of main.c on the simulated TIMER, PPI and
+// SAADC (sim_nrf.c), set up the same way: TIMER1 compare to SAMPLE over PPI,
+// two buffers of ADC_SCAN_BLOCK scans queued with nrfx_saadc_buffer_convert().
+// DONE has to come back once per block, alternating between the buffers,
+// with every scan in channel order and none lost while the callback re-queues
+// in time. A callback that holds on to a buffer loses scans only once the
+// other one fills too. Downstream, the callback unpacks frames into an SPSC
+// ring the way saadc_callback() does, and a consumer polling at the adc task's
+// period must see every frame in order.
+//
+//   test_saadc [-b]   -b adds the host cost per scan of the callback and the
+//                     consumer
+
+#include "harness.h"
+#include "nrf_drv_ppi.h"
+#include "nrf_drv_timer.h"
+#include "nrfx_saadc.h"
+#include "ring.h"
+#include "sim.h"
+#include "sim_nrf.h"
+
+#define CHANNELS 5
+#define BLOCK 50 // ADC_SCAN_BLOCK
+#define SCAN_US 1000
+#define MS 1000000ull
+
+typedef struct
+{
+  uint32_t scan; // ms since the simulation started, from the values
+  uint16_t ch[CHANNELS];
+} frame_t;
+
+static const nrf_saadc_input_t pins[CHANNELS] = {NRF_SAADC_INPUT_AIN1, NRF_SAADC_INPUT_AIN2, NRF_SAADC_INPUT_AIN4,
+                                                 NRF_SAADC_INPUT_AIN5, NRF_SAADC_INPUT_AIN6};
+static const nrf_drv_timer_t timer = NRF_DRV_TIMER_INSTANCE(1);
+static nrf_saadc_value_t bufs[2][BLOCK * CHANNELS];
+
+RING_DEF(frames, frame_t, 256);
+
+static struct
+{
+  uint32_t blocks;
+  nrf_saadc_value_t *last; // buffer of the previous DONE
+  uint32_t same_buffer;    // DONE with the buffer of the one before
+  uint32_t off_time;       // DONE not at the end of a scan period
+  uint32_t bad_scans;      // values not in channel order
+  uint64_t done_ns;        // time of the last DONE
+  uint8_t hold;            // DONEs whose buffer is not queued again
+  uint8_t held_count;
+  nrf_saadc_value_t *held[2];
+} cb;
+
+static struct
+{
+  uint32_t frames;
+  uint32_t next;   // scan expected next
+  uint32_t missed; // scans skipped
+  uint32_t disorder;
+  bool started;
+} consumer;
+
+// Scan k (the k-th ms) reads k * 8 + pin, so every value says where it came from
+static uint16_t analog(nrf_saadc_input_t pin, uint64_t t_ns)
+{
+  return (uint16_t)(((t_ns / MS) * 8 + pin) & 0x0FFF);
+}
+
+static void on_done(nrfx_saadc_evt_t const *p_event)
+{
+  const nrf_saadc_value_t *buf = p_event->data.done.p_buffer;
+  uint16_t scans = p_event->data.done.size / CHANNELS;
+
+  cb.blocks++;
+  cb.same_buffer += p_event->data.done.p_buffer == cb.last;
+  cb.last = p_event->data.done.p_buffer;
+  cb.off_time += sim_now() % (SCAN_US * 1000u) != 0;
+  cb.done_ns = sim_now();
+  for (uint16_t i = 0; i < scans; i++)
+  {
+    frame_t frame = {.scan = (uint32_t)(buf[i * CHANNELS] >> 3)};
+    for (uint8_t c = 0; c < CHANNELS; c++)
+    {
+      frame.ch[c] = buf[i * CHANNELS + c];
+      cb.bad_scans += (frame.ch[c] & 0x07) != pins[c] || (frame.ch[c] >> 3) != frame.scan;
+    }
+    ring_push(&frames, &frame);
+  }
+  if (cb.hold)
+  {
+    cb.hold--;
+    cb.held[cb.held_count++] = p_event->data.done.p_buffer;
+    return;
+  }
+  CHECK_EQ(nrfx_saadc_buffer_convert(p_event->data.done.p_buffer, p_event->data.done.size), NRF_SUCCESS);
+}
+
+static bool consume(void *ctx, uint32_t period_ms)
+{
+  frame_t frame;
+
+  while (ring_pop(&frames, &frame))
+  {
+    // Scan numbers wrap with the 9 value bits left above the pin
+    if (consumer.started && frame.scan != consumer.next)
+    {
+      uint32_t skipped = (frame.scan - consumer.next) & 0x1FF;
+      if (skipped > 0x100)
+        consumer.disorder++;
+      else
+        consumer.missed += skipped;
+    }
+    consumer.started = true;
+    consumer.next = (frame.scan + 1) & 0x1FF;
+    consumer.frames++;
+  }
+  if (period_ms)
+    sim_at(sim_now() + period_ms * MS, ctx, consume, ctx, period_ms);
+  return true;
+}
+
+static void setup(void)
+{
+  nrfx_saadc_config_t saadc_config = NRFX_SAADC_DEFAULT_CONFIG;
+  nrf_saadc_channel_config_t channel_config = NRFX_SAADC_DEFAULT_CHANNEL_CONFIG_SE(0);
+  nrf_drv_timer_config_t timer_config = NRF_DRV_TIMER_DEFAULT_CONFIG;
+  nrf_ppi_channel_t ppi;
+
+  sim_begin(&(sim_config_t){.end_ns = UINT64_MAX});
+  sim_nrf_begin(0, analog);
+  saadc_config.resolution = NRF_SAADC_RESOLUTION_12BIT;
+  CHECK_EQ(nrfx_saadc_init(&saadc_config, on_done), NRF_SUCCESS);
+  for (uint8_t c = 0; c < CHANNELS; c++)
+  {
+    channel_config.pin_p = pins[c];
+    CHECK_EQ(nrfx_saadc_channel_init(c, &channel_config), NRF_SUCCESS);
+  }
+
+  timer_config.bit_width = NRF_TIMER_BIT_WIDTH_32;
+  CHECK_EQ(nrf_drv_timer_init(&timer, &timer_config, NULL), NRF_SUCCESS);
+  nrf_drv_timer_extended_compare(&timer, NRF_TIMER_CC_CHANNEL0, nrf_drv_timer_us_to_ticks(&timer, SCAN_US),
+                                 NRF_TIMER_SHORT_COMPARE0_CLEAR_MASK, false);
+  CHECK_EQ(nrf_drv_ppi_init(), NRF_SUCCESS);
+  CHECK_EQ(nrf_drv_ppi_channel_alloc(&ppi), NRF_SUCCESS);
+  CHECK_EQ(nrf_drv_ppi_channel_assign(ppi, nrf_drv_timer_compare_event_address_get(&timer, NRF_TIMER_CC_CHANNEL0),
+                                      nrfx_saadc_sample_task_get()),
+           NRF_SUCCESS);
+  CHECK_EQ(nrfx_saadc_buffer_convert(bufs[0], BLOCK * CHANNELS), NRF_SUCCESS);
+  CHECK_EQ(nrfx_saadc_buffer_convert(bufs[1], BLOCK * CHANNELS), NRF_SUCCESS);
+  CHECK_EQ(nrfx_saadc_buffer_convert(bufs[0], BLOCK * CHANNELS), NRF_ERROR_BUSY); // both queued
+  CHECK_EQ(nrf_drv_ppi_channel_enable(ppi), NRF_SUCCESS);
+  nrf_drv_timer_enable(&timer);
+  consume(sim_handler("adc_task", true), 25);
+}
+
+// One DONE per block, alternating buffers, nothing lost or out of place
+static void check_swap(void)
+{
+  sim_run(1000 * MS + 1);
+  CHECK_EQ(cb.blocks, 1000 / BLOCK);
+  CHECK_EQ(cb.same_buffer, 0);
+  CHECK_EQ(cb.off_time, 0);
+  CHECK_EQ(cb.bad_scans, 0);
+  CHECK_EQ(sim_nrf_saadc_stats()->scans, 1000);
+  CHECK_EQ(sim_nrf_saadc_stats()->lost, 0);
+  CHECK_EQ(sim_nrf_saadc_stats()->buffers, cb.blocks);
+  sim_run(1025 * MS + 1);
+  CHECK_EQ(consumer.frames, 1000);
+  CHECK_EQ(consumer.missed, 0);
+  CHECK_EQ(consumer.disorder, 0);
+  CHECK_EQ(frames.overruns, 0);
+}
+
+// Holding one buffer back costs nothing, the other one keeps being filled
+// and re-queued. Holding both loses every scan until one is back.
+static void check_hold(uint8_t holds, uint64_t late_ms, uint32_t lost)
+{
+  uint32_t lost_before = sim_nrf_saadc_stats()->lost;
+  uint32_t missed_before = consumer.missed;
+  uint32_t same_before = cb.same_buffer;
+  uint32_t blocks = cb.blocks;
+
+  cb.hold = holds;
+  cb.held_count = 0;
+  while (cb.blocks < blocks + holds)
+    sim_run(sim_now() + MS);
+  sim_run(cb.done_ns + late_ms * MS);
+  for (uint8_t i = 0; i < holds; i++)
+    CHECK_EQ(nrfx_saadc_buffer_convert(cb.held[i], BLOCK * CHANNELS), NRF_SUCCESS);
+  sim_run(sim_now() + 4 * BLOCK * MS);
+  CHECK_EQ(sim_nrf_saadc_stats()->lost - lost_before, lost);
+  CHECK_EQ(consumer.missed - missed_before, lost);
+  // With one held, the other buffer comes back twice in a row
+  CHECK_EQ(cb.same_buffer - same_before, holds == 1);
+  CHECK_EQ(cb.bad_scans, 0);
+}
+
+// A stopped timer stops the scans, restarting carries on into the same buffer
+static void check_stop(void)
+{
+  const sim_saadc_stats_t *stats = sim_nrf_saadc_stats();
+
+  sim_run(sim_now() + BLOCK / 2 * MS);
+  nrf_drv_timer_disable(&timer);
+  uint32_t scans = stats->scans;
+  uint32_t blocks = cb.blocks;
+  sim_run(sim_now() + 500 * MS);
+  CHECK_EQ(sim_nrf_saadc_stats()->scans, scans);
+  CHECK_EQ(cb.blocks, blocks);
+  nrf_drv_timer_enable(&timer);
+  sim_run(sim_now() + 10 * BLOCK * MS);
+  CHECK_EQ(sim_nrf_saadc_stats()->scans - scans, 10 * BLOCK);
+  CHECK_EQ(cb.blocks - blocks, 10);
+  CHECK_EQ(cb.bad_scans, 0);
+  CHECK_EQ(consumer.missed, stats->lost);
+  CHECK(stats->scans - stats->lost - cb.blocks * BLOCK < BLOCK);
+}
+
+// Host time per scan of DONE handling and of the consumer, from the simulator's handler accounting
+static void bench(void)
+{
+  sim_handler_t *done = sim_handler("saadc", true);
+  sim_handler_t *task = sim_handler("adc_task", true);
+  uint32_t scans = sim_nrf_saadc_stats()->scans;
+  uint64_t start = harness_ns();
+
+  done->host_ns = task->host_ns = 0;
+  sim_run(sim_now() + 60000 * MS);
+  uint64_t ns = harness_ns() - start;
+  scans = sim_nrf_saadc_stats()->scans - scans;
+  printf("%u scans: saadc %.1f ns/scan, adc task %.1f ns/scan, simulation %.1f ns/scan\n", (unsigned)scans,
+         (double)done->host_ns / scans, (double)task->host_ns / scans, (double)ns / scans);
+}
+
+int main(int argc, char **argv)
+{
+  setup();
+  check_swap();
+  check_hold(1, 80, 0);
+  check_hold(2, 30, 30);
+  check_stop();
+  if (harness_bench(argc, argv))
+    bench();
+  return harness_result("test_saadc");
+}
@@ -0,0 +1,226 @@
+// sched.c on a simulated clock that only moves when a task spends time or the
+// loop sleeps to its next wakeup, the RTC's 24-bit range wrapping partway.
+// Tasks released together have to run in priority order, the earliest
+// deadline breaking ties. Within capacity nothing overruns or misses and the
+// execution times are exact. Overloaded, with the work asking for 120 % of
+// the CPU, the two higher priority tasks still run on every release within
+// their deadlines, the overload lands on the lowest, every release is either
+// run, dropped or still pending, and no pass runs a task twice. A stall of
+// many periods costs one run per task, due by the latest release's deadline.
+//
+//   test_sched [-b]   -b adds the per-task figures under overload and the
+//                     host cost of a pass
+
+#include "harness.h"
+#include "sched.h"
+#include "synth.h"
+
+#define TASKS 3
+#define WAKE 25           // loop wakeup period, ticks
+#define START 0xFFFF00u   // just before the wrap
+
+static uint32_t now;
+static uint32_t cost[TASKS];   // ticks each run takes
+static uint8_t order[64];
+static uint32_t ran;
+
+static uint32_t clock_fn(void)
+{
+  return now & SYNTH_TICK_MASK;
+}
+
+static void work(uint8_t i)
+{
+  if (ran < sizeof(order))
+    order[ran] = i;
+  ran++;
+  now += cost[i];
+}
+
+static void task0(void) { work(0); }
+static void task1(void) { work(1); }
+static void task2(void) { work(2); }
+
+typedef struct
+{
+  uint32_t passes;
+  uint32_t most;   // runs in one pass
+  uint32_t seen;   // clock at the end of the last pass, releases up to it are counted
+} loop_t;
+
+// Runs the loop until ticks have gone by. After each pass it sleeps to the
+// next wakeup, unless that wakeup came during the pass.
+static loop_t loop(sched_ctx_t *ctx, uint32_t ticks)
+{
+  loop_t l = {0};
+  uint32_t end = now + ticks;
+
+  while ((int32_t)(now - end) < 0)
+  {
+    uint32_t wake = now + WAKE - (now - START) % WAKE;
+    uint8_t n = sched_run(ctx);
+
+    l.passes++;
+    l.most = n > l.most ? n : l.most;
+    l.seen = now;
+    if ((int32_t)(now - wake) < 0)
+      now = wake;
+  }
+  return l;
+}
+
+// Releases from the start up to the end of the loop's last pass
+static uint32_t releases(const sched_task_t *t, const loop_t *l)
+{
+  return (l->seen - START) / t->period + 1;
+}
+
+static void setup(sched_ctx_t *ctx, sched_task_t *tasks, const uint32_t *costs)
+{
+  now = START;
+  ran = 0;
+  for (int i = 0; i < TASKS; i++)
+    cost[i] = costs[i];
+  sched_begin(ctx, tasks, TASKS, clock_fn, SYNTH_TICK_MASK);
+}
+
+// All released at once: priority first, then the earliest deadline
+static void check_order(void)
+{
+  sched_task_t tasks[TASKS] = {
+      SCHED_TASK("c", task0, 100, 90, 1),
+      SCHED_TASK("a", task1, 100, 100, 0),
+      SCHED_TASK("b", task2, 100, 80, 1),
+  };
+  sched_ctx_t ctx;
+
+  setup(&ctx, tasks, (const uint32_t[]){1, 1, 1});
+  CHECK_EQ(sched_run(&ctx), 3);
+  CHECK_EQ(order[0], 1);
+  CHECK_EQ(order[1], 2);
+  CHECK_EQ(order[2], 0);
+  // Nothing is due again until the next period
+  now += 50;
+  CHECK_EQ(sched_run(&ctx), 0);
+}
+
+// 42 % of the CPU, the wrap on the way
+static void check_capacity(void)
+{
+  sched_task_t tasks[TASKS] = {
+      SCHED_TASK("adc", task0, 25, 50, 0),
+      SCHED_TASK("ppg", task1, 100, 250, 1),
+      SCHED_TASK("tx", task2, 25, 50, 2),
+  };
+  sched_ctx_t ctx;
+  uint32_t ticks = 100000;
+
+  setup(&ctx, tasks, (const uint32_t[]){5, 10, 3});
+  loop_t l = loop(&ctx, ticks);
+  for (int i = 0; i < TASKS; i++)
+  {
+    CHECK_EQ(tasks[i].runs, releases(&tasks[i], &l));
+    CHECK_EQ(tasks[i].overruns, 0);
+    CHECK_EQ(tasks[i].misses, 0);
+    CHECK_EQ(tasks[i].exec_min, cost[i]);
+    CHECK_EQ(tasks[i].exec_max, cost[i]);
+    CHECK_EQ(sched_exec_mean(&tasks[i]), cost[i]);
+  }
+}
+
+static sched_task_t overload[TASKS];
+static loop_t overload_loop;
+
+// 20 + 32 + 68 % of the CPU
+static void check_overload(void)
+{
+  sched_task_t tasks[TASKS] = {
+      SCHED_TASK("high", task0, 25, 25, 0),
+      SCHED_TASK("mid", task1, 25, 50, 1),
+      SCHED_TASK("low", task2, 25, 25, 2),
+  };
+  sched_ctx_t ctx;
+  uint32_t ticks = 100000;
+
+  setup(&ctx, tasks, (const uint32_t[]){5, 8, 17});
+  overload_loop = loop(&ctx, ticks);
+  for (int i = 0; i < TASKS; i++)
+  {
+    const sched_task_t *t = &tasks[i];
+    CHECK_EQ(t->runs + t->overruns + t->pending, releases(t, &overload_loop));
+    overload[i] = *t;
+  }
+  CHECK(overload_loop.most <= TASKS);
+  CHECK_EQ(tasks[0].overruns, 0);
+  CHECK_EQ(tasks[0].misses, 0);
+  CHECK_EQ(tasks[1].overruns, 0);
+  CHECK_EQ(tasks[1].misses, 0);
+  // The low task gets what is left, 48 % of the CPU for its 68 %
+  CHECK(tasks[2].overruns > 0);
+  CHECK_NEAR(tasks[2].runs * cost[2], ticks - tasks[0].runs * cost[0] - tasks[1].runs * cost[1], 2 * cost[2]);
+}
+
+// The clock jumps 40 periods: one run each, the skipped releases dropped
+static void check_stall(void)
+{
+  sched_task_t tasks[TASKS] = {
+      SCHED_TASK("a", task0, 10, 10, 0),
+      SCHED_TASK("b", task1, 20, 20, 1),
+      SCHED_TASK("c", task2, 40, 40, 2),
+  };
+  sched_ctx_t ctx;
+
+  setup(&ctx, tasks, (const uint32_t[]){1, 1, 1});
+  CHECK_EQ(sched_run(&ctx), 3);
+  now += 400;
+  CHECK_EQ(sched_run(&ctx), 3);
+  CHECK_EQ(tasks[0].overruns, 39);
+  CHECK_EQ(tasks[1].overruns, 19);
+  CHECK_EQ(tasks[2].overruns, 9);
+  CHECK_EQ(tasks[0].misses, 0); // released at 400, run at once
+  // Back on the period after
+  now = START + 410;
+  CHECK_EQ(sched_run(&ctx), 1);
+}
+
+// Cycles are the TSC's on x86, 0 elsewhere
+static void bench(void)
+{
+  printf("%-6s %8s %8s %8s %8s %8s\n", "task", "runs", "overruns", "misses", "min", "max");
+  for (int i = 0; i < TASKS; i++)
+    printf("%-6s %8u %8u %8u %8u %8u\n", overload[i].name, (unsigned)overload[i].runs,
+           (unsigned)overload[i].overruns, (unsigned)overload[i].misses, (unsigned)overload[i].exec_min,
+           (unsigned)overload[i].exec_max);
+  printf("%u passes, at most %u runs in one\n", (unsigned)overload_loop.passes, (unsigned)overload_loop.most);
+
+  // Passes that find nothing due are what the loop does between wakeups
+  sched_task_t tasks[TASKS] = {
+      SCHED_TASK("a", task0, 25, 50, 0),
+      SCHED_TASK("b", task1, 100, 250, 1),
+      SCHED_TASK("c", task2, 25, 50, 2),
+  };
+  sched_ctx_t ctx;
+  uint32_t rounds = 1000000, total = 0;
+
+  setup(&ctx, tasks, (const uint32_t[]){0, 0, 0});
+  uint64_t start = harness_ns(), cyc = harness_cycles();
+  for (uint32_t r = 0; r < rounds; r++)
+  {
+    total += sched_run(&ctx);
+    now++;
+  }
+  printf("sched_run: %.1f ns/pass, %.1f cycles/pass, %u runs\n", (double)(harness_ns() - start) / rounds,
+         (double)(harness_cycles() - cyc) / rounds, (unsigned)total);
+  harness_keep(&total);
+}
+
+int main(int argc, char **argv)
+{
+  check_order();
+  check_capacity();
+  check_overload();
+  check_stall();
+  if (harness_bench(argc, argv))
+    bench();
+  return harness_result("test_sched");
+}
@@ -0,0 +1,185 @@
+// spo2.c against synthetic red and IR pulse trains of known ratio of ratios
+// (synth.h), beat windows closed at the true beats the way hr_update() closes
+// them at detected ones. Over the physiological range the reading has to
+// land within 0.5 % of the calibration curve at that ratio from the first
+// reading on, and within 2.5 % with 3 counts of sensor noise, which the peak
+// to peak amplitude takes in full and the curve steepens towards low
+// saturation. A ratio outside SPO2_R_MIN_Q8..SPO2_R_MAX_Q8, and windows too
+// short to hold a beat, must not produce one.
+//
+//   test_spo2 [-b]   -b adds the host cost per sample, with and without the
+//                    beat windows, and the reading error over sample rates
+
+#include <math.h>
+#include "harness.h"
+#include "spo2.h"
+#include "synth.h"
+
+#define IR_DC 90000
+#define IR_AC 150
+
+typedef struct
+{
+  uint32_t readings;
+  uint16_t last;
+  double max_err; // against the curve, 0.1 %
+  uint32_t beats;
+} result_t;
+
+#define BENCH_SAMPLES 30000 // 5 minutes at 100 sps
+
+static uint32_t bench_red[BENCH_SAMPLES], bench_ir[BENCH_SAMPLES];
+static bool bench_beat[BENCH_SAMPLES];
+
+// Maxim's curve in doubles, 0.1 %
+static double curve(double r)
+{
+  double s = 10.0 * (-45.060 * r * r + 30.354 * r + 94.845);
+  return s < 0 ? 0 : s > 1000 ? 1000 : s;
+}
+
+// Feeds seconds of the pulse train, kept in the bench_ arrays as far as they go
+static result_t run(double r, float rate_hz, float noise, double seconds)
+{
+  // red_ac / red_dc = r * IR_AC / IR_DC
+  synth_ppg_t p = {
+      .rate_hz = rate_hz,
+      .bpm = 72,
+      .rr_jitter = 0.03f,
+      .ir_dc = IR_DC,
+      .ir_ac = IR_AC,
+      .red_dc = 70000,
+      .red_ac = (float)(r * IR_AC * 70000 / IR_DC),
+      .noise = noise,
+      .seed = 23,
+  };
+  uint32_t samples = (uint32_t)(seconds * rate_hz);
+  double expect = curve(round(r * 256) / 256);
+  result_t res = {0};
+  spo2_ctx_t ctx;
+
+  spo2_begin(&ctx);
+  synth_ppg_begin(&p);
+  for (uint32_t i = 0; i < samples; i++)
+  {
+    uint32_t red, ir;
+    double beat_t;
+    bool beat = synth_ppg_next(&p, &red, &ir, &beat_t);
+
+    if (i < BENCH_SAMPLES)
+    {
+      bench_red[i] = red;
+      bench_ir[i] = ir;
+      bench_beat[i] = beat;
+    }
+    spo2_add(&ctx, red, ir);
+    if (!beat)
+      continue;
+    res.beats++;
+    if (!spo2_beat(&ctx))
+      continue;
+    res.readings++;
+    res.last = spo2_value(&ctx);
+    if (fabs(res.last - expect) > res.max_err)
+      res.max_err = fabs(res.last - expect);
+  }
+  return res;
+}
+
+// 0.4 to 1.0 is 100 % down to 80 %, readings every beat after the first few
+static void check_range(void)
+{
+  for (double r = 0.4; r <= 1.0 + 1e-9; r += 0.1)
+  {
+    result_t clean = run(r, 25, 0, 60);
+    result_t noisy = run(r, 25, 3, 60);
+
+    CHECK(clean.readings >= clean.beats - SPO2_AVG_BEATS - 1);
+    CHECK(clean.max_err <= 5);
+    CHECK(noisy.readings >= noisy.beats - SPO2_AVG_BEATS - 1);
+    CHECK(noisy.max_err <= 25);
+    CHECK_NEAR(noisy.last, clean.last, 25);
+  }
+}
+
+// A ratio no blood gives never reaches the average
+static void check_implausible(void)
+{
+  CHECK_EQ(run(0.1, 25, 0, 30).readings, 0);
+  CHECK_EQ(run(2.5, 25, 0, 30).readings, 0);
+}
+
+// Beats closer than SPO2_MIN_SAMPLES samples, as a noisy detector reports
+// them, are dropped without a reading
+static void check_short_windows(void)
+{
+  spo2_ctx_t ctx;
+  uint32_t readings = 0;
+
+  spo2_begin(&ctx);
+  for (uint32_t i = 0; i < 1000; i++)
+  {
+    double ph = 2.0 * M_PI * i / 20;
+    spo2_add(&ctx, (uint32_t)(70000 + 50 * sin(ph)), (uint32_t)(IR_DC + IR_AC * sin(ph)));
+    if (i % (SPO2_MIN_SAMPLES - 1) == 0)
+      readings += spo2_beat(&ctx);
+  }
+  CHECK_EQ(readings, 0);
+  CHECK_EQ(spo2_value(&ctx), 0);
+}
+
+// Cycles are the TSC's on x86, 0 elsewhere. Per sample is spo2_add() alone,
+// then with the spo2_beat() of every beat window spread over the samples.
+static void bench(void)
+{
+  static const float rates[] = {25, 50, 100};
+
+  printf("%6s %5s %10s %10s %10s %10s %10s\n", "sps", "R", "readings", "err 0.1%", "ns/sample", "cyc/sample",
+         "with beats");
+  for (int s = 0; s < 3; s++)
+    for (double r = 0.4; r <= 1.0 + 1e-9; r += 0.3)
+    {
+      uint32_t n = (uint32_t)(300 * rates[s]);
+      result_t res = run(r, rates[s], 3, 300);
+      uint32_t rounds = 20;
+      spo2_ctx_t ctx;
+
+      uint64_t start = harness_ns(), cyc = harness_cycles();
+      for (uint32_t k = 0; k < rounds; k++)
+      {
+        spo2_begin(&ctx);
+        for (uint32_t i = 0; i < n; i++)
+          spo2_add(&ctx, bench_red[i], bench_ir[i]);
+        harness_keep(&ctx);
+      }
+      double add_ns = (double)(harness_ns() - start) / rounds / n;
+      double add_cyc = (double)(harness_cycles() - cyc) / rounds / n;
+
+      start = harness_ns();
+      for (uint32_t k = 0; k < rounds; k++)
+      {
+        spo2_begin(&ctx);
+        for (uint32_t i = 0; i < n; i++)
+        {
+          spo2_add(&ctx, bench_red[i], bench_ir[i]);
+          if (bench_beat[i])
+            spo2_beat(&ctx);
+        }
+        harness_keep(&ctx);
+      }
+      double all_ns = (double)(harness_ns() - start) / rounds / n;
+
+      printf("%6.0f %5.2f %10u %10.1f %10.1f %10.1f %10.1f\n", rates[s], r, (unsigned)res.readings, res.max_err,
+             add_ns, add_cyc, all_ns);
+    }
+}
+
+int main(int argc, char **argv)
+{
+  check_range();
+  check_implausible();
+  check_short_windows();
+  if (harness_bench(argc, argv))
+    bench();
+  return harness_result("test_spo2");
+}
@@ -0,0 +1,292 @@
+// sqi.c with the configuration main.c gives each channel, at the rate that
+// channel reaches it, on synthetic good and bad signals: a pulse, breathing, a
+// slow skin response, EMG and walking against a sensor off the finger or
+// saturated, leads off or shorted, motion noise and a dead accelerometer. A
+// good signal must raise no flag once the window is full, a bad one has to
+// raise the flags that describe it. Switching from good to bad and back, the
+// flags have to follow within a few windows, a flatline once the variance
+// has decayed, and a clip has to clear exactly its hold after the last
+// clipped sample. A noise level near the threshold must not chatter.
+//
+//   test_sqi [-b]   -b adds the flags and settling time of every case and the
+//                   host cost per sample
+
+#include <math.h>
+#include "harness.h"
+#include "sqi.h"
+#include "synth.h"
+
+// main.c's channels and their sqi_config entries
+#define ADC_RAIL_LO 8
+#define ADC_RAIL_HI 4087
+#define POWER_SATURATION 0x3E000
+#define PPG_FINGER_MIN 50000
+
+enum
+{
+  PPG,
+  FLEX,
+  GSR,
+  EMG,
+  ACC,
+  CHANNELS
+};
+
+static const sqi_config_t configs[CHANNELS] = {
+    [PPG] = {.alpha = 1.0f / 100, .lo = 0, .hi = POWER_SATURATION, .dc_min = PPG_FINGER_MIN, .dc_max = POWER_SATURATION,
+             .flat_std = 2.0f, .noise_max = 0.5f, .hold = 50},
+    [FLEX] = {.alpha = 1.0f / 100, .lo = ADC_RAIL_LO, .hi = ADC_RAIL_HI, .dc_min = 50, .dc_max = 4040,
+              .flat_std = 0.5f, .noise_max = 0.5f, .hold = 40},
+    [GSR] = {.alpha = 1.0f / 50, .lo = ADC_RAIL_LO, .hi = ADC_RAIL_HI, .dc_min = 50, .dc_max = 4040,
+             .flat_std = 0.05f, .noise_max = 0.5f, .hold = 10},
+    [EMG] = {.alpha = 1.0f / 500, .lo = ADC_RAIL_LO, .hi = ADC_RAIL_HI, .dc_min = 200, .dc_max = 3900,
+             .flat_std = 1.0f, .noise_max = 0.0f, .hold = 500},
+    [ACC] = {.alpha = 1.0f / 200, .lo = ADC_RAIL_LO, .hi = ADC_RAIL_HI, .dc_min = 50, .dc_max = 4040,
+             .flat_std = 0.05f, .noise_max = 0.0f, .hold = 200},
+};
+
+static const double rate_hz[CHANNELS] = {[PPG] = 25, [FLEX] = 20, [GSR] = 5, [EMG] = 1000, [ACC] = 100};
+
+typedef enum
+{
+  PULSE,       // PPG on a finger
+  OFF_FINGER,  // PPG seeing ambient light
+  SATURATED,   // PPG at full scale
+  MOTION,      // PPG swamped by movement
+  BREATHING,   // flex
+  FLEX_NOISE,  // flex lead picking up interference
+  RAIL_HIGH,   // lead off, pulled to the rail
+  SKIN,        // GSR
+  RAIL_LOW,    // open GSR electrode
+  MUSCLE,      // EMG
+  SHORTED,     // EMG inputs shorted together
+  WALKING,     // acc
+  DEAD,        // acc without supply
+} signal_t;
+
+static double sample(signal_t s, double t, uint32_t *seed)
+{
+  switch (s)
+  {
+  case PULSE:
+    return 120000 + 1500 * sin(2.0 * M_PI * 1.2 * t) + 30 * synth_gauss(seed);
+  case OFF_FINGER:
+    return 8000 + 40 * synth_gauss(seed);
+  case SATURATED:
+    return POWER_SATURATION;
+  case MOTION:
+    return 120000 + 3000 * synth_gauss(seed);
+  case BREATHING:
+    return 2100 + 150 * sin(2.0 * M_PI * 0.25 * t) + synth_gauss(seed);
+  case FLEX_NOISE:
+    return 2100 + 60 * synth_gauss(seed);
+  case RAIL_HIGH:
+    return 4095;
+  case SKIN:
+    return 1500 + 20 * sin(2.0 * M_PI * 0.05 * t) + 0.3 * synth_gauss(seed);
+  case RAIL_LOW:
+    return 0;
+  case MUSCLE:
+    return 2048 + 40 * synth_gauss(seed);
+  case SHORTED:
+    return 2048;
+  case WALKING:
+    return 2048 + 100 * sin(2.0 * M_PI * 1.7 * t) + 4 * synth_gauss(seed);
+  case DEAD:
+  default:
+    return 2048;
+  }
+}
+
+typedef struct
+{
+  const char *name;
+  uint8_t ch;
+  signal_t signal;
+  uint8_t flags;  // all of these and no others
+} case_t;
+
+static const case_t cases[] = {
+    {"pulse", PPG, PULSE, 0},
+    {"off finger", PPG, OFF_FINGER, SQI_DC | SQI_NOISE},
+    {"saturated", PPG, SATURATED, SQI_CLIP | SQI_FLAT},
+    {"motion", PPG, MOTION, SQI_NOISE},
+    {"breathing", FLEX, BREATHING, 0},
+    {"flex noise", FLEX, FLEX_NOISE, SQI_NOISE},
+    {"flex off", FLEX, RAIL_HIGH, SQI_CLIP | SQI_FLAT | SQI_DC},
+    {"skin", GSR, SKIN, 0},
+    {"gsr open", GSR, RAIL_LOW, SQI_CLIP | SQI_FLAT | SQI_DC},
+    {"muscle", EMG, MUSCLE, 0},
+    {"emg off", EMG, RAIL_HIGH, SQI_CLIP | SQI_FLAT | SQI_DC},
+    {"emg shorted", EMG, SHORTED, SQI_FLAT},
+    {"walking", ACC, WALKING, 0},
+    {"acc dead", ACC, DEAD, SQI_FLAT},
+};
+
+#define CASES (sizeof(cases) / sizeof(cases[0]))
+
+// Windows of the channel's EMA
+static uint32_t window(uint8_t ch)
+{
+  return (uint32_t)lroundf(1.0f / configs[ch].alpha);
+}
+
+typedef struct
+{
+  uint8_t flags;     // at the end
+  uint32_t settled;  // samples after the window until the flags last changed
+} outcome_t;
+
+static outcome_t run(const case_t *c, uint32_t windows)
+{
+  sqi_ctx_t ctx;
+  uint32_t seed = 59, n = windows * window(c->ch);
+  outcome_t o = {0};
+  uint8_t prev = 0;
+
+  sqi_begin(&ctx, &configs[c->ch]);
+  for (uint32_t i = 0; i < n; i++)
+  {
+    uint8_t flags = sqi_add(&ctx, (float)sample(c->signal, i / rate_hz[c->ch], &seed));
+    if (flags != prev && i >= window(c->ch))
+      o.settled = i - window(c->ch);
+    prev = flags;
+  }
+  o.flags = sqi_flags(&ctx);
+  return o;
+}
+
+static void check_cases(void)
+{
+  for (unsigned i = 0; i < CASES; i++)
+  {
+    outcome_t o = run(&cases[i], 20);
+
+    CHECK_EQ(o.flags, cases[i].flags);
+    // Settled within two windows of the first full one
+    CHECK(o.settled <= 2 * window(cases[i].ch));
+  }
+}
+
+// good, bad, good on one channel: samples until each change shows
+static void switch_over(uint8_t ch, signal_t good, signal_t bad, uint8_t flag, uint32_t *raise, uint32_t *clear)
+{
+  sqi_ctx_t ctx;
+  uint32_t seed = 61, w = window(ch), i = 0;
+
+  *raise = *clear = UINT32_MAX;
+  sqi_begin(&ctx, &configs[ch]);
+  for (; i < 10 * w; i++)
+    sqi_add(&ctx, (float)sample(good, i / rate_hz[ch], &seed));
+  CHECK_EQ(sqi_flags(&ctx), 0);
+  for (uint32_t j = 0; j < 20 * w; j++, i++)
+    if ((sqi_add(&ctx, (float)sample(bad, i / rate_hz[ch], &seed)) & flag) && *raise == UINT32_MAX)
+      *raise = j;
+  for (uint32_t j = 0; j < 10 * w; j++, i++)
+    if (!sqi_add(&ctx, (float)sample(good, i / rate_hz[ch], &seed)) && *clear == UINT32_MAX)
+      *clear = j;
+}
+
+static void check_switch(void)
+{
+  uint32_t raise, clear;
+
+  // Noise shows within two windows and clears within a few
+  switch_over(PPG, PULSE, MOTION, SQI_NOISE, &raise, &clear);
+  CHECK(raise <= 2 * window(PPG));
+  CHECK(clear <= 4 * window(PPG));
+  switch_over(FLEX, BREATHING, FLEX_NOISE, SQI_NOISE, &raise, &clear);
+  CHECK(raise <= 2 * window(FLEX));
+  CHECK(clear <= 4 * window(FLEX));
+
+  // A flatline shows once the variance the signal left has decayed under
+  // the threshold, from a walking swing that takes about 15 windows
+  switch_over(ACC, WALKING, DEAD, SQI_FLAT, &raise, &clear);
+  CHECK(raise <= 20 * window(ACC));
+  CHECK(clear <= window(ACC));
+
+  // A clip shows on the first sample and clears when its hold runs out, the
+  // flat and DC flags the rail raised having cleared by then
+  switch_over(EMG, MUSCLE, RAIL_HIGH, SQI_CLIP, &raise, &clear);
+  CHECK_EQ(raise, 0);
+  CHECK_EQ(clear, configs[EMG].hold - 1);
+}
+
+// A single clipped sample holds SQI_CLIP up for hold samples, itself included
+static void check_hold(void)
+{
+  sqi_ctx_t ctx;
+  uint32_t seed = 67, up = 0, i = 0;
+
+  sqi_begin(&ctx, &configs[FLEX]);
+  for (; i < 10 * window(FLEX); i++)
+    sqi_add(&ctx, (float)sample(BREATHING, i / rate_hz[FLEX], &seed));
+  CHECK(sqi_add(&ctx, ADC_RAIL_HI) & SQI_CLIP);
+  for (uint32_t j = 0; j < 3 * configs[FLEX].hold; j++, i++)
+    up += (sqi_add(&ctx, (float)sample(BREATHING, i / rate_hz[FLEX], &seed)) & SQI_CLIP) != 0;
+  CHECK_EQ(up, configs[FLEX].hold - 1);
+}
+
+// Noise right at the threshold, the ratio over it about half the time: the
+// hysteresis keeps the flag from flipping sample by sample, without it this
+// flips about 500 times with runs of a single sample
+static void check_hysteresis(void)
+{
+  sqi_ctx_t ctx;
+  uint32_t seed = 71, flips = 0, last = 0, shortest = UINT32_MAX, n = 200 * window(FLEX);
+  uint8_t prev = 0;
+
+  sqi_begin(&ctx, &configs[FLEX]);
+  for (uint32_t i = 0; i < n; i++)
+  {
+    double t = i / rate_hz[FLEX];
+    uint8_t flags = sqi_add(&ctx, (float)(2100 + 40 * sin(2.0 * M_PI * 0.25 * t) + 26 * synth_gauss(&seed)));
+    if ((flags & SQI_NOISE) != (prev & SQI_NOISE))
+    {
+      if (flips++ && i - last < shortest)
+        shortest = i - last;
+      last = i;
+    }
+    prev = flags;
+  }
+  CHECK(flips > 0);
+  CHECK(flips < 100);
+  CHECK(shortest >= 5);
+}
+
+// Cycles are the TSC's on x86, 0 elsewhere
+static void bench(void)
+{
+  printf("%-12s %6s %6s %8s\n", "case", "want", "got", "settled");
+  for (unsigned i = 0; i < CASES; i++)
+  {
+    outcome_t o = run(&cases[i], 20);
+    printf("%-12s %6x %6x %8u\n", cases[i].name, cases[i].flags, o.flags, (unsigned)o.settled);
+  }
+
+  static float x[100000];
+  uint32_t seed = 73, sum = 0;
+  sqi_ctx_t ctx;
+
+  for (uint32_t i = 0; i < 100000; i++)
+    x[i] = (float)sample(MUSCLE, i / 1000.0, &seed);
+  sqi_begin(&ctx, &configs[EMG]);
+  uint64_t start = harness_ns(), cyc = harness_cycles();
+  for (uint32_t r = 0; r < 10; r++)
+    for (uint32_t i = 0; i < 100000; i++)
+      sum += sqi_add(&ctx, x[i]);
+  printf("sqi_add: %.1f ns/sample, %.1f cycles/sample\n", (double)(harness_ns() - start) / 1e6,
+         (double)(harness_cycles() - cyc) / 1e6);
+  harness_keep(&sum);
+}
+
+int main(int argc, char **argv)
+{
+  check_cases();
+  check_switch();
+  check_hold();
+  check_hysteresis();
+  if (harness_bench(argc, argv))
+    bench();
+  return harness_result("test_sqi");
+}
@@ -0,0 +1,177 @@
+// step.c replayed over a synthetic accelerometer trace at the ACC rate with
+// known step times: standing, walking, running and slow walking, each step a
+// heel strike on the body's bounce at the cadence and a smaller arm swing at
+// the stride, gravity drifting with the wrist's orientation and the RTC
+// wrapping partway. Every segment has to
+// count its steps within a few percent and settle its cadence on the true one,
+// standing must count nothing and clear the cadence.
+//
+//   test_step [-b]   -b adds the count and cadence error per segment and the
+//                    host cost per sample
+
+#include <math.h>
+#include "harness.h"
+#include "step.h"
+#include "synth.h"
+
+#define RATE_HZ 100        // ACC_DECIM
+#define START_S 500.0      // RTC time at the first sample, it wraps at 512 s
+#define SEGMENTS 6
+#define SAMPLES_MAX (400 * RATE_HZ)
+
+typedef struct
+{
+  double seconds;
+  double spm;      // 0 standing
+  double strike;   // heel strike amplitude, ADC counts
+} segment_t;
+
+static const segment_t segments[SEGMENTS] = {
+    {10, 0, 0}, {60, 110, 220}, {15, 0, 0}, {40, 170, 400}, {60, 80, 150}, {15, 0, 0},
+};
+
+typedef struct
+{
+  uint32_t steps;   // true
+  uint32_t counted;
+  uint16_t cadence; // at the end of the segment
+  uint32_t first;   // sample the segment starts at
+} seg_result_t;
+
+static uint16_t acc[SAMPLES_MAX];
+static uint32_t ticks[SAMPLES_MAX];
+static uint32_t samples;
+static seg_result_t results[SEGMENTS];
+
+static void make_trace(void)
+{
+  uint32_t seed = 31;
+  double t = 0, next_step = 0;
+
+  samples = 0;
+  for (int s = 0; s < SEGMENTS; s++)
+  {
+    const segment_t *seg = &segments[s];
+    double period = seg->spm ? 60.0 / seg->spm : 0;
+    double end = t + seg->seconds;
+
+    results[s] = (seg_result_t){.first = samples};
+    next_step = t + period / 2;
+    for (; t < end - 1e-9 && samples < SAMPLES_MAX; t += 1.0 / RATE_HZ, samples++)
+    {
+      double x = 2048 + 120 * sin(2.0 * M_PI * t / 90.0) + 4 * synth_gauss(&seed);
+
+      if (period)
+      {
+        // Heel strike: 120 ms half sine after each step, the body bouncing
+        // at the cadence and the arm swinging at the stride
+        double since = t - (next_step - period);
+        if (since >= 0 && since < 0.12)
+          x += seg->strike * sin(M_PI * since / 0.12);
+        x += 0.3 * seg->strike * sin(2.0 * M_PI * since / period) + 0.1 * seg->strike * sin(M_PI * t / period);
+        if (t + 1.0 / RATE_HZ > next_step)
+        {
+          results[s].steps++;
+          next_step += period * (1.0 + 0.02 * synth_uniform(&seed));
+        }
+      }
+      acc[samples] = x < 0 ? 0 : x > 4095 ? 4095 : (uint16_t)lround(x);
+      ticks[samples] = synth_ticks(START_S + t);
+    }
+  }
+}
+
+static void replay(void)
+{
+  step_ctx_t ctx;
+
+  step_begin(&ctx);
+  for (int s = 0; s < SEGMENTS; s++)
+  {
+    uint32_t end = s + 1 < SEGMENTS ? results[s + 1].first : samples;
+
+    for (uint32_t i = results[s].first; i < end; i++)
+      results[s].counted += step_add(&ctx, acc[i], ticks[i]);
+    results[s].cadence = step_cadence(&ctx);
+  }
+}
+
+static void check_segments(void)
+{
+  uint32_t counted = 0;
+  step_ctx_t ctx;
+
+  make_trace();
+  replay();
+  for (int s = 0; s < SEGMENTS; s++)
+  {
+    const seg_result_t *r = &results[s];
+
+    if (!segments[s].spm)
+    {
+      CHECK(r->counted <= 1); // the heel strike that ends the walk
+      CHECK_EQ(r->cadence, 0);
+      continue;
+    }
+    CHECK(r->steps > 50);
+    CHECK_NEAR(r->counted, r->steps, r->steps / 50 + 2);
+    CHECK_NEAR(r->cadence, segments[s].spm, segments[s].spm / 25);
+  }
+
+  // The count is the sum over segments
+  step_begin(&ctx);
+  for (uint32_t i = 0; i < samples; i++)
+    step_add(&ctx, acc[i], ticks[i]);
+  for (int s = 0; s < SEGMENTS; s++)
+    counted += results[s].counted;
+  CHECK_EQ(step_count(&ctx), counted);
+}
+
+// Sensor noise and orientation drift alone, no step at all
+static void check_still(void)
+{
+  step_ctx_t ctx;
+  uint32_t seed = 37, steps = 0;
+
+  step_begin(&ctx);
+  for (uint32_t i = 0; i < 120 * RATE_HZ; i++)
+  {
+    double t = (double)i / RATE_HZ;
+    uint16_t x = (uint16_t)lround(2048 + 120 * sin(2.0 * M_PI * t / 90.0) + 6 * synth_gauss(&seed));
+    steps += step_add(&ctx, x, synth_ticks(START_S + t));
+  }
+  CHECK_EQ(steps, 0);
+  CHECK_EQ(step_cadence(&ctx), 0);
+}
+
+// Cycles are the TSC's on x86, 0 elsewhere
+static void bench(void)
+{
+  uint32_t rounds = 50, total = 0;
+  step_ctx_t ctx;
+
+  printf("%-8s %8s %8s %8s %8s\n", "segment", "spm", "steps", "counted", "cadence");
+  for (int s = 0; s < SEGMENTS; s++)
+    printf("%-8d %8.0f %8u %8u %8u\n", s, segments[s].spm, (unsigned)results[s].steps, (unsigned)results[s].counted,
+           results[s].cadence);
+
+  uint64_t start = harness_ns(), cyc = harness_cycles();
+  for (uint32_t r = 0; r < rounds; r++)
+  {
+    step_begin(&ctx);
+    for (uint32_t i = 0; i < samples; i++)
+      total += step_add(&ctx, acc[i], ticks[i]);
+  }
+  double n = (double)rounds * samples;
+  printf("step_add: %.1f ns/sample, %.1f cycles/sample\n", (harness_ns() - start) / n, (harness_cycles() - cyc) / n);
+  harness_keep(&total);
+}
+
+int main(int argc, char **argv)
+{
+  check_segments();
+  check_still();
+  if (harness_bench(argc, argv))
+    bench();
+  return harness_result("test_step");
+}
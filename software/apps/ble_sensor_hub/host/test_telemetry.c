@@ -0,0 +1,321 @@
+// telemetry.c streaming to the simulated central (sim_ble.h): records pushed
+// at the 1 kHz scan rate and flushed every 10 ms, the way the adc and
+// telemetry tasks of main.c do. The central decodes every notification with
+// decode.c, the C twin of OpenTracker.py, and checks each record against the
+// one pushed with its ticks. With a link that keeps up every record has to
+// arrive intact and in order, with no sequence gaps. With one that does not,
+// what is missing has to be counted as dropped, and still no notification may
+// go missing. Across a disconnect the records buffered at the time count as
+// dropped and the stream picks up again after the next connection. Records
+// pushed under other flags, the way PPG bursts come between the ADC records,
+// have to arrive in frames whose header carries their flags.
+//
+//   test_telemetry [-b]   -b adds the host cost per record of encoding and of
+//                         decoding, and the records per second the link carries
+
+#include "codec.h"
+#include "decode.h"
+#include "harness.h"
+#include "nrf_sdh_ble.h"
+#include "sim.h"
+#include "sim_ble.h"
+#include "simple_ble.h"
+#include "telemetry.h"
+
+#define MS 1000000ull
+#define TICKS_PER_RECORD 32 // about 1 kHz of app_timer ticks
+#define RECORDS_MAX 256     // a full MTU of the smallest records
+#define DRAIN_MS 500        // after the producer stops
+#define FLAGS_RUN 24        // records pushed under the same flags when they alternate
+
+static simple_ble_service_t service = {.uuid128 = {.uuid128 = {0}}};
+static simple_ble_char_t stream_char = {.uuid16 = 0x108d};
+static uint8_t stream_value[TELEMETRY_MAX_PAYLOAD];
+
+static struct
+{
+  bool on;
+  uint8_t noise_bits; // of every field but ticks
+  bool alternate;     // flags change every FLAGS_RUN records
+  uint32_t pushed;
+} producer;
+
+static struct
+{
+  uint32_t frames;
+  uint32_t records;
+  uint32_t damaged; // frames decode_frame() refuses
+  uint32_t wrong;   // records unlike the one pushed with their ticks
+  uint32_t disorder;
+  uint32_t misflagged; // records in a frame of other flags than they were pushed with
+  uint32_t gaps; // notifications missing by seq
+  uint32_t next;  // record index expected next
+  uint16_t next_seq;
+  bool seen;
+} central;
+
+// Record i, smooth signals plus noise both sides can compute from i, every
+// field within its native width (codec.h)
+static telemetry_record_t record(uint32_t i)
+{
+  uint32_t h = i * 2654435761u;
+  uint32_t noise = (1u << producer.noise_bits) - 1;
+
+  return (telemetry_record_t){
+      .ticks = (i * TICKS_PER_RECORD) & 0x00FFFFFF,
+      .max_red = 180000 + (i % 800) * 2 + (h & noise & 0x7FFF),
+      .max_ir = 220000 + (i % 800) * 3 + ((h >> 3) & noise & 0x7FFF),
+      .gsr = 2000 + (i >> 6) % 64 + ((h >> 7) & noise & 0x3FF),
+      .flex = 1500 + ((h >> 11) & noise & 0x3FF),
+      .emg1 = 2048 + ((h >> 13) & noise & 0x3FF),
+      .emg2 = 2048 + ((h >> 17) & noise & 0x3FF),
+  };
+}
+
+// Flags record i is pushed with
+static uint8_t flags_of(uint32_t i)
+{
+  return producer.alternate && (i / FLAGS_RUN) % 2 ? TELEMETRY_FLAG_PPG : 0;
+}
+
+static void rx(uint16_t uuid16, const uint8_t *data, uint16_t len)
+{
+  telemetry_hdr_t hdr;
+  telemetry_record_t records[RECORDS_MAX];
+  int count = decode_frame(data, len, &hdr, records, RECORDS_MAX);
+
+  if (count < 0)
+  {
+    central.damaged++;
+    return;
+  }
+  if (central.seen)
+    central.gaps += (uint16_t)(hdr.seq - central.next_seq);
+  central.seen = true;
+  central.next_seq = hdr.seq + 1;
+  central.frames++;
+  for (int i = 0; i < count; i++)
+  {
+    // Indices stay below the 24-bit ticks wrap in these runs
+    uint32_t index = records[i].ticks / TICKS_PER_RECORD;
+    telemetry_record_t expect = record(index);
+
+    central.wrong += memcmp(&records[i], &expect, sizeof(expect)) != 0;
+    central.misflagged += (hdr.format & ~TELEMETRY_FMT_MASK) != flags_of(index);
+    central.disorder += index < central.next;
+    central.next = index + 1;
+    central.records++;
+  }
+}
+
+static bool adc_task(void *ctx, uint32_t arg)
+{
+  if (producer.on)
+  {
+    telemetry_record_t r = record(producer.pushed);
+    telemetry_set_flags(flags_of(producer.pushed++));
+    telemetry_push(&r);
+  }
+  sim_at(sim_now() + MS, ctx, adc_task, ctx, 0);
+  return true;
+}
+
+static bool telemetry_task(void *ctx, uint32_t arg)
+{
+  telemetry_flush();
+  sim_at(sim_now() + 10 * MS, ctx, telemetry_task, ctx, 0);
+  return true;
+}
+
+// simple_ble's callbacks into the application
+void ble_evt_connected(ble_evt_t const *p_ble_evt)
+{
+}
+
+void ble_evt_disconnected(ble_evt_t const *p_ble_evt)
+{
+}
+
+void ble_evt_write(ble_evt_t const *p_ble_evt)
+{
+}
+
+static void setup(void)
+{
+  sim_begin(&(sim_config_t){.end_ns = UINT64_MAX});
+  sim_ble_begin(30 * MS, 4);
+  sim_ble_central(rx);
+  simple_ble_init(NULL);
+  simple_ble_add_service(&service);
+  simple_ble_add_characteristic(0, 0, 1, 1, sizeof(stream_value), stream_value, &service, &stream_char);
+  telemetry_init(stream_char.char_handle.value_handle);
+  sim_ble_connect_at(0);
+  adc_task(sim_handler("adc", true), 0);
+  telemetry_task(sim_handler("telemetry", true), 0);
+  sim_run(100 * MS); // past the MTU exchange
+}
+
+typedef struct
+{
+  uint32_t pushed;
+  uint32_t received;
+  uint32_t dropped;
+  uint32_t gaps;
+} totals_t;
+
+static totals_t totals(void)
+{
+  return (totals_t){producer.pushed, central.records, telemetry_stats()->dropped, central.gaps};
+}
+
+// Produces for ms, then lets the link drain. Returns what happened meanwhile.
+static totals_t stream(uint64_t ms)
+{
+  totals_t before = totals();
+
+  producer.on = true;
+  sim_run(sim_now() + ms * MS);
+  producer.on = false;
+  sim_run(sim_now() + DRAIN_MS * MS);
+  totals_t after = totals();
+  return (totals_t){after.pushed - before.pushed, after.received - before.received, after.dropped - before.dropped,
+                    after.gaps - before.gaps};
+}
+
+// Four TX buffers per 30 ms connection event carry 1 kHz of records with room to spare
+static void check_lossless(void)
+{
+  producer.noise_bits = 4;
+  totals_t t = stream(10000);
+
+  CHECK_EQ(t.pushed, 10000);
+  CHECK_EQ(t.received, t.pushed);
+  CHECK_EQ(t.dropped, 0);
+  CHECK_EQ(t.gaps, 0);
+  CHECK_EQ(central.wrong, 0);
+  CHECK_EQ(central.disorder, 0);
+  CHECK_EQ(central.damaged, 0);
+}
+
+// One TX buffer and records that barely compress: the link falls behind, the
+// records it cannot take are counted, and no notification goes missing
+static void check_overload(void)
+{
+  sim_ble_begin(30 * MS, 1);
+  producer.noise_bits = 16;
+  totals_t t = stream(10000);
+
+  CHECK(t.received < t.pushed * 9 / 10);
+  CHECK(t.received > 0);
+  CHECK_EQ(t.received + t.dropped, t.pushed);
+  CHECK_EQ(t.gaps, 0);
+  CHECK_EQ(central.wrong, 0);
+  CHECK_EQ(central.disorder, 0);
+  CHECK_EQ(central.damaged, 0);
+}
+
+// Disconnected mid-stream: the records telemetry.c still holds count as
+// dropped, only the notifications the SoftDevice had queued show up as a gap
+static void check_disconnect(void)
+{
+  sim_ble_begin(30 * MS, 4);
+  producer.noise_bits = 4;
+  sim_ble_disconnect_at(sim_now() + 3015 * MS);
+  sim_ble_connect_at(sim_now() + 4000 * MS);
+  totals_t t = stream(10000);
+  uint32_t lost = t.pushed - t.received - t.dropped;
+
+  CHECK(t.dropped >= 900); // a second without a link
+  CHECK(t.gaps <= 4);
+  CHECK(lost <= t.gaps * RECORDS_MAX);
+  CHECK_EQ(central.next, producer.pushed); // the last record arrived
+  CHECK_EQ(central.wrong, 0);
+  CHECK_EQ(central.disorder, 0);
+  CHECK_EQ(central.damaged, 0);
+}
+
+// Flags changing every FLAGS_RUN records: each run goes out in frames of its
+// own, none of them lost
+static void check_flags(void)
+{
+  sim_ble_begin(30 * MS, 4);
+  producer.noise_bits = 4;
+  producer.alternate = true;
+  uint32_t frames = central.frames;
+  totals_t t = stream(2000);
+  producer.alternate = false;
+
+  CHECK_EQ(t.received, t.pushed);
+  CHECK_EQ(t.dropped, 0);
+  CHECK_EQ(t.gaps, 0);
+  CHECK(central.frames - frames >= t.pushed / FLAGS_RUN);
+  CHECK_EQ(central.misflagged, 0);
+  CHECK_EQ(central.wrong, 0);
+  CHECK_EQ(central.disorder, 0);
+}
+
+// Host time per record of packing frames the way telemetry_push() does and of
+// decoding them, and what the simulated link carries with every TX buffer the
+// simulated SoftDevice offers
+static void bench(void)
+{
+  static uint8_t frames[4096][TELEMETRY_MAX_PAYLOAD];
+  static uint16_t lengths[4096];
+  telemetry_record_t records[RECORDS_MAX];
+  telemetry_hdr_t hdr;
+  uint32_t n = 0;
+
+  for (uint8_t bits = 4; bits <= 16; bits += 12)
+  {
+    codec_enc_t enc;
+    uint32_t count = 0;
+    uint32_t framed = 0;
+
+    producer.noise_bits = bits;
+    uint64_t start = harness_ns();
+    for (uint32_t f = 0; f < 4096; f++)
+    {
+      telemetry_hdr_t *h = (telemetry_hdr_t *)frames[f];
+      codec_begin(&enc, frames[f] + sizeof(*h), TELEMETRY_MAX_PAYLOAD - sizeof(*h));
+      for (;;)
+      {
+        telemetry_record_t r = record(n);
+        if (!codec_push(&enc, &r))
+          break;
+        n++;
+      }
+      *h = (telemetry_hdr_t){.seq = f, .count = enc.count, .format = TELEMETRY_FMT_PACKED};
+      lengths[f] = sizeof(*h) + codec_end(&enc);
+      count += enc.count;
+    }
+    uint64_t enc_ns = harness_ns() - start;
+
+    start = harness_ns();
+    for (uint32_t f = 0; f < 4096; f++)
+      framed += decode_frame(frames[f], lengths[f], &hdr, records, RECORDS_MAX);
+    uint64_t dec_ns = harness_ns() - start;
+    harness_keep(records);
+    CHECK_EQ(framed, count);
+    printf("noise %2u bits: %5.1f records/frame, encode %.1f ns/record, decode %.1f ns/record\n", bits,
+           (double)count / 4096, (double)enc_ns / count, (double)dec_ns / count);
+  }
+
+  sim_ble_begin(30 * MS, 8);
+  producer.noise_bits = 4;
+  sim_ble_stats_t link = *sim_ble_stats();
+  totals_t t = stream(10000);
+  printf("link at 30 ms, 8 TX buffers: %u of %u records, %.0f bytes/s\n", (unsigned)t.received,
+         (unsigned)t.pushed, (sim_ble_stats()->bytes - link.bytes) / ((10000 + DRAIN_MS) / 1000.0));
+}
+
+int main(int argc, char **argv)
+{
+  setup();
+  check_lossless();
+  check_overload();
+  check_disconnect();
+  check_flags();
+  if (harness_bench(argc, argv))
+    bench();
+  return harness_result("test_telemetry");
+}
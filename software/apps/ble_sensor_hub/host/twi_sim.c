@@ -0,0 +1,264 @@
+#include <stddef.h>
+#include "twi_sim.h"
+
+#define TWI_SIM_DEVICES 8
+#define TWI_SIM_MANAGERS 4
+
+static const twi_sim_dev_t *devices[TWI_SIM_DEVICES];
+static nrf_twi_mngr_cb_t *managers[TWI_SIM_MANAGERS];
+static uint64_t head_end[TWI_SIM_MANAGERS];      // end of each queue's head transaction
+static ret_code_t head_result[TWI_SIM_MANAGERS]; // and its outcome
+static uint64_t now;
+static uint32_t latency;
+static twi_sim_stats_t stats;
+
+void twi_sim_reset(void)
+{
+  for (int i = 0; i < TWI_SIM_DEVICES; i++)
+    devices[i] = NULL;
+  for (int i = 0; i < TWI_SIM_MANAGERS; i++)
+    if (managers[i])
+    {
+      managers[i]->count = 0;
+      managers[i]->initialized = false;
+      managers[i] = NULL;
+    }
+  now = 0;
+  latency = 0;
+  stats = (twi_sim_stats_t){0};
+}
+
+void twi_sim_attach(const twi_sim_dev_t *dev)
+{
+  twi_sim_detach(dev->address);
+  for (int i = 0; i < TWI_SIM_DEVICES; i++)
+    if (!devices[i])
+    {
+      devices[i] = dev;
+      return;
+    }
+}
+
+void twi_sim_detach(uint8_t address)
+{
+  for (int i = 0; i < TWI_SIM_DEVICES; i++)
+    if (devices[i] && devices[i]->address == address)
+      devices[i] = NULL;
+}
+
+void twi_sim_set_latency(uint32_t ns)
+{
+  latency = ns;
+}
+
+uint64_t twi_sim_now(void)
+{
+  return now;
+}
+
+twi_sim_stats_t *twi_sim_stats(void)
+{
+  return &stats;
+}
+
+static const twi_sim_dev_t *find(uint8_t address)
+{
+  for (int i = 0; i < TWI_SIM_DEVICES; i++)
+    if (devices[i] && devices[i]->address == address)
+      return devices[i];
+  return NULL;
+}
+
+static ret_code_t transfer(const nrf_twi_mngr_transfer_t *t)
+{
+  const twi_sim_dev_t *dev = find(NRF_TWI_MNGR_OP_ADDRESS(t->operation));
+
+  if (!dev)
+    return NRF_ERROR_DRV_TWI_ERR_ANACK;
+  if (NRF_TWI_MNGR_IS_READ_OP(t->operation))
+    dev->read(dev->ctx, t->p_data, t->length);
+  else
+    dev->write(dev->ctx, t->p_data, t->length);
+  return NRF_SUCCESS;
+}
+
+// Bus time of a transaction: a start and the address byte per transfer, 9
+// bits per data byte, one stop
+static uint64_t duration(const nrf_twi_mngr_cb_t *cb, const nrf_twi_mngr_transaction_t *tr)
+{
+  uint32_t bits = 1;
+
+  for (uint8_t i = 0; i < tr->number_of_transfers; i++)
+    bits += 1 + 9 + 9 * tr->p_transfers[i].length;
+  return latency + (uint64_t)bits * 1000000000u / cb->frequency;
+}
+
+// The queue's head starts once the bus is free. Devices see its bytes as it
+// starts: a FIFO drained over a long read frees its slots as it goes, which is
+// closer to this than to popping everything at the end.
+static void start_head(int m)
+{
+  nrf_twi_mngr_cb_t *cb = managers[m];
+  const nrf_twi_mngr_transaction_t *tr = cb->queue[cb->head];
+  ret_code_t result = NRF_SUCCESS;
+  uint64_t d = duration(cb, tr);
+
+  for (uint8_t i = 0; i < tr->number_of_transfers && result == NRF_SUCCESS; i++)
+  {
+    result = transfer(&tr->p_transfers[i]);
+    stats.bytes += tr->p_transfers[i].length;
+  }
+  head_result[m] = result;
+  head_end[m] = now + d;
+  stats.bus_ns += d;
+}
+
+static int index_of(const nrf_twi_mngr_cb_t *cb)
+{
+  for (int i = 0; i < TWI_SIM_MANAGERS; i++)
+    if (managers[i] == cb)
+      return i;
+  return -1;
+}
+
+// Completes the head transaction of manager m at its end time
+static void complete(int m)
+{
+  nrf_twi_mngr_cb_t *cb = managers[m];
+  const nrf_twi_mngr_transaction_t *tr = cb->queue[cb->head];
+  ret_code_t result = head_result[m];
+
+  now = head_end[m];
+  stats.transactions++;
+  cb->head = (cb->head + 1) % cb->size;
+  if (--cb->count)
+    start_head(m);
+  if (tr->callback)
+    tr->callback(result, tr->p_user_data);
+}
+
+// Manager whose head ends first, -1 when every queue is empty
+static int earliest(void)
+{
+  int first = -1;
+
+  for (int i = 0; i < TWI_SIM_MANAGERS; i++)
+    if (managers[i] && managers[i]->count && (first < 0 || head_end[i] < head_end[first]))
+      first = i;
+  return first;
+}
+
+uint64_t twi_sim_next(void)
+{
+  int m = earliest();
+
+  return m < 0 ? UINT64_MAX : head_end[m];
+}
+
+uint32_t twi_sim_advance(uint64_t t)
+{
+  uint32_t done = 0;
+
+  for (int m = earliest(); m >= 0 && head_end[m] <= t; m = earliest())
+  {
+    complete(m);
+    done++;
+  }
+  if (t > now)
+    now = t;
+  return done;
+}
+
+uint32_t twi_sim_run(void)
+{
+  uint32_t done = 0;
+
+  for (int m = earliest(); m >= 0; m = earliest())
+  {
+    complete(m);
+    done++;
+  }
+  return done;
+}
+
+ret_code_t nrf_twi_mngr_init(nrf_twi_mngr_t const *p_nrf_twi_mngr, nrf_drv_twi_config_t const *p_default_twi_config)
+{
+  nrf_twi_mngr_cb_t *cb = p_nrf_twi_mngr->p_cb;
+
+  if (cb->initialized)
+    return NRF_ERROR_INVALID_STATE;
+  for (int i = 0; i < TWI_SIM_MANAGERS; i++)
+    if (!managers[i])
+    {
+      managers[i] = cb;
+      cb->head = 0;
+      cb->count = 0;
+      cb->frequency = p_default_twi_config->frequency;
+      cb->initialized = true;
+      return NRF_SUCCESS;
+    }
+  return NRF_ERROR_NO_MEM;
+}
+
+ret_code_t nrf_twi_mngr_schedule(nrf_twi_mngr_t const *p_nrf_twi_mngr,
+                                 nrf_twi_mngr_transaction_t const *p_transaction)
+{
+  nrf_twi_mngr_cb_t *cb = p_nrf_twi_mngr->p_cb;
+
+  if (!cb->initialized)
+    return NRF_ERROR_INVALID_STATE;
+  if (cb->count == cb->size)
+    return NRF_ERROR_NO_MEM;
+  cb->queue[(cb->head + cb->count) % cb->size] = p_transaction;
+  if (cb->count++ == 0)
+    start_head(index_of(cb));
+  return NRF_SUCCESS;
+}
+
+typedef struct
+{
+  bool done;
+  ret_code_t result;
+} perform_t;
+
+static void perform_done(ret_code_t result, void *p_user_data)
+{
+  perform_t *p = p_user_data;
+
+  p->result = result;
+  p->done = true;
+}
+
+// Like the SDK: queues the transfers behind what is pending and waits, the
+// transactions ahead complete and call back meanwhile
+ret_code_t nrf_twi_mngr_perform(nrf_twi_mngr_t const *p_nrf_twi_mngr, nrf_drv_twi_config_t const *p_config,
+                                nrf_twi_mngr_transfer_t const *p_transfers, uint8_t number_of_transfers,
+                                void (*user_function)(void))
+{
+  perform_t p = {false, NRF_SUCCESS};
+  nrf_twi_mngr_transaction_t const transaction = {
+      .callback = perform_done,
+      .p_user_data = &p,
+      .p_transfers = p_transfers,
+      .number_of_transfers = number_of_transfers,
+      .p_required_twi_cfg = p_config,
+  };
+  uint64_t start = now;
+  ret_code_t err_code = nrf_twi_mngr_schedule(p_nrf_twi_mngr, &transaction);
+
+  if (err_code != NRF_SUCCESS)
+    return err_code;
+  while (!p.done)
+  {
+    if (user_function)
+      user_function();
+    twi_sim_advance(twi_sim_next());
+  }
+  stats.blocked_ns += now - start;
+  return p.result;
+}
+
+bool nrf_twi_mngr_is_idle(nrf_twi_mngr_t const *p_nrf_twi_mngr)
+{
+  return p_nrf_twi_mngr->p_cb->count == 0;
+}
@@ -0,0 +1,52 @@
+#ifndef TWI_SIM_H_
+#define TWI_SIM_H_
+#include <stdbool.h>
+#include <stdint.h>
+#include "nrf_twi_mngr.h"
+
+// Host implementation of nrf_twi_mngr (stub/nrf_twi_mngr.h) over device
+// models attached to a simulated bus. Every transfer starts with a (repeated)
+// start and the device's address. A device receives the bytes of each write
+// and fills the bytes of each read, an address nobody answers is NACKed.
+//
+// The bus has a virtual clock. A transaction occupies it for its bits at the
+// manager's frequency (start, address and 9 bits per byte, a stop at the
+// end) plus an optional fixed latency standing in for clock stretching or
+// other traffic. Transactions queue behind each other. Devices see the bytes
+// of one when it starts, and its callback runs, as the TWI interrupt would,
+// once the clock gets past its end: twi_sim_advance() or twi_sim_run().
+// nrf_twi_mngr_perform() blocks the caller until its own transaction ends,
+// the time it waits is counted as blocked CPU time.
+
+typedef struct
+{
+  uint8_t address;
+  void *ctx;
+  void (*write)(void *ctx, const uint8_t *data, uint8_t len);
+  void (*read)(void *ctx, uint8_t *data, uint8_t len);
+} twi_sim_dev_t;
+
+typedef struct
+{
+  uint64_t bus_ns;     // bus occupied
+  uint64_t blocked_ns; // CPU waiting in nrf_twi_mngr_perform()
+  uint32_t transactions;
+  uint32_t bytes;
+} twi_sim_stats_t;
+
+void twi_sim_reset(void); // detaches every device, managers lose their queues
+void twi_sim_attach(const twi_sim_dev_t *dev);
+void twi_sim_detach(uint8_t address);
+
+void twi_sim_set_latency(uint32_t ns); // added to every transaction
+uint64_t twi_sim_now(void);
+uint64_t twi_sim_next(void); // end of the next transaction, UINT64_MAX when idle
+twi_sim_stats_t *twi_sim_stats(void); // may be cleared by the caller
+
+// Moves the clock to t, completing what ends by then, including transactions
+// their callbacks schedule. Returns how many completed.
+uint32_t twi_sim_advance(uint64_t t);
+// Moves the clock until every queue is empty. Returns how many completed.
+uint32_t twi_sim_run(void);
+
+#endif /* TWI_SIM_H_ */
@@ -0,0 +1,73 @@
+#include <string.h>
+#include "hr.h"
+
+uint32_t hr_beat_ticks(const beat_t *beat, uint32_t ticks, uint32_t period_q8)
+{
+  // Q8 samples times Q8 ticks
+  uint32_t lag = (((uint32_t)BEAT_FIR_DELAY << 8) + beat->lag_q8) * period_q8 >> 16;
+
+  return (ticks - lag) & HR_TICK_MASK;
+}
+
+void hr_begin(hr_ctx_t *ctx)
+{
+  memset(ctx, 0, sizeof(*ctx));
+}
+
+bool hr_add_beat(hr_ctx_t *ctx, uint32_t ticks)
+{
+  uint32_t delta = (ticks - ctx->lastbeat_ticks) & HR_TICK_MASK;
+  ctx->lastbeat_ticks = ticks;
+  if (delta == 0)
+    return false;
+
+  // Rounded, and clamped before narrowing so a long gap can't wrap into range
+  uint32_t bpm = (60UL * HR_TICK_HZ + delta / 2) / delta;
+  ctx->bpm = bpm > UINT16_MAX ? UINT16_MAX : bpm;
+
+  if (ctx->bpm >= 300 || ctx->bpm <= 40)
+    return false;
+
+  if (ctx->ref)
+  {
+    if (ctx->bpm > ctx->ref + HR_VAR_THRESHOLD || ctx->bpm < ctx->ref - HR_VAR_THRESHOLD)
+    {
+      ctx->adjbuf[ctx->adjbuf_cnt++] = ctx->bpm;
+      if (ctx->adjbuf_cnt >= HR_BPM_ADJ_SIZE)
+      {
+        uint32_t sum = 0;
+        ctx->adjbuf_cnt = 0;
+        for (uint8_t x = 0; x < HR_BPM_ADJ_SIZE; x++)
+        {
+          sum += ctx->adjbuf[x];
+        }
+        ctx->ref = sum / HR_BPM_ADJ_SIZE;
+      }
+      return false;
+    }
+    else
+    {
+      ctx->adjbuf_cnt = 0;
+    }
+  }
+
+  ctx->bpmbuf[ctx->bpmbuf_cnt++] = ctx->bpm;
+  ctx->bpmbuf_cnt %= HR_BPM_BUF_SIZE;
+  if (ctx->bpmbuf_cnt != 0)
+    return false;
+
+  uint32_t sum = 0;
+  for (uint8_t x = 0; x < HR_BPM_BUF_SIZE; x++)
+  {
+    sum += ctx->bpmbuf[x];
+  }
+  ctx->bpm_avg = sum / HR_BPM_BUF_SIZE;
+  if (!ctx->ref)
+    ctx->ref = ctx->bpm_avg;
+  return true;
+}
+
+uint16_t hr_bpm(const hr_ctx_t *ctx)
+{
+  return ctx->bpm_avg;
+}
@@ -0,0 +1,40 @@
+#ifndef HR_H_
+#define HR_H_
+#include <stdbool.h>
+#include <stdint.h>
+#include "algorithm.h"
+
+#define HR_BPM_BUF_SIZE 4
+#define HR_BPM_ADJ_SIZE 3
+#define HR_VAR_THRESHOLD 16
+
+// Beat times are RTC ticks, the counter is 24 bits wide at 32768 Hz
+#define HR_TICK_HZ 32768
+#define HR_TICK_MASK 0x00FFFFFF
+
+// Heart rate averaging state. Beat to beat rates are averaged over
+// HR_BPM_BUF_SIZE beats; a rate that strays more than HR_VAR_THRESHOLD from the
+// last average is held back until HR_BPM_ADJ_SIZE of them in a row establish a
+// new reference.
+typedef struct
+{
+  uint32_t lastbeat_ticks;
+  uint16_t bpm;      // last beat to beat rate
+  uint16_t bpm_avg;  // last published average
+  uint16_t ref;      // reference rate, 0 until the first average
+  uint16_t bpmbuf[HR_BPM_BUF_SIZE];
+  uint16_t adjbuf[HR_BPM_ADJ_SIZE];
+  uint8_t bpmbuf_cnt;
+  uint8_t adjbuf_cnt;
+} hr_ctx_t;
+
+// RTC time of a beat checkForBeat_block() reported against a sample taken at
+// ticks: back by the interpolated lag and the FIR delay, period_q8 being the
+// sample period in Q8 ticks
+uint32_t hr_beat_ticks(const beat_t *beat, uint32_t ticks, uint32_t period_q8);
+
+void hr_begin(hr_ctx_t *ctx);
+bool hr_add_beat(hr_ctx_t *ctx, uint32_t ticks); //true when a new average is available
+uint16_t hr_bpm(const hr_ctx_t *ctx);
+
+#endif /* HR_H_ */
@@ -0,0 +1,143 @@
+#include <string.h>
+#include "hrv.h"
+#include "hr.h"
+
+void hrv_begin(hrv_ctx_t *ctx)
+{
+  memset(ctx, 0, sizeof(*ctx));
+}
+
+// Drops every interval but keeps the beat clock, used when the rhythm moved away from the window
+static void restart(hrv_ctx_t *ctx)
+{
+  ctx->rr_head = ctx->rr_count = 0;
+  ctx->diff_head = ctx->diff_count = 0;
+  ctx->rr_sum = ctx->rr_sumsq = ctx->diff_sumsq = 0;
+  ctx->nn50 = 0;
+  ctx->last_valid = false;
+  ctx->rejects = 0;
+}
+
+static void push_diff(hrv_ctx_t *ctx, int16_t d)
+{
+  if (ctx->diff_count == HRV_WINDOW)
+  {
+    int16_t old = ctx->diff[ctx->diff_head];
+    ctx->diff_sumsq -= (int32_t)old * old;
+    ctx->nn50 -= (old > HRV_NN50_MS || old < -HRV_NN50_MS);
+  }
+  else
+  {
+    ctx->diff_count++;
+  }
+  ctx->diff[ctx->diff_head] = d;
+  ctx->diff_sumsq += (int32_t)d * d;
+  ctx->nn50 += (d > HRV_NN50_MS || d < -HRV_NN50_MS);
+  ctx->diff_head = (ctx->diff_head + 1) % HRV_WINDOW;
+}
+
+static void push_rr(hrv_ctx_t *ctx, uint16_t rr)
+{
+  if (ctx->rr_count == HRV_WINDOW)
+  {
+    uint16_t old = ctx->rr[ctx->rr_head];
+    ctx->rr_sum -= old;
+    ctx->rr_sumsq -= (uint32_t)old * old;
+  }
+  else
+  {
+    ctx->rr_count++;
+  }
+  ctx->rr[ctx->rr_head] = rr;
+  ctx->rr_sum += rr;
+  ctx->rr_sumsq += (uint32_t)rr * rr;
+  ctx->rr_head = (ctx->rr_head + 1) % HRV_WINDOW;
+}
+
+bool hrv_add_beat(hrv_ctx_t *ctx, uint32_t ticks)
+{
+  uint32_t delta = (ticks - ctx->lastbeat_ticks) & HR_TICK_MASK;
+  bool first = !ctx->have_beat;
+
+  ctx->lastbeat_ticks = ticks;
+  ctx->have_beat = true;
+  if (first)
+    return false;
+
+  // ticks * 1000 / 32768, delta is at most 24 bits
+  uint32_t rr = (delta * 125) >> 12;
+  bool ok = rr >= HRV_RR_MIN_MS && rr <= HRV_RR_MAX_MS;
+
+  if (ok && ctx->rr_count >= 4)
+  {
+    uint32_t mean = ctx->rr_sum / ctx->rr_count;
+    uint32_t dev = rr > mean ? rr - mean : mean - rr;
+    ok = dev * HRV_RR_MAX_DEV <= mean;
+  }
+  if (!ok)
+  {
+    ctx->rejected++;
+    ctx->last_valid = false;
+    if (++ctx->rejects >= HRV_REJECT_RESET)
+      restart(ctx);
+    return false;
+  }
+
+  if (ctx->last_valid)
+    push_diff(ctx, (int16_t)rr - (int16_t)ctx->last_rr);
+  push_rr(ctx, rr);
+  ctx->last_rr = rr;
+  ctx->last_valid = true;
+  ctx->rejects = 0;
+  ctx->accepted++;
+  return true;
+}
+
+uint16_t hrv_rr(const hrv_ctx_t *ctx)
+{
+  return ctx->last_rr;
+}
+
+static uint16_t isqrt(uint32_t x)
+{
+  uint32_t root = 0;
+  uint32_t bit = 1UL << 30;
+
+  while (bit > x)
+    bit >>= 2;
+  while (bit)
+  {
+    if (x >= root + bit)
+    {
+      x -= root + bit;
+      root = (root >> 1) + bit;
+    }
+    else
+    {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+  return root;
+}
+
+void hrv_metrics(const hrv_ctx_t *ctx, hrv_metrics_t *metrics)
+{
+  uint32_t n = ctx->rr_count;
+  uint32_t m = ctx->diff_count;
+
+  metrics->sdnn_ms = 0;
+  metrics->rmssd_ms = 0;
+  metrics->pnn50 = 0;
+  if (n >= 2)
+  {
+    // Sample variance from the running sums, exact in integers
+    uint64_t num = (uint64_t)n * ctx->rr_sumsq - (uint64_t)ctx->rr_sum * ctx->rr_sum;
+    metrics->sdnn_ms = isqrt(num / (n * (n - 1)));
+  }
+  if (m)
+  {
+    metrics->rmssd_ms = isqrt(ctx->diff_sumsq / m);
+    metrics->pnn50 = ctx->nn50 * 1000 / m;
+  }
+}
@@ -0,0 +1,49 @@
+#ifndef HRV_H_
+#define HRV_H_
+#include <stdbool.h>
+#include <stdint.h>
+
+#define HRV_WINDOW 64          // RR intervals the rolling metrics cover
+#define HRV_RR_MIN_MS 300      // 200 bpm
+#define HRV_RR_MAX_MS 2000     // 30 bpm
+#define HRV_RR_MAX_DEV 5       // reject an RR further than 1/5 of the window mean away from it
+#define HRV_REJECT_RESET 5     // consecutive rejections after which the window restarts
+#define HRV_NN50_MS 50
+
+// Rolling time domain HRV over the last HRV_WINDOW accepted RR intervals.
+// Sums are kept in integers and updated as intervals enter and leave the
+// window, so every beat costs the same regardless of the window size.
+typedef struct
+{
+  uint16_t rr[HRV_WINDOW];   // accepted RR intervals, ms
+  int16_t diff[HRV_WINDOW];  // successive differences between adjacent accepted RRs, ms
+  uint8_t rr_head;
+  uint8_t rr_count;
+  uint8_t diff_head;
+  uint8_t diff_count;
+  uint32_t rr_sum;
+  uint32_t rr_sumsq;
+  uint32_t diff_sumsq;
+  uint16_t nn50;             // window diffs with |diff| > HRV_NN50_MS
+  uint16_t last_rr;          // newest accepted RR
+  bool last_valid;           // last_rr directly precedes the next interval
+  bool have_beat;
+  uint32_t lastbeat_ticks;
+  uint8_t rejects;           // consecutive rejections
+  uint32_t accepted;
+  uint32_t rejected;
+} hrv_ctx_t;
+
+typedef struct
+{
+  uint16_t rmssd_ms;
+  uint16_t sdnn_ms;
+  uint16_t pnn50;            // per mille
+} hrv_metrics_t;
+
+void hrv_begin(hrv_ctx_t *ctx);
+bool hrv_add_beat(hrv_ctx_t *ctx, uint32_t ticks); //24-bit RTC ticks, true when an RR interval was accepted
+uint16_t hrv_rr(const hrv_ctx_t *ctx);
+void hrv_metrics(const hrv_ctx_t *ctx, hrv_metrics_t *metrics);
+
+#endif /* HRV_H_ */
@@ -2,6 +2,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 #include "nrf.h"
 #include "app_util.h"
 #include "nrf_twi_mngr.h"
@@ -14,36 +15,86 @@
 
 #include "simple_ble.h"
 #include "nrfx_saadc.h"
+#include "nrf_drv_ppi.h"
+#include "nrf_drv_timer.h"
+#include "nrf_drv_gpiote.h"
 #include "nrf_drv_systick.h"
+#include "nrf_fstorage.h"
+#include "nrf_fstorage_sd.h"
 
 #include "max30102.h"
 #include "algorithm.h"
-#include "pd.h"
+#include "hr.h"
+#include "hrv.h"
+#include "spo2.h"
+#include "anc.h"
+#include "step.h"
+#include "br.h"
+#include "emg.h"
+#include "decim.h"
+#include "ring.h"
+#include "sched.h"
+#include "prof.h"
+#include "power.h"
+#include "sqi.h"
+#include "rec.h"
+#include "telemetry.h"
 
-APP_TIMER_DEF(upd_timer);
+APP_TIMER_DEF(sched_timer);
 
 #define ADC_CHN_GSR 0
 #define ADC_CHN_FLEX 1
 #define ADC_CHN_EMG1 2
 #define ADC_CHN_EMG2 3
-APP_TIMER_DEF(sample_upd);
-APP_TIMER_DEF(hr_upd);
-APP_TIMER_DEF(br_upd);
-APP_TIMER_DEF(sr_upd);
 
 #define ADC_CHN_GSR 0
 #define ADC_CHN_FLEX 1
 #define ADC_CHN_EMG1 2
 #define ADC_CHN_EMG2 3
 #define ADC_CHN_ACC 4
+#define ADC_CHN_COUNT 5
+#define SQI_CHN_PPG ADC_CHN_COUNT // quality channels are the ADC ones, then PPG IR
+#define SQI_CHN_COUNT (ADC_CHN_COUNT + 1)
+#define ADC_RAIL_LO 8             // 12-bit readings this close to a rail are clipped
+#define ADC_RAIL_HI 4087
 
-#define SAMPLE_INTERVAL_MS 20
-#define HR_INTERVAL_MS 100
-#define BR_INTERVAL_MS 800 // CHANGE THIS
-#define SR_INTERVAL_MS 500 // CHANGE THIS
-#define BPM_BUF_SIZE 4
-#define BPM_ADJ_SIZE 3
-#define HR_VAR_THRESHOLD 16
+#define PPG_WATERMARK 24            // FIFO samples per INT wakeup, about one second at 25 sps
+#define PPG_DRAIN_MS 800            // timer drain, well before the 32-sample FIFO fills at 25 sps
+#define PPG_STALL_MS 3000          // INT quiet this long while acquiring, longer than a watermark at 12.5 sps
+#define ADC_SCAN_INTERVAL_US 1000  // hardware-timed scan of all ADC channels, EMG stays at this rate
+#define ADC_SCAN_BLOCK 50          // scans per DMA buffer
+#define ACC_DECIM 10               // ACC at 100 Hz
+#define FLEX_DECIM1 10             // flex at 20 Hz
+#define FLEX_DECIM2 5
+#define GSR_DECIM1 10              // GSR at 5 Hz
+#define GSR_DECIM2 5
+#define GSR_DECIM3 4
+#define PPG_FINGER_MIN 50000       // IR level below which nothing is on the sensor
+#define ANC_REF_DECIM (1000000 / ADC_SCAN_INTERVAL_US / MAX30102_SAMPLE_RATE_HZ) // scans per PPG sample
+#define ANC_REF_HISTORY 64         // motion references kept, 2.5 s at the PPG rate
+#define SCHED_TICK_MS 25           // wakeup period of the scheduler, divides every task period
+
+// Session log (see rec.h) in the flash above the application, clear of any bootloader
+#ifndef REC_FLASH_START
+#define REC_FLASH_START 0x60000
+#endif
+#ifndef REC_PAGES
+#define REC_PAGES 24               // 96 KB
+#endif
+#define REC_PAGE_SIZE 4096
+#define REC_CHUNK_END 0xFFFF       // rec_chunk_t.block of the last notification of a download
+#define REC_LANE_ADC 0             // rec.h lanes: the ADC records as they are scanned
+#define REC_LANE_PPG 1             // and the PPG samples a FIFO burst behind them
+
+// Per channel decimation from the scan rate
+DECIM_DEF(acc_decim, ACC_DECIM, DECIM_TAPS_PER_FACTOR * ACC_DECIM);
+DECIM_DEF(flex_decim1, FLEX_DECIM1, DECIM_TAPS_PER_FACTOR * FLEX_DECIM1);
+DECIM_DEF(flex_decim2, FLEX_DECIM2, DECIM_TAPS_PER_FACTOR * FLEX_DECIM2);
+DECIM_DEF(gsr_decim1, GSR_DECIM1, DECIM_TAPS_PER_FACTOR * GSR_DECIM1);
+DECIM_DEF(gsr_decim2, GSR_DECIM2, DECIM_TAPS_PER_FACTOR * GSR_DECIM2);
+DECIM_DEF(gsr_decim3, GSR_DECIM3, DECIM_TAPS_PER_FACTOR * GSR_DECIM3);
+static decim_t *const flex_chain[] = {&flex_decim1, &flex_decim2};
+static decim_t *const gsr_chain[] = {&gsr_decim1, &gsr_decim2, &gsr_decim3};
 
 // Intervals for advertising and connections
 static simple_ble_config_t ble_config = {
@@ -56,29 +107,19 @@ static simple_ble_config_t ble_config = {
     .max_conn_interval = MSEC_TO_UNITS(200, UNIT_1_25_MS),
 };
 
-uint32_t millis(void)
+// ticks * 1000 / 32768 without float, exact for the 24-bit RTC range
+uint32_t ticks_to_ms(uint32_t ticks)
 {
-  return (app_timer_cnt_get() / 32.768);
+  return ((ticks & APP_TIMER_MAX_CNT_VAL) * 125) >> 12;
 }
 
-uint16_t sample_value(uint8_t channel)
+uint32_t millis(void)
 {
-  uint16_t val;
-  APP_ERROR_CHECK(nrfx_saadc_sample_convert(channel, (nrf_saadc_value_t *)&val));
-  return val;
+  return ticks_to_ms(app_timer_cnt_get());
 }
 
 static bool alive = false;
-
-static uint32_t startms;
-static uint32_t currms;
-static int same_peak = 0;
-static int peak_high_count = 0;
-static uint16_t rates[4]; //Array of step rate
-static uint16_t rateSpot = 0;
-static uint32_t lastStep = 0; //Time at which the last step occurred
-static uint16_t stepAvg;
-static float stepPerMinute;
+static volatile bool acquiring = true; // sensors running, follows the power state
 
 typedef struct
 {
@@ -90,14 +131,56 @@ typedef struct
   uint16_t emg2;
 } packet_t;
 
+// Ring entries, stamped with 24-bit app_timer ticks at acquisition
+typedef struct
+{
+  uint32_t ticks;
+  uint32_t red;
+  uint32_t ir;
+} ppg_sample_t;
+
+typedef struct
+{
+  uint32_t ticks;
+  uint16_t ch[ADC_CHN_COUNT]; // ADC_CHN_* order
+} adc_sample_t;
+
+// Motion reference for the PPG artifact canceller, at the PPG rate
+typedef struct
+{
+  uint32_t ticks;
+  int16_t acc;
+  int16_t emg;
+} anc_ref_t;
+
 typedef struct
 {
   uint16_t hr_bpm;  // heart rate
   uint16_t br_bpm;  // breath rate
-  uint16_t sr1_bpm; // step rate
-  uint16_t sr2_bpm;
+  uint16_t sr1_bpm; // step cadence, steps per minute
+  uint16_t sr2_bpm; // step count, wraps
+  uint16_t spo2;    // 0.1 %, 0 while unknown
+  uint16_t emg;     // bit 0 EMG1, bit 1 EMG2 while the muscle is active
+  uint32_t sqi;     // SQI_* flags, SQI_BITS per channel in ADC_CHN_* order then PPG
 } stat_packet_t;
 
+typedef struct
+{
+  uint16_t rr_ms;    // newest accepted RR interval
+  uint16_t rmssd_ms; // over the last HRV_WINDOW intervals
+  uint16_t sdnn_ms;
+  uint16_t pnn50;    // per mille
+  uint16_t beats;    // accepted intervals, wraps, lets the host spot missed notifications
+} hrv_packet_t;
+
+// Every download notification starts with this, followed by the block bytes
+// from offset on. The end marker carries the block count in offset.
+typedef struct __attribute__((packed))
+{
+  uint16_t block;  // position in the download, REC_CHUNK_END after the last one
+  uint16_t offset; // byte offset into the block
+} rec_chunk_t;
+
 // 32e61089-2b22-4db5-a914-43ce41986c70
 static simple_ble_service_t sensing_service = {{.uuid128 = {0x70, 0x6C, 0x98, 0x41, 0xCE, 0x43, 0x14, 0xA9,
                                                             0xB5, 0x4D, 0x22, 0x2B, 0x89, 0x10, 0xE6, 0x32}}};
@@ -111,161 +194,759 @@ static packet_t buffer;
 static simple_ble_char_t stat_char = {.uuid16 = 0x108c};
 static stat_packet_t stat;
 
+// RR interval and rolling HRV, notified on every accepted beat
+static simple_ble_char_t hrv_char = {.uuid16 = 0x108e};
+static hrv_packet_t hrv_packet;
+
+#if PROF_ENABLED
+// Section timing (see prof.h), refreshed once a second, read only
+static simple_ble_char_t diag_char = {.uuid16 = 0x108f};
+static prof_report_t diag;
+#endif
+
+// Batched, timestamped samples (see frame.h), notify only
+static simple_ble_char_t stream_char = {.uuid16 = 0x108d};
+static uint8_t stream_value[TELEMETRY_MAX_PAYLOAD];
+
+// Bulk download of the session log, notify only
+static simple_ble_char_t rec_char = {.uuid16 = 0x1090};
+static uint8_t rec_value[TELEMETRY_MAX_PAYLOAD];
+
+// SAADC scan: TIMER1 compare triggers the SAMPLE task over PPI, EasyDMA
+// alternates between the two buffers
+static const nrf_drv_timer_t adc_timer = NRF_DRV_TIMER_INSTANCE(1);
+static nrf_ppi_channel_t adc_ppi;
+static nrf_saadc_value_t adc_buf[2][ADC_SCAN_BLOCK * ADC_CHN_COUNT];
+
+// PPG sample period in 1/256 ticks, 1310.72 ticks doesn't divide evenly
+#define PPG_SAMPLE_TICKS_Q8 ((APP_TIMER_CLOCK_FREQ << 8) / MAX30102_SAMPLE_RATE_HZ)
+#define ADC_SCAN_TICKS_Q8 ((uint32_t)(((uint64_t)APP_TIMER_CLOCK_FREQ << 8) * ADC_SCAN_INTERVAL_US / 1000000))
+
+// Acquisition interrupts produce, the main loop consumes
+RING_DEF(ppg_ring, ppg_sample_t, 64);
+RING_DEF(adc_ring, adc_sample_t, 256); // five DMA blocks of 1 kHz scans
+
+static uint32_t ppg_overflow = 0; // samples lost on the sensor side
+static uint32_t ppg_busy = 0;     // wakeups skipped because a drain was still in flight
+static uint32_t ppg_wakeups = 0;  // INT pin events
+static uint32_t ppg_stalls = 0;   // times INT went quiet while acquiring
+static uint32_t ppg_samples = 0;  // samples drained from the FIFO
+static volatile uint32_t ppg_sample_ticks_q8 = PPG_SAMPLE_TICKS_Q8; // follows the sensor rate the power state set
+
+// PPG bursts arrive up to a FIFO watermark late, so ADC derived references are
+// kept long enough to line up with them by timestamp
+static anc_ref_t anc_refs[ANC_REF_HISTORY];
+static uint8_t anc_ref_head = 0;
+static uint8_t anc_ref_count = 0;
+
 /*******************************************************************************
  *   State for this application
  ******************************************************************************/
 // Main application state
 simple_ble_app_t *simple_ble_app;
 
-static uint32_t hr_lastbeat_ms = 0;
+static hr_ctx_t hr;
+static hrv_ctx_t hrv;
+static spo2_ctx_t spo2;
+static anc_ctx_t anc;
+static step_ctx_t steps;
+static br_ctx_t br;
+static emg_ctx_t emg1;
+static emg_ctx_t emg2;
+static volatile bool stream_red = true; // raw red in the stream, redundant once SpO2 is computed here
+static bool red_streamed = true;         // stream_red as last applied to the PPG records
+static volatile bool stream_emg_raw = false; // 1 kHz raw EMG in the stream instead of the 20 Hz envelopes
+static bool emg_raw_streamed = false;
+static power_ctx_t power;
+static rec_ctx_t rec;
+static volatile uint8_t rec_cmd = 0x00; // recorder command from the BLE handler, run by rec_update()
+
+// Windows of a few seconds at each channel's own rate. EMG is broadband by
+// nature and the accelerometer at rest is plain noise, neither gets a noise check.
+static const sqi_config_t sqi_config[SQI_CHN_COUNT] = {
+    [ADC_CHN_GSR] = {.alpha = 1.0f / 50, .lo = ADC_RAIL_LO, .hi = ADC_RAIL_HI, .dc_min = 50, .dc_max = 4040,
+                     .flat_std = 0.05f, .noise_max = 0.5f, .hold = 10},
+    [ADC_CHN_FLEX] = {.alpha = 1.0f / 100, .lo = ADC_RAIL_LO, .hi = ADC_RAIL_HI, .dc_min = 50, .dc_max = 4040,
+                      .flat_std = 0.5f, .noise_max = 0.5f, .hold = 40},
+    [ADC_CHN_EMG1] = {.alpha = 1.0f / 500, .lo = ADC_RAIL_LO, .hi = ADC_RAIL_HI, .dc_min = 200, .dc_max = 3900,
+                      .flat_std = 1.0f, .noise_max = 0.0f, .hold = 500},
+    [ADC_CHN_EMG2] = {.alpha = 1.0f / 500, .lo = ADC_RAIL_LO, .hi = ADC_RAIL_HI, .dc_min = 200, .dc_max = 3900,
+                      .flat_std = 1.0f, .noise_max = 0.0f, .hold = 500},
+    [ADC_CHN_ACC] = {.alpha = 1.0f / 200, .lo = ADC_RAIL_LO, .hi = ADC_RAIL_HI, .dc_min = 50, .dc_max = 4040,
+                     .flat_std = 0.05f, .noise_max = 0.0f, .hold = 200},
+    [SQI_CHN_PPG] = {.alpha = 1.0f / 100, .lo = 0, .hi = POWER_SATURATION, .dc_min = PPG_FINGER_MIN, .dc_max = POWER_SATURATION,
+                     .flat_std = 2.0f, .noise_max = 0.5f, .hold = 50},
+};
+static sqi_ctx_t sqi[SQI_CHN_COUNT];
 
-static uint16_t hr_bpmAvg;
+// Quality of one sample, mirrored into the stat packet
+static uint8_t sqi_update(uint8_t ch, float x)
+{
+  uint8_t flags = sqi_add(&sqi[ch], x);
+  uint32_t mask = ((1UL << SQI_BITS) - 1) << (ch * SQI_BITS);
 
-static uint16_t hr_bpm;
+  stat.sqi = (stat.sqi & ~mask) | ((uint32_t)flags << (ch * SQI_BITS));
+  return flags;
+}
 
-static uint16_t hr_bpmbuf[BPM_BUF_SIZE];
+void hrv_publish(void)
+{
+  hrv_metrics_t metrics;
 
-static uint16_t hr_adjbuf[BPM_ADJ_SIZE];
+  hrv_metrics(&hrv, &metrics);
+  hrv_packet.rr_ms = hrv_rr(&hrv);
+  hrv_packet.rmssd_ms = metrics.rmssd_ms;
+  hrv_packet.sdnn_ms = metrics.sdnn_ms;
+  hrv_packet.pnn50 = metrics.pnn50;
+  hrv_packet.beats++;
+  if (alive)
+    simple_ble_notify_char(&hrv_char);
+}
 
-static uint16_t hr_ref_ctr = 0;
+void hr_beat(const ppg_sample_t *sample, uint32_t ticks)
+{
+  if (sample->ir > PPG_FINGER_MIN)
+  {
+    if (hr_add_beat(&hr, ticks))
+      stat.hr_bpm = hr_bpm(&hr);
+    if (hrv_add_beat(&hrv, ticks))
+      hrv_publish();
+  }
+}
 
-static size_t hr_adjbuf_cnt = 0;
+// Newest motion reference taken at or before ticks, the oldest one if there is none
+static const anc_ref_t *anc_ref_at(uint32_t ticks)
+{
+  uint8_t idx = anc_ref_head;
 
-static size_t hr_bpmbufcnt = 0;
+  for (uint8_t i = 0; i < anc_ref_count; i++)
+  {
+    idx = (idx + ANC_REF_HISTORY - 1) % ANC_REF_HISTORY;
+    if (((ticks - anc_refs[idx].ticks) & APP_TIMER_MAX_CNT_VAL) <= APP_TIMER_MAX_CNT_VAL / 2)
+      return &anc_refs[idx];
+  }
+  return &anc_refs[idx];
+}
 
-void hr_update()
+// Runs the motion canceller and the beat detector over a burst of PPG samples in
+// one filter pass. It only runs while tracking, so always at the full sensor rate.
+void hr_update(const ppg_sample_t *samples, uint16_t n)
 {
-  if (!alive)
+  int32_t ir[BEAT_BLOCK_SIZE];
+  int16_t acc[BEAT_BLOCK_SIZE];
+  int16_t emg[BEAT_BLOCK_SIZE];
+  beat_t beats[BEAT_BLOCK_SIZE];
+
+  // Beats and SpO2 from a clipped, flat or noisy PPG are worthless, skip the whole pipeline
+  if (sqi_flags(&sqi[SQI_CHN_PPG]))
+  {
+    spo2_begin(&spo2);
+    anc_begin(&anc);
+    stat.spo2 = 0;
     return;
-  bool check = checkForBeat((int32_t)buffer.max_ir);
-  printf("Currms: %lu, Beat check: %s\n", millis(), check ? "detected" : "not detected");
-  if (buffer.max_ir > 50000 && check)
+  }
+  for (uint16_t i = 0; i < n; i++)
   {
-    uint32_t t = millis();
-    uint32_t hr_delta = t - hr_lastbeat_ms;
-    hr_lastbeat_ms = t;
-    hr_bpm = 60 / (hr_delta / 1000.0);
+    const anc_ref_t *ref = anc_ref_at(samples[i].ticks);
+    ir[i] = samples[i].ir;
+    acc[i] = ref->acc;
+    emg[i] = ref->emg;
+  }
+  if (anc_ref_count && !sqi_flags(&sqi[ADC_CHN_ACC]))
+    anc_process(&anc, ir, acc, emg, ir, n);
+  uint16_t found = checkForBeat_block(ir, n, beats);
+  for (uint16_t i = 0; i < found; i++)
+  {
+    const ppg_sample_t *sample = &samples[beats[i].idx];
+    hr_beat(sample, hr_beat_ticks(&beats[i], sample->ticks, PPG_SAMPLE_TICKS_Q8));
+  }
 
-    if (hr_bpm < 300 && hr_bpm > 40)
+  // SpO2 windows run from beat to beat, the shared filter delay doesn't change their length
+  for (uint16_t i = 0, b = 0; i < n; i++)
+  {
+    if (samples[i].ir <= PPG_FINGER_MIN)
     {
-      if (hr_ref_ctr)
-      {
-        if (hr_bpm > hr_ref_ctr + HR_VAR_THRESHOLD || hr_bpm < hr_ref_ctr - HR_VAR_THRESHOLD)
-        {
-          hr_adjbuf[hr_adjbuf_cnt++] = hr_bpm;
-          if (hr_adjbuf_cnt >= BPM_ADJ_SIZE)
-          {
-            hr_adjbuf_cnt = 0;
-            hr_ref_ctr = 0;
-            for (size_t x = 0; x < BPM_ADJ_SIZE; x++)
-            {
-              hr_ref_ctr += hr_adjbuf[x];
-            }
-            hr_ref_ctr /= BPM_ADJ_SIZE;
-          }
-          return;
-        }
-        else
-        {
-          hr_adjbuf_cnt = 0;
-        }
-      }
-      hr_bpmbuf[hr_bpmbufcnt++] = hr_bpm;
-      hr_bpmbufcnt %= BPM_BUF_SIZE;
-
-      if (hr_bpmbufcnt % BPM_BUF_SIZE == 0)
-      {
-        hr_bpmAvg = 0;
-        for (size_t x = 0; x < BPM_BUF_SIZE; x++)
-        {
-          hr_bpmAvg += hr_bpmbuf[x];
-        }
-        hr_bpmAvg /= BPM_BUF_SIZE;
-        stat.hr_bpm = hr_bpmAvg;
-        if (!hr_ref_ctr)
-          hr_ref_ctr = hr_bpmAvg;
-      }
+      spo2_begin(&spo2);
+      anc_begin(&anc);
+      stat.spo2 = 0;
+      continue;
     }
+    spo2_add(&spo2, samples[i].red, samples[i].ir);
+    while (b < found && beats[b].idx < i)
+      b++;
+    if (b < found && beats[b].idx == i && spo2_beat(&spo2))
+      stat.spo2 = spo2_value(&spo2);
   }
 }
 
-void br_update()
+void val_update(void);
+
+// Completion of the MAX30102 FIFO drain started by val_update (TWI interrupt)
+void ppg_update(ret_code_t result, const uint32_t *red, const uint32_t *ir, uint8_t count, uint8_t overflow)
 {
-  currms = millis();
-  if (peak_high_count == 2)
+  ppg_sample_t sample;
+  uint32_t now = app_timer_cnt_get();
+  uint32_t period_q8 = ppg_sample_ticks_q8; // one rate for the whole burst
+
+  if (result != NRF_SUCCESS)
+    return;
+  ppg_overflow += overflow;
+  ppg_samples += count;
+  // The newest sample was taken about now, the older ones one period apart
+  for (uint8_t i = 0; i < count; i++)
   {
-    if (currms - startms < 120)
+    sample.ticks = (now - (((count - 1 - i) * period_q8) >> 8)) & APP_TIMER_MAX_CNT_VAL;
+    sample.red = red[i];
+    sample.ir = ir[i];
+    ring_push(&ppg_ring, &sample);
+  }
+#ifdef MAX30102_INT_PIN
+  // A_FULL clears once the FIFO is read, INT still low means it refilled meanwhile
+  if (!nrf_gpio_pin_read(MAX30102_INT_PIN))
+    val_update();
+#endif
+}
+
+void val_update(void)
+{
+  if (!acquiring)
+    return;
+  if (MAX30102_read_fifo_async(ppg_update) == NRF_ERROR_BUSY)
+    ppg_busy++;
+}
+
+#ifdef MAX30102_INT_PIN
+// MAX30102 INT asserted: the FIFO reached PPG_WATERMARK samples
+void ppg_int_handler(nrf_drv_gpiote_pin_t pin, nrf_gpiote_polarity_t action)
+{
+  ppg_wakeups++;
+  val_update();
+}
+
+void ppg_int_init(void)
+{
+  ret_code_t error_code;
+  nrf_drv_gpiote_in_config_t config = GPIOTE_CONFIG_IN_SENSE_HITOLO(false);
+
+  config.pull = NRF_GPIO_PIN_PULLUP;
+  if (!nrf_drv_gpiote_is_init())
+  {
+    error_code = nrf_drv_gpiote_init();
+    APP_ERROR_CHECK(error_code);
+  }
+  error_code = nrf_drv_gpiote_in_init(MAX30102_INT_PIN, &config, ppg_int_handler);
+  APP_ERROR_CHECK(error_code);
+  nrf_drv_gpiote_in_event_enable(MAX30102_INT_PIN, true);
+}
+#endif
+
+// Without INT this is how the FIFO gets read. With it, a missed edge would
+// stop acquisition for good, so once INT has been quiet for PPG_STALL_MS the
+// timer takes over until the next wakeup.
+void ppg_drain_task(void)
+{
+#ifdef MAX30102_INT_PIN
+  static uint32_t wakeups = 0;
+  static uint32_t quiet_ms = 0;
+
+  if (ppg_wakeups != wakeups || !acquiring)
+    quiet_ms = 0;
+  else if (quiet_ms < PPG_STALL_MS)
+  {
+    quiet_ms += PPG_DRAIN_MS;
+    if (quiet_ms >= PPG_STALL_MS)
+      ppg_stalls++;
+  }
+  wakeups = ppg_wakeups;
+  if (quiet_ms < PPG_STALL_MS)
+    return;
+#endif
+  val_update();
+}
+
+// Averages the raw EMG1 scans and the decimated ACC held between its samples
+// down to the PPG rate for the artifact canceller. Called every scan, whatever
+// the EMG stream carries.
+static void anc_ref_update(uint32_t ticks, uint16_t acc, uint16_t emg)
+{
+  static uint32_t acc_sum = 0;
+  static uint32_t emg_sum = 0;
+  static uint8_t scans = 0;
+
+  acc_sum += acc;
+  emg_sum += emg;
+  if (++scans < ANC_REF_DECIM)
+    return;
+  anc_refs[anc_ref_head].ticks = ticks;
+  anc_refs[anc_ref_head].acc = acc_sum / ANC_REF_DECIM;
+  anc_refs[anc_ref_head].emg = emg_sum / ANC_REF_DECIM;
+  anc_ref_head = (anc_ref_head + 1) % ANC_REF_HISTORY;
+  if (anc_ref_count < ANC_REF_HISTORY)
+    anc_ref_count++;
+  acc_sum = emg_sum = 0;
+  scans = 0;
+}
+
+// Stages that run at the ACC rate, frame holds every channel at its own rate
+void motion_update(const adc_sample_t *frame)
+{
+  bool acc_ok = !sqi_update(ADC_CHN_ACC, frame->ch[ADC_CHN_ACC]);
+
+  if (acc_ok)
+    step_add(&steps, frame->ch[ADC_CHN_ACC], frame->ticks);
+  stat.sr1_bpm = acc_ok ? step_cadence(&steps) : 0;
+  stat.sr2_bpm = step_count(&steps);
+}
+
+// Filter ringing can dip just below 0, the channels are unsigned
+static uint16_t adc_clamp(int16_t y)
+{
+  return y < 0 ? 0 : y;
+}
+
+// Envelopes and activation of both EMG channels, true when a new envelope is out.
+// Both see the same scans so they finish their blocks together.
+static bool emg_update(const adc_sample_t *frame)
+{
+  uint8_t q1 = sqi_update(ADC_CHN_EMG1, frame->ch[ADC_CHN_EMG1]);
+  uint8_t q2 = sqi_update(ADC_CHN_EMG2, frame->ch[ADC_CHN_EMG2]);
+  bool ready = emg_add(&emg1, frame->ch[ADC_CHN_EMG1]);
+
+  emg_add(&emg2, frame->ch[ADC_CHN_EMG2]);
+  if (!ready)
+    return false;
+  // Activation on a clipped or loose electrode means nothing
+  stat.emg = (emg_active(&emg1) && !q1 ? 0x01 : 0) | (emg_active(&emg2) && !q2 ? 0x02 : 0);
+  return true;
+}
+
+// TELEMETRY_FLAG_* of the records adc_update() produces
+static uint8_t stream_flags(void)
+{
+  return emg_raw_streamed ? 0 : TELEMETRY_FLAG_EMG_ENV;
+}
+
+// TELEMETRY_FLAG_* of the records ppg_task() produces
+static uint8_t ppg_flags(void)
+{
+  return TELEMETRY_FLAG_PPG | (red_streamed ? 0 : TELEMETRY_FLAG_NO_RED);
+}
+
+// One scan at the full rate: EMG raw or reduced to its envelope, the other
+// channels are decimated to their own rate and held in between
+void adc_update(const adc_sample_t *frame)
+{
+  static adc_sample_t held;
+  int16_t y;
+  bool envelope = emg_update(frame);
+
+  held.ticks = frame->ticks;
+  if (emg_raw_streamed)
+  {
+    held.ch[ADC_CHN_EMG1] = frame->ch[ADC_CHN_EMG1];
+    held.ch[ADC_CHN_EMG2] = frame->ch[ADC_CHN_EMG2];
+  }
+  else if (envelope)
+  {
+    held.ch[ADC_CHN_EMG1] = emg_envelope_telemetry(&emg1);
+    held.ch[ADC_CHN_EMG2] = emg_envelope_telemetry(&emg2);
+  }
+  if (decim_push_chain(flex_chain, 2, frame->ch[ADC_CHN_FLEX], &y))
+  {
+    held.ch[ADC_CHN_FLEX] = adc_clamp(y);
+    bool was_ok = !sqi_flags(&sqi[ADC_CHN_FLEX]);
+    if (!sqi_update(ADC_CHN_FLEX, held.ch[ADC_CHN_FLEX]))
+    {
+      if (br_add(&br, held.ch[ADC_CHN_FLEX]))
+        stat.br_bpm = br_bpm(&br);
+    }
+    else if (was_ok)
     {
-      same_peak = 1;
-      peak_high_count = 0;
+      // The window would mix in the bad stretch, start over once it recovers
+      br_begin(&br);
+      stat.br_bpm = 0;
     }
   }
-  else if (currms - startms > 120)
+  if (decim_push_chain(gsr_chain, 3, frame->ch[ADC_CHN_GSR], &y))
   {
-    same_peak = 0;
-    peak_high_count = 0;
+    held.ch[ADC_CHN_GSR] = adc_clamp(y);
+    sqi_update(ADC_CHN_GSR, held.ch[ADC_CHN_GSR]);
   }
-  add(buffer.flex);
-  if (getPeak() == 1)
+  if (decim_push(&acc_decim, frame->ch[ADC_CHN_ACC], &y))
   {
-    startms = currms;
-    peak_high_count++;
+    held.ch[ADC_CHN_ACC] = adc_clamp(y);
+    motion_update(&held);
   }
+  anc_ref_update(frame->ticks, held.ch[ADC_CHN_ACC], frame->ch[ADC_CHN_EMG1]);
+
+  buffer.gsr = held.ch[ADC_CHN_GSR];
+  buffer.flex = held.ch[ADC_CHN_FLEX];
+  buffer.emg1 = held.ch[ADC_CHN_EMG1];
+  buffer.emg2 = held.ch[ADC_CHN_EMG2];
+
+  // A streaming toggle starts a new frame so its header flags cover every record,
+  // and a new block in the session log for the same reason
+  if (emg_raw_streamed != stream_emg_raw)
+  {
+    emg_raw_streamed = stream_emg_raw;
+    telemetry_set_flags(stream_flags());
+    if (rec_recording(&rec))
+      rec_start(&rec, REC_LANE_ADC, stream_flags());
+  }
+
+  // Raw EMG needs one record per scan, held channels repeat and cost the codec 2
+  // bits each. With envelopes nothing changes faster than a record per envelope.
+  if (!emg_raw_streamed && !envelope)
+    return;
+  telemetry_record_t record = {
+      .ticks = frame->ticks,
+      .gsr = buffer.gsr,
+      .flex = buffer.flex,
+      .emg1 = buffer.emg1,
+      .emg2 = buffer.emg2,
+  };
+  telemetry_push(&record);
+  rec_push(&rec, REC_LANE_ADC, &record);
 }
 
-void sr_update()
+// Everything the SAADC scanned since the last run
+void adc_task(void)
 {
-  currms = millis();
-  if (peak_high_count == 2)
+  adc_sample_t adc;
+
+  PROF_BEGIN(PROF_ADC);
+  while (ring_pop(&adc_ring, &adc))
+    adc_update(&adc);
+  PROF_END(PROF_ADC);
+}
+
+// A block of PPG samples through the beat pipeline, then out as a record per
+// sample with the ticks of its FIFO slot. Beats go first, an HRV notification
+// would otherwise find the TX buffer taken by the frame these records close.
+static void ppg_block(const ppg_sample_t *ppg, uint16_t n, bool tracking)
+{
+  if (tracking)
+    hr_update(ppg, n);
+  for (uint16_t i = 0; i < n; i++)
   {
-    if (currms - startms < 50)
+    telemetry_record_t record = {
+        .ticks = ppg[i].ticks,
+        .max_red = red_streamed ? ppg[i].red : 0,
+        .max_ir = ppg[i].ir,
+    };
+    telemetry_push(&record);
+    rec_push(&rec, REC_LANE_PPG, &record);
+  }
+}
+
+// Every PPG burst drained since the last run. While searching for a finger the
+// sensor runs slower than the beat pipeline expects, so only presence is checked.
+void ppg_task(void)
+{
+  ppg_sample_t ppg[BEAT_BLOCK_SIZE];
+  uint16_t n = 0;
+  power_state_t state = power_state(&power);
+  bool tracking = state == POWER_ACTIVE || state == POWER_SATURATED;
+
+  PROF_BEGIN(PROF_PPG);
+  red_streamed = stream_red;
+  telemetry_set_flags(ppg_flags());
+  if (rec_recording(&rec))
+    rec_start(&rec, REC_LANE_PPG, ppg_flags());
+  while (ring_pop(&ppg_ring, &ppg[n]))
+  {
+    // The telemetry characteristic reads the newest of every channel
+    buffer.max_red = ppg[n].red;
+    buffer.max_ir = ppg[n].ir;
+    power_ppg(&power, ppg[n].ir, ppg[n].ticks);
+    sqi_update(SQI_CHN_PPG, ppg[n].ir);
+    if (++n == BEAT_BLOCK_SIZE)
     {
-      same_peak = 1;
-      peak_high_count = 0;
+      ppg_block(ppg, n, tracking);
+      n = 0;
     }
   }
-  else if (currms - startms > 50)
+  if (n)
+    ppg_block(ppg, n, tracking);
+  telemetry_set_flags(stream_flags());
+  if (!tracking)
   {
-    same_peak = 0;
-    peak_high_count = 0;
+    spo2_begin(&spo2);
+    anc_begin(&anc);
+    stat.spo2 = 0;
   }
+  PROF_END(PROF_PPG);
+}
+
+void telemetry_task(void)
+{
+  PROF_BEGIN(PROF_TELEMETRY);
+  telemetry_flush();
+  PROF_END(PROF_TELEMETRY);
+}
+
+#if PROF_ENABLED
+void diag_task(void)
+{
+  prof_report(&diag);
+}
+#endif
+
+// Priority puts ADC before PPG, so the motion references cover the PPG burst
+// that follows. Periods leave the rings at least half empty.
+static sched_task_t tasks[] = {
+    SCHED_TASK("adc", adc_task, APP_TIMER_TICKS(25), APP_TIMER_TICKS(50), 0),
+    SCHED_TASK("ppg", ppg_task, APP_TIMER_TICKS(100), APP_TIMER_TICKS(250), 1),
+    SCHED_TASK("drain", ppg_drain_task, APP_TIMER_TICKS(PPG_DRAIN_MS), APP_TIMER_TICKS(PPG_DRAIN_MS), 1),
+    SCHED_TASK("telemetry", telemetry_task, APP_TIMER_TICKS(25), APP_TIMER_TICKS(50), 2),
+#if PROF_ENABLED
+    SCHED_TASK("diag", diag_task, APP_TIMER_TICKS(1000), APP_TIMER_TICKS(1000), 3),
+#endif
+};
+static sched_ctx_t sched;
+
+// Only there to wake the main loop, tasks run from sched_run()
+void sched_tick_handler(void *p_context)
+{
+}
 
-  add(buffer.gsr);
-  int peak = getPeak();
-  if (peak == 1)
+static const char *const power_names[POWER_STATES] = {"off", "search", "active", "saturated"};
+
+// Brings the hardware in line with the power state machine, main context only
+static void power_update(void)
+{
+  // What main() leaves running
+  static power_config_t hw = {
+      .adc_on = true,
+      .ppg_on = true,
+      .ppg_fast = true,
+      .led_red = POWER_LED_ACTIVE,
+      .led_ir = POWER_LED_ACTIVE,
+  };
+  power_config_t config;
+  power_report_t report;
+  ret_code_t error_code;
+
+  power_link(&power, alive, rec_recording(&rec), app_timer_cnt_get());
+  if (!power_changed(&power))
+    return;
+  power_config(&power, &config);
+  printf("Power: %s, LED red/IR: %u/%u\n", power_names[power_state(&power)], config.led_red, config.led_ir);
+
+  if (config.adc_on != hw.adc_on)
   {
-    startms = currms;
-    peak_high_count++;
+    if (config.adc_on)
+    {
+      // Stats restart with every connection, releases missed while stopped aren't overruns
+      sched_begin(&sched, tasks, sizeof(tasks) / sizeof(tasks[0]), app_timer_cnt_get, APP_TIMER_MAX_CNT_VAL);
+      error_code = app_timer_start(sched_timer, APP_TIMER_TICKS(SCHED_TICK_MS), NULL);
+      APP_ERROR_CHECK(error_code);
+      nrf_drv_timer_enable(&adc_timer);
+    }
+    else
+    {
+      nrf_drv_timer_disable(&adc_timer);
+      error_code = app_timer_stop(sched_timer);
+      APP_ERROR_CHECK(error_code);
+    }
   }
-  //Step per minute counting
-  if (same_peak)
+  if (config.ppg_on != hw.ppg_on)
+    MAX30102_shutdown(!config.ppg_on);
+  if (config.led_red != hw.led_red || config.led_ir != hw.led_ir)
+    MAX30102_set_led_current(config.led_red, config.led_ir);
+  if (config.ppg_fast != hw.ppg_fast)
   {
-    long delta = millis() - lastStep;
-    lastStep = millis();
-    stepPerMinute = 60 / (delta / 1000.0);
-    if (stepPerMinute < 250 && stepPerMinute > 20)
+    MAX30102_set_sample_rate(config.ppg_fast ? MAX30102_SPS_100 : MAX30102_SPS_50);
+    ppg_sample_ticks_q8 = config.ppg_fast ? PPG_SAMPLE_TICKS_Q8 : 2 * PPG_SAMPLE_TICKS_Q8;
+  }
+  hw = config;
+  acquiring = config.adc_on;
+
+  if (!config.connected)
+  {
+    power_report(&power, app_timer_cnt_get(), &report);
+    for (uint8_t s = 0; s < POWER_STATES; s++)
+      printf("Power %s: %lu s, %lu uA\n", power_names[s], report.seconds[s], report.ua[s]);
+    printf("Power average: %lu uA\n", report.avg_ua);
+  }
+}
+
+// Flash writes and erases go through the SoftDevice and complete in order
+static void rec_fs_handler(nrf_fstorage_evt_t *p_evt)
+{
+  if (p_evt->id == NRF_FSTORAGE_EVT_WRITE_RESULT)
+    rec_write_done(&rec, p_evt->p_param, p_evt->result == NRF_SUCCESS);
+  else if (p_evt->id == NRF_FSTORAGE_EVT_ERASE_RESULT)
+    rec_erase_done(&rec, p_evt->p_param, p_evt->result == NRF_SUCCESS);
+}
+
+NRF_FSTORAGE_DEF(nrf_fstorage_t rec_fs) = {
+    .evt_handler = rec_fs_handler,
+    .start_addr = REC_FLASH_START,
+    .end_addr = REC_FLASH_START + REC_PAGES * REC_PAGE_SIZE - 1,
+};
+
+static bool rec_fs_erase(uint16_t page, uint16_t count, void *p_context)
+{
+  return nrf_fstorage_erase(&rec_fs, REC_FLASH_START + page * REC_PAGE_SIZE, count, p_context) == NRF_SUCCESS;
+}
+
+static bool rec_fs_write(uint32_t offset, const void *src, uint16_t len, void *p_context)
+{
+  return nrf_fstorage_write(&rec_fs, REC_FLASH_START + offset, src, len, p_context) == NRF_SUCCESS;
+}
+
+static const rec_flash_t rec_flash = {
+    .page_size = REC_PAGE_SIZE,
+    .pages = REC_PAGES,
+    .base = (const uint8_t *)REC_FLASH_START,
+    .erase = rec_fs_erase,
+    .write = rec_fs_write,
+};
+
+// Download position, blocks first..end-1 of the log as it was when it started
+static bool downloading = false;
+static uint32_t download_seq;
+static uint32_t download_end;
+static uint16_t download_offset;
+static uint16_t download_blocks;
+
+// Log erase asked for and not issued yet, then issued and not completed
+static bool erase_wanted = false;
+static bool erasing = false;
+static uint32_t erase_wipes;
+
+// Queues download notifications until the SoftDevice runs out of buffers, the
+// next TX complete event wakes the main loop to carry on
+static void rec_download(void)
+{
+  ble_gatts_hvx_params_t hvx_params;
+  rec_chunk_t *chunk = (rec_chunk_t *)rec_value;
+  uint16_t room = telemetry_payload_size() - sizeof(rec_chunk_t);
+  uint16_t len;
+  uint32_t err_code;
+
+  memset(&hvx_params, 0, sizeof(hvx_params));
+  hvx_params.handle = rec_char.char_handle.value_handle;
+  hvx_params.type = BLE_GATT_HVX_NOTIFICATION;
+  hvx_params.p_len = &len;
+  hvx_params.p_data = rec_value;
+  while (downloading)
+  {
+    const rec_hdr_t *hdr = NULL;
+
+    // Blocks overwritten since the download started, or torn by a reset, are skipped
+    while (download_seq < download_end && !(hdr = rec_block(&rec, download_seq)))
+    {
+      // One lost halfway through stays incomplete, the host drops it
+      if (download_offset)
+      {
+        download_offset = 0;
+        download_blocks++;
+      }
+      download_seq++;
+    }
+    if (hdr)
     {
-      rates[rateSpot++] = (uint16_t)stepPerMinute;
-      rateSpot %= 4; //Wrap variable
-      //Take average of readings
-      stepAvg = 0;
-      for (size_t x = 0; x < 4; x++)
-        stepAvg += rates[x];
-      stepAvg /= 4;
+      uint16_t size = sizeof(rec_hdr_t) + hdr->length;
+      len = size - download_offset < room ? size - download_offset : room;
+      chunk->block = download_blocks;
+      chunk->offset = download_offset;
+      memcpy(chunk + 1, (const uint8_t *)hdr + download_offset, len);
+      len += sizeof(rec_chunk_t);
+    }
+    else
+    {
+      chunk->block = REC_CHUNK_END;
+      chunk->offset = download_blocks;
+      len = sizeof(rec_chunk_t);
+    }
+
+    err_code = sd_ble_gatts_hvx(simple_ble_app->conn_handle, &hvx_params);
+    if (err_code == NRF_ERROR_RESOURCES)
+      return;
+    if (err_code != NRF_SUCCESS || !hdr)
+    {
+      // Done, not subscribed or the link is gone
+      printf("Download: %u blocks, %s\n", download_blocks, err_code == NRF_SUCCESS ? "done" : "aborted");
+      downloading = false;
+      return;
+    }
+    download_offset += len - sizeof(rec_chunk_t);
+    if (download_offset == sizeof(rec_hdr_t) + hdr->length)
+    {
+      download_offset = 0;
+      download_blocks++;
+      download_seq++;
     }
   }
-  printf("Currms: %lu, SP: %s, avgbpm: %d\n", currms, peak ? "yes" : "no", stepAvg);
 }
 
-void val_update()
+// Recorder commands from the BLE handler and the download pump, main context only
+static void rec_update(void)
 {
-  if (!alive)
-    return;
-  MAX30102_read_fifo(&buffer.max_red, &buffer.max_ir);
-  buffer.gsr = sample_value(ADC_CHN_GSR);
-  buffer.flex = sample_value(ADC_CHN_FLEX);
-  buffer.emg1 = sample_value(ADC_CHN_EMG1);
-  buffer.emg2 = sample_value(ADC_CHN_EMG2);
+  uint8_t command = rec_cmd;
+  const rec_stats_t *stats = &rec.stats;
+
+  rec_cmd = 0x00;
+  switch (command)
+  {
+  case 0x05:
+    rec_start(&rec, REC_LANE_ADC, stream_flags());
+    rec_start(&rec, REC_LANE_PPG, ppg_flags());
+    printf("Recording\n");
+    break;
+
+  case 0x06:
+    rec_stop(&rec);
+    printf("Recording stopped, blocks: %lu, erases: %lu, dropped: %lu, failed: %lu\n", stats->blocks, stats->erases,
+           stats->dropped, stats->failed);
+    break;
+
+  case 0x07:
+    if (!alive || downloading)
+      break;
+    rec_range(&rec, &download_seq, &download_end);
+    download_offset = 0;
+    download_blocks = 0;
+    downloading = true;
+    printf("Download: blocks %lu..%lu\n", download_seq, download_end);
+    break;
+
+  case 0x08:
+    erase_wanted = true;
+    break;
+
+  default:
+    break;
+  }
+  if (downloading && !alive)
+    downloading = false;
+  // Waits for the download to end and for the blocks on their way to flash
+  if (erase_wanted && !downloading && rec_erase(&rec))
+  {
+    erase_wanted = false;
+    erasing = true;
+    erase_wipes = stats->wipes;
+    printf("Log erase started\n");
+  }
+  if (erasing && !rec_wiping(&rec))
+  {
+    erasing = false;
+    printf(stats->wipes != erase_wipes ? "Log erased\n" : "Log erase failed\n");
+  }
+  rec_download();
+}
+
+// CYCCNT stops while the core sleeps, so sleep is timed on the RTC
+static void idle(void)
+{
+#if PROF_ENABLED
+  uint32_t start = app_timer_cnt_get();
+#endif
+
+  power_manage();
+  PROF_RECORD(PROF_SLEEP, ((app_timer_cnt_get() - start) & APP_TIMER_MAX_CNT_VAL) * (prof_hz() / APP_TIMER_CLOCK_FREQ));
 }
 
 void ble_evt_write(ble_evt_t const *p_ble_evt)
@@ -291,6 +972,26 @@ void ble_evt_write(ble_evt_t const *p_ble_evt)
         cmd = 0x00;
         break;
 
+      case 0x03:
+        stream_red = !stream_red;
+        printf("(BLE) Raw red streaming %s\n", stream_red ? "on" : "off");
+        cmd = 0x00;
+        break;
+
+      case 0x04:
+        stream_emg_raw = !stream_emg_raw;
+        printf("(BLE) Raw EMG streaming %s\n", stream_emg_raw ? "on" : "off");
+        cmd = 0x00;
+        break;
+
+      case 0x05: // record start
+      case 0x06: // record stop
+      case 0x07: // download the log
+      case 0x08: // erase the log
+        rec_cmd = cmd;
+        cmd = 0x00;
+        break;
+
       default:
         printf("Unknown command: %x\n", cmd);
         cmd = 0x00;
@@ -302,12 +1003,19 @@ void ble_evt_write(ble_evt_t const *p_ble_evt)
 
 void ble_evt_connected(ble_evt_t const *p_ble_evt)
 {
+  // The main loop wakes the sensors up, see power_update()
   alive = true;
 }
 
 void ble_evt_disconnected(ble_evt_t const *p_ble_evt)
 {
   alive = false;
+  printf("PPG wakeups: %lu, stalls: %lu, samples: %lu, overflow: %lu, busy: %lu, ring overruns: %lu\n", ppg_wakeups,
+         ppg_stalls, ppg_samples, ppg_overflow, ppg_busy, ppg_ring.overruns);
+  printf("ADC ring overruns: %lu\n", adc_ring.overruns);
+  for (uint8_t i = 0; i < sizeof(tasks) / sizeof(tasks[0]); i++)
+    printf("Task %s: runs: %lu, overruns: %lu, misses: %lu, exec ticks min/mean/max: %lu/%lu/%lu\n", tasks[i].name, tasks[i].runs,
+           tasks[i].overruns, tasks[i].misses, tasks[i].runs ? tasks[i].exec_min : 0, sched_exec_mean(&tasks[i]), tasks[i].exec_max);
 }
 
 void ble_error(uint32_t error_code)
@@ -317,7 +1025,59 @@ void ble_error(uint32_t error_code)
 
 void saadc_callback(nrfx_saadc_evt_t const *p_event)
 {
-  // don't care about adc callbacks
+  adc_sample_t frame;
+  uint32_t now = app_timer_cnt_get();
+
+  if (p_event->type != NRFX_SAADC_EVT_DONE)
+    return;
+  // The other buffer is filling now, hand this one off and queue it behind
+  uint16_t count = p_event->data.done.size / ADC_CHN_COUNT;
+  for (uint16_t i = 0; acquiring && i < count; i++)
+  {
+    const nrf_saadc_value_t *scan = &p_event->data.done.p_buffer[i * ADC_CHN_COUNT];
+    frame.ticks = (now - (((count - 1 - i) * ADC_SCAN_TICKS_Q8) >> 8)) & APP_TIMER_MAX_CNT_VAL;
+    for (uint8_t c = 0; c < ADC_CHN_COUNT; c++)
+      frame.ch[c] = scan[c] < 0 ? 0 : scan[c]; // single ended input can read slightly below 0
+    ring_push(&adc_ring, &frame);
+  }
+  APP_ERROR_CHECK(nrfx_saadc_buffer_convert(p_event->data.done.p_buffer, p_event->data.done.size));
+}
+
+void adc_timer_handler(nrf_timer_event_t event_type, void *p_context)
+{
+  // compare events only drive PPI
+}
+
+// Starts continuous scan conversion of every initialized channel
+void adc_scan_start(void)
+{
+  ret_code_t error_code;
+  nrf_drv_timer_config_t timer_config = NRF_DRV_TIMER_DEFAULT_CONFIG;
+
+  timer_config.bit_width = NRF_TIMER_BIT_WIDTH_32;
+  error_code = nrf_drv_timer_init(&adc_timer, &timer_config, adc_timer_handler);
+  APP_ERROR_CHECK(error_code);
+  nrf_drv_timer_extended_compare(&adc_timer, NRF_TIMER_CC_CHANNEL0, nrf_drv_timer_us_to_ticks(&adc_timer, ADC_SCAN_INTERVAL_US),
+                                 NRF_TIMER_SHORT_COMPARE0_CLEAR_MASK, false);
+
+  error_code = nrf_drv_ppi_init();
+  if (error_code != NRF_ERROR_MODULE_ALREADY_INITIALIZED)
+    APP_ERROR_CHECK(error_code);
+  error_code = nrf_drv_ppi_channel_alloc(&adc_ppi);
+  APP_ERROR_CHECK(error_code);
+  error_code = nrf_drv_ppi_channel_assign(adc_ppi, nrf_drv_timer_compare_event_address_get(&adc_timer, NRF_TIMER_CC_CHANNEL0),
+                                          nrfx_saadc_sample_task_get());
+  APP_ERROR_CHECK(error_code);
+
+  // Double buffering: the driver switches to the second buffer when the first fills
+  error_code = nrfx_saadc_buffer_convert(adc_buf[0], ADC_SCAN_BLOCK * ADC_CHN_COUNT);
+  APP_ERROR_CHECK(error_code);
+  error_code = nrfx_saadc_buffer_convert(adc_buf[1], ADC_SCAN_BLOCK * ADC_CHN_COUNT);
+  APP_ERROR_CHECK(error_code);
+
+  error_code = nrf_drv_ppi_channel_enable(adc_ppi);
+  APP_ERROR_CHECK(error_code);
+  nrf_drv_timer_enable(&adc_timer);
 }
 
 int main(void)
@@ -326,6 +1086,8 @@ int main(void)
   // Initialize
   ret_code_t error_code = NRF_SUCCESS;
 
+  PROF_INIT();
+
   // initialize RTT library
   error_code = NRF_LOG_INIT(NULL);
   APP_ERROR_CHECK(error_code);
@@ -383,6 +1145,7 @@ int main(void)
   MAX30102_twi_init(&i2c_config);
 
   // Setup PO & HR
+  MAX30102_set_watermark(PPG_WATERMARK);
   MAX30102_init();
 
   // Setup BLE
@@ -393,6 +1156,14 @@ int main(void)
   simple_ble_add_characteristic(1, 1, 1, 0, sizeof(cmd), (uint8_t *)&cmd, &sensing_service, &cmd_char);
   simple_ble_add_characteristic(1, 0, 1, 0, sizeof(packet_t), (uint8_t *)&buffer, &sensing_service, &telemetry_char);
   simple_ble_add_characteristic(1, 0, 1, 0, sizeof(stat_packet_t), (uint8_t *)&stat, &sensing_service, &stat_char);
+  simple_ble_add_characteristic(1, 0, 1, 0, sizeof(hrv_packet_t), (uint8_t *)&hrv_packet, &sensing_service, &hrv_char);
+  simple_ble_add_characteristic(0, 0, 1, 1, sizeof(stream_value), stream_value, &sensing_service, &stream_char);
+#if PROF_ENABLED
+  simple_ble_add_characteristic(1, 0, 0, 0, sizeof(prof_report_t), (uint8_t *)&diag, &sensing_service, &diag_char);
+#endif
+  simple_ble_add_characteristic(0, 0, 1, 1, sizeof(rec_value), rec_value, &sensing_service, &rec_char);
+  telemetry_init(stream_char.char_handle.value_handle);
+  telemetry_set_flags(stream_flags());
 
   // Start Advertising
   simple_ble_adv_only_name();
@@ -400,19 +1171,43 @@ int main(void)
   nrf_gpio_cfg_output(NRF_GPIO_PIN_MAP(0, 10));
 
   app_timer_init();
-  app_timer_create(&sample_upd, APP_TIMER_MODE_REPEATED, (app_timer_timeout_handler_t)val_update);
-  app_timer_start(sample_upd, APP_TIMER_TICKS(SAMPLE_INTERVAL_MS), NULL);
-  app_timer_create(&sr_upd, APP_TIMER_MODE_REPEATED, (app_timer_timeout_handler_t)hr_update);
-  app_timer_start(sr_upd, APP_TIMER_TICKS(60), NULL);
-  //app_timer_create(&br_upd, APP_TIMER_MODE_REPEATED, (app_timer_timeout_handler_t)br_update);
-  //app_timer_start(br_upd, APP_TIMER_TICKS(BR_INTERVAL_MS), NULL);
-  app_timer_create(&sr_upd, APP_TIMER_MODE_REPEATED, (app_timer_timeout_handler_t)sr_update);
-  app_timer_start(sr_upd, APP_TIMER_TICKS(SR_INTERVAL_MS), NULL);
-
-  begin(30, 1.2, 0.9);
-  startms = millis();
+#ifdef MAX30102_INT_PIN
+  ppg_int_init();
+#endif
+
+  hr_begin(&hr);
+  hrv_begin(&hrv);
+  spo2_begin(&spo2);
+  anc_begin(&anc);
+  step_begin(&steps);
+  br_begin(&br);
+  emg_begin(&emg1);
+  emg_begin(&emg2);
+  for (uint8_t c = 0; c < SQI_CHN_COUNT; c++)
+    sqi_begin(&sqi[c], &sqi_config[c]);
+  decim_init(&acc_decim);
+  for (uint8_t i = 0; i < sizeof(flex_chain) / sizeof(flex_chain[0]); i++)
+    decim_init(flex_chain[i]);
+  for (uint8_t i = 0; i < sizeof(gsr_chain) / sizeof(gsr_chain[0]); i++)
+    decim_init(gsr_chain[i]);
+  adc_scan_start();
+
+  // fstorage needs the SoftDevice enabled, simple_ble_init() did that
+  error_code = nrf_fstorage_init(&rec_fs, &nrf_fstorage_sd, NULL);
+  APP_ERROR_CHECK(error_code);
+  rec_begin(&rec, &rec_flash);
+
+  power_begin(&power, PPG_FINGER_MIN, app_timer_cnt_get());
+  sched_begin(&sched, tasks, sizeof(tasks) / sizeof(tasks[0]), app_timer_cnt_get, APP_TIMER_MAX_CNT_VAL);
+  error_code = app_timer_create(&sched_timer, APP_TIMER_MODE_REPEATED, sched_tick_handler);
+  APP_ERROR_CHECK(error_code);
+  error_code = app_timer_start(sched_timer, APP_TIMER_TICKS(SCHED_TICK_MS), NULL);
+  APP_ERROR_CHECK(error_code);
   while (true)
   {
-    power_manage();
+    sched_run(&sched);
+    rec_update();
+    power_update();
+    idle();
   }
 }
@@ -1,13 +1,19 @@
 #include "max30102.h"
+#include "prof.h"
 
 #define MAX30102_ADDR 0x57
 
-/* TWI instance ID. */
-#if TWI0_ENABLED
-#define TWI_INSTANCE_ID 0
-#elif TWI1_ENABLED
-#define TWI_INSTANCE_ID 1
-#endif
+/* INT_ENABLE_1: FIFO almost full only, PPG_RDY would assert on every sample */
+#define INT_ENABLE_1_A_FULL 0x80
+/* INT_STATUS_1: FIFO almost full, cleared by reading the status or the FIFO */
+#define INT_STATUS_1_A_FULL 0x80
+/* FIFO_CONF without the FIFO_A_FULL field: SMP_AVE = 4, no rollover */
+#define FIFO_CONF_BASE 0x40
+/* MODE_CONF: SpO2 mode, SHDN stops sampling and the LEDs but keeps the registers */
+#define MODE_CONF_SPO2 0x03
+#define MODE_CONF_SHDN 0x80
+/* SPO2_CONF without the SPO2_SR field: 4096 nA range, 411 us pulses (18 bit) */
+#define SPO2_CONF_BASE 0x23
 
 /* Interrupt */
 uint8_t REG_INT_STATUS_1 = 0x00;
@@ -43,32 +49,58 @@ uint8_t REG_PROX_INT_TH = 0x30;
 uint8_t REG_REF_ID = 0xFE;
 uint8_t REG_PART_ID = 0xFF;
 
-/* TWI instance. */
-static const nrf_drv_twi_t twi_instance = NRF_DRV_TWI_INSTANCE(0);
-
-/* Indicates if operation on TWI has ended. */
-static volatile bool m_xfer_done = false;
+/* TWI transaction manager, shared with any other device on the bus. */
+NRF_TWI_MNGR_DEF(twi_mngr, MAX30102_TWI_QUEUE_SIZE, 0);
+
+/* FIFO_A_FULL field, the default of 15 free slots equals a watermark of 17 samples. */
+static uint8_t fifo_a_full = 0x0F;
+/* SPO2_SR field and LED amplitudes, applied by MAX30102_init() and kept up to date after it. */
+static uint8_t spo2_sr = MAX30102_SPS_100;
+static uint8_t led_red = 0x3F;
+static uint8_t led_ir = 0x3F;
+static bool initialized = false;
+
+/* Raw FIFO contents of one asynchronous drain. */
+static uint8_t fifo_raw[MAX30102_FIFO_DEPTH * MAX30102_SAMPLE_BYTES];
+
+/* State of the asynchronous FIFO drain, only one may be in flight. */
+static volatile bool fifo_busy = false;
+static max30102_fifo_handler_t fifo_handler;
+static uint8_t fifo_ptrs[7]; /* INT_STATUS_1 through RD_PTR */
+static uint8_t fifo_count;
+static uint32_t fifo_red[MAX30102_FIFO_DEPTH];
+static uint32_t fifo_ir[MAX30102_FIFO_DEPTH];
+
+static nrf_twi_mngr_transfer_t const fifo_ptr_transfers[] = {
+    NRF_TWI_MNGR_WRITE(MAX30102_ADDR, &REG_INT_STATUS_1, 1, NRF_TWI_MNGR_NO_STOP),
+    NRF_TWI_MNGR_READ(MAX30102_ADDR, fifo_ptrs, sizeof(fifo_ptrs), 0),
+};
+static nrf_twi_mngr_transfer_t fifo_data_transfers[] = {
+    NRF_TWI_MNGR_WRITE(MAX30102_ADDR, &REG_FIFO_DATA, 1, NRF_TWI_MNGR_NO_STOP),
+    NRF_TWI_MNGR_READ(MAX30102_ADDR, fifo_raw, 0, 0),
+};
 
 /**
- * @brief TWI events handler.
+ * @brief Decodes one 18-bit, MSB first LED sample.
  */
-void twi_handler(nrf_drv_twi_evt_t const *p_event, void *p_context)
+static uint32_t MAX30102_unpack_sample(const uint8_t *p)
 {
+    return (((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2]) & 0x0003FFFF;
+}
 
-    switch (p_event->type)
-    {
-    case NRF_DRV_TWI_EVT_DONE:
-        if (p_event->xfer_desc.type == NRF_DRV_TWI_XFER_RX)
-        {
-            //data_handler(sample);
-        }
-
-        m_xfer_done = true;
-        break;
-
-    default:
-        break;
-    }
+/**
+ * @brief Number of samples pending according to INT_STATUS_1 through RD_PTR.
+ */
+static uint8_t MAX30102_fifo_pending(const uint8_t *regs, uint8_t max_samples)
+{
+    uint8_t count = (regs[4] - regs[6]) & 0x1F;
+
+    /* The pointers also meet when the FIFO is full: then A_FULL is up, or samples were lost */
+    if (count == 0 && ((regs[0] & INT_STATUS_1_A_FULL) || (regs[5] & 0x1F)))
+        count = MAX30102_FIFO_DEPTH;
+    if (count > max_samples)
+        count = max_samples;
+    return count;
 }
 
 /**
@@ -78,10 +110,8 @@ void MAX30102_twi_init(nrf_drv_twi_config_t *conf)
 {
     ret_code_t err_code;
 
-    err_code = nrf_drv_twi_init(&twi_instance, conf, twi_handler, NULL);
+    err_code = nrf_twi_mngr_init(&twi_mngr, conf);
     APP_ERROR_CHECK(err_code);
-
-    nrf_drv_twi_enable(&twi_instance);
 }
 
 void MAX30102_reset(void)
@@ -92,17 +122,61 @@ void MAX30102_reset(void)
 
 void MAX30102_init(void)
 {
-    MAX30102_write_register(REG_INT_ENABLE_1, 0xC0);
+    MAX30102_write_register(REG_INT_ENABLE_1, INT_ENABLE_1_A_FULL);
     MAX30102_write_register(REG_INT_ENABLE_2, 0x00);
     MAX30102_write_register(REG_FIFO_WR_PTR, 0x00);
     MAX30102_write_register(REG_OVERFLOW_CTR, 0x00);
     MAX30102_write_register(REG_FIFO_RD_PTR, 0x00);
-    MAX30102_write_register(REG_FIFO_CONF, 0x4F);
-    MAX30102_write_register(REG_MODE_CONF, 0x03);
-    MAX30102_write_register(REG_SPO2_CONF, 0x27);
-    MAX30102_write_register(REG_LED1_PA, 0x3F);
-    MAX30102_write_register(REG_LED2_PA, 0x3F);
+    MAX30102_write_register(REG_FIFO_CONF, FIFO_CONF_BASE | fifo_a_full);
+    MAX30102_write_register(REG_MODE_CONF, MODE_CONF_SPO2);
+    MAX30102_write_register(REG_SPO2_CONF, SPO2_CONF_BASE | spo2_sr);
+    MAX30102_write_register(REG_LED1_PA, led_red);
+    MAX30102_write_register(REG_LED2_PA, led_ir);
     MAX30102_write_register(REG_PILOT_PA, 0x7F);
+    initialized = true;
+}
+
+uint8_t MAX30102_set_watermark(uint8_t samples)
+{
+    fifo_a_full = MAX30102_watermark_to_a_full(samples);
+    if (initialized)
+        MAX30102_write_register(REG_FIFO_CONF, FIFO_CONF_BASE | fifo_a_full);
+    return MAX30102_a_full_to_watermark(fifo_a_full);
+}
+
+void MAX30102_shutdown(bool shutdown)
+{
+    uint8_t status;
+
+    if (shutdown)
+    {
+        MAX30102_write_register(REG_MODE_CONF, MODE_CONF_SHDN | MODE_CONF_SPO2);
+        return;
+    }
+    /* Samples from before the shutdown are stale, and an A_FULL left pending would hold INT low */
+    MAX30102_write_register(REG_FIFO_WR_PTR, 0x00);
+    MAX30102_write_register(REG_OVERFLOW_CTR, 0x00);
+    MAX30102_write_register(REG_FIFO_RD_PTR, 0x00);
+    MAX30102_read_register(REG_INT_STATUS_1, &status);
+    MAX30102_write_register(REG_MODE_CONF, MODE_CONF_SPO2);
+}
+
+void MAX30102_set_led_current(uint8_t red, uint8_t ir)
+{
+    led_red = red;
+    led_ir = ir;
+    if (initialized)
+    {
+        MAX30102_write_register(REG_LED1_PA, led_red);
+        MAX30102_write_register(REG_LED2_PA, led_ir);
+    }
+}
+
+void MAX30102_set_sample_rate(uint8_t sps)
+{
+    spo2_sr = sps & 0x1C;
+    if (initialized)
+        MAX30102_write_register(REG_SPO2_CONF, SPO2_CONF_BASE | spo2_sr);
 }
 
 void MAX30102_read_ID(void)
@@ -126,71 +200,112 @@ void MAX30102_read_fifo(uint32_t *pun_red_led, uint32_t *pun_ir_led)
 {
 
     uint8_t clean;
-    uint32_t temp_32 = 0;
     uint8_t temp_array[6];
-    ret_code_t err_code;
 
     *pun_ir_led = 0;
     *pun_red_led = 0;
     MAX30102_read_register(REG_INT_STATUS_1, &clean);
-    err_code = nrf_drv_twi_tx(&twi_instance, MAX30102_ADDR, &REG_FIFO_DATA, sizeof(REG_FIFO_DATA), true);
-    APP_ERROR_CHECK(err_code);
-    while (m_xfer_done == false)
-        ;
-    m_xfer_done = false;
+    MAX30102_read_registers(REG_FIFO_DATA, temp_array, sizeof(temp_array));
 
-    err_code = nrf_drv_twi_rx(&twi_instance, MAX30102_ADDR, temp_array, sizeof(temp_array));
-    APP_ERROR_CHECK(err_code);
-    while (m_xfer_done == false)
-        ;
-    m_xfer_done = false;
+    *pun_red_led = MAX30102_unpack_sample(&temp_array[0]);
+    *pun_ir_led = MAX30102_unpack_sample(&temp_array[3]);
+}
 
-    temp_32 |= temp_array[0];
-    temp_32 <<= 8;
-    temp_32 |= temp_array[1];
-    temp_32 <<= 8;
-    temp_32 |= temp_array[2];
-    *pun_red_led = temp_32;
+/**
+ * @brief Second stage of the asynchronous drain: samples are in fifo_raw.
+ */
+static void MAX30102_fifo_data_done(ret_code_t result, void *p_user_data)
+{
+    max30102_fifo_handler_t handler = fifo_handler;
+    uint8_t count = (result == NRF_SUCCESS) ? fifo_count : 0;
 
-    *pun_red_led &= 0x0003FFFF;
+    for (uint8_t i = 0; i < count; i++)
+    {
+        fifo_red[i] = MAX30102_unpack_sample(&fifo_raw[i * MAX30102_SAMPLE_BYTES]);
+        fifo_ir[i] = MAX30102_unpack_sample(&fifo_raw[i * MAX30102_SAMPLE_BYTES + 3]);
+    }
+    fifo_busy = false;
+    PROF_END(PROF_TWI);
+    handler(result, fifo_red, fifo_ir, count, fifo_ptrs[5] & 0x1F);
+}
 
-    temp_32 = 0;
+/**
+ * @brief First stage of the asynchronous drain: FIFO pointers are in fifo_ptrs.
+ */
+static void MAX30102_fifo_ptr_done(ret_code_t result, void *p_user_data)
+{
+    static nrf_twi_mngr_transaction_t const transaction = {
+        .callback = MAX30102_fifo_data_done,
+        .p_user_data = NULL,
+        .p_transfers = fifo_data_transfers,
+        .number_of_transfers = sizeof(fifo_data_transfers) / sizeof(fifo_data_transfers[0]),
+        .p_required_twi_cfg = NULL,
+    };
+
+    if (result == NRF_SUCCESS)
+    {
+        fifo_count = MAX30102_fifo_pending(fifo_ptrs, MAX30102_FIFO_DEPTH);
+        if (fifo_count)
+        {
+            fifo_data_transfers[1].length = fifo_count * MAX30102_SAMPLE_BYTES;
+            result = nrf_twi_mngr_schedule(&twi_mngr, &transaction);
+            if (result == NRF_SUCCESS)
+                return;
+        }
+    }
+    fifo_count = 0;
+    MAX30102_fifo_data_done(result, NULL);
+}
+
+ret_code_t MAX30102_read_fifo_async(max30102_fifo_handler_t handler)
+{
+    static nrf_twi_mngr_transaction_t const transaction = {
+        .callback = MAX30102_fifo_ptr_done,
+        .p_user_data = NULL,
+        .p_transfers = fifo_ptr_transfers,
+        .number_of_transfers = sizeof(fifo_ptr_transfers) / sizeof(fifo_ptr_transfers[0]),
+        .p_required_twi_cfg = NULL,
+    };
+    ret_code_t err_code;
 
-    temp_32 |= temp_array[3];
-    temp_32 <<= 8;
-    temp_32 |= temp_array[4];
-    temp_32 <<= 8;
-    temp_32 |= temp_array[5];
-    *pun_ir_led = temp_32;
+    if (fifo_busy)
+        return NRF_ERROR_BUSY;
+    fifo_busy = true;
+    fifo_handler = handler;
+    PROF_BEGIN(PROF_TWI);
 
-    *pun_ir_led &= 0x0003FFFF;
+    err_code = nrf_twi_mngr_schedule(&twi_mngr, &transaction);
+    if (err_code != NRF_SUCCESS)
+        fifo_busy = false;
+    return err_code;
 }
 
+/* Blocking accessors, meant for initialization and diagnostics only. */
 void MAX30102_write_register(uint8_t reg_address, uint8_t data)
 {
     ret_code_t err_code;
     uint8_t buffer_send[2] = {reg_address, data};
+    nrf_twi_mngr_transfer_t const transfers[] = {
+        NRF_TWI_MNGR_WRITE(MAX30102_ADDR, buffer_send, sizeof(buffer_send), 0),
+    };
 
-    err_code = nrf_drv_twi_tx(&twi_instance, MAX30102_ADDR, buffer_send, sizeof(buffer_send), true);
+    err_code = nrf_twi_mngr_perform(&twi_mngr, NULL, transfers, 1, NULL);
     APP_ERROR_CHECK(err_code);
-    while (m_xfer_done == false)
-        ;
-    m_xfer_done = false;
 }
 
 void MAX30102_read_register(uint8_t reg_address, uint8_t *data)
 {
-    ret_code_t err_code;
+    MAX30102_read_registers(reg_address, data, 1);
+}
 
-    err_code = nrf_drv_twi_tx(&twi_instance, MAX30102_ADDR, &reg_address, sizeof(reg_address), true);
-    APP_ERROR_CHECK(err_code);
-    while (m_xfer_done == false)
-        ;
-    m_xfer_done = false;
+void MAX30102_read_registers(uint8_t reg_address, uint8_t *data, uint8_t len)
+{
+    ret_code_t err_code;
+    nrf_twi_mngr_transfer_t const transfers[] = {
+        NRF_TWI_MNGR_WRITE(MAX30102_ADDR, &reg_address, 1, NRF_TWI_MNGR_NO_STOP),
+        NRF_TWI_MNGR_READ(MAX30102_ADDR, data, len, 0),
+    };
 
-    err_code = nrf_drv_twi_rx(&twi_instance, MAX30102_ADDR, data, sizeof(data));
+    err_code = nrf_twi_mngr_perform(&twi_mngr, NULL, transfers, 2, NULL);
     APP_ERROR_CHECK(err_code);
-    while (m_xfer_done == false)
-        ;
-    m_xfer_done = false;
 }
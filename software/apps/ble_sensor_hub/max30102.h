@@ -2,24 +2,91 @@
 #include "stdint.h"
 
 #include "nrf_drv_twi.h"
+#include "nrf_twi_mngr.h"
 #include "boards.h"
+#include "nrf_gpio.h"
 
 #include "nrf.h"
 #include "nrf_log.h"
 #include "nrf_log_ctrl.h"
 #include "nrf_log_default_backends.h"
 
+/* Samples held by the on-chip FIFO */
+#define MAX30102_FIFO_DEPTH 32
+/* FIFO output rate: 100 sps (SPO2_CONF) averaged by 4 (FIFO_CONF) */
+#define MAX30102_SAMPLE_RATE_HZ 25
+/* SPO2_SR field values for MAX30102_set_sample_rate(), the rate before averaging */
+#define MAX30102_SPS_50 (0x00 << 2)
+#define MAX30102_SPS_100 (0x01 << 2)
+/* Bytes per FIFO sample in SpO2 mode (red + IR, 3 bytes each) */
+#define MAX30102_SAMPLE_BYTES 6
+/* Transactions the driver may have queued on the TWI manager at once */
+#define MAX30102_TWI_QUEUE_SIZE 8
+/* Open-drain, active low INT output, MAX30102_INT_PIN when a board wires it to a GPIO. The
+ * breakout's heart rate connector (J7, doc/schematics/Top.SchDoc) carries 3V3, AGND, HR_SCL and
+ * HR_SDA only, so by default there is no INT and the FIFO is drained on a timer. */
+/* FIFO_A_FULL holds 0..15 free slots, so the almost-full watermark spans 17..32 samples. 32 is
+ * left out: without rollover a full FIFO loses the sample that lands while it is being drained. */
+#define MAX30102_WATERMARK_MIN (MAX30102_FIFO_DEPTH - 15)
+#define MAX30102_WATERMARK_MAX (MAX30102_FIFO_DEPTH - 1)
+
+/**
+ * @brief FIFO_A_FULL field that raises A_FULL once `samples` are unread, clamped to the supported range.
+ */
+static inline uint8_t MAX30102_watermark_to_a_full(uint8_t samples)
+{
+    if (samples < MAX30102_WATERMARK_MIN)
+        samples = MAX30102_WATERMARK_MIN;
+    if (samples > MAX30102_WATERMARK_MAX)
+        samples = MAX30102_WATERMARK_MAX;
+    return MAX30102_FIFO_DEPTH - samples;
+}
+
+/**
+ * @brief Unread samples at which a FIFO_A_FULL field value raises A_FULL.
+ */
+static inline uint8_t MAX30102_a_full_to_watermark(uint8_t a_full)
+{
+    return MAX30102_FIFO_DEPTH - (a_full & 0x0F);
+}
+
+/* Completion of MAX30102_read_fifo_async(), called from the TWI interrupt.
+ * The sample arrays are only valid for the duration of the call. */
+typedef void (*max30102_fifo_handler_t)(ret_code_t result, const uint32_t *pun_red_led, const uint32_t *pun_ir_led, uint8_t count, uint8_t overflow);
 
 void MAX30102_twi_init (nrf_drv_twi_config_t *conf);
 
 void MAX30102_reset (void);
 
+/* Only the FIFO almost-full interrupt is enabled, see MAX30102_set_watermark(). */
 void MAX30102_init (void);
 
+/* Sets the almost-full watermark, clamped to 17..31 samples. Returns the watermark in effect.
+ * Takes effect immediately when called after MAX30102_init(). */
+uint8_t MAX30102_set_watermark (uint8_t samples);
+
+/* Puts the sensor in or out of shutdown. Waking up empties the FIFO and clears a pending interrupt. */
+void MAX30102_shutdown (bool shutdown);
+
+/* LED pulse amplitudes (LED1_PA, LED2_PA), 0.2 mA per step, 0 turns an LED off.
+ * Takes effect immediately when called after MAX30102_init(). */
+void MAX30102_set_led_current (uint8_t red, uint8_t ir);
+
+/* Sensor rate before averaging, MAX30102_SPS_*. The FIFO rate is a quarter of it.
+ * Takes effect immediately when called after MAX30102_init(). */
+void MAX30102_set_sample_rate (uint8_t sps);
+
 void MAX30102_read_ID (void);
 
 void MAX30102_read_fifo (uint32_t *pun_red_led, uint32_t *pun_ir_led);
 
+/* Drains every pending sample in one burst without blocking, handler receives them and the
+ * number of samples the sensor dropped since the last drain. Returns NRF_ERROR_BUSY while a
+ * drain is in flight. */
+ret_code_t MAX30102_read_fifo_async (max30102_fifo_handler_t handler);
+
 void MAX30102_write_register (uint8_t reg_address, uint8_t data);
 
 void MAX30102_read_register (uint8_t reg_address, uint8_t *data);
+
+void MAX30102_read_registers (uint8_t reg_address, uint8_t *data, uint8_t len);
@@ -1,89 +1,92 @@
 #include "pd.h"
 
-#define DEFAULT_LAG 32
-#define DEFAULT_THRESHOLD 2.0
-#define DEFAULT_INFLUENCE 0.5
-#define DEFAULT_EPSILON 0.01
+#define DEFAULT_EPSILON 0.01f
+#define RESYNC_INTERVAL 4096
 
-static int index = 0;
-static int lag = DEFAULT_LAG;
-static float threshold = DEFAULT_THRESHOLD;
-static int peak = 0;
-static float influence = DEFAULT_INFLUENCE;
-static float EPSILON = DEFAULT_EPSILON;
-static float *data, *avg, *std;
+static const float EPSILON = DEFAULT_EPSILON;
 
-void begin(int l, float th, float inf) {
-  lag = l;
-  threshold = th;
-  influence = inf;
-  data = (float *)malloc(sizeof(float) * (lag + 1));
-  avg = (float *)malloc(sizeof(float) * (lag + 1));
-  std = (float *)malloc(sizeof(float) * (lag + 1));
-  for (int i = 0; i < lag; ++i) {
-    data[i] = 0.0;
-    avg[i] = 0.0;
-    std[i] = 0.0;
+void pd_begin(pd_ctx_t *ctx, float th, float inf) {
+  ctx->index = 0;
+  ctx->resync = 0;
+  for (uint32_t i = 0; i < (uint32_t)ctx->lag * ctx->channels; ++i)
+    ctx->data[i] = 0.0f;
+  for (uint16_t c = 0; c < ctx->channels; ++c) {
+    ctx->avg[c] = 0.0f;
+    ctx->m2[c] = 0.0f;
+    ctx->std[c] = 0.0f;
+    ctx->peak[c] = 0;
+    pd_config(ctx, c, th, inf);
   }
 }
 
-void chgTh(float th) {
-    threshold = th;
+void pd_config(pd_ctx_t *ctx, uint16_t ch, float th, float inf) {
+  ctx->threshold[ch] = th;
+  ctx->influence[ch] = inf;
 }
 
-float getAvg(int start, int len) {
-  float x = 0.0;
-  for (int i = 0; i < len; ++i)
-    x += data[(start + i) % lag];
-  return x / len;
+// Full O(lag) recomputation of the window statistics, only used to shed the
+// rounding drift the incremental update accumulates.
+static void resync(pd_ctx_t *ctx) {
+  const uint16_t n = ctx->channels;
+  for (uint16_t c = 0; c < n; ++c) {
+    float x = 0.0f;
+    for (uint16_t i = 0; i < ctx->lag; ++i)
+      x += ctx->data[i * n + c];
+    ctx->avg[c] = x / ctx->lag;
+    x = 0.0f;
+    for (uint16_t i = 0; i < ctx->lag; ++i)
+      x += (ctx->data[i * n + c] - ctx->avg[c]) * (ctx->data[i * n + c] - ctx->avg[c]);
+    ctx->m2[c] = x;
+  }
+  ctx->resync = 0;
 }
 
-float getPoint(int start, int len) {
-  float xi = 0.0;
-  for (int i = 0; i < len; ++i)
-    xi += data[(start + i) % lag] * data[(start + i) % lag];
-  return xi / len;
-}
+// One detector step for n channels. Branch-free so the compiler can
+// vectorize across channels.
+static void step(int n, float inv_lag, const float *restrict samples,
+                 const float *restrict cur, float *restrict nxt,
+                 float *restrict avg, float *restrict m2, float *restrict std,
+                 const float *restrict th, const float *restrict inf,
+                 int32_t *restrict peak) {
+  for (int c = 0; c < n; ++c) {
+    float x = samples[c];
+    float deviation = x - avg[c];
+    float limit = th[c] * std[c];
+    float damped = inf[c] * x + (1.0f - inf[c]) * cur[c];
+    float y = (fabsf(deviation) > limit) ? damped : x;
+    peak[c] = (deviation > limit) - (deviation < -limit);
 
-float getStd(int start, int len) {
-  float x1 = getAvg(start, len);
-  float x2 = getPoint(start, len);
-  float powx1 = x1 * x1;
-  float std_val = x2 - powx1;
-  if (std_val > -EPSILON && std_val < EPSILON)
-    return 0.0;
-  else {
-    return sqrt(x2 - powx1);
+    // nxt[c] was the oldest sample in the window, swap it for y
+    float old = nxt[c];
+    float old_avg = avg[c];
+    float new_avg = old_avg + (y - old) * inv_lag;
+    float var = m2[c] + (y - old) * (y - new_avg + old - old_avg);
+    var = var < 0.0f ? 0.0f : var;
+    nxt[c] = y;
+    avg[c] = new_avg;
+    m2[c] = var;
+    var *= inv_lag;
+    float sd = sqrtf(var);
+    std[c] = (var >= EPSILON) ? sd : 0.0f;
   }
 }
 
-void add(float newSample) {
-  peak = 0;
-  int i = index % lag; //current index
-  int j = (index + 1) % lag; //next index
-  float deviation = newSample - avg[i];
-  if (deviation > threshold * std[i]) {
-    data[j] = influence * newSample + (1.0 - influence) * data[i];
-    peak = 1;
-  }
-  else if (deviation < -threshold * std[i]) {
-    data[j] = influence * newSample + (1.0 - influence) * data[i];
-    peak = -1;
-  }
-  else
-    data[j] = newSample;
-  avg[j] = getAvg(j, lag);
-  std[j] = getStd(j, lag);
-  index++;
-  if (index >= 16383) //2^14
-    index = lag + j;
+void pd_add(pd_ctx_t *ctx, const float *samples) {
+  const uint16_t n = ctx->channels;
+  uint16_t next = ctx->index + 1;
+  if (next >= ctx->lag)
+    next = 0;
+  step(n, 1.0f / ctx->lag, samples, &ctx->data[ctx->index * n], &ctx->data[next * n],
+       ctx->avg, ctx->m2, ctx->std, ctx->threshold, ctx->influence, ctx->peak);
+  ctx->index = next;
+  if (++ctx->resync >= RESYNC_INTERVAL)
+    resync(ctx);
 }
 
-float getFilt() {
-  int i = index % lag;
-  return avg[i];
+float pd_filt(const pd_ctx_t *ctx, uint16_t ch) {
+  return ctx->avg[ch];
 }
 
-float getPeak() {
-  return peak;
+int pd_peak(const pd_ctx_t *ctx, uint16_t ch) {
+  return ctx->peak[ch];
 }
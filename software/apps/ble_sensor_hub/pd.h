@@ -1,9 +1,54 @@
+#ifndef PD_H_
+#define PD_H_
 #include <stdlib.h>
 #include <stdint.h>
 #include "math.h"
 
-void begin(int, float, float); //lag, threshold, influence
-void chgTh(float);
-void add(float);
-float getFilt();
-float getPeak();
+// Z-score peak detector state for a bank of independent channels. Per-channel
+// values live in struct-of-arrays form so pd_add() sweeps each array linearly;
+// the sample window is stored row-major, one row of `channels` values per lag
+// slot.
+typedef struct
+{
+  uint16_t channels;
+  uint16_t lag;
+  uint16_t index;     // window slot holding the newest sample
+  uint16_t resync;    // samples since the last exact recomputation
+  float *data;        // [lag][channels]
+  float *avg;         // [channels] window mean
+  float *m2;          // [channels] window sum of squared deviations
+  float *std;         // [channels]
+  float *threshold;   // [channels]
+  float *influence;   // [channels]
+  int32_t *peak;      // [channels] -1, 0 or 1 for the last sample
+} pd_ctx_t;
+
+// Statically allocates a detector bank. Storage is owned by the caller, pd_begin()
+// only initializes it.
+#define PD_CTX_DEF(_name, _channels, _lag)                   \
+  static float _name##_data[(_lag) * (_channels)];           \
+  static float _name##_avg[(_channels)];                     \
+  static float _name##_m2[(_channels)];                      \
+  static float _name##_std[(_channels)];                     \
+  static float _name##_threshold[(_channels)];               \
+  static float _name##_influence[(_channels)];               \
+  static int32_t _name##_peak[(_channels)];                  \
+  static pd_ctx_t _name = {                                  \
+      .channels = (_channels),                               \
+      .lag = (_lag),                                         \
+      .data = _name##_data,                                  \
+      .avg = _name##_avg,                                    \
+      .m2 = _name##_m2,                                      \
+      .std = _name##_std,                                    \
+      .threshold = _name##_threshold,                        \
+      .influence = _name##_influence,                        \
+      .peak = _name##_peak,                                  \
+  }
+
+void pd_begin(pd_ctx_t *ctx, float th, float inf); //threshold, influence for every channel
+void pd_config(pd_ctx_t *ctx, uint16_t ch, float th, float inf);
+void pd_add(pd_ctx_t *ctx, const float *samples); //one sample per channel
+float pd_filt(const pd_ctx_t *ctx, uint16_t ch);
+int pd_peak(const pd_ctx_t *ctx, uint16_t ch);
+
+#endif /* PD_H_ */
@@ -0,0 +1,176 @@
+#include <string.h>
+#include "power.h"
+
+#define SETTLE_TICKS ((uint32_t)POWER_SETTLE_MS * POWER_TICK_HZ / 1000)
+
+// Integrates the current configuration up to ticks
+static void account(power_ctx_t *ctx, uint32_t ticks)
+{
+  power_config_t config;
+  uint32_t dt = (ticks - ctx->last_ticks) & POWER_TICK_MASK;
+
+  power_config(ctx, &config);
+  ctx->ticks_in[ctx->state] += dt;
+  ctx->charge[ctx->state] += (uint64_t)dt * power_model_ua(&config);
+  ctx->last_ticks = ticks;
+}
+
+static void enter(power_ctx_t *ctx, power_state_t state, uint32_t ticks)
+{
+  account(ctx, ticks);
+  ctx->state = state;
+  ctx->count = 0;
+  ctx->changed = true;
+}
+
+void power_begin(power_ctx_t *ctx, uint32_t finger_min, uint32_t ticks)
+{
+  memset(ctx, 0, sizeof(*ctx));
+  ctx->state = POWER_OFF;
+  ctx->finger_min = finger_min;
+  ctx->led = POWER_LED_ACTIVE;
+  ctx->last_ticks = ticks & POWER_TICK_MASK;
+  ctx->changed = true;
+}
+
+void power_link(power_ctx_t *ctx, bool connected, bool recording, uint32_t ticks)
+{
+  bool awake = connected || recording;
+
+  ticks &= POWER_TICK_MASK;
+  if (connected != ctx->connected)
+  {
+    account(ctx, ticks);
+    ctx->connected = connected;
+    ctx->changed = true;
+  }
+  if (awake && ctx->state == POWER_OFF)
+    enter(ctx, POWER_SEARCH, ticks);
+  else if (!awake && ctx->state != POWER_OFF)
+    enter(ctx, POWER_OFF, ticks);
+  else
+    account(ctx, ticks);
+}
+
+// The IR level scales with the LED current, compare it as if at full current
+static bool finger(const power_ctx_t *ctx, uint32_t ir, uint8_t led)
+{
+  return (uint64_t)ir * POWER_LED_ACTIVE > (uint64_t)ctx->finger_min * led;
+}
+
+static void back_off(power_ctx_t *ctx, uint32_t ticks)
+{
+  uint8_t led = ctx->led - ctx->led / 4;
+
+  ctx->led = led < POWER_LED_MIN ? POWER_LED_MIN : led;
+  ctx->settle_ticks = ticks;
+  ctx->changed = true;
+}
+
+void power_ppg(power_ctx_t *ctx, uint32_t ir, uint32_t ticks)
+{
+  ticks &= POWER_TICK_MASK;
+  // Samples are stamped back to when they were taken, which can be before the
+  // last accounting. Accounting back to them would wrap the RTC difference
+  // into a whole counter period, so a change they cause counts from there.
+  if (((ctx->last_ticks - ticks) & POWER_TICK_MASK) < POWER_TICK_MASK / 2)
+    ticks = ctx->last_ticks;
+  switch (ctx->state)
+  {
+  case POWER_SEARCH:
+    ctx->count = finger(ctx, ir, POWER_LED_SEARCH) ? ctx->count + 1 : 0;
+    if (ctx->count >= POWER_PRESENT_SAMPLES)
+    {
+      // Presence ramps the LEDs straight back to full current
+      ctx->led = POWER_LED_ACTIVE;
+      enter(ctx, POWER_ACTIVE, ticks);
+    }
+    break;
+
+  case POWER_ACTIVE:
+    if (ir >= POWER_SATURATION)
+    {
+      enter(ctx, POWER_SATURATED, ticks);
+      back_off(ctx, ticks);
+      break;
+    }
+    ctx->count = finger(ctx, ir, ctx->led) ? 0 : ctx->count + 1;
+    if (ctx->count >= POWER_ABSENT_SAMPLES)
+      enter(ctx, POWER_SEARCH, ticks);
+    break;
+
+  case POWER_SATURATED:
+    // Samples still in flight when the LED current changed prove nothing
+    if (((ticks - ctx->settle_ticks) & POWER_TICK_MASK) < SETTLE_TICKS)
+      break;
+    if (ir >= POWER_SATURATION)
+    {
+      ctx->count = 0;
+      if (ctx->led > POWER_LED_MIN)
+        back_off(ctx, ticks);
+    }
+    else if (++ctx->count >= POWER_CLEAR_SAMPLES)
+      enter(ctx, POWER_ACTIVE, ticks);
+    break;
+
+  default:
+    break;
+  }
+}
+
+bool power_changed(power_ctx_t *ctx)
+{
+  bool changed = ctx->changed;
+
+  ctx->changed = false;
+  return changed;
+}
+
+power_state_t power_state(const power_ctx_t *ctx)
+{
+  return ctx->state;
+}
+
+void power_config(const power_ctx_t *ctx, power_config_t *config)
+{
+  bool tracking = ctx->state == POWER_ACTIVE || ctx->state == POWER_SATURATED;
+  bool awake = ctx->state != POWER_OFF;
+
+  config->connected = ctx->connected;
+  config->adc_on = awake;
+  config->ppg_on = awake;
+  config->ppg_fast = tracking;
+  config->led_red = tracking ? ctx->led : 0;
+  config->led_ir = tracking ? ctx->led : (awake ? POWER_LED_SEARCH : 0);
+}
+
+uint32_t power_model_ua(const power_config_t *config)
+{
+  uint32_t sps = config->ppg_fast ? POWER_SPS_FAST : POWER_SPS_SLOW;
+  uint32_t ua = POWER_UA_IDLE;
+
+  ua += config->connected ? POWER_UA_CONNECTED : POWER_UA_ADVERTISING;
+  ua += config->adc_on ? POWER_UA_ADC : 0;
+  if (!config->ppg_on)
+    return ua + POWER_UA_PPG_SHDN;
+  // LED current averaged over its duty cycle
+  ua += POWER_UA_PPG_ON;
+  ua += (uint32_t)(config->led_red + config->led_ir) * POWER_UA_PER_LED_CODE * POWER_LED_PW_US * sps / 1000000;
+  return ua;
+}
+
+void power_report(power_ctx_t *ctx, uint32_t ticks, power_report_t *report)
+{
+  uint64_t total_ticks = 0;
+  uint64_t total_charge = 0;
+
+  account(ctx, ticks & POWER_TICK_MASK);
+  for (uint8_t s = 0; s < POWER_STATES; s++)
+  {
+    report->seconds[s] = ctx->ticks_in[s] / POWER_TICK_HZ;
+    report->ua[s] = ctx->ticks_in[s] ? ctx->charge[s] / ctx->ticks_in[s] : 0;
+    total_ticks += ctx->ticks_in[s];
+    total_charge += ctx->charge[s];
+  }
+  report->avg_ua = total_ticks ? total_charge / total_ticks : 0;
+}
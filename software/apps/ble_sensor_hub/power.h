@@ -0,0 +1,85 @@
+#ifndef POWER_H_
+#define POWER_H_
+#include <stdbool.h>
+#include <stdint.h>
+
+// Times are RTC ticks, the counter is 24 bits wide at 32768 Hz
+#define POWER_TICK_HZ 32768
+#define POWER_TICK_MASK 0x00FFFFFF
+
+#define POWER_LED_ACTIVE 0x3F      // LEDx_PA code while tracking, 0.2 mA per step
+#define POWER_LED_SEARCH 0x10      // IR only while looking for a finger
+#define POWER_LED_MIN 0x04         // floor when backing off from saturation
+#define POWER_SATURATION 0x3E000   // IR counts close to the 18-bit full scale
+#define POWER_PRESENT_SAMPLES 3    // samples with a finger before tracking starts
+#define POWER_ABSENT_SAMPLES 25    // samples without one before tracking stops
+#define POWER_CLEAR_SAMPLES 10     // unsaturated samples before leaving SATURATED
+#define POWER_SETTLE_MS 250        // samples this soon after an LED change still saw the old current
+
+// Energy model inputs, datasheet typicals for the nRF52832 and the MAX30102
+#define POWER_UA_IDLE 5            // System ON sleep with the RTC running
+#define POWER_UA_ADVERTISING 60    // 100 ms advertising interval
+#define POWER_UA_CONNECTED 150     // connection events carrying notifications
+#define POWER_UA_ADC 400           // TIMER1 on the HF clock and 1 kHz five channel scans
+#define POWER_UA_PPG_ON 600        // MAX30102 supply while sampling
+#define POWER_UA_PPG_SHDN 1        // MAX30102 in shutdown
+#define POWER_UA_PER_LED_CODE 200  // LED pulse current per LEDx_PA step
+#define POWER_LED_PW_US 411        // LED pulse width, SPO2_CONF LED_PW
+#define POWER_SPS_FAST 100         // sensor rate before averaging while tracking
+#define POWER_SPS_SLOW 50          // and while searching
+
+typedef enum
+{
+  POWER_OFF,       // disconnected and not recording, sensors stopped
+  POWER_SEARCH,    // connected or recording, no finger on the PPG sensor
+  POWER_ACTIVE,    // finger present, full acquisition
+  POWER_SATURATED, // IR at full scale, LED current backing off
+  POWER_STATES
+} power_state_t;
+
+// What the hardware should be doing in the current state
+typedef struct
+{
+  bool connected;
+  bool adc_on;     // SAADC scan and the scheduler tick
+  bool ppg_on;     // MAX30102 out of shutdown
+  bool ppg_fast;   // POWER_SPS_FAST instead of POWER_SPS_SLOW
+  uint8_t led_red; // LED1_PA
+  uint8_t led_ir;  // LED2_PA
+} power_config_t;
+
+typedef struct
+{
+  uint32_t seconds[POWER_STATES];
+  uint32_t ua[POWER_STATES];  // estimated mean supply current per state
+  uint32_t avg_ua;            // over all states
+} power_report_t;
+
+// Acquisition power state machine. Connection events and PPG samples move it
+// between states, the caller applies power_config() to the hardware whenever
+// power_changed() says so. Time spent in every state is integrated against the
+// energy model of its configuration.
+typedef struct
+{
+  power_state_t state;
+  bool connected;          // link up, recording alone keeps the sensors on without it
+  uint32_t finger_min;     // IR level at POWER_LED_ACTIVE that means a finger
+  uint8_t led;             // tracking LED code, lowered while saturated
+  uint8_t count;           // consecutive samples towards the next transition
+  uint32_t settle_ticks;   // last LED change
+  bool changed;
+  uint32_t last_ticks;     // last accounting
+  uint64_t ticks_in[POWER_STATES];
+  uint64_t charge[POWER_STATES]; // uA ticks
+} power_ctx_t;
+
+void power_begin(power_ctx_t *ctx, uint32_t finger_min, uint32_t ticks); //starts in POWER_OFF
+void power_link(power_ctx_t *ctx, bool connected, bool recording, uint32_t ticks);
+void power_ppg(power_ctx_t *ctx, uint32_t ir, uint32_t ticks); //one PPG sample, ticks at acquisition
+bool power_changed(power_ctx_t *ctx); //true once after every configuration change
+power_state_t power_state(const power_ctx_t *ctx);
+void power_config(const power_ctx_t *ctx, power_config_t *config);
+uint32_t power_model_ua(const power_config_t *config); //estimated supply current
+void power_report(power_ctx_t *ctx, uint32_t ticks, power_report_t *report);
+
+#endif /* POWER_H_ */
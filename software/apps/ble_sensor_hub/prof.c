@@ -0,0 +1,110 @@
+#include "prof.h"
+
+#if PROF_ENABLED
+#include <string.h>
+#if defined(__arm__)
+#include "nrf.h"
+#else
+#include <time.h>
+#endif
+
+typedef struct
+{
+  uint32_t start;
+  uint32_t count;
+  uint32_t min;
+  uint32_t max;
+  uint64_t total;
+  uint16_t hist[PROF_BINS];
+} section_t;
+
+static section_t sections[PROF_COUNT];
+
+void prof_init(void)
+{
+  memset(sections, 0, sizeof(sections));
+  for (uint8_t i = 0; i < PROF_COUNT; i++)
+    sections[i].min = UINT32_MAX;
+#if defined(__arm__)
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+}
+
+uint32_t prof_now(void)
+{
+#if defined(__arm__)
+  return DWT->CYCCNT;
+#else
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)((uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec);
+#endif
+}
+
+uint32_t prof_hz(void)
+{
+#if defined(__arm__)
+  return SystemCoreClock;
+#else
+  return 1000000000u;
+#endif
+}
+
+void prof_begin(prof_id_t id)
+{
+  sections[id].start = prof_now();
+}
+
+void prof_end(prof_id_t id)
+{
+  prof_record(id, prof_now() - sections[id].start);
+}
+
+static uint8_t bin(uint32_t elapsed)
+{
+  uint8_t b = 0;
+
+  for (elapsed >>= PROF_HIST_SHIFT + 1; elapsed && b < PROF_BINS - 1; elapsed >>= 1)
+    b++;
+  return b;
+}
+
+void prof_record(prof_id_t id, uint32_t elapsed)
+{
+  section_t *s = &sections[id];
+  uint16_t *h = &s->hist[bin(elapsed)];
+
+  s->count++;
+  s->total += elapsed;
+  if (elapsed < s->min)
+    s->min = elapsed;
+  if (elapsed > s->max)
+    s->max = elapsed;
+  if (*h < UINT16_MAX)
+    (*h)++;
+}
+
+// Snapshot without locking, a section recorded from an interrupt meanwhile may
+// be off by its latest sample
+void prof_report(prof_report_t *report)
+{
+  report->hz = prof_hz();
+  report->sections = PROF_COUNT;
+  report->bins = PROF_BINS;
+  report->hist_shift = PROF_HIST_SHIFT;
+  report->reserved = 0;
+  for (uint8_t i = 0; i < PROF_COUNT; i++)
+  {
+    const section_t *s = &sections[i];
+    prof_stat_t *r = &report->stat[i];
+    r->count = s->count;
+    r->min = s->count ? s->min : 0;
+    r->max = s->max;
+    r->mean = s->count ? s->total / s->count : 0;
+    memcpy(r->hist, s->hist, sizeof(r->hist));
+  }
+}
+#endif
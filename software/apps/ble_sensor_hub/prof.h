@@ -0,0 +1,68 @@
+#ifndef PROF_H_
+#define PROF_H_
+#include <stdint.h>
+
+// Section timing probes. Build with PROF_ENABLED=1 (make PROF=1) to record
+// durations in cycles of the DWT cycle counter on target, or nanoseconds of the
+// monotonic clock on a host. Disabled, every probe compiles to nothing.
+#ifndef PROF_ENABLED
+#define PROF_ENABLED 0
+#endif
+
+#define PROF_BINS 16       // log2 duration histogram
+#define PROF_HIST_SHIFT 8  // bin 0 is everything below 2^(PROF_HIST_SHIFT + 1)
+
+// Sections probed in this application. Each one keeps a single start stamp, so
+// a section must not nest into itself, but it may end in another context than
+// it began.
+typedef enum
+{
+  PROF_ADC,       // ADC scans through the decimators and per channel stages
+  PROF_PPG,       // PPG bursts through motion cancelling, beats and SpO2
+  PROF_TWI,       // MAX30102 FIFO drain, from scheduling to completion
+  PROF_TELEMETRY, // frame encoding and notification
+  PROF_SLEEP,     // power_manage(), timed on the RTC since CYCCNT stops in sleep
+  PROF_COUNT
+} prof_id_t;
+
+typedef struct __attribute__((packed))
+{
+  uint32_t count;
+  uint32_t min;
+  uint32_t max;
+  uint32_t mean;
+  uint16_t hist[PROF_BINS]; // saturating
+} prof_stat_t;
+
+// Diagnostics characteristic value
+typedef struct __attribute__((packed))
+{
+  uint32_t hz; // duration units per second
+  uint8_t sections;
+  uint8_t bins;
+  uint8_t hist_shift;
+  uint8_t reserved;
+  prof_stat_t stat[PROF_COUNT];
+} prof_report_t;
+
+#if PROF_ENABLED
+void prof_init(void);
+uint32_t prof_now(void);
+uint32_t prof_hz(void);
+void prof_begin(prof_id_t id);
+void prof_end(prof_id_t id);
+void prof_record(prof_id_t id, uint32_t elapsed);
+void prof_report(prof_report_t *report);
+
+#define PROF_INIT() prof_init()
+#define PROF_BEGIN(_id) prof_begin(_id)
+#define PROF_END(_id) prof_end(_id)
+#define PROF_RECORD(_id, _elapsed) prof_record((_id), (_elapsed))
+#else
+#define PROF_INIT() ((void)0)
+#define PROF_BEGIN(_id) ((void)0)
+#define PROF_END(_id) ((void)0)
+#define PROF_RECORD(_id, _elapsed) ((void)0)
+#endif
+
+#endif /* PROF_H_ */
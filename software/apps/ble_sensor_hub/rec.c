@@ -0,0 +1,319 @@
+#include <stddef.h>
+#include <string.h>
+#include "rec.h"
+
+#define TICK_MASK 0x00FFFFFF
+#define LATE_TICKS 0x100000 // 32 s, how far a lane may lag the newest record
+#define ERASED 0xFFFFFFFF
+#define NO_BUF 0xFF
+
+// Erase contexts, told apart when they complete
+#define ERASE_PAGE ((void *)1)
+#define ERASE_ALL ((void *)2)
+
+// Half-byte table, small enough to keep in flash next to the code
+static const uint32_t crc_table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+};
+
+uint32_t rec_crc32(const uint8_t *data, uint32_t len, uint32_t crc)
+{
+  crc = ~crc;
+  for (uint32_t i = 0; i < len; i++)
+  {
+    crc = crc_table[(crc ^ data[i]) & 0x0F] ^ (crc >> 4);
+    crc = crc_table[(crc ^ (data[i] >> 4)) & 0x0F] ^ (crc >> 4);
+  }
+  return ~crc;
+}
+
+static uint32_t blocks_per_page(const rec_ctx_t *ctx)
+{
+  return ctx->flash->page_size / REC_BLOCK_SIZE;
+}
+
+static const uint8_t *slot_addr(const rec_ctx_t *ctx, uint32_t seq)
+{
+  return ctx->flash->base + (seq % ctx->slots) * REC_BLOCK_SIZE;
+}
+
+static bool intact(const rec_hdr_t *hdr)
+{
+  if (hdr->magic != REC_MAGIC || hdr->length > REC_DATA_SIZE)
+    return false;
+  uint32_t crc = rec_crc32((const uint8_t *)hdr, offsetof(rec_hdr_t, crc), 0);
+  return rec_crc32((const uint8_t *)(hdr + 1), hdr->length, crc) == hdr->crc;
+}
+
+static void open_block(rec_ctx_t *ctx, uint8_t lane)
+{
+  rec_lane_t *l = &ctx->lane[lane];
+
+  codec_begin(&l->enc, ctx->buf[l->fill] + sizeof(rec_hdr_t), REC_DATA_SIZE);
+}
+
+// Gives the lane a buffer neither on its way to flash nor filled by another
+// lane, false when there is none
+static bool claim(rec_ctx_t *ctx, uint8_t lane)
+{
+  for (uint8_t b = 0; b < REC_LANES + 1; b++)
+  {
+    bool taken = ctx->busy[b];
+
+    for (uint8_t i = 0; i < REC_LANES && !taken; i++)
+      taken = i != lane && ctx->lane[i].fill == b;
+    if (taken)
+      continue;
+    ctx->lane[lane].fill = b;
+    open_block(ctx, lane);
+    return true;
+  }
+  ctx->lane[lane].fill = NO_BUF;
+  return false;
+}
+
+static bool any_busy(const rec_ctx_t *ctx)
+{
+  for (uint8_t b = 0; b < REC_LANES + 1; b++)
+    if (ctx->busy[b])
+      return true;
+  return false;
+}
+
+void rec_begin(rec_ctx_t *ctx, const rec_flash_t *flash)
+{
+  bool found = false;
+  uint32_t newest = 0;
+  uint32_t oldest = 0;
+
+  memset(ctx, 0, sizeof(*ctx));
+  ctx->flash = flash;
+  ctx->slots = flash->pages * (flash->page_size / REC_BLOCK_SIZE);
+
+  // Seqs only grow, so the stored ones form one run ending at the newest
+  for (uint32_t slot = 0; slot < ctx->slots; slot++)
+  {
+    const rec_hdr_t *hdr = (const rec_hdr_t *)(flash->base + slot * REC_BLOCK_SIZE);
+    if (!intact(hdr) || hdr->seq % ctx->slots != slot)
+      continue;
+    if (!found || hdr->seq > newest)
+      newest = hdr->seq;
+    if (!found || hdr->seq < oldest)
+      oldest = hdr->seq;
+    found = true;
+  }
+  ctx->head = found ? newest + 1 : 0;
+  ctx->tail = found ? oldest : 0;
+
+  // A reset during a write leaves the slot programmed but broken. Flash can't
+  // be rewritten without an erase, so carry on from the next page.
+  if (ctx->head % blocks_per_page(ctx) && *(const uint32_t *)slot_addr(ctx, ctx->head) != ERASED)
+    ctx->head += blocks_per_page(ctx) - ctx->head % blocks_per_page(ctx);
+  ctx->written = ctx->head;
+  for (uint8_t lane = 0; lane < REC_LANES; lane++)
+    ctx->lane[lane].fill = NO_BUF;
+  for (uint8_t lane = 0; lane < REC_LANES; lane++)
+    claim(ctx, lane);
+}
+
+static void close_block(rec_ctx_t *ctx, uint8_t lane);
+
+void rec_start(rec_ctx_t *ctx, uint8_t lane, uint8_t flags)
+{
+  rec_lane_t *l = &ctx->lane[lane];
+
+  if (ctx->recording && flags != l->flags && l->fill != NO_BUF)
+    close_block(ctx, lane);
+  l->flags = flags;
+  ctx->recording = true;
+}
+
+bool rec_recording(const rec_ctx_t *ctx)
+{
+  return ctx->recording;
+}
+
+// Hands the lane's block to flash and moves the lane on to a free buffer
+static void close_block(rec_ctx_t *ctx, uint8_t lane)
+{
+  rec_lane_t *l = &ctx->lane[lane];
+  uint8_t *block = ctx->buf[l->fill];
+  rec_hdr_t *hdr = (rec_hdr_t *)block;
+  uint32_t bpp = blocks_per_page(ctx);
+  uint32_t seq = ctx->head++;
+
+  if (l->enc.count == 0)
+  {
+    ctx->head--;
+    return;
+  }
+  hdr->magic = REC_MAGIC;
+  hdr->seq = seq;
+  hdr->count = l->enc.count;
+  hdr->length = codec_end(&l->enc);
+  hdr->flags = l->flags;
+  memset(hdr->reserved, 0, sizeof(hdr->reserved));
+  hdr->crc = rec_crc32(block, offsetof(rec_hdr_t, crc), 0);
+  hdr->crc = rec_crc32(block + sizeof(rec_hdr_t), hdr->length, hdr->crc);
+
+  if (seq % bpp == 0 && seq >= ctx->fresh)
+  {
+    // Writing over the old page would corrupt it, the next block tries again
+    if (!ctx->flash->erase((seq % ctx->slots) / bpp, 1, ERASE_PAGE))
+    {
+      ctx->head = seq;
+      ctx->stats.failed++;
+      open_block(ctx, lane);
+      return;
+    }
+    // The page being reused held the oldest blocks
+    if (seq + bpp > ctx->slots && ctx->tail < seq + bpp - ctx->slots)
+      ctx->tail = seq + bpp - ctx->slots;
+  }
+  ctx->busy[l->fill] = true;
+  // Whole words only, the tail of the last one is don't care
+  if (!ctx->flash->write((seq % ctx->slots) * REC_BLOCK_SIZE, block, (sizeof(rec_hdr_t) + hdr->length + 3) & ~3u,
+                         (void *)(uintptr_t)l->fill))
+  {
+    ctx->busy[l->fill] = false;
+    ctx->stats.failed++;
+  }
+  claim(ctx, lane);
+}
+
+void rec_stop(rec_ctx_t *ctx)
+{
+  if (!ctx->recording)
+    return;
+  for (uint8_t lane = 0; lane < REC_LANES; lane++)
+    if (ctx->lane[lane].fill != NO_BUF)
+      close_block(ctx, lane);
+  ctx->recording = false;
+}
+
+// RTC ticks extended past the 24-bit wrap. A record a little behind the newest
+// one, from a lane that lags the others, is not a wrap.
+static uint32_t extend(rec_ctx_t *ctx, uint32_t ticks)
+{
+  uint32_t newest = (ctx->time_hi << 24) | ctx->last_ticks;
+  uint32_t behind = (ctx->last_ticks - ticks) & TICK_MASK;
+
+  if (behind < LATE_TICKS && behind <= newest)
+    return newest - behind;
+  if (ticks < ctx->last_ticks)
+    ctx->time_hi++;
+  ctx->last_ticks = ticks;
+  return (ctx->time_hi << 24) | ticks;
+}
+
+void rec_push(rec_ctx_t *ctx, uint8_t lane, const telemetry_record_t *record)
+{
+  rec_lane_t *l = &ctx->lane[lane];
+  uint32_t time;
+
+  if (!ctx->recording)
+    return;
+  time = extend(ctx, record->ticks & TICK_MASK);
+  if (l->fill == NO_BUF && !claim(ctx, lane))
+  {
+    ctx->stats.dropped++;
+    return;
+  }
+  if (l->enc.count == 0)
+    ((rec_hdr_t *)ctx->buf[l->fill])->time = time;
+  if (codec_push(&l->enc, record))
+    return;
+  close_block(ctx, lane);
+  if (l->fill == NO_BUF)
+  {
+    ctx->stats.dropped++;
+    return;
+  }
+  // A keyframe always fits into a fresh block
+  ((rec_hdr_t *)ctx->buf[l->fill])->time = time;
+  codec_push(&l->enc, record);
+}
+
+void rec_write_done(rec_ctx_t *ctx, void *p_context, bool ok)
+{
+  uint8_t idx = (uintptr_t)p_context;
+  const rec_hdr_t *hdr = (const rec_hdr_t *)ctx->buf[idx];
+
+  // Writes complete in order, so this is the newest block in flash
+  if (ok)
+  {
+    ctx->written = hdr->seq + 1;
+    ctx->stats.blocks++;
+  }
+  else
+    ctx->stats.failed++;
+  ctx->busy[idx] = false;
+}
+
+void rec_erase_done(rec_ctx_t *ctx, void *p_context, bool ok)
+{
+  if (p_context != ERASE_ALL)
+  {
+    // A failed page erase leaves its blocks to fail their CRC
+    if (ok)
+      ctx->stats.erases++;
+    else
+      ctx->stats.failed++;
+    return;
+  }
+  if (ok)
+  {
+    ctx->fresh = ctx->wipe_seq + ctx->slots;
+    ctx->stats.erases += ctx->flash->pages;
+    ctx->stats.wipes++;
+  }
+  else
+  {
+    // The old blocks are still there
+    ctx->tail = ctx->wipe_tail;
+    ctx->stats.failed++;
+  }
+  ctx->wiping = false;
+}
+
+bool rec_erase(rec_ctx_t *ctx)
+{
+  uint32_t bpp = blocks_per_page(ctx);
+
+  // A write still waiting would complete into the erased log
+  if (any_busy(ctx) || ctx->wiping)
+    return false;
+  if (!ctx->flash->erase(0, ctx->flash->pages, ERASE_ALL))
+    return false;
+  // Seqs keep growing, the next block starts a fresh page. Blocks written
+  // while the erase runs still erase their page, it may yet fail.
+  if (ctx->head % bpp)
+    ctx->head += bpp - ctx->head % bpp;
+  ctx->wiping = true;
+  ctx->wipe_seq = ctx->head;
+  ctx->wipe_tail = ctx->tail;
+  ctx->tail = ctx->head;
+  ctx->written = ctx->head;
+  return true;
+}
+
+bool rec_wiping(const rec_ctx_t *ctx)
+{
+  return ctx->wiping;
+}
+
+void rec_range(const rec_ctx_t *ctx, uint32_t *first, uint32_t *end)
+{
+  *end = ctx->written;
+  *first = ctx->tail < *end ? ctx->tail : *end;
+  if (*end - *first > ctx->slots)
+    *first = *end - ctx->slots;
+}
+
+const rec_hdr_t *rec_block(const rec_ctx_t *ctx, uint32_t seq)
+{
+  const rec_hdr_t *hdr = (const rec_hdr_t *)slot_addr(ctx, seq);
+
+  return (hdr->seq == seq && intact(hdr)) ? hdr : NULL;
+}
@@ -0,0 +1,97 @@
+#ifndef REC_H_
+#define REC_H_
+#include <stdbool.h>
+#include <stdint.h>
+#include "codec.h"
+#include "frame.h"
+
+#define REC_BLOCK_SIZE 1024   // bytes per block, a power of two that divides the page size
+#define REC_MAGIC 0x31434552  // "REC1"
+#define REC_LANES 2           // record streams filled side by side, a block holds records of one
+
+// Every block starts with this header. crc covers the header up to crc and
+// then length bytes of codec.h data holding count records.
+typedef struct __attribute__((packed))
+{
+  uint32_t magic;
+  uint32_t seq;      // increments per block forever, the block lives in slot seq % slots
+  uint32_t time;     // first record, RTC ticks extended past the 24-bit wrap
+  uint16_t count;
+  uint16_t length;
+  uint8_t flags;     // TELEMETRY_FLAG_* at capture
+  uint8_t reserved[3];
+  uint32_t crc;      // CRC-32 (IEEE)
+} rec_hdr_t;
+
+#define REC_DATA_SIZE (REC_BLOCK_SIZE - sizeof(rec_hdr_t))
+
+// Flash the log lives in. Reads go straight to the memory mapped region,
+// erases and writes may complete later but must run in the order issued.
+typedef struct
+{
+  uint32_t page_size;  // erase unit, a multiple of REC_BLOCK_SIZE
+  uint16_t pages;
+  const uint8_t *base;
+  bool (*erase)(uint16_t page, uint16_t count, void *p_context); // completion: rec_erase_done(p_context)
+  bool (*write)(uint32_t offset, const void *src, uint16_t len, void *p_context); // completion: rec_write_done(p_context)
+} rec_flash_t;
+
+typedef struct
+{
+  uint32_t blocks;   // written to flash
+  uint32_t erases;   // pages
+  uint32_t wipes;    // whole log erases
+  uint32_t dropped;  // records lost because every buffer was waiting on flash
+  uint32_t failed;   // blocks and erases the flash refused or failed
+} rec_stats_t;
+
+// One stream of records and the block it is filling
+typedef struct
+{
+  uint8_t flags;
+  uint8_t fill;             // buffer being filled, none while they all wait on flash
+  codec_enc_t enc;
+} rec_lane_t;
+
+// Append-only circular log of telemetry records. Records are packed into
+// block sized codec.h blocks in RAM, a full block goes to the next slot and a
+// page is erased just before its first slot is written, so every page wears
+// at the same rate and the oldest blocks give way to the newest. Each lane
+// fills its own block, so records that arrive late and out of order with the
+// others, or under other flags, don't cut the blocks short. Erasing the
+// whole log is a single multi-page erase, records that don't fit the free
+// buffers while it runs are dropped and the lap after it skips the page erases.
+typedef struct
+{
+  const rec_flash_t *flash;
+  uint32_t slots;
+  uint32_t head;            // seq of the block being filled
+  uint32_t tail;            // oldest seq that may still be stored
+  volatile uint32_t written; // seq after the newest completed write
+  bool recording;
+  volatile bool busy[REC_LANES + 1]; // buffer waiting on flash
+  volatile bool wiping;     // whole log erase in flight
+  uint32_t wipe_seq;        // head when it was issued
+  uint32_t wipe_tail;       // tail to go back to if it fails
+  uint32_t fresh;           // pages of seqs below this were erased since they last held data
+  uint8_t buf[REC_LANES + 1][REC_BLOCK_SIZE] __attribute__((aligned(4)));
+  rec_lane_t lane[REC_LANES];
+  uint32_t time_hi;         // RTC wraps seen, for rec_hdr_t.time
+  uint32_t last_ticks;      // newest record of any lane
+  rec_stats_t stats;
+} rec_ctx_t;
+
+void rec_begin(rec_ctx_t *ctx, const rec_flash_t *flash); //recovers the log already in flash
+void rec_start(rec_ctx_t *ctx, uint8_t lane, uint8_t flags); //flags: TELEMETRY_FLAG_* of the lane's records that follow
+void rec_stop(rec_ctx_t *ctx); //writes out the partial blocks of every lane
+bool rec_recording(const rec_ctx_t *ctx);
+void rec_push(rec_ctx_t *ctx, uint8_t lane, const telemetry_record_t *record);
+void rec_write_done(rec_ctx_t *ctx, void *p_context, bool ok); //flash completion, p_context as passed to write
+void rec_erase_done(rec_ctx_t *ctx, void *p_context, bool ok); //flash completion, p_context as passed to erase
+bool rec_erase(rec_ctx_t *ctx); //drops the whole log in one erase, false while a block or erase is on its way to flash
+bool rec_wiping(const rec_ctx_t *ctx); //true until that erase completes
+void rec_range(const rec_ctx_t *ctx, uint32_t *first, uint32_t *end); //stored seqs are first..end-1
+const rec_hdr_t *rec_block(const rec_ctx_t *ctx, uint32_t seq); //NULL unless seq is stored intact
+uint32_t rec_crc32(const uint8_t *data, uint32_t len, uint32_t crc); //crc 0 to start
+
+#endif /* REC_H_ */
@@ -0,0 +1,31 @@
+#include <string.h>
+#include "ring.h"
+
+bool ring_push(ring_t *r, const void *item)
+{
+  uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+
+  if (head - tail > r->mask)
+  {
+    r->overruns++;
+    return false;
+  }
+  memcpy(&r->buf[(head & r->mask) * r->item_size], item, r->item_size);
+  // Publish the item only after its bytes are in place
+  atomic_store_explicit(&r->head, head + 1, memory_order_release);
+  return true;
+}
+
+bool ring_pop(ring_t *r, void *item)
+{
+  uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  uint32_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+
+  if (head == tail)
+    return false;
+  memcpy(item, &r->buf[(tail & r->mask) * r->item_size], r->item_size);
+  // Hand the slot back only after it has been copied out
+  atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+  return true;
+}
@@ -0,0 +1,34 @@
+#ifndef RING_H_
+#define RING_H_
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Lock-free single-producer/single-consumer ring of fixed size items. The
+// producer (typically an interrupt handler) only writes head, the consumer only
+// writes tail, so neither side ever has to mask interrupts.
+typedef struct
+{
+  uint8_t *buf;
+  uint16_t item_size;
+  uint32_t mask;          // capacity - 1, capacity is a power of two
+  _Atomic uint32_t head;  // next slot to write, producer owned
+  _Atomic uint32_t tail;  // next slot to read, consumer owned
+  uint32_t overruns;      // items dropped because the ring was full, producer owned
+} ring_t;
+
+// Statically allocates a ring of _capacity items of _type
+#define RING_DEF(_name, _type, _capacity)                                   \
+  _Static_assert(((_capacity) & ((_capacity) - 1)) == 0,                     \
+                 "ring capacity must be a power of two");                    \
+  static _type _name##_items[(_capacity)];                                  \
+  static ring_t _name = {                                                   \
+      .buf = (uint8_t *)_name##_items,                                      \
+      .item_size = sizeof(_type),                                           \
+      .mask = (_capacity) - 1,                                              \
+  }
+
+bool ring_push(ring_t *r, const void *item); // producer side, false on overrun
+bool ring_pop(ring_t *r, void *item);        // consumer side, false when empty
+
+#endif /* RING_H_ */
@@ -0,0 +1,108 @@
+#include "sched.h"
+
+// a at or after b on a clock wrapping at mask + 1
+static bool reached(const sched_ctx_t *ctx, uint32_t a, uint32_t b)
+{
+  return ((a - b) & ctx->mask) <= ctx->mask / 2;
+}
+
+void sched_begin(sched_ctx_t *ctx, sched_task_t *tasks, uint8_t count, sched_clock_t clock, uint32_t mask)
+{
+  uint32_t now = clock() & mask;
+
+  ctx->tasks = tasks;
+  ctx->count = count;
+  ctx->clock = clock;
+  ctx->mask = mask;
+  for (uint8_t i = 0; i < count; i++)
+  {
+    sched_task_t *t = &tasks[i];
+    t->release = now;
+    t->pending = false;
+    t->runs = t->overruns = t->misses = 0;
+    t->exec_min = UINT32_MAX;
+    t->exec_max = t->exec_total = 0;
+  }
+}
+
+// Marks every task whose release time has come as pending
+static void release(sched_ctx_t *ctx, uint32_t now)
+{
+  for (uint8_t i = 0; i < ctx->count; i++)
+  {
+    sched_task_t *t = &ctx->tasks[i];
+    if (!reached(ctx, now, t->release))
+      continue;
+    if (t->pending)
+      t->overruns++;
+    t->pending = true;
+    // A stall longer than a period collapses the missed releases into the
+    // latest, and the run is due by that one's deadline
+    uint32_t latest = t->release;
+    t->release = (t->release + t->period) & ctx->mask;
+    while (reached(ctx, now, t->release))
+    {
+      t->overruns++;
+      latest = t->release;
+      t->release = (t->release + t->period) & ctx->mask;
+    }
+    t->due = (latest + t->deadline) & ctx->mask;
+  }
+}
+
+// Highest priority pending task
+static sched_task_t *pick(sched_ctx_t *ctx)
+{
+  sched_task_t *best = 0;
+
+  for (uint8_t i = 0; i < ctx->count; i++)
+  {
+    sched_task_t *t = &ctx->tasks[i];
+    if (!t->pending)
+      continue;
+    if (!best || t->priority < best->priority ||
+        (t->priority == best->priority && !reached(ctx, t->due, best->due)))
+      best = t;
+  }
+  return best;
+}
+
+uint8_t sched_run(sched_ctx_t *ctx)
+{
+  uint8_t ran = 0;
+  uint32_t done = 0;
+  sched_task_t *t;
+
+  // Releases are rechecked after every run, so a higher priority task that
+  // came due meanwhile goes before the rest of the backlog. Each task runs at
+  // most once per pass, otherwise an overload would never hand back to the
+  // loop. When the task that should go next already ran, the pass ends there
+  // rather than running the lower priority ones behind its back.
+  release(ctx, ctx->clock() & ctx->mask);
+  while ((t = pick(ctx)) && !(done & (1UL << (t - ctx->tasks))))
+  {
+    done |= 1UL << (t - ctx->tasks);
+    uint32_t start = ctx->clock() & ctx->mask;
+    t->pending = false;
+    t->fn();
+    uint32_t end = ctx->clock() & ctx->mask;
+    uint32_t exec = (end - start) & ctx->mask;
+
+    t->runs++;
+    t->exec_total += exec;
+    if (exec < t->exec_min)
+      t->exec_min = exec;
+    if (exec > t->exec_max)
+      t->exec_max = exec;
+    if (end != t->due && reached(ctx, end, t->due))
+      t->misses++;
+    ran++;
+    release(ctx, end);
+  }
+  return ran;
+}
+
+uint32_t sched_exec_mean(const sched_task_t *task)
+{
+  return task->runs ? task->exec_total / task->runs : 0;
+}
@@ -0,0 +1,54 @@
+#ifndef SCHED_H_
+#define SCHED_H_
+#include <stdbool.h>
+#include <stdint.h>
+
+// Cooperative scheduler for the main loop. Tasks are released every period
+// ticks and run to completion, pending tasks in priority order with the
+// earliest deadline breaking ties. Nothing here touches hardware, time comes
+// from the clock hook so the core runs anywhere.
+typedef uint32_t (*sched_clock_t)(void); // free running tick counter
+typedef void (*sched_fn_t)(void);
+
+typedef struct
+{
+  const char *name;
+  sched_fn_t fn;
+  uint32_t period;   // ticks between releases
+  uint32_t deadline; // ticks after a release by which the run has to finish
+  uint8_t priority;  // 0 runs first
+
+  uint32_t release;  // next release
+  uint32_t due;      // absolute deadline of the pending run
+  bool pending;
+  uint32_t runs;
+  uint32_t overruns; // releases dropped because the previous one had not run yet
+  uint32_t misses;   // runs that finished after their deadline
+  uint32_t exec_min; // ticks per run
+  uint32_t exec_max;
+  uint32_t exec_total;
+} sched_task_t;
+
+// Task table entry, the remaining fields start at zero
+#define SCHED_TASK(_name, _fn, _period, _deadline, _priority) \
+  {                                                         \
+      .name = (_name),                                      \
+      .fn = (_fn),                                          \
+      .period = (_period),                                  \
+      .deadline = (_deadline),                              \
+      .priority = (_priority),                              \
+  }
+
+typedef struct
+{
+  sched_task_t *tasks;
+  uint8_t count; // up to 32
+  sched_clock_t clock;
+  uint32_t mask; // clock range - 1, the clock wraps at mask + 1
+} sched_ctx_t;
+
+void sched_begin(sched_ctx_t *ctx, sched_task_t *tasks, uint8_t count, sched_clock_t clock, uint32_t mask); //first releases are now
+uint8_t sched_run(sched_ctx_t *ctx); //runs everything released so far, returns how many runs happened
+uint32_t sched_exec_mean(const sched_task_t *task); //ticks per run
+
+#endif /* SCHED_H_ */
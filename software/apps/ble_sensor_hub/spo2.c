@@ -0,0 +1,93 @@
+#include <string.h>
+#include "spo2.h"
+
+void spo2_begin(spo2_ctx_t *ctx)
+{
+  memset(ctx, 0, sizeof(*ctx));
+}
+
+static void open_window(spo2_ctx_t *ctx)
+{
+  ctx->red_max = ctx->ir_max = INT32_MIN;
+  ctx->red_min = ctx->ir_min = INT32_MAX;
+  ctx->samples = 0;
+}
+
+void spo2_add(spo2_ctx_t *ctx, uint32_t red, uint32_t ir)
+{
+  int32_t red_q8 = (int32_t)red << 8;
+  int32_t ir_q8 = (int32_t)ir << 8;
+
+  if (!ctx->primed)
+  {
+    // Start the estimators at the first sample instead of ramping up from 0
+    ctx->red_dc = red_q8;
+    ctx->ir_dc = ir_q8;
+    ctx->primed = true;
+    open_window(ctx);
+  }
+  ctx->red_dc += (red_q8 - ctx->red_dc) >> SPO2_DC_SHIFT;
+  ctx->ir_dc += (ir_q8 - ctx->ir_dc) >> SPO2_DC_SHIFT;
+
+  int32_t red_ac = red_q8 - ctx->red_dc;
+  int32_t ir_ac = ir_q8 - ctx->ir_dc;
+  if (red_ac > ctx->red_max)
+    ctx->red_max = red_ac;
+  if (red_ac < ctx->red_min)
+    ctx->red_min = red_ac;
+  if (ir_ac > ctx->ir_max)
+    ctx->ir_max = ir_ac;
+  if (ir_ac < ctx->ir_min)
+    ctx->ir_min = ir_ac;
+  ctx->samples++;
+}
+
+// Maxim's calibration curve, SpO2 = -45.060 R^2 + 30.354 R + 94.845, in 0.1 %
+static uint16_t spo2_from_ratio(uint32_t r_q8)
+{
+  int64_t r = r_q8;
+  int64_t s = 94845LL * 65536 + 30354LL * 256 * r - 45060LL * r * r; // 0.001 % in Q16
+
+  s /= 100LL * 65536;
+  if (s < 0)
+    s = 0;
+  if (s > 1000)
+    s = 1000;
+  return s;
+}
+
+bool spo2_beat(spo2_ctx_t *ctx)
+{
+  bool valid = ctx->primed && ctx->samples >= SPO2_MIN_SAMPLES;
+  uint32_t red_pp = valid ? ctx->red_max - ctx->red_min : 0;
+  uint32_t ir_pp = valid ? ctx->ir_max - ctx->ir_min : 0;
+
+  open_window(ctx);
+  if (!red_pp || !ir_pp || ctx->red_dc <= 0 || ctx->ir_dc <= 0)
+    return false;
+
+  // R = (red_pp / red_dc) / (ir_pp / ir_dc), Q8 operands leave the result in Q8
+  uint64_t num = (uint64_t)red_pp * (uint32_t)ctx->ir_dc << 8;
+  uint64_t den = (uint64_t)ir_pp * (uint32_t)ctx->red_dc;
+  uint32_t r_q8 = num / den;
+  if (r_q8 < SPO2_R_MIN_Q8 || r_q8 > SPO2_R_MAX_Q8)
+    return false;
+
+  ctx->r_q8[ctx->r_head] = r_q8;
+  ctx->r_head = (ctx->r_head + 1) % SPO2_AVG_BEATS;
+  if (ctx->r_count < SPO2_AVG_BEATS)
+    ctx->r_count++;
+  if (ctx->r_count < SPO2_AVG_BEATS)
+    return false;
+
+  uint32_t sum = 0;
+  for (uint8_t i = 0; i < SPO2_AVG_BEATS; i++)
+    sum += ctx->r_q8[i];
+  ctx->spo2 = spo2_from_ratio(sum / SPO2_AVG_BEATS);
+  return true;
+}
+
+uint16_t spo2_value(const spo2_ctx_t *ctx)
+{
+  return ctx->spo2;
+}
@@ -0,0 +1,37 @@
+#ifndef SPO2_H_
+#define SPO2_H_
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SPO2_DC_SHIFT 5    // DC tracker time constant of 2^5 samples, 1.3 s at 25 sps
+#define SPO2_AVG_BEATS 4   // beat ratios averaged into one reading
+#define SPO2_MIN_SAMPLES 5 // shorter beat windows are discarded
+#define SPO2_R_MIN_Q8 51   // ratio of ratios outside 0.2..1.8 is not physiological
+#define SPO2_R_MAX_Q8 461
+
+// Streaming SpO2 from the red and IR channels. DC is tracked per channel with
+// the same shift-and-add estimator the beat detector uses, in Q8 because raw
+// samples are 18 bits wide. The AC amplitude is the peak to peak excursion
+// between two beats, each beat closes a window and yields one ratio of ratios.
+typedef struct
+{
+  bool primed;
+  int32_t red_dc;   // Q8
+  int32_t ir_dc;    // Q8
+  int32_t red_max;  // AC extremes of the open window, Q8
+  int32_t red_min;
+  int32_t ir_max;
+  int32_t ir_min;
+  uint16_t samples; // in the open window
+  uint16_t r_q8[SPO2_AVG_BEATS];
+  uint8_t r_head;
+  uint8_t r_count;
+  uint16_t spo2;    // 0.1 %, 0 until the first reading
+} spo2_ctx_t;
+
+void spo2_begin(spo2_ctx_t *ctx);
+void spo2_add(spo2_ctx_t *ctx, uint32_t red, uint32_t ir);
+bool spo2_beat(spo2_ctx_t *ctx); //closes the beat window, true when a new reading is available
+uint16_t spo2_value(const spo2_ctx_t *ctx);
+
+#endif /* SPO2_H_ */
@@ -0,0 +1,67 @@
+#include <math.h>
+#include <string.h>
+#include "sqi.h"
+
+void sqi_begin(sqi_ctx_t *ctx, const sqi_config_t *config)
+{
+  memset(ctx, 0, sizeof(*ctx));
+  ctx->config = config;
+}
+
+uint8_t sqi_add(sqi_ctx_t *ctx, float x)
+{
+  const sqi_config_t *cfg = ctx->config;
+  uint8_t flags = ctx->flags;
+
+  if (!ctx->primed)
+  {
+    ctx->mean = ctx->prev = x;
+    ctx->primed = true;
+  }
+  float d = x - ctx->prev;
+  float dev = x - ctx->mean;
+  ctx->prev = x;
+  ctx->mean += cfg->alpha * dev;
+  ctx->var += cfg->alpha * (dev * dev - ctx->var);
+  ctx->dvar += cfg->alpha * (d * d - ctx->dvar);
+
+  if (x <= cfg->lo || x >= cfg->hi)
+    ctx->clip = cfg->hold;
+  else if (ctx->clip)
+    ctx->clip--;
+  flags = ctx->clip ? flags | SQI_CLIP : flags & ~SQI_CLIP;
+
+  // The averages need a window to settle before they mean anything
+  if (ctx->samples * cfg->alpha < 1.0f)
+  {
+    ctx->samples++;
+    return ctx->flags = flags & SQI_CLIP;
+  }
+
+  flags = (ctx->mean < cfg->dc_min || ctx->mean > cfg->dc_max) ? flags | SQI_DC : flags & ~SQI_DC;
+
+  // Compared squared, no square root per sample
+  float flat = cfg->flat_std * cfg->flat_std;
+  if (ctx->var < flat)
+    flags |= SQI_FLAT;
+  else if (ctx->var > flat * SQI_HYST * SQI_HYST)
+    flags &= ~SQI_FLAT;
+
+  if (cfg->noise_max > 0.0f && !(flags & SQI_FLAT))
+  {
+    float ratio = ctx->dvar / (2.0f * ctx->var);
+    if (ratio > cfg->noise_max)
+      flags |= SQI_NOISE;
+    else if (ratio * SQI_HYST < cfg->noise_max)
+      flags &= ~SQI_NOISE;
+  }
+  else
+    flags &= ~SQI_NOISE;
+
+  return ctx->flags = flags;
+}
+
+uint8_t sqi_flags(const sqi_ctx_t *ctx)
+{
+  return ctx->flags;
+}
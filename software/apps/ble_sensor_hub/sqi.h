@@ -0,0 +1,48 @@
+#ifndef SQI_H_
+#define SQI_H_
+#include <stdbool.h>
+#include <stdint.h>
+
+// Quality flags, 0 means the channel looks usable
+#define SQI_CLIP 0x01  // a sample hit a rail within the last hold samples
+#define SQI_FLAT 0x02  // no variation, sensor or electrode disconnected
+#define SQI_DC 0x04    // mean level outside the plausible range
+#define SQI_NOISE 0x08 // power sits at the sample rate rather than in band
+#define SQI_BITS 4     // flag bits per channel when several are packed together
+
+#define SQI_HYST 1.25f // a flat or noise flag clears this far inside its threshold
+
+typedef struct
+{
+  float alpha;      // EMA weight per sample, about 1 / window length
+  float lo;         // rails, a sample at or beyond them is clipped
+  float hi;
+  float dc_min;     // plausible mean level
+  float dc_max;
+  float flat_std;   // standard deviation below this is a flatline
+  float noise_max;  // first difference power over twice the variance, 0 disables
+  uint16_t hold;    // samples a clip keeps SQI_CLIP up
+} sqi_config_t;
+
+// Streaming quality estimate for one channel. Mean, variance and first
+// difference power are exponential averages, so a sample costs a handful of
+// multiply-adds. White noise has a difference to variance ratio of 1, a
+// signal well inside the band much less.
+typedef struct
+{
+  const sqi_config_t *config;
+  bool primed;
+  uint32_t samples;  // up to the window length, checks wait for a full window
+  float prev;
+  float mean;
+  float var;
+  float dvar;        // mean squared first difference
+  uint16_t clip;     // samples left on the clip hold
+  uint8_t flags;
+} sqi_ctx_t;
+
+void sqi_begin(sqi_ctx_t *ctx, const sqi_config_t *config);
+uint8_t sqi_add(sqi_ctx_t *ctx, float x); //returns the updated SQI_* flags
+uint8_t sqi_flags(const sqi_ctx_t *ctx);
+
+#endif /* SQI_H_ */
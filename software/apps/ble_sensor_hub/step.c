@@ -0,0 +1,77 @@
+#include <string.h>
+#include "step.h"
+#include "hr.h"
+
+#define MS_TO_TICKS(ms) ((uint32_t)(ms) * HR_TICK_HZ / 1000)
+
+void step_begin(step_ctx_t *ctx)
+{
+  memset(ctx, 0, sizeof(*ctx));
+}
+
+bool step_add(step_ctx_t *ctx, uint16_t acc, uint32_t ticks)
+{
+  int32_t x = (int32_t)acc << 8;
+  uint32_t since = (ticks - ctx->last_ticks) & HR_TICK_MASK;
+
+  if (!ctx->primed)
+  {
+    ctx->dc = x;
+    ctx->primed = true;
+    since = 0;
+    ctx->last_ticks = ticks;
+  }
+
+  // Band-pass: DC tracker for the high-pass corner, two one-pole sections for the low-pass one
+  ctx->dc += (x - ctx->dc) >> STEP_HP_SHIFT;
+  ctx->lp1 += ((x - ctx->dc) - ctx->lp1) >> STEP_LP_SHIFT;
+  ctx->lp2 += (ctx->lp1 - ctx->lp2) >> STEP_LP_SHIFT;
+
+  int32_t y = ctx->lp2;
+  int32_t mag = y < 0 ? -y : y;
+  ctx->env -= ctx->env >> STEP_ENV_SHIFT;
+  if (mag > ctx->env)
+    ctx->env = mag;
+
+  if (since > MS_TO_TICKS(STEP_TIMEOUT_MS))
+  {
+    // Stopped walking, the next step starts a new cadence estimate
+    ctx->cadence = 0;
+    ctx->interval_count = 0;
+  }
+  if (y < 0)
+    ctx->armed = true;
+
+  int32_t threshold = ctx->env >> 1;
+  if (threshold < STEP_MIN_LEVEL)
+    threshold = STEP_MIN_LEVEL;
+  if (!ctx->armed || y < threshold || since < MS_TO_TICKS(STEP_DEBOUNCE_MS))
+    return false;
+
+  ctx->armed = false;
+  ctx->last_ticks = ticks;
+  ctx->count++;
+  if (since > MS_TO_TICKS(STEP_TIMEOUT_MS))
+    return true;
+
+  ctx->intervals[ctx->interval_head] = since;
+  ctx->interval_head = (ctx->interval_head + 1) % STEP_AVG;
+  if (ctx->interval_count < STEP_AVG)
+    ctx->interval_count++;
+
+  uint32_t sum = 0;
+  for (uint8_t i = 0; i < ctx->interval_count; i++)
+    sum += ctx->intervals[i];
+  ctx->cadence = (60UL * HR_TICK_HZ * ctx->interval_count + sum / 2) / sum;
+  return true;
+}
+
+uint16_t step_cadence(const step_ctx_t *ctx)
+{
+  return ctx->cadence;
+}
+
+uint16_t step_count(const step_ctx_t *ctx)
+{
+  return ctx->count;
+}
@@ -0,0 +1,39 @@
+#ifndef STEP_H_
+#define STEP_H_
+#include <stdbool.h>
+#include <stdint.h>
+
+#define STEP_HP_SHIFT 6        // DC tracker, 2^6 samples, about 0.25 Hz at 100 Hz
+#define STEP_LP_SHIFT 3        // two one-pole low-pass sections, about 2 Hz at 100 Hz
+#define STEP_ENV_SHIFT 7       // envelope decay per sample, 2^7 samples
+#define STEP_MIN_LEVEL (8 << 8) // threshold floor, Q8 ADC counts, keeps sensor noise from counting
+#define STEP_DEBOUNCE_MS 250   // 240 steps per minute at most
+#define STEP_TIMEOUT_MS 2000   // longer pauses end the cadence estimate
+#define STEP_AVG 4             // intervals averaged into the cadence
+
+// Streaming step detector on one accelerometer axis. Integer state only: the
+// signal is band-passed with shift-and-add sections, a step is a rising
+// crossing of half the decaying peak envelope, at least STEP_DEBOUNCE_MS after
+// the last one.
+typedef struct
+{
+  bool primed;
+  bool armed;            // signal went below zero since the last step
+  int32_t dc;            // Q8
+  int32_t lp1;           // Q8
+  int32_t lp2;           // Q8, band-passed signal
+  int32_t env;           // Q8 peak envelope of |lp2|
+  uint32_t last_ticks;   // last step
+  uint32_t intervals[STEP_AVG];
+  uint8_t interval_head;
+  uint8_t interval_count;
+  uint16_t cadence;      // steps per minute, 0 when not walking
+  uint16_t count;        // steps so far, wraps
+} step_ctx_t;
+
+void step_begin(step_ctx_t *ctx);
+bool step_add(step_ctx_t *ctx, uint16_t acc, uint32_t ticks); //24-bit RTC ticks, true on a step
+uint16_t step_cadence(const step_ctx_t *ctx);
+uint16_t step_count(const step_ctx_t *ctx);
+
+#endif /* STEP_H_ */
@@ -0,0 +1,188 @@
+#include <string.h>
+#include "telemetry.h"
+#include "codec.h"
+
+#define ATT_NOTIFY_OVERHEAD 3
+#define TELEMETRY_OBSERVER_PRIO 3
+
+static uint16_t conn_handle = BLE_CONN_HANDLE_INVALID;
+static uint16_t value_handle;
+static uint16_t payload_size = BLE_GATT_ATT_MTU_DEFAULT - ATT_NOTIFY_OVERHEAD;
+static uint16_t seq = 0;
+static uint8_t flags = 0;
+
+// Two frames: one is being filled while the other may wait for a SoftDevice
+// TX buffer
+static uint8_t frames[2][TELEMETRY_MAX_PAYLOAD];
+static uint16_t lengths[2];
+static uint8_t fill = 0;
+static bool pending = false;
+static codec_enc_t enc; // encoder of the frame being filled
+
+static telemetry_stats_t stats;
+
+static void telemetry_on_ble_evt(ble_evt_t const *p_ble_evt, void *p_context);
+NRF_SDH_BLE_OBSERVER(telemetry_obs, TELEMETRY_OBSERVER_PRIO, telemetry_on_ble_evt, NULL);
+
+static void reset(void)
+{
+  // Records still buffered will not go out on this link
+  for (uint8_t i = 0; i < 2; i++)
+    if (lengths[i])
+      stats.dropped += ((telemetry_hdr_t *)frames[i])->count;
+  lengths[0] = 0;
+  lengths[1] = 0;
+  pending = false;
+}
+
+static void set_mtu(uint16_t mtu)
+{
+  if (mtu > NRF_SDH_BLE_GATT_MAX_MTU_SIZE)
+    mtu = NRF_SDH_BLE_GATT_MAX_MTU_SIZE;
+  payload_size = mtu - ATT_NOTIFY_OVERHEAD;
+}
+
+static void telemetry_on_ble_evt(ble_evt_t const *p_ble_evt, void *p_context)
+{
+  switch (p_ble_evt->header.evt_id)
+  {
+  case BLE_GAP_EVT_CONNECTED:
+    conn_handle = p_ble_evt->evt.gap_evt.conn_handle;
+    set_mtu(BLE_GATT_ATT_MTU_DEFAULT);
+    reset();
+    break;
+
+  case BLE_GAP_EVT_DISCONNECTED:
+    conn_handle = BLE_CONN_HANDLE_INVALID;
+    reset();
+    break;
+
+  case BLE_GATTS_EVT_EXCHANGE_MTU_REQUEST:
+    set_mtu(p_ble_evt->evt.gatts_evt.params.exchange_mtu_request.client_rx_mtu);
+    break;
+
+  case BLE_GATTC_EVT_EXCHANGE_MTU_RSP:
+    set_mtu(p_ble_evt->evt.gattc_evt.params.exchange_mtu_rsp.server_rx_mtu);
+    break;
+
+  default:
+    break;
+  }
+}
+
+// Tries to notify the frame that is not being filled
+static void send_pending(void)
+{
+  uint8_t idx = fill ^ 1;
+  ble_gatts_hvx_params_t hvx_params;
+  uint32_t err_code;
+
+  if (!pending)
+    return;
+  memset(&hvx_params, 0, sizeof(hvx_params));
+  hvx_params.handle = value_handle;
+  hvx_params.type = BLE_GATT_HVX_NOTIFICATION;
+  hvx_params.p_len = &lengths[idx];
+  hvx_params.p_data = frames[idx];
+
+  err_code = sd_ble_gatts_hvx(conn_handle, &hvx_params);
+  if (err_code == NRF_ERROR_RESOURCES)
+    return; // TX queue full, retry on the next flush
+  if (err_code == NRF_SUCCESS)
+    stats.frames++;
+  else
+    stats.dropped += ((telemetry_hdr_t *)frames[idx])->count; // not subscribed or link gone
+  lengths[idx] = 0;
+  pending = false;
+}
+
+// Closes the frame being filled and queues it for sending
+static bool rotate(void)
+{
+  send_pending();
+  if (lengths[fill] == 0)
+    return true;
+  if (pending)
+    return false;
+  pending = true;
+  fill ^= 1;
+  send_pending();
+  return true;
+}
+
+void telemetry_init(uint16_t handle)
+{
+  value_handle = handle;
+  reset();
+}
+
+static void open_frame(void)
+{
+  telemetry_hdr_t *hdr = (telemetry_hdr_t *)frames[fill];
+
+  hdr->seq = seq++;
+  hdr->count = 0;
+  hdr->format = TELEMETRY_FMT_PACKED | flags;
+  codec_begin(&enc, &frames[fill][sizeof(telemetry_hdr_t)], payload_size - sizeof(telemetry_hdr_t));
+  lengths[fill] = sizeof(telemetry_hdr_t);
+}
+
+void telemetry_push(const telemetry_record_t *record)
+{
+  telemetry_hdr_t *hdr;
+
+  if (conn_handle == BLE_CONN_HANDLE_INVALID)
+  {
+    stats.dropped++;
+    return;
+  }
+  // The header's flags cover every record of the frame, new ones start a new frame
+  hdr = (telemetry_hdr_t *)frames[fill];
+  if (lengths[fill] && (hdr->format & ~TELEMETRY_FMT_MASK) != flags && !rotate())
+  {
+    stats.dropped++;
+    return;
+  }
+  if (lengths[fill] == 0)
+    open_frame();
+  if (!codec_push(&enc, record))
+  {
+    // Frame is full, a keyframe always fits into a fresh one
+    if (!rotate())
+    {
+      stats.dropped++;
+      return;
+    }
+    open_frame();
+    if (!codec_push(&enc, record))
+    {
+      stats.dropped++;
+      return;
+    }
+  }
+  hdr = (telemetry_hdr_t *)frames[fill];
+  hdr->count = enc.count;
+  lengths[fill] = sizeof(telemetry_hdr_t) + codec_end(&enc);
+}
+
+void telemetry_flush(void)
+{
+  if (conn_handle == BLE_CONN_HANDLE_INVALID)
+    return;
+  rotate();
+}
+
+void telemetry_set_flags(uint8_t f)
+{
+  flags = f & ~TELEMETRY_FMT_MASK;
+}
+
+uint16_t telemetry_payload_size(void)
+{
+  return payload_size;
+}
+
+const telemetry_stats_t *telemetry_stats(void)
+{
+  return &stats;
+}
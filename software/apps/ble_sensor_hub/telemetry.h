@@ -0,0 +1,24 @@
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+#include <stdbool.h>
+#include <stdint.h>
+#include "frame.h"
+#include "nrf_sdh_ble.h"
+
+// Largest notification payload the link can ever carry
+#define TELEMETRY_MAX_PAYLOAD (NRF_SDH_BLE_GATT_MAX_MTU_SIZE - 3)
+
+typedef struct
+{
+  uint32_t frames;  // notifications handed to the SoftDevice
+  uint32_t dropped; // records discarded because the link could not keep up
+} telemetry_stats_t;
+
+void telemetry_init(uint16_t value_handle); // value handle of the notify characteristic
+void telemetry_push(const telemetry_record_t *record);
+void telemetry_flush(void); // sends whatever is buffered, call after each processing pass
+void telemetry_set_flags(uint8_t flags); // TELEMETRY_FLAG_* of the records pushed next, they go into a frame of their own
+uint16_t telemetry_payload_size(void); // notification payload the current link carries
+const telemetry_stats_t *telemetry_stats(void);
+
+#endif /* TELEMETRY_H_ */